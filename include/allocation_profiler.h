@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "telemetry.h"
+
+namespace cpplox {
+
+// 一个分配点上某种对象的统计：type_ 是实例的类名、闭包的函数名，function_/line_ 是分配时所在的 Lox 函数和行
+struct AllocationSite {
+  AllocationKind kind_;
+  std::string type_;
+  std::string function_;
+  int line_;
+  uint64_t live_count_{0};
+  uint64_t live_bytes_{0};
+  uint64_t total_count_{0};
+  uint64_t total_bytes_{0};
+};
+
+// --alloc-profile 打开的分配追踪。解释器在调用、声明、取方法和字符串拼接处更新当前行，
+// LoxFunction 执行期间当前函数是它的名字；每个带 AllocationTag 的对象创建时记在当前的分配点上，销毁时从存活统计里减掉
+class AllocationProfiler {
+public:
+  // 离开函数时恢复调用者的函数和行
+  class Scope {
+  public:
+    Scope(AllocationProfiler *profiler, std::string_view function) : profiler_(profiler) {
+      if (profiler_ != nullptr) {
+        line_ = profiler_->line_;
+        profiler_->functions_.push_back(function);
+      }
+    }
+    ~Scope() {
+      if (profiler_ != nullptr) {
+        profiler_->functions_.pop_back();
+        profiler_->line_ = line_;
+      }
+    }
+    Scope(const Scope &) = delete;
+    auto operator=(const Scope &) -> Scope & = delete;
+
+  private:
+    AllocationProfiler *profiler_;
+    int line_{0};
+  };
+
+  // 当前的函数栈和行。协程有自己的一份，resume 和 yield 时和 profiler 里的交换，
+  // 协程里的 Scope 只在协程自己的栈上进出，分配也记在协程当前的函数上
+  struct Context {
+    std::vector<std::string_view> functions_;
+    int line_{0};
+  };
+  void Swap(Context &context) {
+    functions_.swap(context.functions_);
+    std::swap(line_, context.line_);
+  }
+
+  void SetLine(int line) { line_ = line; }
+  auto Record(AllocationKind kind, size_t bytes, std::string_view type) -> AllocationSite *;
+  static void Release(AllocationSite *site, size_t bytes) {
+    --site->live_count_;
+    site->live_bytes_ -= bytes;
+  }
+  static void Grow(AllocationSite *site, size_t bytes) {
+    site->live_bytes_ += bytes;
+    site->total_bytes_ += bytes;
+  }
+
+  // 每行一个分配点，按存活字节数从大到小，Tab 分隔，Diff 可以读回来
+  auto Dump() const -> std::string;
+  // 两份 Dump 之间每个分配点存活对象个数和字节数的变化，按变化的字节数从大到小
+  static auto Diff(const std::string &before, const std::string &after) -> std::string;
+
+private:
+  // 节点的地址不变，AllocationTag 直接保存指向它的指针
+  std::unordered_map<std::string, AllocationSite> sites_;
+  std::vector<std::string_view> functions_;
+  int line_{0};
+  std::string key_;
+};
+
+// 当前线程的分配追踪，没有打开时为 nullptr。打开之后不再销毁：进程退出时还有对象会在析构时访问它的分配点
+inline thread_local AllocationProfiler *allocation_profiler{nullptr};
+
+// 放在运行时对象里的成员：计入 telemetry 的分配统计，打开分配追踪时记下分配点。
+// 复制出来的对象 (绑定的方法、复制的实例) 算作在当前位置的一次新分配
+class AllocationTag {
+public:
+  AllocationTag(AllocationKind kind, size_t bytes, std::string_view type = {}) : bytes_(bytes), kind_(kind) {
+    telemetry.RecordAllocation(kind, bytes);
+    if (allocation_profiler != nullptr) {
+      site_ = allocation_profiler->Record(kind, bytes, type);
+    }
+  }
+  AllocationTag(const AllocationTag &rhs) : bytes_(rhs.bytes_), kind_(rhs.kind_) {
+    telemetry.RecordAllocation(kind_, bytes_);
+    if (allocation_profiler != nullptr) {
+      site_ = allocation_profiler->Record(kind_, bytes_, rhs.site_ == nullptr ? std::string_view{} : rhs.site_->type_);
+    }
+  }
+  auto operator=(const AllocationTag &rhs) -> AllocationTag & = delete;
+  ~AllocationTag() {
+    if (site_ != nullptr) {
+      AllocationProfiler::Release(site_, bytes_);
+    }
+  }
+  void Grow(size_t bytes) {
+    bytes_ += bytes;
+    if (site_ != nullptr) {
+      AllocationProfiler::Grow(site_, bytes);
+    }
+  }
+
+  // 字符串这样的值没有地方放 AllocationTag，只计入分配次数，不算存活
+  static void Transient(AllocationKind kind, size_t bytes) {
+    telemetry.RecordAllocation(kind, bytes);
+    if (allocation_profiler != nullptr) {
+      AllocationProfiler::Release(allocation_profiler->Record(kind, bytes, {}), bytes);
+    }
+  }
+
+private:
+  AllocationSite *site_{nullptr};
+  size_t bytes_;
+  AllocationKind kind_;
+};
+
+}  // namespace cpplox
@@ -2,8 +2,10 @@
 
 #include <algorithm>
 #include <any>
+#include <cstdint>
 #include <future>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -24,6 +26,8 @@ class GetExprAST;
 class SetExprAST;
 class ThisExprAST;
 class SuperExprAST;
+class FunctionStmt;
+class LoxCallable;
 
 using ExprASTPtr = std::shared_ptr<ExprAST>;
 class ExprASTVisitor {
@@ -43,10 +47,50 @@ class ExprASTVisitor {
   virtual ~ExprASTVisitor() = default;
 };
 
+// Resolver 的结果：局部变量是当前 frame 的槽位，被内层函数引用的变量通过 upvalue 访问，
+// 全局变量是 globals_ 的槽位 (执行时可能还没有定义)。没有记录的名字按名字在 globals_ 里查找
+enum class VariableKind { LOCAL, UPVALUE, GLOBAL };
+struct VariableRef {
+  VariableKind kind_;
+  int index_;
+};
+
+// 类型注解和 TypeChecker 推断出的静态类型，UNKNOWN 表示只能在运行时确定
+enum class StaticType : uint8_t { UNKNOWN, NIL, BOOL, NUMBER, STRING };
+
+// TypeChecker 证明了结果是 double 或 bool 的表达式，Interpreter 用 EvaluateNumber/EvaluateBool 直接求值，
+// 中间结果不装进 std::any，也不检查操作数类型。VALUE 是这类表达式树的叶子，照常求值后直接取出值
+enum class Unboxed : uint8_t { NONE, VALUE, LITERAL, GROUPING, NEGATE, NOT, ARITHMETIC, COMPARISON, LOGICAL };
+
 class ExprAST {
  public:
   virtual auto Accept(ExprASTVisitor &visitor) -> std::any = 0;
   virtual ~ExprAST() = default;
+  auto GetStaticType() const -> StaticType { return static_type_; }
+  auto GetUnboxed() const -> Unboxed { return unboxed_; }
+  void SetStaticType(StaticType type, Unboxed unboxed) {
+    static_type_ = type;
+    unboxed_ = unboxed;
+  }
+
+ private:
+  StaticType static_type_{StaticType::UNKNOWN};
+  Unboxed unboxed_{Unboxed::NONE};
+};
+
+// 二元表达式根据观察到的操作数类型把自己改写成的特化版本，GENERIC 表示每次都走通用路径
+enum class BinarySpecialization : uint8_t {
+  UNINITIALIZED,
+  NUMBER_ADD,
+  NUMBER_SUBTRACT,
+  NUMBER_MULTIPLY,
+  NUMBER_DIVIDE,
+  NUMBER_LESS,
+  NUMBER_LESS_EQUAL,
+  NUMBER_GREATER,
+  NUMBER_GREATER_EQUAL,
+  STRING_CONCAT,
+  GENERIC
 };
 
 class BinaryExprAST : public ExprAST, std::enable_shared_from_this<BinaryExprAST> {
@@ -55,22 +99,37 @@ class BinaryExprAST : public ExprAST, std::enable_shared_from_this<BinaryExprAST
       : left_(std::move(left)), op_(op), right_(std::move(right)) {}
 
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitBinaryExprAST(shared_from_this()); }
-  auto GetLeftExpr() const -> ExprASTPtr { return left_; }
-  auto GetRightExpr() const -> ExprASTPtr { return right_; }
-  auto GetOperation() const -> Token { return op_; }
+  auto GetLeftExpr() const -> const ExprASTPtr & { return left_; }
+  auto GetRightExpr() const -> const ExprASTPtr & { return right_; }
+  auto GetOperation() const -> const Token & { return op_; }
+  auto GetSpecialization() const -> BinarySpecialization { return specialization_; }
+  // 特化的守卫失败时重新特化。specialization 为 UNINITIALIZED 表示这次的操作数类型没有特化版本，下次再观察。
+  // 守卫失败和没有特化版本都算 miss，次数太多说明这里的类型不稳定，之后一直走通用路径
+  void Respecialize(BinarySpecialization specialization) {
+    bool miss = specialization_ != BinarySpecialization::UNINITIALIZED ||
+                specialization == BinarySpecialization::UNINITIALIZED;
+    if (miss && ++misses_ > kMaxMisses) {
+      specialization = BinarySpecialization::GENERIC;
+    }
+    specialization_ = specialization;
+  }
 
  private:
+  static constexpr uint8_t kMaxMisses = 4;
+
   ExprASTPtr left_;
   ExprASTPtr right_;
   Token op_;
+  BinarySpecialization specialization_{BinarySpecialization::UNINITIALIZED};
+  uint8_t misses_{0};
 };
 
 class UnaryExprAST : public ExprAST, std::enable_shared_from_this<UnaryExprAST> {
  public:
   UnaryExprAST(ExprASTPtr right, const Token &op) : right_(std::move(right)), op_(op) {}
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitUnaryExprAST(shared_from_this()); }
-  auto GetOperation() const -> Token { return op_; }
-  auto GetRightExpr() const -> ExprASTPtr { return right_; }
+  auto GetOperation() const -> const Token & { return op_; }
+  auto GetRightExpr() const -> const ExprASTPtr & { return right_; }
 
  private:
   ExprASTPtr right_;
@@ -81,7 +140,7 @@ class LiteralExprAST : public ExprAST, std::enable_shared_from_this<LiteralExprA
  public:
   explicit LiteralExprAST(std::any value) : value_(std::move(value)) {}
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitLiteralExprAST(shared_from_this()); }
-  auto GetValue() const -> std::any { return value_; }
+  auto GetValue() const -> const std::any & { return value_; }
 
  private:
   std::any value_;
@@ -91,7 +150,7 @@ class GroupingExprAST : public ExprAST, std::enable_shared_from_this<GroupingExp
  public:
   explicit GroupingExprAST(ExprASTPtr expression) : expression_(std::move(expression)) {}
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitGroupingExprAST(shared_from_this()); }
-  auto GetExpression() const -> ExprASTPtr { return expression_; }
+  auto GetExpression() const -> const ExprASTPtr & { return expression_; }
 
  private:
   ExprASTPtr expression_;
@@ -101,9 +160,9 @@ class LogicalExprAST : public ExprAST, std::enable_shared_from_this<LogicalExprA
  public:
   explicit LogicalExprAST(ExprASTPtr left, const Token &op, ExprASTPtr right)
       : left_(std::move(left)), op_(op), right_(std::move(right)) {}
-  auto GetLeftExpr() const -> ExprASTPtr { return left_; }
-  auto GetRightExpr() const -> ExprASTPtr { return right_; }
-  auto GetToken() const -> Token { return op_; }
+  auto GetLeftExpr() const -> const ExprASTPtr & { return left_; }
+  auto GetRightExpr() const -> const ExprASTPtr & { return right_; }
+  auto GetToken() const -> const Token & { return op_; }
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitLogicalExprAST(shared_from_this()); }
 
  private:
@@ -115,11 +174,15 @@ class LogicalExprAST : public ExprAST, std::enable_shared_from_this<LogicalExprA
 class VarExprAST : public ExprAST, std::enable_shared_from_this<VarExprAST> {
  public:
   explicit VarExprAST(const Token &op) : op_(op) {}
-  auto GetToken() const -> Token { return op_; }
+  auto GetToken() const -> const Token & { return op_; }
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitVariableExprAST(shared_from_this()); }
+  // Resolver 解析出的变量，执行时直接按它读写，不再查表
+  auto GetVariable() const -> const std::optional<VariableRef> & { return variable_; }
+  void SetVariable(VariableRef variable) { variable_ = variable; }
 
  private:
   Token op_;
+  std::optional<VariableRef> variable_;
 };
 
 class AssignExprAST : public ExprAST, std::enable_shared_from_this<AssignExprAST> {
@@ -130,25 +193,44 @@ class AssignExprAST : public ExprAST, std::enable_shared_from_this<AssignExprAST
   }
   auto GetValue() const -> ExprASTPtr { return value_; }
   auto GetName() const -> Token { return name_; }
+  // 被赋值的变量有类型注解，而 TypeChecker 没能证明右边的类型时，赋值前在运行时检查
+  auto GetGuard() const -> StaticType { return guard_; }
+  void SetGuard(StaticType guard) { guard_ = guard; }
+  auto GetVariable() const -> const std::optional<VariableRef> & { return variable_; }
+  void SetVariable(VariableRef variable) { variable_ = variable; }
 
  private:
   Token name_;
   ExprASTPtr value_;
+  StaticType guard_{StaticType::UNKNOWN};
+  std::optional<VariableRef> variable_;
+};
+
+// Inliner 选中的被调函数：只有一条 return 语句，body_ 是它的返回值表达式。
+// verified_ 是上次确认过声明就是 declaration_ 的函数对象，同一个函数再次调用时只比较指针
+struct InlineTarget {
+  std::shared_ptr<FunctionStmt> declaration_;
+  ExprASTPtr body_;
+  std::shared_ptr<LoxCallable> verified_;
 };
 
 class CallExprAST : public ExprAST, std::enable_shared_from_this<CallExprAST> {
  public:
   explicit CallExprAST(ExprASTPtr callee, const Token &op, const std::vector<ExprASTPtr> &arguments)
       : callee_(std::move(callee)), op_(op), arguments_(arguments) {}
-  auto GetCallee() const -> ExprASTPtr { return callee_; }
-  auto GetArguments() const -> std::vector<ExprASTPtr> { return arguments_; }
-  auto GetToken() const -> Token { return op_; }
+  auto GetCallee() const -> const ExprASTPtr & { return callee_; }
+  auto GetArguments() const -> const std::vector<ExprASTPtr> & { return arguments_; }
+  auto GetToken() const -> const Token & { return op_; }
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitCallExprAST(shared_from_this()); }
+  // 没有被内联时返回 nullptr
+  auto GetInlineTarget() const -> InlineTarget * { return inline_.get(); }
+  void SetInlineTarget(InlineTarget target) { inline_ = std::make_unique<InlineTarget>(std::move(target)); }
 
  private:
   ExprASTPtr callee_;
   Token op_;
   std::vector<ExprASTPtr> arguments_;
+  std::unique_ptr<InlineTarget> inline_;
 };
 
 class GetExprAST : public ExprAST, std::enable_shared_from_this<GetExprAST> {
@@ -181,13 +263,17 @@ public:
   explicit ThisExprAST(const Token &keyword) : keyword_(keyword) {}
   auto GetThisKeyWord() const -> Token { return keyword_; }
   auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitThisExprAST(shared_from_this()); }
+  auto GetVariable() const -> const std::optional<VariableRef> & { return variable_; }
+  void SetVariable(VariableRef variable) { variable_ = variable; }
 private:
   Token keyword_;
+  std::optional<VariableRef> variable_;
 };
 
-class SuperExprAST : public ExprAST, std::enable_shared_from_this<SetExprAST> {
+class SuperExprAST : public ExprAST, std::enable_shared_from_this<SuperExprAST> {
 public:
   explicit SuperExprAST(const Token &keyword, const Token &method) : keyword_(keyword), method_(method) {}
+  auto Accept(ExprASTVisitor &visitor) -> std::any override { return visitor.VisitSuperExprAST(shared_from_this()); }
   auto GetSuperkeyWord() const { return keyword_; }
   auto GetSuperMethod() const { return method_; }
 private:
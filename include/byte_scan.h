@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace cpplox {
+
+// Scanner 和 JSON 解析共用的按字符类跳过字节的工具
+
+// 一次比较 kWidth 个字节的字符类，结果是每个字节一位的掩码。有 AVX2 时一次 32 字节，否则用 SSE2 一次 16 字节
+#if defined(__AVX2__)
+struct Chunk {
+  static constexpr int kWidth = 32;
+  __m256i bytes_;
+
+  static auto Load(const char *p) -> Chunk { return {_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p))}; }
+  auto Equal(char ch) const -> uint32_t {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes_, _mm256_set1_epi8(ch))));
+  }
+  // lo 和 hi 都是 ASCII，>= 0x80 的字节按有符号比较是负数，不会落在区间里
+  auto InRange(char lo, char hi) const -> uint32_t {
+    auto above {_mm256_cmpgt_epi8(bytes_, _mm256_set1_epi8(static_cast<char>(lo - 1)))};
+    auto below {_mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), bytes_)};
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(above, below)));
+  }
+};
+inline constexpr uint32_t kFullMask = 0xffffffffU;
+#elif defined(__SSE2__)
+struct Chunk {
+  static constexpr int kWidth = 16;
+  __m128i bytes_;
+
+  static auto Load(const char *p) -> Chunk { return {_mm_loadu_si128(reinterpret_cast<const __m128i *>(p))}; }
+  auto Equal(char ch) const -> uint32_t {
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes_, _mm_set1_epi8(ch))));
+  }
+  auto InRange(char lo, char hi) const -> uint32_t {
+    auto above {_mm_cmpgt_epi8(bytes_, _mm_set1_epi8(static_cast<char>(lo - 1)))};
+    auto below {_mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(hi + 1)), bytes_)};
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(above, below)));
+  }
+};
+inline constexpr uint32_t kFullMask = 0xffffU;
+#endif
+
+// 从 p 开始跳过所有属于字符类的字节，返回第一个不属于的位置。Chunk 掩码和标量判断必须是同一个字符类
+template <typename Vector, typename Scalar>
+auto SkipWhile(const char *p, const char *end, Vector &&in_class, Scalar &&scalar) -> const char * {
+#if defined(__AVX2__) || defined(__SSE2__)
+  for (; end - p >= Chunk::kWidth; p += Chunk::kWidth) {
+    auto stop {~in_class(Chunk::Load(p)) & kFullMask};
+    if (stop != 0) {
+      return p + __builtin_ctz(stop);
+    }
+  }
+#else
+  static_cast<void>(in_class);
+#endif
+  while (p != end && scalar(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+// 跳过空格、制表符和换行
+inline auto SkipSpaces(const char *p, const char *end) -> const char * {
+  return SkipWhile(
+      p, end,
+      [](const auto &chunk) { return chunk.Equal(' ') | chunk.Equal('\t') | chunk.Equal('\r') | chunk.Equal('\n'); },
+      [](char ch) { return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n'; });
+}
+
+// 找到第一个 ch，没有时返回 end
+inline auto FindByte(const char *p, const char *end, char ch) -> const char * {
+  return SkipWhile(
+      p, end, [ch](const auto &chunk) { return ~chunk.Equal(ch); }, [ch](char c) { return c != ch; });
+}
+
+}  // namespace cpplox
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <any>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ast.h"
+#include "interpreter.h"
+#include "stmt.h"
+#include "token.h"
+
+namespace cpplox {
+
+// 把解析并经过 Resolver 处理的程序翻译成链接 lox_runtime.h 的 C++ 代码。
+// 局部变量变成 C++ 局部变量 (被捕获的放进 runtime::Cell)，全局变量变成 runtime::Global，
+// 只定义一次且从不被赋值的顶层函数变成 C++ 函数并被直接调用
+class CppEmitter : public ExprASTVisitor, public StmtVisitor {
+public:
+  CppEmitter(Interpreter &interpreter, std::string source_name)
+      : interpreter_(interpreter), source_name_(std::move(source_name)) {}
+
+  auto Emit(const std::vector<std::shared_ptr<Stmt>> &statements) -> std::string;
+
+  auto VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any override;
+  auto VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any override;
+  auto VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any override;
+  auto VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any override;
+  auto VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any override;
+  auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override;
+  auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override;
+  auto VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any override;
+  auto VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any override;
+  auto VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any override;
+  auto VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any override;
+  auto VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any override;
+
+  void VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override;
+  void VisitIfStmt(std::shared_ptr<IfStmt> stmt) override;
+  void VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) override;
+  void VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) override;
+  void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override;
+  void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override;
+  void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override;
+  void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
+  void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+  void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) override;
+
+private:
+  // 一个 Lox 变量对应的 C++ 变量，cell_ 为 true 时是 runtime::Cell
+  struct Binding {
+    std::string name_;
+    bool cell_;
+  };
+  // 正在生成的函数：frame 槽位和 upvalue 下标到 C++ 变量的映射
+  struct FunctionContext {
+    std::unordered_map<int, Binding> slots_;
+    std::vector<Binding> upvalues_;
+  };
+  struct Output {
+    std::string text_;
+    int indent_{0};
+  };
+
+  void Reset();
+  auto Expr(const std::shared_ptr<ExprAST> &expr) -> std::string;
+  void Emit(const std::shared_ptr<Stmt> &stmt);
+  void Line(const std::string &text);
+  static auto Read(const Binding &binding) -> std::string;
+  auto Global(const std::string &name) -> std::string;
+  auto Lookup(const std::optional<VariableRef> &variable, const Token &name) -> std::string;
+  auto Lookup(VariableRef ref) -> const Binding &;
+  // 声明一个局部变量并返回对它赋值的 C++ 左值；全局声明返回空字符串
+  auto Declare(const std::shared_ptr<Stmt> &declaration, const std::string &name, const std::string &value)
+      -> std::string;
+  // 函数体放在 header 和 footer 两行之间，参数从 arguments 里取，方法的 this 从 self 里取
+  void EmitFunction(const std::shared_ptr<FunctionStmt> &function, const std::string &header,
+                    const std::string &footer);
+  void FindDirectFunctions(const std::vector<std::shared_ptr<Stmt>> &statements);
+  static auto Quote(const std::string &text) -> std::string;
+  static auto LineOf(const Token &token) -> std::string { return std::to_string(token.GetTokenLine()); }
+
+  Interpreter &interpreter_;
+  std::string source_name_;
+  std::set<std::string> globals_;
+  // 可以直接调用的顶层函数及其声明
+  std::map<std::string, std::shared_ptr<FunctionStmt>> direct_functions_;
+  std::unordered_set<std::string> assigned_globals_;
+  std::vector<FunctionContext> contexts_;
+  Output functions_;
+  Output script_;
+  Output *out_{&script_};
+  int next_id_{0};
+};
+
+}  // namespace cpplox
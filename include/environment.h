@@ -1,62 +1,104 @@
 #pragma once
 
 #include <any>
+#include <deque>
 #include <future>
 #include <memory>
 #include <unordered_map>
 #include <string>
+#include <utility>
+#include <vector>
+#include "execution_limits.h"
 #include "runtime_error.h"
 #include "token.h"
 
 namespace cpplox {
 
+// 被闭包捕获的局部变量放在共享的 Upvalue 里，frame 槽位中存放指向它的指针；
+// 没被捕获的局部变量直接存放在 frame 槽位中
+struct Upvalue {
+  std::any value_;
+  AllocationTag tag_{AllocationKind::UPVALUE, sizeof(Upvalue)};
+};
+using UpvaluePtr = std::shared_ptr<Upvalue>;
+
+inline auto ReadSlot(const std::any &slot) -> const std::any & {
+  if (slot.type() == typeid(UpvaluePtr)) {
+    return std::any_cast<const UpvaluePtr &>(slot)->value_;
+  }
+  return slot;
+}
+
+inline void WriteSlot(std::any &slot, std::any value) {
+  if (slot.type() == typeid(UpvaluePtr)) {
+    std::any_cast<const UpvaluePtr &>(slot)->value_ = std::move(value);
+  } else {
+    slot = std::move(value);
+  }
+}
+
+// 只用于全局变量。每个名字有一个固定的槽位号，Resolver 把对全局变量的引用解析成槽位号，执行时按下标访问；
+// 槽位在第一次被引用或定义时分配，还没有定义的槽位是空的 std::any。用 deque 保存，分配新槽位时已有的引用不会失效
 class Environment : public std::enable_shared_from_this<Environment>{
 public:
-  Environment() : enclosing_(nullptr) {}
-  Environment(const Environment &rhs)   : enable_shared_from_this(rhs) {
-    values_ = rhs.values_;
-    enclosing_ = rhs.enclosing_;
+  Environment() = default;
+  void Define(const std::string &name, const std::any &value) { Define(Slot(name), value); }
+  void Define(int slot, const std::any &value) {
+    auto &target {values_[slot]};
+    if (!target.has_value()) {
+      charge_.Grow(HeapCharge::kBindingBytes + names_[slot].size());
+    }
+    target = value;
   }
-  explicit Environment(std::shared_ptr<Environment> enclosing) : enclosing_(std::move(enclosing)) {}
-  void Define(const std::string &name, const std::any &value) { values_[name] = value; }
-  auto GetEnvironmentEnclosing() const -> std::shared_ptr<Environment> { return enclosing_; }
-
-  auto Get(const Token &name) -> std::any {
-    if (values_.contains(name.GetTokenLexeme())) {
-      return values_[name.GetTokenLexeme()];
+  auto Slot(const std::string &name) -> int {
+    auto [iter, inserted] = slots_.try_emplace(name, static_cast<int>(values_.size()));
+    if (inserted) {
+      values_.emplace_back();
+      names_.push_back(name);
     }
-    if (enclosing_ != nullptr) {
-      return enclosing_->Get(name);
+    return iter->second;
+  }
+  auto At(int slot) -> std::any & { return values_[slot]; }
+  auto GetName(int slot) const -> const std::string & { return names_[slot]; }
+  auto SlotCount() const -> int { return static_cast<int>(values_.size()); }
+  // 已经定义的全局变量
+  auto GetValues() const -> std::unordered_map<std::string, std::any> {
+    std::unordered_map<std::string, std::any> values;
+    for (size_t i = 0; i < values_.size(); ++i) {
+      if (values_[i].has_value()) {
+        values.emplace(names_[i], values_[i]);
+      }
     }
-    throw RuntimeError(name, "Undefined variable" + name.GetTokenLexeme() + ".");
+    return values;
   }
-  auto GetAt(int distance, const std::string &name) -> std::any {
-    return Ancestor(distance)->values_[name];
+  auto Find(const std::string &name) const -> const std::any * {
+    auto iter {slots_.find(name)};
+    if (iter == slots_.end() || !values_[iter->second].has_value()) {
+      return nullptr;
+    }
+    return &values_[iter->second];
   }
 
-  void Assign(const Token &name, const std::any &value) {
-    if (values_.contains(name.GetTokenLexeme())) {
-      values_[name.GetTokenLexeme()] = value;
-      return;
-    }
-    if (enclosing_ != nullptr) {
-      enclosing_->Assign(name, value);
-      return;
+  auto Get(const Token &name) -> std::any {
+    if (const auto *value = Find(name.GetTokenLexeme()); value != nullptr) {
+      return *value;
     }
-    throw RuntimeError(name, "Undefined variable " + name.GetTokenLexeme() + ".");
+    throw RuntimeError(name, "Undefined variable" + name.GetTokenLexeme() + ".");
   }
 
-private:
-  auto Ancestor(int distance) -> std::shared_ptr<Environment> {
-    std::shared_ptr<Environment> environment {this};
-    for (int i = 0; i < distance; ++ i) {
-      environment = environment->GetEnvironmentEnclosing();
+  void Assign(const Token &name, const std::any &value) {
+    auto iter {slots_.find(name.GetTokenLexeme())};
+    if (iter == slots_.end() || !values_[iter->second].has_value()) {
+      throw RuntimeError(name, "Undefined variable " + name.GetTokenLexeme() + ".");
     }
-    return environment;
+    values_[iter->second] = value;
   }
+
 private:
-  std::unordered_map<std::string, std::any> values_;
-  std::shared_ptr<Environment> enclosing_;
+  std::unordered_map<std::string, int> slots_;
+  std::deque<std::any> values_;
+  std::vector<std::string> names_;
+  HeapCharge charge_{sizeof(Environment), AllocationKind::ENVIRONMENT, "globals"};
 };
 
 } // namespace cpplox
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <token.h>
+#include <atomic>
 #include <exception>
 #include <iostream>
 #include <string>
@@ -8,8 +9,9 @@
 
 namespace cpplox {
 
-inline bool had_error {false};
-inline bool had_runtime_error{false};
+// 每个 isolate 在自己的线程上解析和执行脚本，编译错误只属于当前线程。流水线模式下解析线程的错误由 RunPipelined 转交
+inline thread_local bool had_error {false};
+inline std::atomic<bool> had_runtime_error{false};
 
 class Log {
  public:
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <any>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "lox_callable.h"
+
+namespace cpplox {
+
+class Interpreter;
+
+// 单线程事件循环：epoll 监听定时器 (timerfd) 和非阻塞 fd，
+// I/O 完成后在解释器线程上按 (error, value) 的形式调用 Lox 回调。
+// 普通文件不能用 epoll 监听，读写交给一个后台线程，完成后通过 eventfd 通知循环
+class EventLoop {
+ public:
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  auto operator=(const EventLoop &) -> EventLoop & = delete;
+
+  auto SetTimer(double delay_ms, std::shared_ptr<LoxCallable> callback) -> int;
+  void ClearTimer(int timer_id);
+  void ReadFile(const std::string &path, std::shared_ptr<LoxCallable> callback);
+  void WriteFile(const std::string &path, const std::string &data, std::shared_ptr<LoxCallable> callback);
+  void Read(int fd, std::shared_ptr<LoxCallable> callback);
+  void Write(int fd, std::string data, std::shared_ptr<LoxCallable> callback);
+  auto Pipe() -> std::pair<int, int>;
+  auto Listen(int port, std::shared_ptr<LoxCallable> callback) -> int;
+  void Connect(int port, std::shared_ptr<LoxCallable> callback);
+  void Close(int fd);
+  // fd 可读时在解释器线程上调用 on_ready，由 on_ready 读走数据。它不算待处理的事件，不会让循环一直运行，
+  // 只在循环等待定时器或 I/O 时起作用。--watch 用它在 epoll_wait 里空闲时也能重新加载
+  void WatchIdle(int fd, std::function<void()> on_ready);
+
+  auto HasPendingWork() const -> bool {
+    return !ready_.empty() || watches_.size() > idle_watches_ || !file_callbacks_.empty();
+  }
+  // 一直运行到没有定时器、没有未完成的 I/O 为止
+  void Run(Interpreter &interpreter);
+
+ private:
+  enum class WatchKind { TIMER, READ, WRITE, LISTEN, CONNECT, IDLE };
+  struct Watch {
+    WatchKind kind_;
+    int user_fd_;  // 脚本看到的 fd，epoll 里注册的是它的 dup。定时器是定时器 id
+    std::shared_ptr<LoxCallable> callback_;
+    std::string buffer_;
+    size_t offset_{0};
+    std::function<void()> on_ready_;
+  };
+
+  void AddWatch(int watch_fd, uint32_t events, std::unique_ptr<Watch> watch);
+  void RemoveWatch(int watch_fd);
+  void Complete(const std::shared_ptr<LoxCallable> &callback, std::vector<std::any> arguments);
+  void Dispatch(int watch_fd);
+  // job 在后台线程上运行，只能用它自己捕获的值，返回回调的参数
+  using FileJob = std::function<std::vector<std::any>()>;
+  void SubmitFile(std::shared_ptr<LoxCallable> callback, FileJob job);
+  void WorkFiles();
+  void CompleteFiles();
+
+ private:
+  int epoll_fd_;
+  std::unordered_map<int, std::unique_ptr<Watch>> watches_;
+  std::deque<std::pair<std::shared_ptr<LoxCallable>, std::vector<std::any>>> ready_;
+  // 定时器 id 到 timerfd。fd 关闭后编号会被复用，所以 id 单独递增，过期的 id 不会取消新的定时器
+  std::unordered_map<int, int> timers_;
+  int next_timer_id_{1};
+  size_t idle_watches_{0};
+  // 后台线程在第一次读写普通文件时启动，退出前做完已经提交的读写
+  int completion_fd_;
+  std::unordered_map<uint64_t, std::shared_ptr<LoxCallable>> file_callbacks_;
+  uint64_t next_file_job_{0};
+  std::mutex file_mutex_;
+  std::condition_variable file_work_;
+  std::deque<std::pair<uint64_t, FileJob>> file_jobs_;
+  std::vector<std::pair<uint64_t, std::vector<std::any>>> file_results_;
+  bool stopping_{false};
+  std::thread file_worker_;
+};
+
+}  // namespace cpplox
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "allocation_profiler.h"
+#include "runtime_error.h"
+#include "telemetry.h"
+#include "token.h"
+
+namespace cpplox {
+
+// 每次运行的资源限制，0 表示不限制
+struct ExecutionLimits {
+  uint64_t max_steps_{0};                 // 循环回边和函数调用的总次数
+  std::chrono::milliseconds timeout_{0};  // 墙钟时间
+  size_t max_heap_bytes_{0};              // 环境、实例和字符串拼接占用的估算字节数
+  int max_call_depth_{0};
+};
+
+// 超出资源限制时抛出，和普通的 RuntimeError 一样带有行号
+class ResourceLimitError : public RuntimeError {
+public:
+  using RuntimeError::RuntimeError;
+};
+
+// 放在 Environment/LoxInstance 里的成员，对象存活期间把它的大小计入当前线程的 telemetry.live_heap_bytes_，
+// 同时是对象的 AllocationTag
+class HeapCharge {
+public:
+  HeapCharge(size_t bytes, AllocationKind kind, std::string_view type = {}) : bytes_(bytes), tag_(kind, bytes, type) {
+    telemetry.live_heap_bytes_.Add(bytes_);
+  }
+  HeapCharge(const HeapCharge &rhs) : bytes_(rhs.bytes_), tag_(rhs.tag_) { telemetry.live_heap_bytes_.Add(bytes_); }
+  // 和 AllocationTag 一样不能赋值：赋值后按旧的 tag 记账，各类分配的统计会对不上
+  auto operator=(const HeapCharge &rhs) -> HeapCharge & = delete;
+  ~HeapCharge() { telemetry.live_heap_bytes_.Sub(bytes_); }
+  void Grow(size_t bytes) {
+    bytes_ += bytes;
+    telemetry.live_heap_bytes_.Add(bytes);
+    tag_.Grow(bytes);
+  }
+
+  // unordered_map 节点加上 key 的大致开销
+  static constexpr size_t kBindingBytes = 96;
+
+private:
+  size_t bytes_;
+  AllocationTag tag_;
+};
+
+}  // namespace cpplox
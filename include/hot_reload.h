@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "interpreter.h"
+#include "token.h"
+
+namespace cpplox {
+
+// 热重载：重新扫描脚本，只重新解析指纹变了的顶层 fun/class 声明，resolve 后替换到全局变量里。
+// 函数直接替换，类在原来的 LoxClass 上换方法，所以已有实例和全局数据都保留；顶层的 var 和其他语句不会重新执行
+class HotReloader {
+public:
+  static constexpr std::chrono::milliseconds kPollInterval{200};
+
+  // 以当前文件内容作为之后比较的基准
+  HotReloader(std::shared_ptr<Interpreter> interpreter, std::string path);
+  ~HotReloader();
+  HotReloader(const HotReloader &) = delete;
+  auto operator=(const HotReloader &) -> HotReloader & = delete;
+
+  // 返回替换的声明个数。语法或 resolve 错误的声明会报告并跳过，下次文件变化时再试
+  auto Reload() -> int;
+  // 在解释器的安全点调用：距离上次检查超过 kPollInterval 并且文件修改时间变了才重新加载
+  void Poll();
+  // 监视脚本所在目录的 inotify fd，不支持 inotify 时为 -1。脚本空闲在事件循环里时，
+  // 这个 fd 可读就调用 Notify，不用等到安全点
+  auto GetNotifyFd() const -> int { return notify_fd_; }
+  void Notify();
+
+private:
+  // 顶层声明在 token 序列中的范围 [begin_, end_)
+  struct Declaration {
+    std::string name_;
+    size_t begin_;
+    size_t end_;
+    uint64_t fingerprint_;
+  };
+  auto ReadTokens() const -> std::vector<Token>;
+  // 文件修改时间变了时重新加载
+  void ReloadIfModified();
+  static auto Split(const std::vector<Token> &tokens) -> std::vector<Declaration>;
+
+  std::shared_ptr<Interpreter> interpreter_;
+  std::string path_;
+  std::unordered_map<std::string, uint64_t> fingerprints_;
+  std::filesystem::file_time_type modified_;
+  std::chrono::steady_clock::time_point next_poll_;
+  bool reloading_{false};
+  int notify_fd_{-1};
+};
+
+}  // namespace cpplox
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <any>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "interpreter.h"
+#include "stmt.h"
+#include "token.h"
+namespace cpplox {
+
+// Resolver 和 TypeChecker 之后运行：函数体只有一条 return 语句、表达式足够小的顶层函数是内联候选，
+// 对候选函数的全局调用被标记成 InlineTarget，Interpreter 在被调用的全局变量仍然是这个函数时直接求值 return 表达式。
+// 被内联的函数体之间不能形成环，所以内联调用的嵌套层数有限
+class Inliner : public ExprASTVisitor, StmtVisitor {
+public:
+  static constexpr size_t kMaxNodes = 16;
+
+  void Inline(Interpreter &interpreter, const std::vector<std::shared_ptr<Stmt>> &statements);
+  // 取出上次 Inline 之后的报告，每行一条
+  auto TakeReport() -> std::vector<std::string> { return std::move(report_); }
+  void EnableReport() { reporting_ = true; }
+
+  void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override;
+  void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override;
+  void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override;
+  void VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override;
+  void VisitIfStmt(std::shared_ptr<IfStmt> stmt) override;
+  void VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) override;
+  void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
+  void VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) override;
+  void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+  void VisitImportStmt(std::shared_ptr<ImportStmt> /*stmt*/) override {}
+
+  // 表达式返回自己的节点个数 (size_t)
+  auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override;
+  auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override;
+  auto VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any override;
+  auto VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any override;
+  auto VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any override;
+  auto VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any override;
+  auto VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any override;
+  auto VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any override;
+  auto VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any override;
+  auto VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any override;
+  auto VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any override;
+  auto VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any override;
+
+private:
+  void Walk(const std::vector<std::shared_ptr<Stmt>> &statements);
+  void Walk(const std::shared_ptr<Stmt> &statement);
+  auto Size(const std::shared_ptr<ExprAST> &expr) -> size_t;
+  void AddCandidate(const std::shared_ptr<FunctionStmt> &function);
+  // 内联 to 里的调用会不会让 from 的函数体经过内联调用回到自己
+  auto Reaches(const FunctionStmt *from, const FunctionStmt *to) const -> bool;
+  void Report(const Token &token, const std::string &message);
+
+  Interpreter *interpreter_{nullptr};
+  // 全局函数名 -> 最近一次声明的候选函数，跨 REPL 的行和流水线的语句保留
+  std::unordered_map<std::string, InlineTarget> candidates_;
+  // 候选函数体里被内联的候选函数
+  std::unordered_map<const FunctionStmt *, std::vector<const FunctionStmt *>> edges_;
+  // 正在遍历的候选函数体，不在候选函数里时为 nullptr
+  const FunctionStmt *current_{nullptr};
+  // 第一遍只计算大小，第二遍才标记调用
+  bool marking_{false};
+  bool reporting_{false};
+  std::vector<std::string> report_;
+};
+
+}  // namespace cpplox
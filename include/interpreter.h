@@ -1,19 +1,69 @@
 #pragma once
 
+#include <algorithm>
 #include <any>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
+#include "allocation_profiler.h"
 #include "ast.h"
 #include "environment.h"
+#include "execution_limits.h"
+#include "isolate.h"
+#include "lox_module.h"
 #include "stmt.h"
+#include "telemetry.h"
 #include "token.h"
+#include "value_stack.h"
 
 namespace cpplox {
 
+class EventLoop;
+class Jit;
+class LoxCallable;
+class LoxCoroutine;
+class LoxFunction;
+class TelemetryExporter;
+
+struct UpvalueRef {
+  int index_;
+  bool is_local_;  // true: 捕获外层函数 frame 的槽位；false: 转发外层函数自己的 upvalue
+};
+// 局部声明 (var/fun/class/super) 的槽位，captured_ 表示要放进共享的 Upvalue 里
+struct SlotInfo {
+  int index_;
+  bool captured_;
+};
+struct FunctionInfo {
+  int slot_count_{0};
+  bool has_receiver_{false};       // 方法的 slot 0 是 this
+  std::vector<int> captured_params_;  // 被捕获的参数 (包括 this) 的槽位
+  std::vector<UpvalueRef> upvalues_;
+};
+
 class Interpreter : public ExprASTVisitor, public StmtVisitor {
+  // 写快照、编译机器码和生成 C++ 时要读取 Resolver 留下的各个表
+  friend class SnapshotWriter;
+  friend class JitCompiler;
+  friend class CppEmitter;
+
 public:
+  // 值栈的槽位数，超出时报告 "Stack overflow."
+  static constexpr size_t kValueStackSlots = 1 << 16;
+  static constexpr size_t kCoroutineStackSlots = 1 << 12;
+
+  Interpreter();
+  ~Interpreter() override;
   auto VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any override {
     return expr_ast->GetValue();
   }
@@ -24,7 +74,7 @@ public:
   auto VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any override;
   auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override {
     // return environment_->Get(expr_ast->GetToken());
-    return LookUpVariable(expr_ast->GetToken(),expr_ast);
+    return LookUpVariable(expr_ast->GetToken(), expr_ast->GetVariable());
   }
   auto VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any override;
   auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override;
@@ -36,6 +86,60 @@ public:
 
   void Interpret(const std::shared_ptr<ExprAST>& expression);
   void Interpret(const std::vector<std::shared_ptr<Stmt>> &statements);
+  // 流水线模式逐条执行已经 resolve 的顶层语句，执行预算从 BeginScript 开始累计。出现运行时错误时返回 false
+  void BeginScript() { ResetBudget(); }
+  auto InterpretNext(const std::shared_ptr<Stmt> &statement) -> bool;
+  // 热重载时重新执行一条已经 resolve 的顶层 fun/class 声明。类声明会把新方法换进原来的 LoxClass，已有实例不受影响
+  void ReloadDeclaration(const std::shared_ptr<Stmt> &declaration, const std::string &name);
+  // 第一次访问模块成员时调用：读取、解析并 resolve 模块文件，把语句交给 module，再调用 ExecuteModule。出错时抛出 RuntimeError
+  using ModuleLoader = void (*)(LoxModule &module, const Token &token);
+  void SetModuleLoader(ModuleLoader loader) { module_loader_ = loader; }
+  // 在模块自己的顶层 frame 上执行模块的顶层语句
+  void ExecuteModule(const LoxModule &module);
+  // 解析并 resolve 预解析函数的函数体，出错时报告语法错误并抛出 RuntimeError
+  using BodyParser = void (*)(const std::shared_ptr<FunctionStmt> &function);
+  void SetBodyParser(BodyParser parser) { body_parser_ = parser; }
+  // LoxFunction 第一次被调用时调用
+  void ParseBody(const std::shared_ptr<FunctionStmt> &function);
+  // 解析所有还没有被调用过的预解析函数，返回出错的个数。写快照之前和 --check 用
+  auto ParseLazyBodies() -> int;
+  // spawn(fn, arg) 在新的 isolate 里调用全局函数 function，返回值发送到 result。由 Lox 设置：
+  // 在 IsolatePool 的线程上用新的解释器重新解析脚本，执行顶层声明后调用 RunIsolate
+  using IsolateStarter = void (*)(const std::string &function, Message argument, std::shared_ptr<LoxChannel> result);
+  void SetIsolateStarter(IsolateStarter starter) { isolate_starter_ = starter; }
+  void Spawn(const std::string &function, Message argument, std::shared_ptr<LoxChannel> result);
+  // 调用全局函数 function(argument) 并运行事件循环，返回要发回去的返回值。出错时报告错误并返回 nil
+  auto RunIsolate(const std::string &function, Message argument) -> Message;
+  // Message::GlobalName 记下的全局变量。模块里的是 "path::name"，这个 isolate 还没用到模块时先加载它
+  auto GetSharedGlobal(const std::string &name) -> std::any;
+  // 每隔 kCheckInterval 步在 CheckLimits 里调用一次，此时可以安全地替换全局变量
+  void SetSafePoint(std::function<void()> safe_point) { safe_point_ = std::move(safe_point); }
+  // 运行脚本注册的定时器和异步 I/O 回调，直到没有待处理的事件
+  void RunEventLoop();
+  // 事件循环调用回调也要经过 CallFunction：检查资源限制、调用深度和协程栈，原生函数的 NativeError 转成 RuntimeError
+  auto CallCallback(const std::shared_ptr<LoxCallable> &callback, std::span<std::any> arguments) -> std::any;
+  void SetLimits(const ExecutionLimits &limits) { limits_ = limits; }
+  auto GetLimits() const -> const ExecutionLimits & { return limits_; }
+  // 在循环回边和函数调用处计数，只有到达 next_check_ 时才检查各项限制
+  void CheckBudget(const Token &token) {
+    if (++steps_ >= next_check_) {
+      CheckLimits(token);
+    }
+  }
+  auto GetEventLoop() -> EventLoop &;
+  // 函数被调用 hot_calls 次后编译成机器码
+  void EnableJit(uint32_t hot_calls);
+  // 没有打开 JIT 时返回 0
+  auto GetJitHotCalls() const -> uint32_t;
+  // 创建解释器的线程上的统计，其它线程也可以读
+  auto GetTelemetry() const -> const Telemetry & { return *telemetry_; }
+  // 每隔 interval 在后台把统计导出到文件或者 "unix:PATH"，见 TelemetryExporter
+  void ExportTelemetry(std::string target, std::chrono::milliseconds interval);
+  // 机器码里不检查步数、超时和调用深度，设置了这些限制时不使用 JIT
+  auto GetJit() -> Jit * {
+    bool limited = limits_.max_steps_ > 0 || limits_.timeout_.count() > 0 || limits_.max_call_depth_ > 0;
+    return limited ? nullptr : jit_.get();
+  }
   
   void VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override;
   void VisitIfStmt(std::shared_ptr<IfStmt> stmt) override;
@@ -43,32 +147,190 @@ public:
   void VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) override;
   void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override;
   void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override {
-    ExecuteBlock(stmt->GetBlockStatements(), environment_);
+    ExecuteBlock(stmt->GetBlockStatements());
   }
   void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override;
   void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
   void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+  void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) override;
 
-  void ExecuteBlock(const std::vector<std::shared_ptr<Stmt>> &statements, const std::shared_ptr<Environment> &env);
+  // 块作用域的局部变量在当前 frame 的槽位里，执行块不需要新的环境
+  void ExecuteBlock(const std::vector<std::shared_ptr<Stmt>> &statements);
+  // 在函数自己的 frame 和 upvalues 上执行函数体
+  void ExecuteFunction(const std::vector<std::shared_ptr<Stmt>> &statements, std::any *frame,
+                       const std::vector<UpvaluePtr> *upvalues);
   auto GetGlobalEnvironment() const -> std::shared_ptr<Environment> { return globals_; }
-  void Resolve(std::shared_ptr<ExprAST> expr, std::unordered_map<std::string, bool> &scope);
-  void Resolve(const std::shared_ptr<ExprAST> &expr, int depth);
+
+  // 协程有自己的值栈，切换协程时和 frame 一起切换
+  struct CallFrame {
+    std::any *slots_;
+    const std::vector<UpvaluePtr> *upvalues_;
+    ValueStack *stack_;
+  };
+  auto GetCallFrame() const -> CallFrame { return {frame_, upvalues_, stack_}; }
+  void SetCallFrame(CallFrame frame) {
+    frame_ = frame.slots_;
+    upvalues_ = frame.upvalues_;
+    stack_ = frame.stack_;
+  }
+  auto GetStack() -> ValueStack & { return *stack_; }
+  // 协程挂起时带走自己那部分调用深度，恢复时再加回来
+  auto GetCallDepth() const -> int { return call_depth_; }
+  void SetCallDepth(int depth) { call_depth_ = depth; }
+  // 开始运行、还没有结束的协程。解释器销毁前展开它们的栈
+  void AddCoroutine(LoxCoroutine *coroutine) { coroutines_.insert(coroutine); }
+  void RemoveCoroutine(LoxCoroutine *coroutine) { coroutines_.erase(coroutine); }
+  // return 语句不抛异常，只记下返回值，ExecuteBlock 和循环看到 returning_ 后逐层退出
+  auto TakeReturnValue() -> std::any {
+    returning_ = false;
+    return std::exchange(return_value_, std::any{nullptr});
+  }
+  // 尾调用 return f(...) 也只设置 returning_，同时记下被调函数和参数，由外层的 LoxFunction::Call 循环执行
+  struct TailCall {
+    std::shared_ptr<LoxFunction> function_;
+    std::vector<std::any> arguments_;
+    const Token *token_{nullptr};
+  };
+  auto HasTailCall() const -> bool { return tail_call_.function_ != nullptr; }
+  auto TakeTailCall() -> TailCall { return std::exchange(tail_call_, TailCall{}); }
+
+  auto ResolveGlobal(const std::string &name) -> VariableRef { return {VariableKind::GLOBAL, globals_->Slot(name)}; }
+  static auto IsGlobal(const VarExprAST &expr) -> bool {
+    const auto &variable {expr.GetVariable()};
+    return !variable.has_value() || variable->kind_ == VariableKind::GLOBAL;
+  }
+  void ResolveSuper(const std::shared_ptr<SuperExprAST> &expr, VariableRef super_ref, VariableRef this_ref) {
+    super_refs_[expr] = {super_ref, this_ref};
+  }
+  void DeclareSlot(const std::shared_ptr<Stmt> &declaration, SlotInfo slot) { declarations_[declaration] = slot; }
+  // 模块的顶层声明写入 name (带模块路径前缀) 的全局槽位，返回槽位号
+  auto DeclareGlobal(const std::shared_ptr<Stmt> &declaration, const std::string &name) -> int {
+    auto slot {globals_->Slot(name)};
+    global_declarations_[declaration] = slot;
+    return slot;
+  }
+  // path 是规范化的绝对路径，同一个文件只有一个 LoxModule
+  auto ImportModule(const std::string &path) -> std::shared_ptr<LoxModule> {
+    auto &module {modules_[path]};
+    if (module == nullptr) {
+      module = std::make_shared<LoxModule>(path);
+    }
+    return module;
+  }
+  void DeclareImport(const std::shared_ptr<ImportStmt> &stmt, std::shared_ptr<LoxModule> module) {
+    imports_[stmt] = std::move(module);
+  }
+  void DeclareLazyFunction(const std::shared_ptr<FunctionStmt> &function) { lazy_functions_.push_back(function); }
+  void DeclareSuperSlot(const std::shared_ptr<ClassStmt> &klass, SlotInfo slot) { super_slots_[klass] = slot; }
+  void DeclareFunction(const std::shared_ptr<FunctionStmt> &function, FunctionInfo info) {
+    functions_[function] = std::move(info);
+  }
+  void SetScriptSlots(int slot_count) { script_slots_ = std::max(script_slots_, slot_count); }
+  void MarkTailCall(const std::shared_ptr<ReturnStmt> &stmt) { tail_calls_.insert(stmt); }
+  void UnmarkTailCall(const std::shared_ptr<ReturnStmt> &stmt) { tail_calls_.erase(stmt); }
+  auto GetFunctionInfo(const std::shared_ptr<FunctionStmt> &function) const -> const FunctionInfo * {
+    return &functions_.at(function);
+  }
+
+  // 打开分配追踪后创建 allocation_profiler，它记下之后每个运行时对象的分配点
+  static void EnableAllocationProfiler() {
+    if (allocation_profiler == nullptr) {
+      allocation_profiler = new AllocationProfiler();
+    }
+  }
+
+  // 带注解的变量、参数和返回值在 TypeChecker 不能证明类型时由这里检查，what 是错误信息里的主语
+  static void CheckType(const std::any &value, StaticType type, const Token &token, const std::string &what);
+
+  // 最短往返表示最多 24 个字符 (e.g. -2.2250738585072014e-308)
+  using NumberBuffer = std::array<char, 32>;
+  static auto FormatNumber(double value, NumberBuffer &buffer) -> std::string_view;
 
 private:
   auto Evaluate(const std::shared_ptr<ExprAST>& expression) -> std::any {
     return expression->Accept(*this);
   }
   auto IsTruthy(const std::any &value) -> bool;
+  // 打开分配追踪时，接下来的分配记在 token 所在的行上
+  static void TraceAllocation(const Token &token) {
+    if (allocation_profiler != nullptr) {
+      allocation_profiler->SetLine(token.GetTokenLine());
+    }
+  }
+  // TypeChecker 标记了 Unboxed 的表达式树直接算出 double/bool，不经过 std::any
+  auto EvaluateNumber(ExprAST &expr) -> double;
+  auto EvaluateBool(ExprAST &expr) -> bool;
+  auto EvaluateCondition(const std::shared_ptr<ExprAST> &expr) -> bool {
+    return expr->GetStaticType() == StaticType::BOOL ? EvaluateBool(*expr) : IsTruthy(Evaluate(expr));
+  }
   auto IsEqual(const std::any &left, const std::any &right) -> bool;
   void CheckNumberOperand(const Token &op, const std::any &left, const std::any &right);
+  static auto Specialize(TokenType op, const std::any &left, const std::any &right) -> BinarySpecialization;
+  static auto EvaluateSpecialized(BinarySpecialization specialization, double left, double right) -> std::any;
+  auto EvaluateBinary(const Token &op, const std::any &left, const std::any &right) -> std::any;
   auto StringIfy(const std::any &value) -> std::string;
   void Execute(const std::shared_ptr<Stmt> &stmt);
-  auto LookUpVariable(const Token &name, const std::shared_ptr<ExprAST> &expr) -> std::any;
+  auto LookUpVariable(const Token &name, const std::optional<VariableRef> &variable) -> std::any;
+  auto ReadVariable(VariableRef ref) -> const std::any &;
+  void WriteVariable(VariableRef ref, std::any value);
+  // 局部声明写入它的槽位 (被捕获时新建 Upvalue)，全局声明写入 globals_
+  void DeclareVariable(const std::shared_ptr<Stmt> &declaration, const std::string &name, std::any value);
+  void AssignDeclared(const std::shared_ptr<Stmt> &declaration, const Token &name, std::any value);
+  auto MakeClosure(const std::shared_ptr<FunctionStmt> &declaration, bool is_initializer)
+      -> std::shared_ptr<LoxFunction>;
+  auto CheckCallee(const std::any &callee, size_t argument_count, const Token &token) -> std::shared_ptr<LoxCallable>;
+  static void CheckArity(LoxCallable &function, size_t argument_count, const Token &token);
+  auto CallFunction(const std::shared_ptr<LoxCallable> &function, std::span<std::any> arguments, const Token &token)
+      -> std::any;
+  // 被调用的函数是否还是 Inliner 选中的那个声明 (全局变量可能被重新赋值)
+  static auto MatchInline(InlineTarget &target, const std::shared_ptr<LoxCallable> &function) -> bool;
+  // 在实参所在的槽位上求值被内联的 return 表达式，参数名只能引用这些槽位，不会和调用方的变量混淆
+  auto EvaluateInline(const InlineTarget &target, std::any *arguments, const Token &token) -> std::any;
+  // 需要时先加载模块，模块还没有执行到这个声明 (循环 import) 时报错
+  auto GetModuleMember(LoxModule &module, const Token &name) -> std::any;
+  // 变量的值所在的位置，没有定义的全局变量返回 nullptr
+  auto FindVariable(const Token &name, const std::optional<VariableRef> &variable) -> const std::any *;
+  void ResetBudget();
+  void CheckLimits(const Token &token);
+  void CheckHeap(const Token &token, size_t extra_bytes);
 
 private:
   std::shared_ptr<Environment> globals_{std::make_shared<Environment>()};
-  std::shared_ptr<Environment> environment_{globals_};
-  std::unordered_map<std::shared_ptr<ExprAST>, int> locals_;
+  ValueStack main_stack_{kValueStackSlots};
+  std::any *frame_{nullptr};
+  const std::vector<UpvaluePtr> *upvalues_{nullptr};
+  ValueStack *stack_{&main_stack_};
+  bool returning_{false};
+  std::any return_value_{nullptr};
+  TailCall tail_call_;
+  // 顶层代码里块作用域的局部变量
+  std::vector<std::any> script_frame_;
+  std::vector<UpvaluePtr> no_upvalues_;
+  int script_slots_{0};
+
+  std::unordered_map<std::shared_ptr<SuperExprAST>, std::pair<VariableRef, VariableRef>> super_refs_;
+  std::unordered_map<std::shared_ptr<Stmt>, SlotInfo> declarations_;
+  std::unordered_map<std::shared_ptr<ClassStmt>, SlotInfo> super_slots_;
+  std::unordered_map<std::shared_ptr<FunctionStmt>, FunctionInfo> functions_;
+  std::unordered_set<std::shared_ptr<ReturnStmt>> tail_calls_;
+  std::unordered_map<std::shared_ptr<Stmt>, int> global_declarations_;
+  std::unordered_map<std::shared_ptr<ImportStmt>, std::shared_ptr<LoxModule>> imports_;
+  std::unordered_map<std::string, std::shared_ptr<LoxModule>> modules_;
+  ModuleLoader module_loader_{nullptr};
+  std::vector<std::shared_ptr<FunctionStmt>> lazy_functions_;
+  BodyParser body_parser_{nullptr};
+  IsolateStarter isolate_starter_{nullptr};
+  std::unique_ptr<EventLoop> event_loop_;
+  std::unique_ptr<Jit> jit_;
+  const Telemetry *telemetry_{&telemetry};
+  std::unique_ptr<TelemetryExporter> telemetry_exporter_;
+  ExecutionLimits limits_;
+  std::function<void()> safe_point_;
+  uint64_t steps_{0};
+  uint64_t next_check_{0};
+  int call_depth_{0};
+  std::unordered_set<LoxCoroutine *> coroutines_;
+  std::chrono::steady_clock::time_point deadline_;
 };
 
 } // namespace cpplox
\ No newline at end of file
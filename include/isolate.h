@@ -0,0 +1,106 @@
+#pragma once
+
+#include <any>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "environment.h"
+
+namespace cpplox {
+
+class Interpreter;
+class LoxCallable;
+class LoxChannel;
+
+// isolate 之间传递的值：发送时从发送方的堆里复制出来，接收时在接收方的堆里重建，两边不共享可变的对象。
+// nil、布尔值、数字和字符串按值保存，最外层的字符串是移动进来的，接收时再移动出去；通道本身是线程安全的，直接共享；
+// 全局的函数和类不可变，只记下保存它们的全局变量名，接收方用自己的同名全局变量 (每个 isolate 执行的是同一份脚本，
+// 模块里的在接收方第一次用到时加载)；
+// 实例连同字段深复制，同一个实例只复制一次，引用关系和环保持不变
+class Message {
+public:
+  Message() = default;
+  // 不能发送的值 (闭包、绑定的方法、局部类的实例、协程、模块) 抛出 NativeError
+  static auto From(Environment &globals, std::any value) -> Message;
+  // 在接收方的解释器里重建这个值，之后 message 不再可用
+  auto Take(Interpreter &interpreter) -> std::any;
+  // 保存 callable 的全局变量名，不是全局变量时返回空字符串
+  static auto GlobalName(Environment &globals, const LoxCallable &callable) -> std::string;
+
+private:
+  struct GlobalRef {
+    std::string name_;
+  };
+  struct InstanceRef {
+    size_t index_;
+  };
+  using Value = std::variant<std::nullptr_t, bool, double, std::string, std::shared_ptr<LoxChannel>, GlobalRef,
+                             InstanceRef>;
+  struct Instance {
+    std::string class_;
+    std::vector<std::pair<std::string, Value>> fields_;
+  };
+  friend class MessageWriter;
+  friend class MessageReader;
+
+  Value root_{nullptr};
+  std::vector<Instance> instances_;
+};
+
+// channel() 创建的通道，多个 isolate 可以同时发送和接收。发送不阻塞，接收在通道为空时阻塞调用的线程，
+// 不会让出给事件循环
+class LoxChannel {
+public:
+  void Send(Message message) {
+    {
+      std::lock_guard lock{mutex_};
+      messages_.push_back(std::move(message));
+    }
+    ready_.notify_one();
+  }
+  auto Receive() -> Message;
+  auto ToString() const -> std::string { return "<channel>"; }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<Message> messages_;
+};
+
+// spawn 的 isolate 在这些线程上运行，同时运行的线程数不超过 CPU 核数。isolate 在 receive 上等待时不算在内：
+// 还有排队的 isolate 而没有空闲线程时再启动一个，等待消息的 isolate 不会让它要等的 isolate 一直排不上。
+// 线程不退出，进程结束前用 Wait 等所有 isolate 运行完
+class IsolatePool {
+public:
+  static auto Shared() -> IsolatePool &;
+  void Submit(std::function<void()> task);
+  void Wait();
+  // LoxChannel::Receive 等待之前和之后调用，不在池里的线程上什么都不做
+  static void BeginBlocking();
+  static void EndBlocking();
+
+private:
+  IsolatePool();
+  void Work();
+  // 持有 mutex_ 时调用
+  void Grow();
+
+  std::mutex mutex_;
+  std::condition_variable work_;
+  std::condition_variable done_;
+  std::deque<std::function<void()>> tasks_;
+  size_t concurrency_;
+  size_t threads_{0};
+  size_t idle_{0};
+  size_t blocked_{0};
+  size_t running_{0};
+};
+
+}  // namespace cpplox
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <any>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "interpreter.h"
+#include "stmt.h"
+
+namespace cpplox {
+
+class LoxCallable;
+
+// 一个函数编译出来的 x86-64 机器码。参数和返回值都是 double，函数体里只有数字运算、
+// 局部变量、if/while/return 和对自己的递归调用，没有副作用，所以守卫失败时可以直接交给解释器重新执行。
+// depth 是还允许的递归层数，每进入一层减一，用完时写入负数并逐层返回，由解释器重新执行这次调用
+class JitCode {
+public:
+  using Entry = double (*)(const double *arguments, int64_t *depth);
+
+  JitCode(void *memory, size_t size, std::string name, size_t arity, bool self_recursive, size_t frame_bytes,
+          size_t slot_count)
+      : memory_(memory),
+        size_(size),
+        name_(std::move(name)),
+        arity_(arity),
+        self_recursive_(self_recursive),
+        frame_bytes_(frame_bytes),
+        slots_per_call_(arity + slot_count) {}
+  JitCode(const JitCode &) = delete;
+  auto operator=(const JitCode &) -> JitCode & = delete;
+  ~JitCode();
+
+  // 参数都是数字，并且 (有递归调用时) 全局变量 name_ 仍然是 function 时执行机器码；否则返回 false
+  auto Run(Interpreter &interpreter, const LoxCallable *function, std::span<const std::any> arguments,
+           std::any &result) const -> bool;
+
+private:
+  void *memory_;
+  size_t size_;
+  std::string name_;
+  size_t arity_;
+  bool self_recursive_;
+  // 每层递归占用的 C 栈字节数，和解释器执行同样的调用时占用的值栈槽位 (实参和 frame)。
+  // 递归深度不超过两者允许的层数，解释器会报告栈溢出的调用一定退回解释器
+  size_t frame_bytes_;
+  size_t slots_per_call_;
+  // 递归太深退回解释器时的调用深度。解释器执行这次调用时，里面更深的调用不再尝试机器码
+  mutable int fallback_depth_{std::numeric_limits<int>::max()};
+};
+
+// 模板 JIT：函数调用次数到达 hot_calls (默认 kHotCalls，--jit-threshold 设置) 后，按 AST 节点拼接机器码模板。
+// 默认关闭 (--jit 打开)，设置了步数、超时或调用深度限制时不使用，因为机器码里不做这些检查
+class Jit {
+public:
+  static constexpr uint32_t kHotCalls = 1000;
+
+  explicit Jit(uint32_t hot_calls = kHotCalls) : hot_calls_(hot_calls) {}
+  auto GetHotCalls() const -> uint32_t { return hot_calls_; }
+
+  // 不支持的函数返回 nullptr，结果按声明缓存，不会重复尝试
+  auto Compile(Interpreter &interpreter, const std::shared_ptr<FunctionStmt> &declaration, const FunctionInfo &info)
+      -> const JitCode *;
+
+private:
+  uint32_t hot_calls_;
+  std::unordered_map<std::shared_ptr<FunctionStmt>, std::unique_ptr<JitCode>> code_;
+};
+
+}  // namespace cpplox
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <any>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace cpplox {
+
+class LoxClass;
+class LoxInstance;
+
+// json_parse/json_stringify 的实现。Lox 没有列表和字典：JSON 对象是 JsonObject 的实例，键就是字段名；
+// 数组是 JsonArray 的实例，元素在字段 "0" 到 "n-1" 里，length 是元素个数。键不是标识符时用 json_get/json_set 访问
+class Json {
+public:
+  // 嵌套超过这个深度时报错，解析和输出都是递归的
+  static constexpr size_t kMaxDepth = 512;
+
+  Json(std::shared_ptr<LoxClass> object_class, std::shared_ptr<LoxClass> array_class)
+      : object_class_(std::move(object_class)), array_class_(std::move(array_class)) {}
+  auto GetObjectClass() const -> const std::shared_ptr<LoxClass> & { return object_class_; }
+  auto GetArrayClass() const -> const std::shared_ptr<LoxClass> & { return array_class_; }
+  auto IsArray(const LoxInstance &instance) const -> bool;
+
+  // 语法错误抛出 NativeError，信息里带出错位置的字节偏移
+  auto Parse(std::string_view text) const -> std::any;
+  // 数组以外的实例都按对象输出，字段按名字排序。NaN 和无穷大输出 null，函数、通道这样的值和有环的实例抛出 NativeError
+  auto Stringify(const std::any &value) const -> std::string;
+  // key 是字符串或者非负整数 (数组下标)，没有这个字段时返回 nil
+  auto Get(const LoxInstance &instance, const std::any &key) const -> std::any;
+  // 给数组设置 length 以外的下标时同时更新 length
+  void Set(LoxInstance &instance, const std::any &key, std::any value) const;
+
+  // 数组的 length 字段，不是非负数时按 0 处理
+  static auto Length(const LoxInstance &array) -> size_t;
+
+private:
+  std::shared_ptr<LoxClass> object_class_;
+  std::shared_ptr<LoxClass> array_class_;
+};
+
+}  // namespace cpplox
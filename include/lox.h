@@ -1,26 +1,112 @@
+#include <chrono>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "error.h"
+#include "execution_limits.h"
+#include "hot_reload.h"
+#include "inliner.h"
 #include "interpreter.h"
+#include "isolate.h"
+#include "lox_module.h"
 #include "scanner.h"
 #include "token.h"
+#include "type_checker.h"
 
 namespace cpplox {
 
 class Lox {
 public:
+  Lox() { interpreter = NewInterpreter(); }
   auto RunFile(const std::string& filePath) -> void;
   auto RunPrompt() -> void; 
+  auto SetLimits(const ExecutionLimits &limits) -> void { interpreter->SetLimits(limits); }
+  auto EnableJit(uint32_t hot_calls) -> void { interpreter->EnableJit(hot_calls); }
+  auto ExportTelemetry(const std::string &target, std::chrono::milliseconds interval) -> void {
+    interpreter->ExportTelemetry(target, interval);
+  }
+  // 扫描、解析在各自的线程上运行，顶层语句 resolve 之后立即执行
+  auto EnablePipeline() -> void { pipeline_ = true; }
+  // 顶层函数 (包括模块里的) 只预解析，函数体在第一次调用时才解析、resolve 和检查类型，
+  // 没有被调用的函数里的语法错误不会报告，用 CheckFile 检查
+  auto EnableLazyParse() -> void { lazy_parse = true; }
+  // 完整地解析、resolve 并检查脚本，不运行。没有错误时返回 true
+  auto CheckFile(const std::string &path) -> bool;
+  // 脚本文件修改后在安全点重新加载变化了的顶层 fun/class 声明
+  auto EnableWatch() -> void { watch_ = true; }
+  // 记录每个运行时对象的分配点，脚本结束时把存活对象按类型和分配点汇总写到 path
+  auto EnableAllocationProfile(const std::string &path) -> void {
+    Interpreter::EnableAllocationProfiler();
+    heap_dump_path_ = path;
+  }
+  // 把两份 heap dump 之间存活对象的变化写到标准输出
+  static auto DiffHeapDumps(const std::string &before, const std::string &after) -> void;
+  // 把 Inliner 内联了哪些调用写到标准错误
+  auto EnableInlineReport() -> void { inliner_.EnableReport(); }
+  // 立即重新加载正在运行的脚本，返回替换的声明个数
+  auto Reload() -> int { return reloader_ == nullptr ? 0 : reloader_->Reload(); }
+  // 在运行脚本之前加载 prelude 的快照 / 在脚本运行结束后把全局变量写成快照
+  auto LoadSnapshot(const std::string &path) -> void;
+  auto SaveSnapshot(const std::string &path) -> void;
+  // 把脚本翻译成链接 lox_runtime.h 的 C++ 代码，output 为 "-" 时写到标准输出
+  auto EmitCpp(const std::string &script_path, const std::string &output) -> void;
  
 private:
   auto Run(const std::string& source) -> void;
-  inline static std::shared_ptr<Interpreter> interpreter{std::make_shared<Interpreter>()};
+  auto RunPipelined(std::string source) -> void;
+  auto Optimize(const std::vector<std::shared_ptr<Stmt>> &statements) -> void;
+  auto SaveHeapDump() -> void;
+  // 扫描并解析，返回之前释放 token
+  static auto Parse(const std::string &source, bool lazy) -> std::vector<std::shared_ptr<Stmt>>;
+  static auto Parse(const std::vector<Token> &tokens, bool lazy) -> std::vector<std::shared_ptr<Stmt>>;
+  // 模块用自己的 TypeChecker 和 Inliner，它们按名字记录的全局变量不会和脚本的混在一起
+  static auto LoadModule(LoxModule &module, const Token &token) -> void;
+  static auto ParseBody(const std::shared_ptr<FunctionStmt> &function) -> void;
+  static auto NewInterpreter() -> std::shared_ptr<Interpreter>;
+  // isolate 重新解析的脚本：脚本文件的源码，REPL 里是到目前为止编译通过的所有行。
+  // token 在第一次 spawn 时扫描一次，之后的 isolate 共用，每个 isolate 只需要解析
+  struct IsolateScript {
+    IsolateScript(std::string source, std::filesystem::path directory)
+        : source_(std::move(source)), directory_(std::move(directory)) {}
+    auto Tokens() const -> const std::vector<Token> & {
+      std::call_once(scanned_, [this] { tokens_ = Scanner(source_).ScanTokens(); });
+      return tokens_;
+    }
+    std::string source_;
+    std::filesystem::path directory_;
+    mutable std::once_flag scanned_;
+    mutable std::vector<Token> tokens_;
+  };
+  // 记下新的 isolate 要用的脚本、资源限制和 JIT 设置，交给 IsolatePool
+  static auto Spawn(const std::string &function, Message argument, std::shared_ptr<LoxChannel> result) -> void;
+  // 在池里的线程上用新的解释器编译脚本，只执行顶层的 fun、class 和 import 声明，再调用 function。
+  // 其它顶层语句 (包括全局变量的初始化) 不执行，isolate 需要的数据通过参数和通道传入
+  static auto RunIsolate(const std::shared_ptr<const IsolateScript> &script, const ExecutionLimits &limits,
+                         uint32_t jit_hot_calls, const std::string &function, Message argument, LoxChannel &result)
+      -> void;
+  bool pipeline_{false};
+  bool watch_{false};
+  std::string heap_dump_path_;
+  // 脚本所在的目录，脚本里 import 的相对路径从这里开始
+  std::filesystem::path script_directory_;
+  std::unique_ptr<HotReloader> reloader_;
+  // REPL 的每一行共用一个 TypeChecker，带注解的全局变量在后面的行里仍然检查赋值
+  TypeChecker checker_;
+  // 候选函数同样跨行保留，后面的行可以内联前面定义的函数
+  Inliner inliner_;
+  // 每个 isolate 的线程有自己的解释器和脚本，LoadModule、ParseBody 和 Spawn 用当前线程的
+  inline static thread_local std::shared_ptr<Interpreter> interpreter;
+  inline static thread_local std::shared_ptr<const IsolateScript> isolate_script;
+  inline static bool lazy_parse{false};
 };
 
 }  // namespace cpplox
\ No newline at end of file
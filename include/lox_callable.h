@@ -1,15 +1,18 @@
 #pragma once
 
 #include <any>
+#include <span>
 #include <vector>
 #include "interpreter.h"
 namespace cpplox {
 
 class LoxCallable {
 public:
-  virtual auto Call(Interpreter &interpreter, std::vector<std::any> &arguments) -> std::any = 0;
+  virtual auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any = 0;
   virtual auto Arity() -> int = 0;
   virtual auto ToString() -> std::string = 0;
+  // 运行 C++ 代码而不是 Lox 代码，telemetry 单独统计它们花的时间
+  virtual auto IsNative() -> bool { return true; }
 };
 
 } // namespace cpplox
\ No newline at end of file
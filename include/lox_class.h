@@ -4,6 +4,7 @@
 #include <string>
 #include <unordered_map>
 #include <utility>
+#include "allocation_profiler.h"
 #include "lox_callable.h"
 #include "lox_function.h"
 #include "lox_instance.h"
@@ -15,12 +16,15 @@ class LoxClass : public LoxCallable {
   explicit LoxClass(std::string name, std::shared_ptr<LoxClass> supper_class,
                     const std::unordered_map<std::string, std::shared_ptr<LoxFunction>> &methods)
       : name_(std::move(name)), supper_class_(std::move(supper_class)), methods_(methods) {}
-  LoxClass(const LoxClass &rhs) {
+  LoxClass(const LoxClass &rhs) : tag_(rhs.tag_) {
     name_ = rhs.name_;
     supper_class_ = rhs.supper_class_;
     methods_ = rhs.methods_;
   }
   auto ToString() const -> std::string { return name_; }
+  auto GetName() const -> const std::string & { return name_; }
+  auto GetSuperClass() const -> const std::shared_ptr<LoxClass> & { return supper_class_; }
+  auto GetMethods() const -> const std::unordered_map<std::string, std::shared_ptr<LoxFunction>> & { return methods_; }
   auto Arity() -> int override {
     auto initializer{FindMethod("init")};
     if (initializer == nullptr) {
@@ -28,7 +32,8 @@ class LoxClass : public LoxCallable {
     }
     return initializer->Arity();
   }
-  auto Call(Interpreter &interpreter, std::vector<std::any> &arguments) -> std::any override {
+  auto IsNative() -> bool override { return false; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
     std::shared_ptr<LoxInstance> instance = std::make_shared<LoxInstance>(this);
     auto initializer{FindMethod("init")};
     if (initializer != nullptr) {
@@ -36,6 +41,11 @@ class LoxClass : public LoxCallable {
     }
     return instance;
   }
+  // 热重载：换上新声明的父类和方法，已有实例仍然指向这个对象
+  void Redefine(const LoxClass &rhs) {
+    supper_class_ = rhs.supper_class_;
+    methods_ = rhs.methods_;
+  }
   auto FindMethod(const std::string &method_name) -> std::shared_ptr<LoxFunction> {
     if (methods_.contains(method_name)) {
       return methods_[method_name];
@@ -50,6 +60,7 @@ class LoxClass : public LoxCallable {
   std::string name_;
   std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods_;
   std::shared_ptr<LoxClass> supper_class_;
+  AllocationTag tag_{AllocationKind::CLASS, sizeof(LoxClass), name_};
 };
 
 }  // namespace cpplox
\ No newline at end of file
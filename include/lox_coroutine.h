@@ -0,0 +1,245 @@
+#pragma once
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <any>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "allocation_profiler.h"
+#include "environment.h"
+#include "interpreter.h"
+#include "lox_callable.h"
+#include "runtime_error.h"
+#include "value_stack.h"
+
+namespace cpplox {
+
+enum class CoroutineStatus { SUSPENDED, RUNNING, NORMAL, DEAD };
+
+// 有栈协程：每个协程有自己的 C 栈，递归的 Execute/ExecuteBlock 直接在协程栈上运行，
+// yield 时用 swapcontext 切回 resume 的调用者，不需要改写解释器。
+class LoxCoroutine {
+ public:
+  static constexpr size_t kDefaultStackSize = 256 * 1024;
+  // 协程栈剩下的空间少于这么多时，函数调用报告栈溢出，不会碰到栈底的保护页
+  static constexpr size_t kStackReserve = 32 * 1024;
+
+  explicit LoxCoroutine(std::shared_ptr<LoxCallable> function, size_t stack_size = kDefaultStackSize)
+      : function_(std::move(function)), stack_size_(stack_size) {}
+  LoxCoroutine(const LoxCoroutine &) = delete;
+  auto operator=(const LoxCoroutine &) -> LoxCoroutine & = delete;
+  // 挂起的协程栈上还有 frame、shared_ptr 和调用深度，先展开再释放栈
+  ~LoxCoroutine() {
+    Cancel();
+    if (stack_ != nullptr) {
+      munmap(stack_, mapping_size_);
+    }
+  }
+
+  auto Status() const -> CoroutineStatus { return status_; }
+  auto StatusName() const -> std::string {
+    switch (status_) {
+      case CoroutineStatus::SUSPENDED:
+        return "suspended";
+      case CoroutineStatus::RUNNING:
+        return "running";
+      case CoroutineStatus::NORMAL:
+        return "normal";
+      case CoroutineStatus::DEAD:
+        return "dead";
+    }
+    return "dead";
+  }
+  static auto Current() -> LoxCoroutine * { return current_; }
+  // 不在协程里，或者协程栈还有 kStackReserve 以上的空间
+  static auto HasStackRoom() -> bool {
+    if (current_ == nullptr) {
+      return true;
+    }
+    const auto *top {static_cast<const char *>(__builtin_frame_address(0))};
+    return static_cast<size_t>(top - current_->StackBottom()) > kStackReserve;
+  }
+
+  // 当前 C 栈 (协程栈或者线程栈) 在 kStackReserve 之外还剩的字节数。JIT 的机器码递归时不经过 CallFunction，
+  // 用它限制递归深度
+  static auto StackRoom() -> size_t {
+    const auto *top {static_cast<const char *>(__builtin_frame_address(0))};
+    const auto *bottom {current_ != nullptr ? current_->StackBottom() : ThreadStackBottom()};
+    auto room {static_cast<size_t>(top - bottom)};
+    return room > kStackReserve ? room - kStackReserve : 0;
+  }
+
+  // 切换到协程运行，直到它 yield 或者结束；返回 yield 的值或者函数的返回值
+  auto Resume(Interpreter &interpreter, std::any value) -> std::any {
+    if (status_ == CoroutineStatus::DEAD) {
+      throw NativeError("Cannot resume dead coroutine.");
+    }
+    if (status_ != CoroutineStatus::SUSPENDED) {
+      throw NativeError("Cannot resume non-suspended coroutine.");
+    }
+    if (stack_ == nullptr) {
+      AllocateStack();
+      getcontext(&context_);
+      context_.uc_stack.ss_sp = StackBottom();
+      context_.uc_stack.ss_size = stack_size_;
+      context_.uc_link = nullptr;
+      makecontext(&context_, &LoxCoroutine::Entry, 0);
+      values_ = std::make_unique<ValueStack>(Interpreter::kCoroutineStackSlots);
+      interpreter.AddCoroutine(this);
+    }
+    interpreter_ = &interpreter;
+    caller_ = current_;
+    if (caller_ != nullptr) {
+      caller_->status_ = CoroutineStatus::NORMAL;
+    }
+    auto caller_frame{interpreter.GetCallFrame()};
+    if (frame_.slots_ != nullptr) {
+      interpreter.SetCallFrame(frame_);
+    } else {
+      interpreter.SetCallFrame({caller_frame.slots_, caller_frame.upvalues_, values_.get()});
+    }
+    auto caller_depth {interpreter.GetCallDepth()};
+    interpreter.SetCallDepth(caller_depth + depth_);
+    auto *profiler {allocation_profiler};
+    if (profiler != nullptr) {
+      profiler->Swap(profile_);
+    }
+    transfer_ = std::move(value);
+    status_ = CoroutineStatus::RUNNING;
+    current_ = this;
+
+    swapcontext(&return_context_, &context_);
+
+    if (profiler != nullptr) {
+      profiler->Swap(profile_);
+    }
+
+    current_ = caller_;
+    if (caller_ != nullptr) {
+      caller_->status_ = CoroutineStatus::RUNNING;
+    }
+    frame_ = interpreter.GetCallFrame();
+    interpreter.SetCallFrame(caller_frame);
+    depth_ = interpreter.GetCallDepth() - caller_depth;
+    interpreter.SetCallDepth(caller_depth);
+    if (status_ == CoroutineStatus::DEAD) {
+      interpreter.RemoveCoroutine(this);
+    }
+    if (exception_ != nullptr) {
+      std::rethrow_exception(std::exchange(exception_, nullptr));
+    }
+    return std::exchange(transfer_, {});
+  }
+
+  // 挂起当前协程，把 value 交给 resume 的调用者；再次 resume 时返回传入的值
+  static auto Yield(std::any value) -> std::any {
+    auto *self = current_;
+    if (self == nullptr) {
+      throw NativeError("Can't yield outside of a coroutine.");
+    }
+    self->transfer_ = std::move(value);
+    self->status_ = CoroutineStatus::SUSPENDED;
+    swapcontext(&self->context_, &self->return_context_);
+    if (self->cancelled_) {
+      throw Cancelled{};
+    }
+    return std::exchange(self->transfer_, {});
+  }
+
+  // 让挂起的协程从 yield 处抛出 Cancelled，把协程栈展开到 Entry，之后协程是 dead。
+  // 没开始运行或者已经结束的协程什么也不做。只在析构时调用，展开途中保存下来的异常直接丢掉
+  void Cancel() noexcept {
+    if (status_ != CoroutineStatus::SUSPENDED || stack_ == nullptr) {
+      return;
+    }
+    cancelled_ = true;
+    try {
+      Resume(*interpreter_, nullptr);
+    } catch (...) {
+    }
+  }
+
+ private:
+  // 只在 Cancel 时从 Yield 抛出，不是 std::exception，解释器里不会被当成错误处理
+  struct Cancelled {};
+
+  auto StackBottom() const -> char * { return stack_ + (mapping_size_ - stack_size_); }
+  // 线程栈的最低地址，每个线程只查一次
+  static auto ThreadStackBottom() -> const char * {
+    thread_local const char *bottom {[] {
+      void *address {nullptr};
+      size_t size {0};
+      pthread_attr_t attributes;
+      if (pthread_getattr_np(pthread_self(), &attributes) == 0) {
+        pthread_attr_getstack(&attributes, &address, &size);
+        pthread_attr_destroy(&attributes);
+      }
+      return static_cast<const char *>(address);
+    }()};
+    return bottom;
+  }
+
+  // 栈底多映射一页不可访问的保护页，栈溢出时立刻出错，不会改写别的内存
+  void AllocateStack() {
+    auto page {static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+    stack_size_ = (stack_size_ + page - 1) / page * page;
+    mapping_size_ = stack_size_ + page;
+    void *mapping {
+        mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0)};
+    if (mapping == MAP_FAILED) {
+      throw NativeError("Cannot allocate coroutine stack.");
+    }
+    stack_ = static_cast<char *>(mapping);
+    mprotect(stack_, page, PROT_NONE);
+  }
+
+  static void Entry() {
+    auto *self = current_;
+    try {
+      std::vector<std::any> arguments;
+      if (self->function_->Arity() == 1) {
+        arguments.push_back(self->transfer_);
+      }
+      self->transfer_ = self->function_->Call(*self->interpreter_, arguments);
+    } catch (const Cancelled &) {
+      self->transfer_ = nullptr;
+    } catch (...) {
+      // 异常不能跨越 swapcontext 传播，交给 Resume 在调用者的栈上重新抛出
+      self->exception_ = std::current_exception();
+      self->transfer_ = nullptr;
+    }
+    self->status_ = CoroutineStatus::DEAD;
+    setcontext(&self->return_context_);
+  }
+
+ private:
+  std::shared_ptr<LoxCallable> function_;
+  size_t stack_size_;
+  size_t mapping_size_{0};
+  char *stack_{nullptr};
+  // 协程里的调用 frame 分配在自己的值栈上，和 resume 的调用者交错执行时互不影响
+  std::unique_ptr<ValueStack> values_;
+  ucontext_t context_{};
+  ucontext_t return_context_{};
+  CoroutineStatus status_{CoroutineStatus::SUSPENDED};
+  Interpreter *interpreter_{nullptr};
+  LoxCoroutine *caller_{nullptr};
+  Interpreter::CallFrame frame_{nullptr, nullptr, nullptr};
+  std::any transfer_;
+  std::exception_ptr exception_;
+  // 挂起时协程自己那部分调用深度，和分配追踪里协程自己的函数栈
+  int depth_{0};
+  AllocationProfiler::Context profile_;
+  bool cancelled_{false};
+  // 协程栈在第一次 resume 时才分配，也算在创建协程的位置上
+  AllocationTag tag_{AllocationKind::COROUTINE, sizeof(LoxCoroutine) + stack_size_};
+  inline static thread_local LoxCoroutine *current_{nullptr};
+};
+
+}  // namespace cpplox
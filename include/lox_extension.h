@@ -0,0 +1,105 @@
+#pragma once
+
+/* cpplox 原生扩展的 C ABI。扩展是一个导出 lox_extension_init 的共享库，脚本里用
+ * load_extension("libfoo.so") 加载。init 通过 lox_define_function 注册函数，声明参数个数、参数类型和返回类型，
+ * 解释器在调用前检查类型，参数直接以 LoxValue 数组传给扩展函数。
+ * init 返回非 0 时，已经注册的函数都不会定义，共享库被卸载。
+ *
+ * 字符串参数只在调用期间有效；返回的字符串由扩展持有，解释器在函数返回后立即复制。 */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOX_EXTENSION_ABI_VERSION 2
+#define LOX_EXTENSION_MAX_ARITY 8
+
+typedef enum LoxType {
+  LOX_TYPE_NIL = 0,
+  LOX_TYPE_BOOL = 1,
+  LOX_TYPE_NUMBER = 2,
+  LOX_TYPE_STRING = 3,
+  LOX_TYPE_ANY = 4,   /* 只用于声明参数：nil、bool、number 或 string */
+  LOX_TYPE_ERROR = 5, /* 只用于返回值：string 是错误信息，报告为运行时错误 */
+} LoxType;
+
+typedef struct LoxValue {
+  LoxType type;
+  union {
+    int boolean;
+    double number;
+    struct {
+      const char *chars;
+      size_t length;
+    } string;
+  } as;
+} LoxValue;
+
+typedef LoxValue (*LoxExtensionFn)(const LoxValue *args, int argc, void *userdata);
+
+typedef struct LoxRegistrar {
+  int abi_version; /* 解释器的 ABI 版本 */
+  void *context;
+  /* 把函数定义成全局变量 name。abi_version 是扩展编译时的 LOX_EXTENSION_ABI_VERSION，和解释器的不同时
+   * 拒绝注册，整个扩展加载失败。成功返回 0，版本不对、参数个数或类型不合法时返回 -1 */
+  int (*define_function)(void *context, int abi_version, const char *name, LoxExtensionFn fn, int arity,
+                         const LoxType *params, LoxType result, void *userdata);
+} LoxRegistrar;
+
+/* 扩展导出的入口，返回非 0 表示初始化失败 */
+typedef int (*LoxExtensionInit)(const LoxRegistrar *registrar);
+#define LOX_EXTENSION_INIT_SYMBOL "lox_extension_init"
+
+/* 带上扩展编译时的 ABI 版本调用 define_function */
+static inline int lox_define_function(const LoxRegistrar *registrar, const char *name, LoxExtensionFn fn, int arity,
+                                      const LoxType *params, LoxType result, void *userdata) {
+  return registrar->define_function(registrar->context, LOX_EXTENSION_ABI_VERSION, name, fn, arity, params, result,
+                                    userdata);
+}
+
+static inline LoxValue lox_nil(void) {
+  LoxValue value;
+  value.type = LOX_TYPE_NIL;
+  value.as.number = 0;
+  return value;
+}
+
+static inline LoxValue lox_bool(int boolean) {
+  LoxValue value;
+  value.type = LOX_TYPE_BOOL;
+  value.as.boolean = boolean != 0;
+  return value;
+}
+
+static inline LoxValue lox_number(double number) {
+  LoxValue value;
+  value.type = LOX_TYPE_NUMBER;
+  value.as.number = number;
+  return value;
+}
+
+static inline LoxValue lox_string(const char *chars, size_t length) {
+  LoxValue value;
+  value.type = LOX_TYPE_STRING;
+  value.as.string.chars = chars;
+  value.as.string.length = length;
+  return value;
+}
+
+static inline LoxValue lox_error(const char *message) {
+  LoxValue value;
+  size_t length = 0;
+  while (message[length] != '\0') {
+    ++length;
+  }
+  value.type = LOX_TYPE_ERROR;
+  value.as.string.chars = message;
+  value.as.string.length = length;
+  return value;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,46 +2,131 @@
 
 #include <algorithm>
 #include <any>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
+#include "allocation_profiler.h"
 #include "environment.h"
 #include "interpreter.h"
+#include "jit.h"
 #include "lox_callable.h"
 #include "lox_instance.h"
 #include "runtime_error.h"
 #include "stmt.h"
+#include "telemetry.h"
+#include "value_stack.h"
 namespace cpplox {
 
 class LoxFunction : public LoxCallable {
 public:
-  explicit LoxFunction(std::shared_ptr<FunctionStmt> declaration, const Environment &closure, bool is_initializer) : 
-            declaration_(std::move(declaration)), closure_(closure), is_initializer_(is_initializer) {}
-  auto Call(Interpreter &interpreter, std::vector<std::any> &arguments) -> std::any override {
-    auto environment {std::make_shared<Environment>(closure_)};
-    for (int i = 0; i < declaration_->GetFunctionParams().size(); ++ i) {
-      environment->Define(declaration_->GetFunctionParams()[i].GetTokenLexeme(), arguments[i]);
-    }
-    try {
-      interpreter.ExecuteBlock(declaration_->GetFunctionBody(), environment);
-    } catch(Return return_value) {
-      if (is_initializer_) { return closure_.GetAt(0, "this"); }
-      return return_value.GetReturnValue();
-    }
-    if (is_initializer_) { return closure_.GetAt(0, "this"); }
-    return {};
+  // info 属于解释器的 functions_ 表，和 declaration 一样比闭包活得久
+  explicit LoxFunction(std::shared_ptr<FunctionStmt> declaration, const FunctionInfo *info,
+                       std::vector<UpvaluePtr> upvalues, bool is_initializer)
+      : declaration_(std::move(declaration)),
+        info_(info),
+        upvalues_(std::move(upvalues)),
+        is_initializer_(is_initializer),
+        tag_(AllocationKind::CLOSURE, sizeof(LoxFunction), declaration_->GetFunctionName().GetTokenLexeme()) {}
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    // 函数体以尾调用结束时不递归调用，而是在这里循环执行下一个函数
+    LoxFunction *function = this;
+    Interpreter::TailCall tail_call;
+    for (;;) {
+      auto result {function->Invoke(interpreter, arguments)};
+      if (!interpreter.HasTailCall()) {
+        return result;
+      }
+      tail_call = interpreter.TakeTailCall();
+      interpreter.CheckBudget(*tail_call.token_);
+      telemetry.calls_.Add();
+      function = tail_call.function_.get();
+      arguments = tail_call.arguments_;
+    }
   }
+  auto IsInitializer() const -> bool { return is_initializer_; }
+  auto GetDeclaration() const -> const std::shared_ptr<FunctionStmt> & { return declaration_; }
+  auto GetUpvalues() const -> const std::vector<UpvaluePtr> & { return upvalues_; }
+  auto GetReceiver() const -> const std::any & { return receiver_; }
   auto Arity() -> int override { return declaration_->GetFunctionParams().size(); }
+  auto IsNative() -> bool override { return false; }
   auto ToString() -> std::string override { return "<fn" + declaration_->GetFunctionName().GetTokenLexeme() + ">"; }
+  // 绑定后的方法和原方法共享 upvalues，调用时 this 放在 slot 0
   auto Bind(const std::shared_ptr<LoxInstance> &instance) -> std::shared_ptr<LoxFunction> {
-    auto environment {std::make_shared<Environment>(closure_)};
-    environment->Define("this", instance);
-    return std::make_shared<LoxFunction>(declaration_, environment, is_initializer_);
+    auto method {std::make_shared<LoxFunction>(*this)};
+    method->receiver_ = instance;
+    return method;
   }
 private:
+  auto Invoke(Interpreter &interpreter, std::span<std::any> arguments) -> std::any {
+    if (declaration_->GetLazyBody() != nullptr) {
+      interpreter.ParseBody(declaration_);
+    }
+    // 带注解的参数在进入函数时检查，TypeChecker 在函数体里直接相信这些注解
+    const auto &param_types {declaration_->GetParamTypes()};
+    for (size_t i = 0; i < param_types.size(); ++i) {
+      if (param_types[i] != StaticType::UNKNOWN) {
+        const auto &param {declaration_->GetFunctionParams()[i]};
+        Interpreter::CheckType(arguments[i], param_types[i], param, "Parameter '" + param.GetTokenLexeme() + "'");
+      }
+    }
+    if (auto *jit = interpreter.GetJit(); jit != nullptr && !is_initializer_) {
+      if (native_ == nullptr && ++calls_ == jit->GetHotCalls()) {
+        native_ = jit->Compile(interpreter, declaration_, *info_);
+      }
+      std::any result;
+      if (native_ != nullptr && native_->Run(interpreter, this, arguments, result)) {
+        return CheckReturn(std::move(result));
+      }
+    }
+    // 没开 --alloc-profile 时不进出 profiler 的函数栈
+    std::optional<AllocationProfiler::Scope> scope;
+    if (allocation_profiler != nullptr) {
+      scope.emplace(allocation_profiler, declaration_->GetFunctionName().GetTokenLexeme());
+    }
+    // frame 分配在解释器的值栈上，函数返回或者抛出异常时弹出
+    auto &stack {interpreter.GetStack()};
+    ValueStack::Mark mark{stack};
+    auto *frame = stack.Allocate(info_->slot_count_);
+    if (frame == nullptr) {
+      throw NativeError("Stack overflow.");
+    }
+    size_t base = 0;
+    if (info_->has_receiver_) {
+      frame[base++] = receiver_;
+    }
+    for (size_t i = 0; i < arguments.size(); ++ i) {
+      frame[base + i] = std::move(arguments[i]);
+    }
+    for (auto slot : info_->captured_params_) {
+      frame[slot] = std::make_shared<Upvalue>(Upvalue{std::move(frame[slot])});
+    }
+    interpreter.ExecuteFunction(declaration_->GetFunctionBody(), frame, &upvalues_);
+    auto result {interpreter.TakeReturnValue()};
+    // 尾调用时还没有返回值，返回值和它的检查都交给 Call 接着执行的被调函数
+    if (interpreter.HasTailCall()) {
+      return result;
+    }
+    if (is_initializer_) { return receiver_; }
+    return CheckReturn(std::move(result));
+  }
+  auto CheckReturn(std::any result) -> std::any {
+    if (declaration_->GetReturnType() != StaticType::UNKNOWN) {
+      Interpreter::CheckType(result, declaration_->GetReturnType(), declaration_->GetFunctionName(), "Return value");
+    }
+    return result;
+  }
+
   std::shared_ptr<FunctionStmt> declaration_;
-  Environment closure_;
+  const FunctionInfo *info_;
+  std::vector<UpvaluePtr> upvalues_;
+  std::any receiver_;
   bool is_initializer_;
+  uint32_t calls_{0};
+  const JitCode *native_{nullptr};
+  AllocationTag tag_;
 };
 
 } // namespace cpplox
\ No newline at end of file
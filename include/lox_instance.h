@@ -4,6 +4,8 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include "execution_limits.h"
 #include "lox_class.h"
 #include "runtime_error.h"
 #include "token.h"
@@ -13,6 +15,8 @@ class LoxInstance {
 public:
   explicit LoxInstance(const std::shared_ptr<LoxClass>& klass) : klass_(klass) {}
   auto ToString() -> std::string { return klass_->ToString() + " instance"; }
+  auto GetClass() const -> const std::shared_ptr<LoxClass> & { return klass_; }
+  auto GetFields() const -> const std::unordered_map<std::string, std::any> & { return fields_; }
   auto Get(const Token &name) -> std::any {
     if (fields_.contains(name.GetTokenLexeme())) {
       return fields_[name.GetTokenLexeme()];
@@ -21,11 +25,17 @@ public:
     if (method != nullptr) { return method->Bind(this); }
     throw RuntimeError(name, "Undefined property " + name.GetTokenLexeme() + " .");
   }
-  void Set(const Token &name, const std::any &value) {
-    fields_[name.GetTokenLexeme()] = value;
+  void Set(const Token &name, const std::any &value) { SetField(name.GetTokenLexeme(), value); }
+  // 不经过语法树设置的字段 (json_parse、从别的 isolate 复制过来的实例)
+  void SetField(std::string name, std::any value) {
+    auto [iter, inserted] = fields_.insert_or_assign(std::move(name), std::move(value));
+    if (inserted) {
+      charge_.Grow(HeapCharge::kBindingBytes + iter->first.size());
+    }
   }
 private:
   std::shared_ptr<LoxClass> klass_;
   std::unordered_map<std::string, std::any> fields_;
+  HeapCharge charge_{sizeof(LoxInstance), AllocationKind::INSTANCE, klass_->GetName()};
 };
 } // namespace cpplox
\ No newline at end of file
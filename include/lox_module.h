@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "stmt.h"
+
+namespace cpplox {
+
+// import 得到的模块。import 只在解释器里按路径找到 (或创建) 这个对象，第一次访问成员 (m.x) 时才读取、解析、resolve
+// 并执行模块文件，之后所有 import 同一个文件的地方共用它。模块的顶层声明放在 globals_ 里以 "path::name" 命名的槽位上，
+// 不会和脚本或其他模块的全局变量冲突
+class LoxModule {
+public:
+  // LOADING 时模块的顶层代码正在执行，循环 import 的模块只能看到已经执行过的声明
+  enum class State { UNLOADED, LOADING, LOADED, FAILED };
+
+  explicit LoxModule(std::string path) : path_(std::move(path)), name_(std::filesystem::path(path_).stem().string()) {}
+  auto ToString() const -> std::string { return "<module " + name_ + ">"; }
+  auto GetPath() const -> const std::string & { return path_; }
+  auto GetName() const -> const std::string & { return name_; }
+  auto GetState() const -> State { return state_; }
+  void SetState(State state) { state_ = state; }
+
+  // 模块的顶层声明在 globals_ 里的名字
+  auto GlobalName(const std::string &name) const -> std::string { return path_ + "::" + name; }
+  // Resolver 在 resolve 模块之前记下每个顶层声明的槽位
+  void Export(const std::string &name, int slot) { exports_.insert_or_assign(name, slot); }
+  auto FindExport(const std::string &name) const -> const int * {
+    auto iter {exports_.find(name)};
+    return iter == exports_.end() ? nullptr : &iter->second;
+  }
+
+  // 已经 resolve 的顶层语句和顶层块作用域需要的槽位数，加载后一直保留
+  void SetStatements(std::vector<std::shared_ptr<Stmt>> statements) { statements_ = std::move(statements); }
+  auto GetStatements() const -> const std::vector<std::shared_ptr<Stmt>> & { return statements_; }
+  void SetSlotCount(int slot_count) { slot_count_ = std::max(slot_count_, slot_count); }
+  auto GetSlotCount() const -> int { return slot_count_; }
+
+private:
+  std::string path_;
+  std::string name_;
+  State state_{State::UNLOADED};
+  std::unordered_map<std::string, int> exports_;
+  std::vector<std::shared_ptr<Stmt>> statements_;
+  int slot_count_{0};
+};
+
+}  // namespace cpplox
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// cpplox --emit-cpp 生成的 C++ 代码链接的运行时，语义和错误信息与解释器保持一致
+namespace cpplox::runtime {
+
+struct Function;
+struct Class;
+struct Instance;
+using FunctionPtr = std::shared_ptr<Function>;
+using ClassPtr = std::shared_ptr<Class>;
+using InstancePtr = std::shared_ptr<Instance>;
+using Value = std::variant<std::monostate, bool, double, std::string, FunctionPtr, ClassPtr, InstancePtr>;
+// 被闭包捕获的局部变量
+using Cell = std::shared_ptr<Value>;
+// 直接调用的顶层函数的参数，用花括号初始化保证从左到右求值
+template <size_t N>
+using Args = std::array<Value, N>;
+
+class RuntimeError : public std::runtime_error {
+public:
+  RuntimeError(int line, const std::string &message) : std::runtime_error(message), line_(line) {}
+  auto GetLine() const -> int { return line_; }
+
+private:
+  int line_;
+};
+
+struct Function {
+  using Body = std::function<Value(const Value &self, std::vector<Value> &arguments)>;
+  std::string name_;
+  size_t arity_;
+  Body body_;
+  bool is_initializer_{false};
+  Value self_;
+};
+
+struct Class {
+  std::string name_;
+  ClassPtr super_class_;
+  std::unordered_map<std::string, FunctionPtr> methods_;
+
+  auto FindMethod(const std::string &name) const -> FunctionPtr {
+    if (auto iter {methods_.find(name)}; iter != methods_.end()) {
+      return iter->second;
+    }
+    return super_class_ == nullptr ? nullptr : super_class_->FindMethod(name);
+  }
+};
+
+struct Instance {
+  ClassPtr class_;
+  std::unordered_map<std::string, Value> fields_;
+};
+
+// 二元运算的两个操作数，花括号初始化保证左操作数先求值
+struct Operands {
+  Value left_;
+  Value right_;
+};
+
+inline auto MakeFunction(std::string name, size_t arity, Function::Body body, bool is_initializer = false)
+    -> FunctionPtr {
+  return std::make_shared<Function>(Function{std::move(name), arity, std::move(body), is_initializer, {}});
+}
+
+inline auto Bind(const FunctionPtr &method, const Value &self) -> FunctionPtr {
+  auto bound {std::make_shared<Function>(*method)};
+  bound->self_ = self;
+  return bound;
+}
+
+inline auto MakeClass(std::string name, const Value &super_class, int line,
+                      std::unordered_map<std::string, FunctionPtr> methods) -> ClassPtr {
+  ClassPtr super;
+  if (!std::holds_alternative<std::monostate>(super_class)) {
+    if (!std::holds_alternative<ClassPtr>(super_class)) {
+      throw RuntimeError(line, "Supper class must be a class");
+    }
+    super = std::get<ClassPtr>(super_class);
+  }
+  return std::make_shared<Class>(Class{std::move(name), std::move(super), std::move(methods)});
+}
+
+inline auto Truthy(const Value &value) -> bool {
+  if (std::holds_alternative<std::monostate>(value)) {
+    return false;
+  }
+  if (const auto *boolean = std::get_if<bool>(&value)) {
+    return *boolean;
+  }
+  return true;
+}
+
+inline auto ToString(const Value &value) -> std::string {
+  switch (value.index()) {
+    case 0:
+      return "nil";
+    case 1:
+      return std::get<bool>(value) ? "true" : "false";
+    case 2: {
+      // 和 Interpreter::FormatNumber 一样使用最短的往返表示
+      std::array<char, 32> buffer;
+      auto [end, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), std::get<double>(value));
+      return {buffer.data(), end};
+    }
+    case 3:
+      return std::get<std::string>(value);
+    case 4:
+      return "<fn" + std::get<FunctionPtr>(value)->name_ + ">";
+    case 5:
+      return std::get<ClassPtr>(value)->name_;
+    default:
+      return std::get<InstancePtr>(value)->class_->name_ + " instance";
+  }
+}
+
+inline void Print(const Value &value) { std::cout << ToString(value) << "\n"; }
+
+inline auto Equal(const Operands &operands) -> Value { return operands.left_ == operands.right_; }
+inline auto NotEqual(const Operands &operands) -> Value { return operands.left_ != operands.right_; }
+
+inline auto Numbers(const Operands &operands, int line) -> std::pair<double, double> {
+  const auto *left = std::get_if<double>(&operands.left_);
+  const auto *right = std::get_if<double>(&operands.right_);
+  if (left == nullptr || right == nullptr) {
+    throw RuntimeError(line, "Operand must be a number");
+  }
+  return {*left, *right};
+}
+
+inline auto Add(const Operands &operands, int line) -> Value {
+  const auto *left = std::get_if<double>(&operands.left_);
+  const auto *right = std::get_if<double>(&operands.right_);
+  if (left != nullptr && right != nullptr) {
+    return *left + *right;
+  }
+  const auto *left_string = std::get_if<std::string>(&operands.left_);
+  const auto *right_string = std::get_if<std::string>(&operands.right_);
+  if (left_string != nullptr && right_string != nullptr) {
+    return *left_string + *right_string;
+  }
+  throw RuntimeError(line, "Operands must be two numbers or two strings");
+}
+inline auto Subtract(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left - right;
+}
+inline auto Multiply(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left * right;
+}
+inline auto Divide(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left / right;
+}
+inline auto Less(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left < right;
+}
+inline auto LessEqual(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left <= right;
+}
+inline auto Greater(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left > right;
+}
+inline auto GreaterEqual(const Operands &operands, int line) -> Value {
+  auto [left, right] = Numbers(operands, line);
+  return left >= right;
+}
+
+inline auto Negate(const Value &value, int line) -> Value {
+  const auto *number = std::get_if<double>(&value);
+  if (number == nullptr) {
+    throw RuntimeError(line, "Operand must be a number");
+  }
+  return -*number;
+}
+inline auto Not(const Value &value) -> Value { return !Truthy(value); }
+
+template <typename Right>
+auto And(Value left, Right &&right) -> Value {
+  return Truthy(left) ? right() : left;
+}
+template <typename Right>
+auto Or(Value left, Right &&right) -> Value {
+  return Truthy(left) ? left : right();
+}
+
+// 第一个元素是被调用的值，后面是参数
+inline auto Call(std::vector<Value> values, int line) -> Value {
+  Value callee {std::move(values.front())};
+  values.erase(values.begin());
+  auto check_arity = [&](size_t arity) {
+    if (values.size() != arity) {
+      throw RuntimeError(line, "Expected " + std::to_string(arity) + " arguments but got " +
+                                   std::to_string(values.size()) + ".");
+    }
+  };
+  if (const auto *function = std::get_if<FunctionPtr>(&callee)) {
+    check_arity((*function)->arity_);
+    auto result {(*function)->body_((*function)->self_, values)};
+    return (*function)->is_initializer_ ? (*function)->self_ : result;
+  }
+  if (const auto *klass = std::get_if<ClassPtr>(&callee)) {
+    Value instance {std::make_shared<Instance>(Instance{*klass, {}})};
+    auto initializer {(*klass)->FindMethod("init")};
+    check_arity(initializer == nullptr ? 0 : initializer->arity_);
+    if (initializer != nullptr) {
+      initializer->body_(instance, values);
+    }
+    return instance;
+  }
+  throw RuntimeError(line, "Can only call functions and classes.");
+}
+
+inline auto Get(const Value &object, const std::string &name, int line) -> Value {
+  const auto *instance = std::get_if<InstancePtr>(&object);
+  if (instance == nullptr) {
+    throw RuntimeError(line, "Only instances have properties.");
+  }
+  if (auto iter {(*instance)->fields_.find(name)}; iter != (*instance)->fields_.end()) {
+    return iter->second;
+  }
+  if (auto method {(*instance)->class_->FindMethod(name)}) {
+    return Bind(method, object);
+  }
+  throw RuntimeError(line, "Undefined property " + name + " .");
+}
+
+inline auto Set(const Operands &operands, const std::string &name, int line) -> Value {
+  const auto *instance = std::get_if<InstancePtr>(&operands.left_);
+  if (instance == nullptr) {
+    throw RuntimeError(line, "Only instances have fileds.");
+  }
+  (*instance)->fields_[name] = operands.right_;
+  return operands.right_;
+}
+
+inline auto GetSuper(const Value &super_class, const Value &self, const std::string &name, int line) -> Value {
+  auto method {std::get<ClassPtr>(super_class)->FindMethod(name)};
+  if (method == nullptr) {
+    throw RuntimeError(line, "Undefined property " + name + ".");
+  }
+  return Bind(method, self);
+}
+
+// 全局变量在定义之前读写是运行时错误
+class Global {
+public:
+  explicit Global(std::string name) : name_(std::move(name)) {}
+  Global(std::string name, Value value) : name_(std::move(name)), value_(std::move(value)), defined_(true) {}
+  void Define(Value value) {
+    value_ = std::move(value);
+    defined_ = true;
+  }
+  void Check(int line) const {
+    if (!defined_) {
+      throw RuntimeError(line, "Undefined variable" + name_ + ".");
+    }
+  }
+  auto Get(int line) const -> const Value & {
+    Check(line);
+    return value_;
+  }
+  auto Assign(Value value, int line) -> Value {
+    if (!defined_) {
+      throw RuntimeError(line, "Undefined variable " + name_ + ".");
+    }
+    value_ = std::move(value);
+    return value_;
+  }
+
+private:
+  std::string name_;
+  Value value_;
+  bool defined_{false};
+};
+
+inline auto Clock() -> Value {
+  return MakeFunction("clock", 0, [](const Value &, std::vector<Value> &) -> Value {
+    auto now {std::chrono::system_clock::now().time_since_epoch()};
+    return std::chrono::duration<double>(now).count() / 1000.0;
+  });
+}
+
+// 运行时错误的输出格式和退出码与解释器相同
+inline auto Run(void (*script)()) -> int {
+  try {
+    script();
+  } catch (const RuntimeError &error) {
+    std::cerr << error.what() << "\n[line " << error.GetLine() << "]\n";
+    return 70;
+  }
+  return 0;
+}
+
+}  // namespace cpplox::runtime
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <dlfcn.h>
+#include <algorithm>
+#include <any>
+#include <array>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "environment.h"
+#include "interpreter.h"
+#include "lox_callable.h"
+#include "lox_extension.h"
+#include "runtime_error.h"
+
+namespace cpplox {
+
+// 扩展注册的函数。参数按声明的类型检查后放进栈上的 LoxValue 数组，字符串参数直接指向解释器里的 std::string
+class ExtensionFunction : public LoxCallable {
+public:
+  ExtensionFunction(std::string name, LoxExtensionFn fn, std::span<const LoxType> params, LoxType result,
+                    void *userdata)
+      : name_(std::move(name)), fn_(fn), arity_(static_cast<int>(params.size())), result_(result),
+        userdata_(userdata) {
+    std::copy(params.begin(), params.end(), params_.begin());
+  }
+
+  auto Arity() -> int override { return arity_; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    std::array<LoxValue, LOX_EXTENSION_MAX_ARITY> args;
+    for (int i = 0; i < arity_; ++i) {
+      args[i] = ToValue(arguments[i], params_[i], i);
+    }
+    auto result{fn_(args.data(), arity_, userdata_)};
+    if (result.type == LOX_TYPE_ERROR) {
+      throw NativeError(std::string(result.as.string.chars, result.as.string.length));
+    }
+    // 返回的值必须是具体类型，ANY 和越界的值都算错
+    if (!Declarable(result.type) || result.type == LOX_TYPE_ANY ||
+        (result.type != result_ && result_ != LOX_TYPE_ANY)) {
+      throw NativeError("Extension function " + name_ + " returned the wrong type.");
+    }
+    return FromValue(result);
+  }
+  auto ToString() -> std::string override { return "<native fn " + name_ + ">"; }
+
+  // 注册时检查参数个数和类型，类型来自 C 代码，可能是任意整数
+  static auto Valid(int arity, const LoxType *params, LoxType result) -> bool {
+    if (arity < 0 || arity > LOX_EXTENSION_MAX_ARITY || (arity > 0 && params == nullptr)) {
+      return false;
+    }
+    for (int i = 0; i < arity; ++i) {
+      if (!Declarable(params[i])) {
+        return false;
+      }
+    }
+    return Declarable(result);
+  }
+
+private:
+  // 参数和返回值能声明的类型：NIL 到 ANY，ERROR 只出现在返回的值里
+  static auto Declarable(LoxType type) -> bool {
+    auto value{static_cast<int>(type)};
+    return value >= LOX_TYPE_NIL && value <= LOX_TYPE_ANY;
+  }
+
+  auto ToValue(const std::any &argument, LoxType type, int index) const -> LoxValue {
+    const auto &id{argument.type()};
+    if (id == typeid(double) && (type == LOX_TYPE_NUMBER || type == LOX_TYPE_ANY)) {
+      return lox_number(std::any_cast<double>(argument));
+    }
+    if (id == typeid(bool) && (type == LOX_TYPE_BOOL || type == LOX_TYPE_ANY)) {
+      return lox_bool(static_cast<int>(std::any_cast<bool>(argument)));
+    }
+    if (id == typeid(std::string) && (type == LOX_TYPE_STRING || type == LOX_TYPE_ANY)) {
+      const auto &str{*std::any_cast<std::string>(&argument)};
+      return lox_string(str.data(), str.size());
+    }
+    if (id == typeid(std::nullptr_t) && (type == LOX_TYPE_NIL || type == LOX_TYPE_ANY)) {
+      return lox_nil();
+    }
+    throw NativeError("Argument " + std::to_string(index + 1) + " to " + name_ + " must be " + TypeName(type) + ".");
+  }
+
+  static auto FromValue(const LoxValue &value) -> std::any {
+    switch (value.type) {
+      case LOX_TYPE_BOOL:
+        return value.as.boolean != 0;
+      case LOX_TYPE_NUMBER:
+        return value.as.number;
+      case LOX_TYPE_STRING:
+        return std::string(value.as.string.chars, value.as.string.length);
+      default:
+        return nullptr;
+    }
+  }
+
+  static auto TypeName(LoxType type) -> std::string {
+    switch (type) {
+      case LOX_TYPE_NIL:
+        return "nil";
+      case LOX_TYPE_BOOL:
+        return "a boolean";
+      case LOX_TYPE_NUMBER:
+        return "a number";
+      case LOX_TYPE_STRING:
+        return "a string";
+      default:
+        return "nil, a boolean, a number or a string";
+    }
+  }
+
+  std::string name_;
+  LoxExtensionFn fn_;
+  int arity_;
+  std::array<LoxType, LOX_EXTENSION_MAX_ARITY> params_{};
+  LoxType result_;
+  void *userdata_;
+};
+
+// load_extension(path): dlopen 共享库并调用 lox_extension_init，返回注册的函数个数。
+// 注册的函数先记下来，init 成功后才定义成全局变量；失败时什么也不定义并卸载库，之后可以重试。
+// 同一个路径只加载一次，库在解释器退出前不会卸载，已经注册的函数一直有效
+class NativeLoadExtension : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    if (arguments[0].type() != typeid(std::string)) {
+      throw NativeError("Argument to load_extension must be a string.");
+    }
+    const auto &path{*std::any_cast<std::string>(&arguments[0])};
+    if (auto it = loaded_.find(path); it != loaded_.end()) {
+      return static_cast<double>(it->second);
+    }
+    void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+      throw NativeError("Cannot load extension: " + std::string(dlerror()));
+    }
+    auto init{reinterpret_cast<LoxExtensionInit>(dlsym(handle, LOX_EXTENSION_INIT_SYMBOL))};
+    if (init == nullptr) {
+      dlclose(handle);
+      throw NativeError("Extension " + path + " does not export " LOX_EXTENSION_INIT_SYMBOL ".");
+    }
+    Registration registration;
+    LoxRegistrar registrar{LOX_EXTENSION_ABI_VERSION, &registration, &DefineFunction};
+    auto status {init(&registrar)};
+    if (registration.abi_version_ != LOX_EXTENSION_ABI_VERSION) {
+      dlclose(handle);
+      throw NativeError("Extension " + path + " was built for ABI version " +
+                        std::to_string(registration.abi_version_) + ", expected " +
+                        std::to_string(LOX_EXTENSION_ABI_VERSION) + ".");
+    }
+    if (status != 0) {
+      dlclose(handle);
+      throw NativeError("Extension " + path + " failed to initialize.");
+    }
+    auto &globals {*interpreter.GetGlobalEnvironment()};
+    for (auto &[name, function] : registration.functions_) {
+      globals.Define(name, std::move(function));
+    }
+    auto count {static_cast<int>(registration.functions_.size())};
+    loaded_.emplace(path, count);
+    return static_cast<double>(count);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+
+private:
+  struct Registration {
+    std::vector<std::pair<std::string, std::shared_ptr<LoxCallable>>> functions_;
+    // 第一次版本不对的调用带来的版本
+    int abi_version_{LOX_EXTENSION_ABI_VERSION};
+  };
+
+  static auto DefineFunction(void *context, int abi_version, const char *name, LoxExtensionFn fn, int arity,
+                             const LoxType *params, LoxType result, void *userdata) -> int {
+    auto *registration{static_cast<Registration *>(context)};
+    // 版本不对时其它参数的布局也不可信，不再看它们
+    if (abi_version != LOX_EXTENSION_ABI_VERSION) {
+      if (registration->abi_version_ == LOX_EXTENSION_ABI_VERSION) {
+        registration->abi_version_ = abi_version;
+      }
+      return -1;
+    }
+    if (name == nullptr || fn == nullptr || !ExtensionFunction::Valid(arity, params, result)) {
+      return -1;
+    }
+    auto function{std::make_shared<ExtensionFunction>(name, fn, std::span<const LoxType>(params, arity), result,
+                                                      userdata)};
+    registration->functions_.emplace_back(name, std::move(function));
+    return 0;
+  }
+
+  std::unordered_map<std::string, int> loaded_;
+};
+
+}  // namespace cpplox
@@ -1,18 +1,376 @@
 #pragma once
 
+#include <any>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include "allocation_profiler.h"
+#include "event_loop.h"
 #include "interpreter.h"
+#include "isolate.h"
+#include "json.h"
 #include "lox_callable.h"
+#include "lox_coroutine.h"
+#include "runtime_error.h"
+#include "telemetry.h"
 
 namespace cpplox {
 
 class NativeClock : public LoxCallable {
 public:
   auto Arity() -> int override { return 0;}
-  auto Call(Interpreter &interpreter, std::vector<std::any> &arguments) -> std::any override {
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
     auto ticks = std::chrono::system_clock::now().time_since_epoch();
     return std::chrono::duration<double>{ticks}.count() / 1000.0;
   }
   auto ToString() -> std::string override { return "<native fn>";}
 };
 
-} // namespace cpplox
\ No newline at end of file
+inline auto AsCoroutine(const std::any &value) -> std::shared_ptr<LoxCoroutine> {
+  if (value.type() != typeid(std::shared_ptr<LoxCoroutine>)) {
+    throw NativeError("Argument must be a coroutine.");
+  }
+  return std::any_cast<std::shared_ptr<LoxCoroutine>>(value);
+}
+
+// coroutine(fn): 创建一个挂起的协程，第一次 resume 时调用 fn
+class NativeCoroutine : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    if (arguments[0].type() != typeid(std::shared_ptr<LoxCallable>)) {
+      throw NativeError("Argument to coroutine must be a function.");
+    }
+    auto function{std::any_cast<std::shared_ptr<LoxCallable>>(arguments[0])};
+    if (function->Arity() > 1) {
+      throw NativeError("Coroutine function takes at most 1 argument.");
+    }
+    return std::make_shared<LoxCoroutine>(function);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// resume(co, value): 运行协程直到下一次 yield，返回 yield 的值
+class NativeResume : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return AsCoroutine(arguments[0])->Resume(interpreter, arguments[1]);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+  // 时间花在协程里的 Lox 代码上
+  auto IsNative() -> bool override { return false; }
+};
+
+// yield(value): 挂起当前协程，返回下一次 resume 传入的值
+class NativeYield : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return LoxCoroutine::Yield(arguments[0]);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// status(co): "suspended", "running", "normal" 或 "dead"
+class NativeCoroutineStatus : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return AsCoroutine(arguments[0])->StatusName();
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+inline auto AsCallable(const std::any &value) -> std::shared_ptr<LoxCallable> {
+  if (value.type() != typeid(std::shared_ptr<LoxCallable>)) {
+    throw NativeError("Callback must be a function.");
+  }
+  return std::any_cast<std::shared_ptr<LoxCallable>>(value);
+}
+
+inline auto AsNumber(const std::any &value) -> double {
+  if (value.type() != typeid(double)) {
+    throw NativeError("Argument must be a number.");
+  }
+  return std::any_cast<double>(value);
+}
+
+inline auto AsString(const std::any &value) -> std::string {
+  if (value.type() != typeid(std::string)) {
+    throw NativeError("Argument must be a string.");
+  }
+  return std::any_cast<std::string>(value);
+}
+
+// 下面的异步 native 都把结果交给事件循环，回调的参数是 (error, value)，成功时 error 为 nil
+
+// setTimeout(callback, ms): 返回定时器 id
+class NativeSetTimeout : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    auto callback{AsCallable(arguments[0])};
+    return static_cast<double>(interpreter.GetEventLoop().SetTimer(AsNumber(arguments[1]), callback));
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// clearTimeout(id)
+class NativeClearTimeout : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().ClearTimer(static_cast<int>(AsNumber(arguments[0])));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// readFile(path, callback(error, data))
+class NativeReadFile : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().ReadFile(AsString(arguments[0]), AsCallable(arguments[1]));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// writeFile(path, data, callback(error, bytes))
+class NativeWriteFile : public LoxCallable {
+public:
+  auto Arity() -> int override { return 3; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().WriteFile(AsString(arguments[0]), AsString(arguments[1]), AsCallable(arguments[2]));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// pipe(callback(read_fd, write_fd)): 立即用新建的非阻塞管道调用 callback
+class NativePipe : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    auto callback{AsCallable(arguments[0])};
+    auto [read_fd, write_fd] = interpreter.GetEventLoop().Pipe();
+    std::vector<std::any> fds{static_cast<double>(read_fd), static_cast<double>(write_fd)};
+    fds.resize(callback->Arity(), std::any{nullptr});
+    return callback->Call(interpreter, fds);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// read(fd, callback(error, data)): 读到 EOF
+class NativeRead : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().Read(static_cast<int>(AsNumber(arguments[0])), AsCallable(arguments[1]));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// write(fd, data, callback(error, bytes))
+class NativeWrite : public LoxCallable {
+public:
+  auto Arity() -> int override { return 3; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().Write(static_cast<int>(AsNumber(arguments[0])), AsString(arguments[1]),
+                                     AsCallable(arguments[2]));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// listen(port, callback(error, fd)): 在 127.0.0.1 上监听，返回监听 fd
+class NativeListen : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    auto port{static_cast<int>(AsNumber(arguments[0]))};
+    return static_cast<double>(interpreter.GetEventLoop().Listen(port, AsCallable(arguments[1])));
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// connect(port, callback(error, fd)): 连接 127.0.0.1
+class NativeConnect : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().Connect(static_cast<int>(AsNumber(arguments[0])), AsCallable(arguments[1]));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// close(fd): 取消该 fd 上未完成的 I/O 并关闭
+class NativeClose : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    interpreter.GetEventLoop().Close(static_cast<int>(AsNumber(arguments[0])));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// heap_dump(path): 把存活对象按分配点汇总写到 path，需要 --alloc-profile。两份 dump 用 --heap-diff 比较
+class NativeHeapDump : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    if (allocation_profiler == nullptr) {
+      throw NativeError("heap_dump needs --alloc-profile.");
+    }
+    std::ofstream out{AsString(arguments[0])};
+    if (!(out << allocation_profiler->Dump())) {
+      throw NativeError("Cannot write heap dump " + AsString(arguments[0]) + ".");
+    }
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+inline auto AsChannel(const std::any &value) -> std::shared_ptr<LoxChannel> {
+  if (value.type() != typeid(std::shared_ptr<LoxChannel>)) {
+    throw NativeError("Argument must be a channel.");
+  }
+  return std::any_cast<std::shared_ptr<LoxChannel>>(value);
+}
+
+// spawn(fn, arg): 在新的 isolate 里调用全局函数 fn(arg)，arg 按 Message 的规则复制过去。
+// 返回一个通道，fn 返回时在上面收到它的返回值，出错时收到 nil
+class NativeSpawn : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    if (arguments[0].type() != typeid(std::shared_ptr<LoxCallable>)) {
+      throw NativeError("Argument to spawn must be a function.");
+    }
+    const auto &function {std::any_cast<const std::shared_ptr<LoxCallable> &>(arguments[0])};
+    if (function->Arity() > 1) {
+      throw NativeError("Isolate function takes at most 1 argument.");
+    }
+    auto &globals {*interpreter.GetGlobalEnvironment()};
+    auto name {Message::GlobalName(globals, *function)};
+    if (name.empty()) {
+      throw NativeError("Only global functions can be spawned.");
+    }
+    auto result {std::make_shared<LoxChannel>()};
+    interpreter.Spawn(name, Message::From(globals, std::move(arguments[1])), result);
+    return result;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// channel(): 新建一个通道
+class NativeChannel : public LoxCallable {
+public:
+  auto Arity() -> int override { return 0; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return std::make_shared<LoxChannel>();
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// send(channel, value): 把 value 的副本放进通道，不等待接收
+class NativeSend : public LoxCallable {
+public:
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    auto channel {AsChannel(arguments[0])};
+    channel->Send(Message::From(*interpreter.GetGlobalEnvironment(), std::move(arguments[1])));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+// receive(channel): 取出通道里最早的值，通道为空时阻塞当前线程等待。
+// 在主 isolate 上等待时事件循环和协程都停下来，定时器和 I/O 回调要等收到消息之后才会运行
+class NativeReceive : public LoxCallable {
+public:
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return AsChannel(arguments[0])->Receive().Take(interpreter);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+};
+
+inline auto AsInstance(const std::any &value) -> std::shared_ptr<LoxInstance> {
+  if (value.type() != typeid(std::shared_ptr<LoxInstance>)) {
+    throw NativeError("Argument must be an instance.");
+  }
+  return std::any_cast<std::shared_ptr<LoxInstance>>(value);
+}
+
+// json_parse(text): 把 JSON 文本转换成 Lox 的值，对象和数组的表示见 Json
+class NativeJsonParse : public LoxCallable {
+public:
+  explicit NativeJsonParse(std::shared_ptr<const Json> json) : json_(std::move(json)) {}
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    // 输入可能很大，不复制
+    if (arguments[0].type() != typeid(std::string)) {
+      throw NativeError("Argument must be a string.");
+    }
+    return json_->Parse(std::any_cast<const std::string &>(arguments[0]));
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+
+private:
+  std::shared_ptr<const Json> json_;
+};
+
+// json_stringify(value): 返回紧凑格式的 JSON 文本
+class NativeJsonStringify : public LoxCallable {
+public:
+  explicit NativeJsonStringify(std::shared_ptr<const Json> json) : json_(std::move(json)) {}
+  auto Arity() -> int override { return 1; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return json_->Stringify(arguments[0]);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+
+private:
+  std::shared_ptr<const Json> json_;
+};
+
+// json_get(value, key): 按字符串键或者数组下标取字段，没有时返回 nil
+class NativeJsonGet : public LoxCallable {
+public:
+  explicit NativeJsonGet(std::shared_ptr<const Json> json) : json_(std::move(json)) {}
+  auto Arity() -> int override { return 2; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    return json_->Get(*AsInstance(arguments[0]), arguments[1]);
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+
+private:
+  std::shared_ptr<const Json> json_;
+};
+
+// json_set(value, key, field): 按字符串键或者数组下标设置字段
+class NativeJsonSet : public LoxCallable {
+public:
+  explicit NativeJsonSet(std::shared_ptr<const Json> json) : json_(std::move(json)) {}
+  auto Arity() -> int override { return 3; }
+  auto Call(Interpreter &interpreter, std::span<std::any> arguments) -> std::any override {
+    json_->Set(*AsInstance(arguments[0]), arguments[1], std::move(arguments[2]));
+    return nullptr;
+  }
+  auto ToString() -> std::string override { return "<native fn>"; }
+
+private:
+  std::shared_ptr<const Json> json_;
+};
+
+} // namespace cpplox
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <error.h>
-#include <initializer_list>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -14,32 +18,56 @@ namespace cpplox {
 
 class Parser {
  public:
-  explicit Parser(const std::vector<Token> &token) : tokens_(token) {}
+  // 把下一批 token 追加到队尾，没有更多 token 时返回 false。最后一批以 TOKEN_EOF 结尾
+  using TokenSource = std::function<bool(std::deque<Token> &tokens)>;
+
+  explicit Parser(const std::vector<Token> &token) : tokens_(token.begin(), token.end()) {}
+  explicit Parser(TokenSource source) : source_(std::move(source)) { Fill(); }
 
   // auto Parse() -> std::shared_ptr<ExprAST>;
   auto Parse() -> std::vector<std::shared_ptr<Stmt>>;
+  // 每解析完一条顶层语句就交给 emit，并丢掉已经用过的 token
+  void Parse(const std::function<void(std::shared_ptr<Stmt>)> &emit);
+  // 预解析：顶层函数只找到函数体的范围，token 保存在 LazyBody 里，第一次调用时再解析
+  void EnableLazyBodies() { lazy_bodies_ = true; }
 
  private:
-  auto Expression() -> std::shared_ptr<ExprAST> { return Assignment(); }
-  auto Equality() -> std::shared_ptr<ExprAST>;
-  auto Term() -> std::shared_ptr<ExprAST>;
-  auto Comparsion() -> std::shared_ptr<ExprAST>;
-  auto Factor() -> std::shared_ptr<ExprAST>;
-  auto Unary() -> std::shared_ptr<ExprAST>;
-  auto Primary() -> std::shared_ptr<ExprAST>;
-  auto Assignment() -> std::shared_ptr<ExprAST>;
-  auto Call() -> std::shared_ptr<ExprAST>;
-  auto FinishCall(const std::shared_ptr<ExprAST> &callee) -> std::shared_ptr<ExprAST>;
+  // Pratt parser 的优先级，由低到高
+  enum class Precedence : uint8_t { NONE, ASSIGNMENT, OR, AND, EQUALITY, COMPARISON, TERM, FACTOR, UNARY, CALL, PRIMARY };
+  using PrefixFn = auto (Parser::*)(bool can_assign) -> std::shared_ptr<ExprAST>;
+  using InfixFn = auto (Parser::*)(const std::shared_ptr<ExprAST> &left, bool can_assign) -> std::shared_ptr<ExprAST>;
+  // 一个 TokenType 出现在表达式开头 (prefix_) 或两个操作数之间 (infix_) 时的处理函数
+  struct ParseRule {
+    PrefixFn prefix_{nullptr};
+    InfixFn infix_{nullptr};
+    Precedence precedence_{Precedence::NONE};
+  };
+  static constexpr size_t kTokenTypeCount = static_cast<size_t>(TokenType::TOKEN_EOF) + 1;
+  static auto BuildRules() -> std::array<ParseRule, kTokenTypeCount>;
+  static auto GetRule(TokenType type) -> const ParseRule &;
+
+  auto Expression() -> std::shared_ptr<ExprAST> { return ParsePrecedence(Precedence::ASSIGNMENT); }
+  auto ParsePrecedence(Precedence precedence) -> std::shared_ptr<ExprAST>;
+  auto Grouping(bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Literal(bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Variable(bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto This(bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Super(bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Unary(bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Binary(const std::shared_ptr<ExprAST> &left, bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Logical(const std::shared_ptr<ExprAST> &left, bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Call(const std::shared_ptr<ExprAST> &callee, bool can_assign) -> std::shared_ptr<ExprAST>;
+  auto Dot(const std::shared_ptr<ExprAST> &object, bool can_assign) -> std::shared_ptr<ExprAST>;
 
-  auto Consume(const TokenType &type, const std::string &message) -> Token;
+  auto Consume(TokenType type, const std::string &message) -> const Token &;
 
-  // auto Match(const TokenType &lhs, const TokenType &rhs) -> bool;
-  auto Match(const std::initializer_list<TokenType> &types) -> bool;
-  auto Previous() -> Token;
-  auto IsAtEnd() -> bool;
-  auto Peek() -> Token;
-  auto Advance() -> Token;
-  auto Check(const TokenType &type) -> bool;
+  auto Match(TokenType type) -> bool;
+  auto Previous() const -> const Token &;
+  auto IsAtEnd() const -> bool;
+  auto Peek() const -> const Token &;
+  auto Advance() -> const Token &;
+  auto Check(TokenType type) const -> bool;
+  void Fill();
 
   void Synchronize();
 
@@ -55,20 +83,29 @@ class Parser {
   auto IfStatement() -> std::shared_ptr<Stmt>;  // 处理if语句
   auto PrintStatement() -> std::shared_ptr<Stmt>;
   auto WhileStatement() -> std::shared_ptr<Stmt>;
-  auto And() -> std::shared_ptr<ExprAST>;
-  auto Or() -> std::shared_ptr<ExprAST>;
   auto ForStatement() -> std::shared_ptr<Stmt>;
   auto VarDeclaration() -> std::shared_ptr<Stmt>;
+  // import "path"; 或 import "path" as name;
+  auto ImportDeclaration() -> std::shared_ptr<Stmt>;
   auto ExpressionStatement() -> std::shared_ptr<Stmt>;
   auto Declaration() -> std::shared_ptr<Stmt>;
   auto Block() -> std::vector<std::shared_ptr<Stmt>>;
   auto Function(const std::string &kind) -> std::shared_ptr<Stmt>;
+  // 跳过 '{' 之后到匹配的 '}' 的 token，只检查括号是否配对
+  auto SkipBody() -> std::shared_ptr<LazyBody>;
+  // ": num" / ": bool" / ": str"，没有冒号时返回 UNKNOWN
+  auto TypeAnnotation() -> StaticType;
   auto ReturnStatement() -> std::shared_ptr<Stmt>;
   auto ClassDeclaration() -> std::shared_ptr<Stmt>;
 
  private:
-  std::vector<Token> tokens_;
-  int current_{0};
+  // 用 deque 保存 token：追加新的一批不会让已经返回的 Token 引用失效
+  std::deque<Token> tokens_;
+  TokenSource source_;
+  size_t current_{0};
+  bool lazy_bodies_{false};
+  // 正在解析的块的嵌套层数，函数体也算一层
+  int block_depth_{0};
 };
 
 }  // namespace cpplox
\ No newline at end of file
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <filesystem>
 #include <memory>
+#include <optional>
 #include <stack>
 #include <string>
 #include <unordered_map>
@@ -9,6 +11,7 @@
 
 #include "ast.h"
 #include "interpreter.h"
+#include "lox_module.h"
 #include "stmt.h"
 #include "token.h"
 namespace cpplox {
@@ -28,7 +31,11 @@ enum class ClassType {
 
 class Resolver : public ExprASTVisitor, StmtVisitor {
 public:
-  explicit Resolver(const std::shared_ptr<Interpreter> &interpreter) : interpreter_(interpreter) {}
+  // directory 是 import 的相对路径的起点；module 不为空时 resolve 的是这个模块的顶层语句，
+  // 它的顶层声明放在带模块前缀的全局槽位上
+  explicit Resolver(const std::shared_ptr<Interpreter> &interpreter, std::filesystem::path directory = {},
+                    LoxModule *module = nullptr)
+      : interpreter_(interpreter), directory_(std::move(directory)), module_(module) {}
 
   void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override;
   void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override;
@@ -39,6 +46,7 @@ public:
   void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
   void VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) override;
   void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+  void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) override;
 
   auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override;
   auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override;
@@ -54,19 +62,52 @@ public:
   auto VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any override;
 
   void Resolve(const std::vector<std::shared_ptr<Stmt>> &statements);
+  // 预解析的顶层函数解析出函数体之后调用，resolve 的结果覆盖声明时留下的空 FunctionInfo
+  void ResolveLazyFunction(const std::shared_ptr<FunctionStmt> &function) {
+    ResolveFunction(function, FunctionType::FUNCTION);
+  }
 private:
   void BeginScope();
   void EndScope();
   
   void Resolve(const std::shared_ptr<Stmt> &statements);
   void Resolve(const std::shared_ptr<ExprAST> &expr);
-  void Declare(const Token &name);
+  void Declare(const Token &name, const std::shared_ptr<Stmt> &declaration);
   void Define(const Token &name);
-  void ResolveLocal(const std::shared_ptr<ExprAST> &expr, const Token &name);
+  void AddLocal(const std::string &name, const std::shared_ptr<Stmt> &declaration, bool is_super = false);
+  void PopLocals(int depth);
+  auto IsGlobalScope() const -> bool { return functions_.size() == 1 && functions_.back().scope_depth_ == 0; }
+  auto ResolveLocal(const Token &name) -> VariableRef;
+  // 模块顶层声明的名字加上模块前缀，其他全局变量 (内置函数和脚本的全局变量) 不变
+  auto GlobalName(const std::string &name) const -> std::string {
+    return module_ != nullptr && module_->FindExport(name) != nullptr ? module_->GlobalName(name) : name;
+  }
+  void ExportDeclarations(const std::vector<std::shared_ptr<Stmt>> &statements);
+  auto ResolveName(size_t function_index, const std::string &name) -> std::optional<VariableRef>;
+  auto AddUpvalue(size_t function_index, UpvalueRef upvalue) -> int;
   void ResolveFunction(const std::shared_ptr<FunctionStmt> &function, const FunctionType &function_type);
 private:
+  // 函数内所有块作用域的局部变量平铺在同一个 frame 里，槽位号就是它在 locals_ 中的下标
+  struct Local {
+    std::string name_;
+    int depth_;
+    bool defined_{false};
+    bool captured_{false};
+    std::shared_ptr<Stmt> declaration_;  // 参数和 this 为空
+    bool is_super_{false};
+  };
+  struct FunctionScope {
+    std::vector<Local> locals_;
+    std::vector<UpvalueRef> upvalues_;
+    int scope_depth_{0};
+    int slot_count_{0};
+  };
+
   std::shared_ptr<Interpreter> interpreter_;
-  std::vector<std::unordered_map<std::string, bool>> scopes_;
+  std::filesystem::path directory_;
+  LoxModule *module_;
+  // functions_[0] 是顶层脚本，深度为 0 的声明是全局变量
+  std::vector<FunctionScope> functions_{FunctionScope{}};
   FunctionType current_function_ {FunctionType::NONE};
   ClassType current_class_ {ClassType::NONE};
 };
@@ -17,12 +17,10 @@ private:
   Token token_;
 };
 
-class Return {
+// native 函数拿不到调用处的 token，由 VisitCallExprAST 转换成带行号的 RuntimeError
+class NativeError : public std::runtime_error {
 public:
-  explicit Return(std::any value) : value_(std::move(value)) {}
-  auto GetReturnValue() const -> std::any { return value_; }
-private:
-  std::any value_;
+  using std::runtime_error::runtime_error;
 };
 
 } // namespace cpplox
\ No newline at end of file
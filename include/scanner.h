@@ -1,4 +1,7 @@
 #pragma once
+#include <any>
+#include <cstddef>
+#include <functional>
 #include <string>
 #include <utility>
 #include <list>
@@ -12,20 +15,21 @@ class Scanner {
 public:
   explicit Scanner(std::string source) : source_(std::move(source)) {}
   auto ScanTokens() -> std::vector<Token>;
+  // 每扫描出 batch 个 token 就交给 flush，最后一批以 TOKEN_EOF 结尾
+  void ScanTokens(size_t batch, const std::function<void(std::vector<Token> &&)> &flush);
 
 private:
   auto IsAtEnd() -> bool;
   auto ScanToken() -> void;
   auto Advance() -> char;
   auto AddToken(TokenType token_type) -> void;
-  auto AddToken(TokenType token_type, const std::string &val) -> void;
+  auto AddToken(TokenType token_type, const std::any &literal) -> void;
   auto Match(char expected) -> bool;
   auto Peek() -> char;
   auto String() -> void;
   auto Number() -> void;
   auto PeekNext() -> char;
   auto Identifier() -> void;
-  auto IsAlphaNumeric(char ch) -> bool;
 
 private:
   std::string source_;
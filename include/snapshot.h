@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+namespace cpplox {
+
+class Interpreter;
+
+// 快照文件损坏、版本不匹配或者全局变量里有无法序列化的值 (native 函数、协程等)
+class SnapshotError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// 预先运行 prelude 脚本，把它留下的全局变量 (常量、函数、类、实例以及闭包捕获的 Upvalue)
+// 连同函数体的 AST 和 Resolver 的结果一起写进快照文件；加载时不需要再扫描、解析和执行 prelude
+class Snapshot {
+public:
+  static void Save(Interpreter &interpreter, const std::string &path);
+  static void Load(Interpreter &interpreter, const std::string &path);
+};
+
+}  // namespace cpplox
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace cpplox {
+
+// 单生产者单消费者的有界环形队列。head_ 只由消费者写，tail_ 只由生产者写，不需要锁；
+// 队列满或空时用 std::atomic::wait 睡眠，而不是空转
+template <typename T, size_t Capacity>
+class SpscQueue {
+public:
+  // 队列满时阻塞，直到消费者取走一个元素
+  void Push(T value) {
+    auto tail {tail_.load(std::memory_order_relaxed)};
+    auto head {head_.load(std::memory_order_acquire)};
+    while (tail - head == Capacity) {
+      head_.wait(head, std::memory_order_acquire);
+      head = head_.load(std::memory_order_acquire);
+    }
+    slots_[tail % Capacity] = std::move(value);
+    tail_.store(tail + 1, std::memory_order_release);
+    tail_.notify_one();
+  }
+
+  // 队列空时阻塞，直到生产者放入一个元素
+  auto Pop() -> T {
+    auto head {head_.load(std::memory_order_relaxed)};
+    auto tail {tail_.load(std::memory_order_acquire)};
+    while (tail == head) {
+      tail_.wait(tail, std::memory_order_acquire);
+      tail = tail_.load(std::memory_order_acquire);
+    }
+    T value {std::move(slots_[head % Capacity])};
+    head_.store(head + 1, std::memory_order_release);
+    head_.notify_one();
+    return value;
+  }
+
+private:
+  std::array<T, Capacity> slots_;
+  // 生产者和消费者各自写的计数放在不同的缓存行里
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+}  // namespace cpplox
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <any>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 #include "ast.h"
@@ -17,6 +19,7 @@ class BlockStmt;
 class FunctionStmt;
 class ReturnStmt;
 class ClassStmt;
+class ImportStmt;
 
 class StmtVisitor {
  public:
@@ -29,6 +32,7 @@ class StmtVisitor {
   virtual void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) = 0;
   virtual void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) = 0;
   virtual void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) = 0;
+  virtual void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) = 0;
 };
 
 class Stmt {
@@ -66,13 +70,15 @@ class PrintStmt : public Stmt, std::enable_shared_from_this<PrintStmt> {
 
 class WhileStmt : public Stmt, std::enable_shared_from_this<WhileStmt> {
  public:
-  WhileStmt(std::shared_ptr<ExprAST> cond_expression, std::shared_ptr<Stmt> body)
-      : cond_expression_(std::move(cond_expression)), body_(std::move(body)) {}
+  WhileStmt(const Token &keyword, std::shared_ptr<ExprAST> cond_expression, std::shared_ptr<Stmt> body)
+      : keyword_(keyword), cond_expression_(std::move(cond_expression)), body_(std::move(body)) {}
+  auto GetKeyWord() const -> const Token & { return keyword_; }
   auto GetConditionExpr() const -> std::shared_ptr<ExprAST> { return cond_expression_; }
   auto GetWhileBody() const -> std::shared_ptr<Stmt> { return body_; }
   void Accept(StmtVisitor &visitor) override { visitor.VisitWhileStmt(shared_from_this()); }
 
  private:
+  Token keyword_;
   std::shared_ptr<ExprAST> cond_expression_;
   std::shared_ptr<Stmt> body_;
 };
@@ -80,7 +86,7 @@ class WhileStmt : public Stmt, std::enable_shared_from_this<WhileStmt> {
 class BlockStmt : public Stmt, std::enable_shared_from_this<BlockStmt> {
  public:
   explicit BlockStmt(std::vector<std::shared_ptr<Stmt>> stmts) : stmts_(std::move(stmts)) {}
-  auto GetBlockStatements() const -> std::vector<std::shared_ptr<Stmt>> { return stmts_; }
+  auto GetBlockStatements() const -> const std::vector<std::shared_ptr<Stmt>> & { return stmts_; }
   void Accept(StmtVisitor &visitor) override { visitor.VisitBlockStmt(shared_from_this()); }
 
  private:
@@ -99,29 +105,63 @@ class ExpressionStmt : public Stmt, std::enable_shared_from_this<ExpressionStmt>
 
 class VarStmt : public Stmt, std::enable_shared_from_this<VarStmt> {
  public:
-  VarStmt(const Token &name, std::shared_ptr<ExprAST> expr) : name_(name), expr_(std::move(expr)) {}
+  VarStmt(const Token &name, std::shared_ptr<ExprAST> expr, StaticType type = StaticType::UNKNOWN)
+      : name_(name), expr_(std::move(expr)), type_(type) {}
   auto GetExpr() const -> std::shared_ptr<ExprAST> { return expr_; }
   auto GetName() const -> Token { return name_; }
+  // var x: num 的注解，没有注解时为 UNKNOWN
+  auto GetType() const -> StaticType { return type_; }
+  // TypeChecker 证明了初始值符合注解时不再在运行时检查
+  auto IsChecked() const -> bool { return checked_; }
+  void SetChecked() { checked_ = true; }
   void Accept(StmtVisitor &visitor) override { visitor.VisitVarStmt(shared_from_this()); }
 
  private:
   Token name_;
   std::shared_ptr<ExprAST> expr_;
+  StaticType type_;
+  bool checked_{false};
+};
+
+class LoxModule;
+
+// 预解析的顶层函数只保存函数体的 token (以 TOKEN_EOF 结尾)，第一次调用时才解析和 resolve。
+// module_ 和 directory_ 是 Resolver 遇到这个声明时的环境，之后 resolve 函数体时照样使用
+struct LazyBody {
+  std::vector<Token> tokens_;
+  LoxModule *module_{nullptr};
+  std::string directory_;
+  // 函数体有错误并且已经报告过，之后的调用直接失败，不再解析和 resolve
+  bool failed_{false};
 };
 
 class FunctionStmt : public Stmt, std::enable_shared_from_this<FunctionStmt> {
  public:
-  FunctionStmt(const Token &name, const std::vector<Token> &params, const std::vector<std::shared_ptr<Stmt>> &body)
-      : name_(name), params_(params), body_(body) {}
-  auto GetFunctionParams() const -> std::vector<Token> { return params_; }
-  auto GetFunctionBody() const -> std::vector<std::shared_ptr<Stmt>> { return body_; }
-  auto GetFunctionName() const -> Token { return name_; }
+  FunctionStmt(const Token &name, const std::vector<Token> &params, const std::vector<std::shared_ptr<Stmt>> &body,
+               std::vector<StaticType> param_types = {}, StaticType return_type = StaticType::UNKNOWN)
+      : name_(name), params_(params), body_(body), param_types_(std::move(param_types)), return_type_(return_type) {}
+  auto GetFunctionParams() const -> const std::vector<Token> & { return params_; }
+  auto GetFunctionBody() const -> const std::vector<std::shared_ptr<Stmt>> & { return body_; }
+  auto GetFunctionName() const -> const Token & { return name_; }
+  // 参数的类型注解，没有任何参数带注解时为空
+  auto GetParamTypes() const -> const std::vector<StaticType> & { return param_types_; }
+  auto GetReturnType() const -> StaticType { return return_type_; }
+  // 函数体还没有解析时不为空，此时 GetFunctionBody 是空的
+  auto GetLazyBody() const -> const std::shared_ptr<LazyBody> & { return lazy_body_; }
+  void SetLazyBody(std::shared_ptr<LazyBody> lazy_body) { lazy_body_ = std::move(lazy_body); }
+  void SetFunctionBody(std::vector<std::shared_ptr<Stmt>> body) {
+    body_ = std::move(body);
+    lazy_body_.reset();
+  }
   void Accept(StmtVisitor &visitor) override { visitor.VisitFunctionStmt(shared_from_this()); }
 
  private:
   Token name_;
   std::vector<Token> params_;
   std::vector<std::shared_ptr<Stmt>> body_;
+  std::vector<StaticType> param_types_;
+  StaticType return_type_;
+  std::shared_ptr<LazyBody> lazy_body_;
 };
 
 class ReturnStmt : public Stmt, std::enable_shared_from_this<ReturnStmt> {
@@ -142,7 +182,7 @@ class ClassStmt : public Stmt, std::enable_shared_from_this<ClassStmt> {
       : name_(name), supper_class_(std::move(supper_class)), methods_(methods) {}
   void Accept(StmtVisitor &visitor) override { visitor.VisitClassStmt(shared_from_this()); }
   auto GetClassName() const -> Token { return name_; }
-  auto GetClassMethods() const -> std::vector<std::shared_ptr<FunctionStmt>> { return methods_; }
+  auto GetClassMethods() const -> const std::vector<std::shared_ptr<FunctionStmt>> & { return methods_; }
   auto GetSupperClass() const -> std::shared_ptr<VarExprAST> { return supper_class_; }
  private:
   Token name_;
@@ -150,4 +190,21 @@ class ClassStmt : public Stmt, std::enable_shared_from_this<ClassStmt> {
   std::vector<std::shared_ptr<FunctionStmt>> methods_;
 };
 
+// import "path" as name; 把模块绑定到 name 上，和 var 一样可以出现在任意作用域。
+// path 相对于 import 所在的文件，Resolver 把它对应到解释器缓存的 LoxModule
+class ImportStmt : public Stmt, std::enable_shared_from_this<ImportStmt> {
+ public:
+  ImportStmt(const Token &keyword, const Token &path, const Token &name)
+      : keyword_(keyword), path_(path), name_(name) {}
+  auto GetKeyWord() const -> const Token & { return keyword_; }
+  auto GetPath() const -> std::string { return std::any_cast<std::string>(path_.GetLiteral()); }
+  auto GetName() const -> const Token & { return name_; }
+  void Accept(StmtVisitor &visitor) override { visitor.VisitImportStmt(shared_from_this()); }
+
+ private:
+  Token keyword_;
+  Token path_;
+  Token name_;
+};
+
 }  // namespace cpplox
\ No newline at end of file
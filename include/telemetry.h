@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace cpplox {
+
+// 只有解释器线程写、导出线程读的计数器。只有一个写者，不需要原子的读-改-写，relaxed 的 load/store 就够了
+class Counter {
+public:
+  void Add(uint64_t n = 1) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+  void Sub(uint64_t n) { value_.store(value_.load(std::memory_order_relaxed) - n, std::memory_order_relaxed); }
+  auto Get() const -> uint64_t { return value_.load(std::memory_order_relaxed); }
+  void Reset() { value_.store(0, std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+// 固定上界的直方图，桶里存的是落在 (上一个上界, 上界] 里的次数，导出时再累加成 Prometheus 的 le 桶
+template <size_t N>
+class Histogram {
+public:
+  explicit constexpr Histogram(const std::array<double, N> &bounds) : bounds_(bounds) {}
+  void Observe(double value) {
+    size_t i = 0;
+    while (i < N && value > bounds_[i]) {
+      ++i;
+    }
+    buckets_[i].Add();
+    sum_.store(sum_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+  auto Count() const -> uint64_t {
+    uint64_t count = 0;
+    for (const auto &bucket : buckets_) {
+      count += bucket.Get();
+    }
+    return count;
+  }
+  auto Sum() const -> double { return sum_.load(std::memory_order_relaxed); }
+  void Merge(const Histogram &other) {
+    for (size_t i = 0; i <= N; ++i) {
+      buckets_[i].Add(other.buckets_[i].Get());
+    }
+    sum_.store(Sum() + other.Sum(), std::memory_order_relaxed);
+  }
+  void Reset() {
+    for (auto &bucket : buckets_) {
+      bucket.Reset();
+    }
+    sum_.store(0, std::memory_order_relaxed);
+  }
+  void Format(std::string &out, const std::string &name, const std::string &help) const {
+    out += "# HELP " + name + " " + help + "\n# TYPE " + name + " histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < N; ++i) {
+      cumulative += buckets_[i].Get();
+      out += name + "_bucket{le=\"" + FormatDouble(bounds_[i]) + "\"} " + std::to_string(cumulative) + "\n";
+    }
+    cumulative += buckets_[N].Get();
+    out += name + "_bucket{le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+    out += name + "_sum " + FormatDouble(Sum()) + "\n";
+    out += name + "_count " + std::to_string(cumulative) + "\n";
+  }
+
+private:
+  // 最短往返表示，std::to_string 只保留 6 位小数，微秒级的时间会变成 0
+  static auto FormatDouble(double value) -> std::string {
+    std::array<char, 32> buffer;
+    auto result {std::to_chars(buffer.data(), buffer.data() + buffer.size(), value)};
+    return {buffer.data(), result.ptr};
+  }
+
+  std::array<double, N> bounds_;
+  std::array<Counter, N + 1> buckets_{};
+  std::atomic<double> sum_{0};
+};
+
+enum class AllocationKind : uint8_t { ENVIRONMENT, INSTANCE, CLOSURE, CLASS, STRING, COROUTINE, UPVALUE };
+inline constexpr size_t kAllocationKinds = 7;
+inline constexpr std::array<const char *, kAllocationKinds> kAllocationKindNames{
+    "environment", "instance", "closure", "class", "string", "coroutine", "upvalue"};
+
+// 解释器的运行时统计，按线程保存。所有成员都能常量初始化，访问 thread_local 不需要初始化检查。
+// 对象由引用计数回收，没有停顿，所以没有 GC 停顿的指标
+class Telemetry {
+public:
+  Counter statements_;
+  Counter calls_;
+  Counter native_calls_;
+  Counter live_heap_bytes_;
+  std::array<Counter, kAllocationKinds> allocations_{};
+  Histogram<8> allocation_bytes_{{16, 64, 256, 1024, 4096, 16384, 65536, 262144}};
+  Histogram<8> native_seconds_{{1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 0.1, 1, 10}};
+
+  void RecordAllocation(AllocationKind kind, size_t bytes) {
+    allocations_[static_cast<size_t>(kind)].Add();
+    allocation_bytes_.Observe(static_cast<double>(bytes));
+  }
+
+  // 存活字节数是各个线程自己的堆，Merge 和 Reset 都不动它
+  void Merge(const Telemetry &other) {
+    statements_.Add(other.statements_.Get());
+    calls_.Add(other.calls_.Get());
+    native_calls_.Add(other.native_calls_.Get());
+    for (size_t i = 0; i < kAllocationKinds; ++i) {
+      allocations_[i].Add(other.allocations_[i].Get());
+    }
+    allocation_bytes_.Merge(other.allocation_bytes_);
+    native_seconds_.Merge(other.native_seconds_);
+  }
+  void Reset() {
+    statements_.Reset();
+    calls_.Reset();
+    native_calls_.Reset();
+    for (auto &allocations : allocations_) {
+      allocations.Reset();
+    }
+    allocation_bytes_.Reset();
+    native_seconds_.Reset();
+  }
+
+  // Prometheus 文本格式
+  auto Format() const -> std::string {
+    std::string out;
+    FormatCounter(out, "cpplox_statements_total", "Statements executed.", statements_);
+    FormatCounter(out, "cpplox_calls_total", "Function, method and native calls.", calls_);
+    FormatCounter(out, "cpplox_native_calls_total", "Calls into native functions.", native_calls_);
+    out += "# HELP cpplox_allocations_total Objects allocated by kind.\n# TYPE cpplox_allocations_total counter\n";
+    for (size_t i = 0; i < kAllocationKinds; ++i) {
+      out += std::string("cpplox_allocations_total{kind=\"") + kAllocationKindNames[i] + "\"} " +
+             std::to_string(allocations_[i].Get()) + "\n";
+    }
+    out += "# HELP cpplox_live_heap_bytes Estimated bytes held by live environments, instances and bindings.\n"
+           "# TYPE cpplox_live_heap_bytes gauge\n"
+           "cpplox_live_heap_bytes " + std::to_string(live_heap_bytes_.Get()) + "\n";
+    allocation_bytes_.Format(out, "cpplox_allocation_bytes", "Size of allocated objects and strings.");
+    native_seconds_.Format(out, "cpplox_native_call_seconds", "Time spent in native functions.");
+    return out;
+  }
+
+private:
+  static void FormatCounter(std::string &out, const std::string &name, const std::string &help,
+                            const Counter &counter) {
+    out += "# HELP " + name + " " + help + "\n# TYPE " + name + " counter\n";
+    out += name + " " + std::to_string(counter.Get()) + "\n";
+  }
+};
+
+inline thread_local constinit Telemetry telemetry;
+
+// 已经结束的 isolate 的统计，导出时加到主线程的统计上。多个 isolate 线程会写，用 mutex_ 保护
+struct FinishedIsolates {
+  std::mutex mutex_;
+  Telemetry telemetry_;
+};
+inline constinit FinishedIsolates finished_isolates;
+
+// isolate 结束时在它的线程上调用。线程之后还会运行别的 isolate，合并之后把这个线程的计数清零
+inline void FinishIsolateTelemetry() {
+  std::lock_guard lock{finished_isolates.mutex_};
+  finished_isolates.telemetry_.Merge(telemetry);
+  telemetry.Reset();
+}
+
+}  // namespace cpplox
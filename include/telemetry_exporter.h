@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "telemetry.h"
+
+namespace cpplox {
+
+// 后台线程每隔 interval 把 Telemetry 按 Prometheus 文本格式导出到 target：
+// "unix:PATH" 连接 Unix 域套接字写一次；"file:PATH" 或者普通路径先写临时文件再 rename，采集方不会读到写了一半的文件。
+// 析构时再导出一次，运行时间很短的脚本也能留下最后的数字
+class TelemetryExporter {
+ public:
+  TelemetryExporter(const Telemetry &telemetry, std::string target, std::chrono::milliseconds interval);
+  ~TelemetryExporter();
+  TelemetryExporter(const TelemetryExporter &) = delete;
+  auto operator=(const TelemetryExporter &) -> TelemetryExporter & = delete;
+
+  // 导出失败 (采集方没有在监听、目录不可写) 时返回 false，下一次照常再试
+  auto Export() const -> bool;
+
+ private:
+  auto WriteFile(const std::string &path, const std::string &text) const -> bool;
+  auto WriteSocket(const std::string &path, const std::string &text) const -> bool;
+
+  const Telemetry &telemetry_;
+  std::string target_;
+  std::chrono::milliseconds interval_;
+  std::mutex mutex_;
+  std::condition_variable_any wakeup_;
+  std::jthread thread_;
+};
+
+}  // namespace cpplox
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <any>
-#include <map>
+#include <array>
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <utility>
 
 namespace cpplox {
@@ -14,6 +16,7 @@ enum class TokenType {
   LEFT_BRACE,
   RIGHT_BRACE,
   COMMA,
+  COLON,
   DOT,
   MINUS,
   PLUS,
@@ -53,6 +56,7 @@ enum class TokenType {
   TRUE,
   VAR,
   WHILE,
+  IMPORT,
   TOKEN_EOF
 };
 
@@ -64,6 +68,7 @@ class Token {
     this->token_type_ = other.token_type_;
     this->lexeme_ = other.lexeme_;
     this->line_ = other.line_;
+    this->literal_ = other.literal_;
   }
   // TODO(gaoxiang):
   // auto ToString() -> std::string {
@@ -71,22 +76,69 @@ class Token {
   // }
   auto GetTokenType() const -> TokenType { return token_type_; }
   auto GetTokenLine() const -> int { return line_; }
-  auto GetTokenLexeme() const -> std::string { return lexeme_; }
+  auto GetTokenLexeme() const -> const std::string & { return lexeme_; }
   auto GetLiteral() const -> std::any { return literal_; }
  private:
   TokenType token_type_;
   std::string lexeme_;
   int line_;
   std::any literal_;
+};
 
- public:
-  inline static std::map<std::string, TokenType> key_words{
-      {"and", TokenType::AND},     {"class", TokenType::CLASS},   {"else", TokenType::ELSE},
-      {"false", TokenType::FALSE}, {"for", TokenType::FOR},       {"fun", TokenType::FUN},
-      {"if", TokenType::IF},       {"nil", TokenType::NIL},       {"or", TokenType::OR},
-      {"print", TokenType::PRINT}, {"return", TokenType::RETURN}, {"super", TokenType::SUPER},
-      {"this", TokenType::THIS},   {"true", TokenType::TRUE},     {"var", TokenType::VAR},
-      {"while", TokenType::WHILE}};
+struct KeywordEntry {
+  std::string_view text_;
+  TokenType type_{TokenType::IDENTIFIER};
 };
 
-}  // namespace cpplox
\ No newline at end of file
+inline constexpr std::array<KeywordEntry, 17> kKeywords{{{"and", TokenType::AND},
+                                                         {"class", TokenType::CLASS},
+                                                         {"else", TokenType::ELSE},
+                                                         {"false", TokenType::FALSE},
+                                                         {"for", TokenType::FOR},
+                                                         {"fun", TokenType::FUN},
+                                                         {"if", TokenType::IF},
+                                                         {"nil", TokenType::NIL},
+                                                         {"or", TokenType::OR},
+                                                         {"print", TokenType::PRINT},
+                                                         {"return", TokenType::RETURN},
+                                                         {"super", TokenType::SUPER},
+                                                         {"this", TokenType::THIS},
+                                                         {"true", TokenType::TRUE},
+                                                         {"var", TokenType::VAR},
+                                                         {"while", TokenType::WHILE},
+                                                         {"import", TokenType::IMPORT}}};
+
+// 关键字的完美哈希：17 个关键字按 (3 * 首字符 + 5 * 末字符 + 5 * 长度) % 32 各占一个槽，查找最多一次字符串比较
+constexpr auto KeywordHash(std::string_view text) -> size_t {
+  return (3U * static_cast<unsigned char>(text.front()) + 5U * static_cast<unsigned char>(text.back()) +
+          5U * text.size()) %
+         32;
+}
+
+inline constexpr auto kKeywordTable = [] {
+  std::array<KeywordEntry, 32> table{};
+  for (const auto &keyword : kKeywords) {
+    table[KeywordHash(keyword.text_)] = keyword;
+  }
+  return table;
+}();
+
+constexpr auto LookupKeyword(std::string_view text) -> TokenType {
+  if (text.empty()) {
+    return TokenType::IDENTIFIER;
+  }
+  const auto &entry {kKeywordTable[KeywordHash(text)]};
+  return entry.text_ == text ? entry.type_ : TokenType::IDENTIFIER;
+}
+
+// 修改关键字后哈希函数可能不再是完美的，编译期检查没有冲突
+static_assert([] {
+  for (const auto &keyword : kKeywords) {
+    if (LookupKeyword(keyword.text_) != keyword.type_) {
+      return false;
+    }
+  }
+  return true;
+}());
+
+}  // namespace cpplox
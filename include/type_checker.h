@@ -0,0 +1,74 @@
+#pragma once
+
+#include <any>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "stmt.h"
+#include "token.h"
+namespace cpplox {
+
+// Resolver 之后运行：检查类型注解，推断局部变量和表达式的静态类型，把证明了类型的表达式标记成可以不装箱求值。
+// 没有注解的局部变量取初始值的类型，只要有一次赋值的类型不同就退回 UNKNOWN，反复遍历直到所有变量的类型不再变化。
+// 全局变量可能被别的脚本、快照或 native 重新定义，读全局变量的类型总是 UNKNOWN
+class TypeChecker : public ExprASTVisitor, StmtVisitor {
+public:
+  void Check(const std::vector<std::shared_ptr<Stmt>> &statements);
+
+  void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override;
+  void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override;
+  void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override;
+  void VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override;
+  void VisitIfStmt(std::shared_ptr<IfStmt> stmt) override;
+  void VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) override;
+  void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override;
+  void VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) override;
+  void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override;
+  void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) override;
+
+  auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override;
+  auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override;
+  auto VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any override;
+  auto VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any override;
+  auto VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any override;
+  auto VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any override;
+  auto VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any override;
+  auto VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any override;
+  auto VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any override;
+  auto VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any override;
+  auto VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any override;
+  auto VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any override;
+
+  static auto TypeName(StaticType type) -> std::string;
+
+private:
+  struct Variable {
+    StaticType type_;
+    bool annotated_;
+  };
+
+  void Walk(const std::vector<std::shared_ptr<Stmt>> &statements);
+  void Check(const std::shared_ptr<Stmt> &statement);
+  auto TypeOf(const std::shared_ptr<ExprAST> &expr) -> StaticType;
+  // 只在最后一遍遍历时写入语法树和报告错误
+  auto Mark(ExprAST &expr, StaticType type, Unboxed unboxed) -> std::any;
+  void Error(const Token &token, const std::string &message);
+  // key 是声明变量的 VarStmt / FunctionStmt，参数用参数 Token 的地址
+  void Declare(const Token &name, const void *key, StaticType type, bool annotated);
+  auto Lookup(const std::string &name) -> Variable *;
+  void CheckFunction(const std::shared_ptr<FunctionStmt> &function);
+
+  // 各个声明的类型在多遍遍历之间保留，只会从具体类型退回 UNKNOWN
+  std::unordered_map<const void *, Variable> variables_;
+  std::vector<std::unordered_map<std::string, Variable *>> scopes_;
+  // 带注解的全局变量，只用来检查对它们的赋值
+  std::unordered_map<std::string, StaticType> globals_;
+  std::vector<StaticType> returns_;
+  bool changed_{false};
+  bool final_{false};
+};
+
+}  // namespace cpplox
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <any>
+#include <cstddef>
+#include <vector>
+
+namespace cpplox {
+
+// 解释器的值栈：调用参数和函数 frame 都从这里按栈的方式分配，稳定运行后调用路径上没有堆分配。
+// 栈顶以上的槽位始终是 nil，弹出时清空，frame 里引用的对象可以及时释放
+class ValueStack {
+public:
+  explicit ValueStack(size_t size) : slots_(size, std::any{nullptr}) {}
+  ValueStack(const ValueStack &) = delete;
+  auto operator=(const ValueStack &) -> ValueStack & = delete;
+
+  // 在栈顶分配 count 个 nil 槽位，空间不够时返回 nullptr
+  auto Allocate(size_t count) -> std::any * {
+    if (slots_.size() - top_ < count) {
+      return nullptr;
+    }
+    auto *slots = slots_.data() + top_;
+    top_ += count;
+    return slots;
+  }
+  auto Top() const -> size_t { return top_; }
+  auto Remaining() const -> size_t { return slots_.size() - top_; }
+  void PopTo(size_t top) {
+    for (auto i = top; i < top_; ++i) {
+      slots_[i] = nullptr;
+    }
+    top_ = top;
+  }
+
+  // 作用域结束时 (包括异常) 把栈恢复到构造时的高度
+  class Mark {
+  public:
+    explicit Mark(ValueStack &stack) : stack_(stack), top_(stack.Top()) {}
+    Mark(const Mark &) = delete;
+    auto operator=(const Mark &) -> Mark & = delete;
+    ~Mark() { stack_.PopTo(top_); }
+
+  private:
+    ValueStack &stack_;
+    size_t top_;
+  };
+
+private:
+  std::vector<std::any> slots_;
+  size_t top_{0};
+};
+
+}  // namespace cpplox
@@ -0,0 +1,116 @@
+#include "allocation_profiler.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "telemetry.h"
+
+namespace cpplox {
+
+namespace {
+
+constexpr const char *kDumpHeader = "# kind\ttype\tfunction\tline\tlive_count\tlive_bytes\ttotal_count\ttotal_bytes\n";
+
+// Dump 的一行：前四列是分配点，后面是存活个数和字节数
+struct DumpRow {
+  std::string site_;
+  int64_t live_count_{0};
+  int64_t live_bytes_{0};
+};
+
+auto ParseDump(const std::string &text) -> std::map<std::string, DumpRow> {
+  std::map<std::string, DumpRow> rows;
+  std::istringstream in{text};
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    // 第四个 Tab 之前是分配点
+    size_t end = 0;
+    for (int i = 0; i < 4 && end != std::string::npos; ++i) {
+      end = line.find('\t', end == 0 ? 0 : end + 1);
+    }
+    if (end == std::string::npos) {
+      continue;
+    }
+    DumpRow row{line.substr(0, end)};
+    std::istringstream counts{line.substr(end + 1)};
+    counts >> row.live_count_ >> row.live_bytes_;
+    rows[row.site_] = row;
+  }
+  return rows;
+}
+
+}  // namespace
+
+auto AllocationProfiler::Record(AllocationKind kind, size_t bytes, std::string_view type) -> AllocationSite * {
+  std::string_view function {functions_.empty() ? std::string_view{"<script>"} : functions_.back()};
+  key_.assign(kAllocationKindNames[static_cast<size_t>(kind)]);
+  key_.append("\t").append(type.empty() ? "-" : type).append("\t").append(function).append("\t");
+  key_.append(std::to_string(line_));
+  auto [iter, inserted] = sites_.try_emplace(key_);
+  auto &site {iter->second};
+  if (inserted) {
+    site.kind_ = kind;
+    site.type_ = type;
+    site.function_ = function;
+    site.line_ = line_;
+  }
+  ++site.live_count_;
+  ++site.total_count_;
+  site.live_bytes_ += bytes;
+  site.total_bytes_ += bytes;
+  return &site;
+}
+
+auto AllocationProfiler::Dump() const -> std::string {
+  std::vector<const std::pair<const std::string, AllocationSite> *> sites;
+  sites.reserve(sites_.size());
+  for (const auto &entry : sites_) {
+    sites.push_back(&entry);
+  }
+  std::sort(sites.begin(), sites.end(), [](const auto *lhs, const auto *rhs) {
+    return std::tie(rhs->second.live_bytes_, lhs->first) < std::tie(lhs->second.live_bytes_, rhs->first);
+  });
+  std::string out {"# cpplox heap dump\n"};
+  out += kDumpHeader;
+  for (const auto *entry : sites) {
+    const auto &site {entry->second};
+    out += entry->first + "\t" + std::to_string(site.live_count_) + "\t" + std::to_string(site.live_bytes_) + "\t" +
+           std::to_string(site.total_count_) + "\t" + std::to_string(site.total_bytes_) + "\n";
+  }
+  return out;
+}
+
+auto AllocationProfiler::Diff(const std::string &before, const std::string &after) -> std::string {
+  auto old_rows {ParseDump(before)};
+  auto new_rows {ParseDump(after)};
+  for (const auto &[site, row] : old_rows) {
+    auto &current {new_rows[site]};
+    current.site_ = site;
+    current.live_count_ -= row.live_count_;
+    current.live_bytes_ -= row.live_bytes_;
+  }
+  std::vector<DumpRow> changes;
+  for (auto &[site, row] : new_rows) {
+    if (row.live_count_ != 0 || row.live_bytes_ != 0) {
+      changes.push_back(std::move(row));
+    }
+  }
+  std::sort(changes.begin(), changes.end(), [](const DumpRow &lhs, const DumpRow &rhs) {
+    return std::make_tuple(-std::llabs(lhs.live_bytes_), lhs.site_) <
+           std::make_tuple(-std::llabs(rhs.live_bytes_), rhs.site_);
+  });
+  std::string out {"# cpplox heap diff\n# kind\ttype\tfunction\tline\tlive_count_delta\tlive_bytes_delta\n"};
+  for (const auto &row : changes) {
+    out += row.site_ + "\t" + std::to_string(row.live_count_) + "\t" + std::to_string(row.live_bytes_) + "\n";
+  }
+  return out;
+}
+
+}  // namespace cpplox
@@ -0,0 +1,99 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "error.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+#include "scanner.h"
+
+// 函数调用路径的分配检查：预热之后，只有数字参数和返回值的调用不应该有任何堆分配。
+// 有分配时返回 1，ctest 作为测试运行；同时报告每次调用的耗时
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+
+// 函数定义和一轮小规模的调用：值栈、顶层 frame 和各个侧表在这里分配好
+const char *const kWarmUp = R"(
+fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }
+fun add(a, b) { return a + b; }
+fun loop(n) {
+  var sum = 0;
+  for (var i = 0; i < n; i = i + 1) { sum = add(sum, i); }
+  return sum;
+}
+fib(15);
+loop(1000);
+)";
+
+// 计数的部分只有表达式语句，不定义新的全局变量
+auto CallSource(int depth, int rounds) -> std::string {
+  std::ostringstream source;
+  source << "fib(" << depth << ");\n"
+         << "loop(" << rounds << ");\n";
+  return source.str();
+}
+
+auto Compile(const std::string &source, const std::shared_ptr<cpplox::Interpreter> &interpreter)
+    -> std::vector<std::shared_ptr<cpplox::Stmt>> {
+  auto tokens = cpplox::Scanner(source).ScanTokens();
+  auto statements = cpplox::Parser(tokens).Parse();
+  std::make_unique<cpplox::Resolver>(interpreter)->Resolve(statements);
+  return statements;
+}
+
+template <typename F>
+auto TimeMs(F &&func) -> double {
+  auto begin = std::chrono::steady_clock::now();
+  func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+}  // namespace
+
+auto operator new(size_t size) -> void * {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+auto operator delete(void *ptr) noexcept -> void { std::free(ptr); }
+
+auto operator delete(void *ptr, size_t /*size*/) noexcept -> void { std::free(ptr); }
+
+auto main() -> int {
+  const int depth = 25;
+  const int rounds = 1000000;
+  auto interpreter = std::make_shared<cpplox::Interpreter>();
+  auto warm_up = Compile(kWarmUp, interpreter);
+  auto measured = Compile(CallSource(depth, rounds), interpreter);
+  if (cpplox::had_error) {
+    return 1;
+  }
+  interpreter->Interpret(warm_up);
+
+  // fib(25) 一共调用 242785 次，loop 里 add 调用 rounds 次
+  const double calls = 242785.0 + 1 + rounds;
+  uint64_t before = allocations.load();
+  auto ms = TimeMs([&] { interpreter->Interpret(measured); });
+  uint64_t count = allocations.load() - before;
+  std::cerr << "calls   " << calls << " in " << ms << " ms (" << ms * 1e6 / calls << " ns/call)\n";
+  std::cerr << "alloc   " << count << " (" << count / calls << " per call)\n";
+  if (cpplox::had_error) {
+    return 1;
+  }
+  if (count > 0) {
+    std::cerr << "FAIL: numeric calls allocated on the heap\n";
+    return 1;
+  }
+  return 0;
+}
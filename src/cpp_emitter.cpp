@@ -0,0 +1,475 @@
+#include "cpp_emitter.h"
+#include <algorithm>
+#include <any>
+#include <array>
+#include <charconv>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast.h"
+#include "interpreter.h"
+#include "stmt.h"
+#include "token.h"
+
+namespace cpplox {
+
+namespace {
+
+constexpr const char *kLambda = "[=](const runtime::Value &self, std::vector<runtime::Value> &arguments) -> runtime::Value {";
+
+auto Join(const std::vector<std::string> &items) -> std::string {
+  std::string result;
+  for (const auto &item : items) {
+    if (!result.empty()) {
+      result += ", ";
+    }
+    result += item;
+  }
+  return result;
+}
+
+}  // namespace
+
+auto CppEmitter::Emit(const std::vector<std::shared_ptr<Stmt>> &statements) -> std::string {
+  // 第一遍只为了找出被赋值过的全局变量，第二遍才能确定哪些顶层函数可以直接调用
+  Reset();
+  for (const auto &stmt : statements) {
+    Emit(stmt);
+  }
+  FindDirectFunctions(statements);
+  Reset();
+  for (const auto &stmt : statements) {
+    Emit(stmt);
+  }
+
+  std::string result;
+  result += "// Generated by cpplox --emit-cpp from " + source_name_ + ". Do not edit.\n";
+  result += "#include \"lox_runtime.h\"\n\nnamespace {\n\nnamespace runtime = cpplox::runtime;\n\n";
+  for (const auto &name : globals_) {
+    if (name == "clock") {
+      result += "runtime::Global g_clock{\"clock\", runtime::Clock()};\n";
+    } else {
+      result += "runtime::Global g_" + name + "{" + Quote(name) + "};\n";
+    }
+  }
+  if (!direct_functions_.empty()) {
+    result += "\n";
+  }
+  for (const auto &[name, function] : direct_functions_) {
+    result += "auto f_" + name + "(runtime::Args<" + std::to_string(function->GetFunctionParams().size()) +
+              "> arguments) -> runtime::Value;\n";
+  }
+  result += "\n" + functions_.text_;
+  result += "void Script() {\n" + script_.text_ + "}\n\n}  // namespace\n\n";
+  result += "auto main() -> int { return cpplox::runtime::Run(Script); }\n";
+  return result;
+}
+
+void CppEmitter::Reset() {
+  globals_.clear();
+  contexts_.assign(1, FunctionContext{});
+  functions_ = Output{};
+  script_ = Output{"", 1};
+  out_ = &script_;
+  next_id_ = 0;
+}
+
+void CppEmitter::FindDirectFunctions(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  std::unordered_map<std::string, int> declarations;
+  for (const auto &stmt : statements) {
+    if (auto function {std::dynamic_pointer_cast<FunctionStmt>(stmt)}) {
+      ++declarations[function->GetFunctionName().GetTokenLexeme()];
+    } else if (auto var {std::dynamic_pointer_cast<VarStmt>(stmt)}) {
+      ++declarations[var->GetName().GetTokenLexeme()];
+    } else if (auto klass {std::dynamic_pointer_cast<ClassStmt>(stmt)}) {
+      ++declarations[klass->GetClassName().GetTokenLexeme()];
+    }
+  }
+  direct_functions_.clear();
+  for (const auto &stmt : statements) {
+    auto function {std::dynamic_pointer_cast<FunctionStmt>(stmt)};
+    if (function == nullptr) {
+      continue;
+    }
+    auto name {function->GetFunctionName().GetTokenLexeme()};
+    if (declarations[name] == 1 && !assigned_globals_.contains(name) &&
+        interpreter_.functions_.at(function).upvalues_.empty()) {
+      direct_functions_[name] = function;
+    }
+  }
+}
+
+auto CppEmitter::Expr(const std::shared_ptr<ExprAST> &expr) -> std::string {
+  return std::any_cast<std::string>(expr->Accept(*this));
+}
+
+void CppEmitter::Emit(const std::shared_ptr<Stmt> &stmt) { stmt->Accept(*this); }
+
+void CppEmitter::Line(const std::string &text) {
+  out_->text_.append(2 * out_->indent_, ' ');
+  out_->text_ += text;
+  out_->text_ += '\n';
+}
+
+auto CppEmitter::Read(const Binding &binding) -> std::string {
+  return binding.cell_ ? "(*" + binding.name_ + ")" : binding.name_;
+}
+
+auto CppEmitter::Global(const std::string &name) -> std::string {
+  globals_.insert(name);
+  return "g_" + name;
+}
+
+auto CppEmitter::Lookup(VariableRef ref) -> const Binding & {
+  auto &context {contexts_.back()};
+  return ref.kind_ == VariableKind::LOCAL ? context.slots_.at(ref.index_) : context.upvalues_.at(ref.index_);
+}
+
+auto CppEmitter::Lookup(const std::optional<VariableRef> &variable, const Token &name) -> std::string {
+  if (variable.has_value() && variable->kind_ != VariableKind::GLOBAL) {
+    return Read(Lookup(*variable));
+  }
+  return Global(name.GetTokenLexeme()) + ".Get(" + LineOf(name) + ")";
+}
+
+auto CppEmitter::Declare(const std::shared_ptr<Stmt> &declaration, const std::string &name, const std::string &value)
+    -> std::string {
+  auto slot {interpreter_.declarations_.find(declaration)};
+  if (slot == interpreter_.declarations_.end()) {
+    Line(Global(name) + ".Define(" + value + ");");
+    return "";
+  }
+  Binding binding {"v" + std::to_string(next_id_++) + "_" + name, slot->second.captured_};
+  if (binding.cell_) {
+    Line("auto " + binding.name_ + " = std::make_shared<runtime::Value>(" + value + ");");
+  } else {
+    Line("runtime::Value " + binding.name_ + " = " + value + ";");
+  }
+  contexts_.back().slots_[slot->second.index_] = binding;
+  return binding.cell_ ? "*" + binding.name_ : binding.name_;
+}
+
+void CppEmitter::EmitFunction(const std::shared_ptr<FunctionStmt> &function, const std::string &header,
+                              const std::string &footer) {
+  const auto &info {interpreter_.functions_.at(function)};
+  FunctionContext context;
+  for (const auto &upvalue : info.upvalues_) {
+    const auto &enclosing {contexts_.back()};
+    context.upvalues_.push_back(upvalue.is_local_ ? enclosing.slots_.at(upvalue.index_)
+                                                  : enclosing.upvalues_.at(upvalue.index_));
+  }
+  Line(header);
+  ++out_->indent_;
+  contexts_.push_back(std::move(context));
+  int slot = 0;
+  auto bind = [&](const std::string &name, const std::string &value) {
+    bool captured = std::find(info.captured_params_.begin(), info.captured_params_.end(), slot) !=
+                    info.captured_params_.end();
+    Binding binding {"v" + std::to_string(next_id_++) + "_" + name, captured};
+    if (captured) {
+      Line("auto " + binding.name_ + " = std::make_shared<runtime::Value>(" + value + ");");
+    } else {
+      Line("runtime::Value " + binding.name_ + " = " + value + ";");
+    }
+    contexts_.back().slots_[slot++] = binding;
+  };
+  if (info.has_receiver_) {
+    bind("this", "self");
+  }
+  auto params {function->GetFunctionParams()};
+  for (size_t i = 0; i < params.size(); ++i) {
+    bind(params[i].GetTokenLexeme(), "std::move(arguments[" + std::to_string(i) + "])");
+  }
+  for (const auto &stmt : function->GetFunctionBody()) {
+    Emit(stmt);
+  }
+  Line("return runtime::Value{};");
+  contexts_.pop_back();
+  --out_->indent_;
+  Line(footer);
+}
+
+auto CppEmitter::Quote(const std::string &text) -> std::string {
+  std::string result {"\""};
+  for (char c : text) {
+    switch (c) {
+      case '"':
+        result += "\\\"";
+        break;
+      case '\\':
+        result += "\\\\";
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      case '\t':
+        result += "\\t";
+        break;
+      case '\r':
+        result += "\\r";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          // 固定三位八进制，后面的字符不会被当成转义的一部分
+          std::array<char, 5> escape {'\\', static_cast<char>('0' + ((c >> 6) & 7)),
+                                      static_cast<char>('0' + ((c >> 3) & 7)), static_cast<char>('0' + (c & 7)), 0};
+          result += escape.data();
+        } else {
+          result += c;
+        }
+        break;
+    }
+  }
+  return result + "\"";
+}
+
+auto CppEmitter::VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any {
+  auto operands {"{" + Expr(expr_ast->GetLeftExpr()) + ", " + Expr(expr_ast->GetRightExpr()) + "}"};
+  auto line {LineOf(expr_ast->GetOperation())};
+  switch (expr_ast->GetOperation().GetTokenType()) {
+    case TokenType::PLUS:
+      return "runtime::Add(" + operands + ", " + line + ")";
+    case TokenType::MINUS:
+      return "runtime::Subtract(" + operands + ", " + line + ")";
+    case TokenType::STAR:
+      return "runtime::Multiply(" + operands + ", " + line + ")";
+    case TokenType::SLASH:
+      return "runtime::Divide(" + operands + ", " + line + ")";
+    case TokenType::LESS:
+      return "runtime::Less(" + operands + ", " + line + ")";
+    case TokenType::LESS_EQUAL:
+      return "runtime::LessEqual(" + operands + ", " + line + ")";
+    case TokenType::GREATER:
+      return "runtime::Greater(" + operands + ", " + line + ")";
+    case TokenType::GREATER_EQUAL:
+      return "runtime::GreaterEqual(" + operands + ", " + line + ")";
+    case TokenType::EQUAL_EQUAL:
+      return "runtime::Equal(" + operands + ")";
+    case TokenType::BANG_EQUAL:
+      return "runtime::NotEqual(" + operands + ")";
+    default:
+      return std::string{"runtime::Value{}"};
+  }
+}
+
+auto CppEmitter::VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any {
+  return Expr(expr_ast->GetExpression());
+}
+
+auto CppEmitter::VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any {
+  auto value {expr_ast->GetValue()};
+  if (value.type() == typeid(bool)) {
+    return std::string{std::any_cast<bool>(value) ? "runtime::Value{true}" : "runtime::Value{false}"};
+  }
+  if (value.type() == typeid(double)) {
+    Interpreter::NumberBuffer buffer;
+    std::string number {Interpreter::FormatNumber(std::any_cast<double>(value), buffer)};
+    if (number.find_first_of(".e") == std::string::npos) {
+      number += ".0";
+    }
+    return "runtime::Value{" + number + "}";
+  }
+  if (value.type() == typeid(std::string)) {
+    return "runtime::Value{std::string{" + Quote(std::any_cast<std::string>(value)) + "}}";
+  }
+  return std::string{"runtime::Value{}"};
+}
+
+auto CppEmitter::VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any {
+  auto right {Expr(expr_ast->GetRightExpr())};
+  if (expr_ast->GetOperation().GetTokenType() == TokenType::MINUS) {
+    return "runtime::Negate(" + right + ", " + LineOf(expr_ast->GetOperation()) + ")";
+  }
+  return "runtime::Not(" + right + ")";
+}
+
+auto CppEmitter::VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any {
+  auto function {expr_ast->GetToken().GetTokenType() == TokenType::OR ? "runtime::Or(" : "runtime::And("};
+  return function + Expr(expr_ast->GetLeftExpr()) + ", [&]() -> runtime::Value { return " +
+         Expr(expr_ast->GetRightExpr()) + "; })";
+}
+
+auto CppEmitter::VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any {
+  return Lookup(expr_ast->GetVariable(), expr_ast->GetToken());
+}
+
+auto CppEmitter::VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any {
+  auto value {Expr(expr_ast->GetValue())};
+  const auto &variable {expr_ast->GetVariable()};
+  if (variable.has_value() && variable->kind_ != VariableKind::GLOBAL) {
+    return "(" + Read(Lookup(*variable)) + " = " + value + ")";
+  }
+  auto name {expr_ast->GetName().GetTokenLexeme()};
+  assigned_globals_.insert(name);
+  return Global(name) + ".Assign(" + value + ", " + LineOf(expr_ast->GetName()) + ")";
+}
+
+auto CppEmitter::VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any {
+  auto line {LineOf(expr_ast->GetToken())};
+  std::vector<std::string> arguments;
+  for (const auto &argument : expr_ast->GetArguments()) {
+    arguments.push_back(Expr(argument));
+  }
+  // 调用目标在编译时已知：先检查全局函数已经定义，再直接调用对应的 C++ 函数
+  auto callee {std::dynamic_pointer_cast<VarExprAST>(expr_ast->GetCallee())};
+  if (callee != nullptr && Interpreter::IsGlobal(*callee)) {
+    auto name {callee->GetToken().GetTokenLexeme()};
+    auto direct {direct_functions_.find(name)};
+    if (direct != direct_functions_.end() && direct->second->GetFunctionParams().size() == arguments.size()) {
+      return "(" + Global(name) + ".Check(" + line + "), f_" + name + "({" + Join(arguments) + "}))";
+    }
+  }
+  arguments.insert(arguments.begin(), Expr(expr_ast->GetCallee()));
+  return "runtime::Call({" + Join(arguments) + "}, " + line + ")";
+}
+
+auto CppEmitter::VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any {
+  return "runtime::Get(" + Expr(expr_ast->GetObject()) + ", " + Quote(expr_ast->GetName().GetTokenLexeme()) + ", " +
+         LineOf(expr_ast->GetName()) + ")";
+}
+
+auto CppEmitter::VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any {
+  return "runtime::Set({" + Expr(expr_ast->GetSetObject()) + ", " + Expr(expr_ast->GetSetValue()) + "}, " +
+         Quote(expr_ast->GetSetName().GetTokenLexeme()) + ", " + LineOf(expr_ast->GetSetName()) + ")";
+}
+
+auto CppEmitter::VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any {
+  return Lookup(expr_ast->GetVariable(), expr_ast->GetThisKeyWord());
+}
+
+auto CppEmitter::VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any {
+  const auto &[super_ref, this_ref] = interpreter_.super_refs_.at(expr_ast);
+  return "runtime::GetSuper(" + Read(Lookup(super_ref)) + ", " + Read(Lookup(this_ref)) + ", " +
+         Quote(expr_ast->GetSuperMethod().GetTokenLexeme()) + ", " + LineOf(expr_ast->GetSuperMethod()) + ")";
+}
+
+void CppEmitter::VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) {
+  Line("static_cast<void>(" + Expr(stmt->GetExpr()) + ");");
+}
+
+void CppEmitter::VisitIfStmt(std::shared_ptr<IfStmt> stmt) {
+  Line("if (runtime::Truthy(" + Expr(stmt->GetConditionExpression()) + ")) {");
+  ++out_->indent_;
+  Emit(stmt->GetThenBranch());
+  --out_->indent_;
+  if (stmt->GetElseBranch() != nullptr) {
+    Line("} else {");
+    ++out_->indent_;
+    Emit(stmt->GetElseBranch());
+    --out_->indent_;
+  }
+  Line("}");
+}
+
+void CppEmitter::VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+  Line("while (runtime::Truthy(" + Expr(stmt->GetConditionExpr()) + ")) {");
+  ++out_->indent_;
+  Emit(stmt->GetWhileBody());
+  --out_->indent_;
+  Line("}");
+}
+
+void CppEmitter::VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) { Line("runtime::Print(" + Expr(stmt->GetExpr()) + ");"); }
+
+void CppEmitter::VisitVarStmt(std::shared_ptr<VarStmt> stmt) {
+  auto value {stmt->GetExpr() == nullptr ? std::string{"runtime::Value{}"} : Expr(stmt->GetExpr())};
+  Declare(stmt, stmt->GetName().GetTokenLexeme(), value);
+}
+
+void CppEmitter::VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+  Line("{");
+  ++out_->indent_;
+  for (const auto &statement : stmt->GetBlockStatements()) {
+    Emit(statement);
+  }
+  --out_->indent_;
+  Line("}");
+}
+
+void CppEmitter::VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+  auto name {stmt->GetFunctionName().GetTokenLexeme()};
+  auto arity {std::to_string(stmt->GetFunctionParams().size())};
+  auto direct {direct_functions_.find(name)};
+  if (direct != direct_functions_.end() && direct->second == stmt) {
+    auto *script = out_;
+    out_ = &functions_;
+    EmitFunction(stmt, "auto f_" + name + "(runtime::Args<" + arity + "> arguments) -> runtime::Value {", "}");
+    Line("");
+    out_ = script;
+    // 作为一等值使用 (传参、存进变量) 时通过这个包装调用
+    std::vector<std::string> forward;
+    for (size_t i = 0; i < stmt->GetFunctionParams().size(); ++i) {
+      forward.push_back("arguments[" + std::to_string(i) + "]");
+    }
+    Line(Global(name) + ".Define(runtime::MakeFunction(" + Quote(name) + ", " + arity +
+         ", [](const runtime::Value &, std::vector<runtime::Value> &arguments) -> runtime::Value { return f_" + name +
+         "({" + Join(forward) + "}); }));");
+    return;
+  }
+  // 先声明再赋值，函数体才能通过捕获的 Cell 递归调用自己
+  auto target {Declare(stmt, name, "runtime::Value{}")};
+  auto make {"runtime::MakeFunction(" + Quote(name) + ", " + arity + ", " + kLambda};
+  if (target.empty()) {
+    EmitFunction(stmt, Global(name) + ".Define(" + make, "}));");
+  } else {
+    EmitFunction(stmt, target + " = " + make, "});");
+  }
+}
+
+void CppEmitter::VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+  if (stmt->GetReturnValue() == nullptr) {
+    Line("return runtime::Value{};");
+  } else {
+    Line("return " + Expr(stmt->GetReturnValue()) + ";");
+  }
+}
+
+// 生成的程序只有一个翻译单元，模块要在运行时按路径加载
+void CppEmitter::VisitImportStmt(std::shared_ptr<ImportStmt> stmt) {
+  throw std::runtime_error("[line " + std::to_string(stmt->GetKeyWord().GetTokenLine()) +
+                           "] --emit-cpp does not support import.\n");
+}
+
+void CppEmitter::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+  auto name {stmt->GetClassName().GetTokenLexeme()};
+  auto target {Declare(stmt, name, "runtime::Value{}")};
+  Line("{");
+  ++out_->indent_;
+  std::string super_value {"runtime::Value{}"};
+  if (stmt->GetSupperClass() != nullptr) {
+    super_value = Expr(stmt->GetSupperClass());
+    auto slot {interpreter_.super_slots_.find(stmt)};
+    if (slot != interpreter_.super_slots_.end()) {
+      Binding binding {"v" + std::to_string(next_id_++) + "_super", slot->second.captured_};
+      if (binding.cell_) {
+        Line("auto " + binding.name_ + " = std::make_shared<runtime::Value>(" + super_value + ");");
+      } else {
+        Line("runtime::Value " + binding.name_ + " = " + super_value + ";");
+      }
+      contexts_.back().slots_[slot->second.index_] = binding;
+      super_value = Read(binding);
+    }
+  }
+  Line("std::unordered_map<std::string, runtime::FunctionPtr> methods;");
+  for (const auto &method : stmt->GetClassMethods()) {
+    auto method_name {method->GetFunctionName().GetTokenLexeme()};
+    EmitFunction(method,
+                 "methods[" + Quote(method_name) + "] = runtime::MakeFunction(" + Quote(method_name) + ", " +
+                     std::to_string(method->GetFunctionParams().size()) + ", " + kLambda,
+                 method_name == "init" ? "}, true);" : "});");
+  }
+  auto klass {"runtime::MakeClass(" + Quote(name) + ", " + super_value + ", " + LineOf(stmt->GetClassName()) +
+              ", std::move(methods))"};
+  if (target.empty()) {
+    Line(Global(name) + ".Define(" + klass + ");");
+  } else {
+    Line(target + " = " + klass + ";");
+  }
+  --out_->indent_;
+  Line("}");
+}
+
+}  // namespace cpplox
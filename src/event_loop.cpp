@@ -0,0 +1,496 @@
+#include "event_loop.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "interpreter.h"
+#include "lox_callable.h"
+#include "runtime_error.h"
+
+namespace cpplox {
+
+namespace {
+
+auto ErrorString() -> std::string { return std::strerror(errno); }
+
+void SetNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    throw NativeError("Cannot set fd non-blocking: " + ErrorString());
+  }
+}
+
+auto IsRegularFile(int fd) -> bool {
+  struct stat info {};
+  return fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// 读到 EOF，出错时返回 false，errno 是出错的原因
+auto ReadAll(int fd, std::string &data) -> bool {
+  std::array<char, 65536> buffer;
+  ssize_t count;
+  while ((count = ::read(fd, buffer.data(), buffer.size())) > 0) {
+    data.append(buffer.data(), count);
+  }
+  return count == 0;
+}
+
+// 返回写入的字节数，少于 data.size() 时 errno 是出错的原因
+auto WriteAll(int fd, const std::string &data) -> size_t {
+  size_t offset = 0;
+  while (offset < data.size()) {
+    auto count = ::write(fd, data.data() + offset, data.size() - offset);
+    if (count < 0) {
+      break;
+    }
+    offset += count;
+  }
+  return offset;
+}
+
+auto LoopbackAddress(int port) -> sockaddr_in {
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return address;
+}
+
+}  // namespace
+
+EventLoop::EventLoop() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  if (epoll_fd_ < 0) {
+    throw std::runtime_error("epoll_create1 failed: " + ErrorString());
+  }
+  completion_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = completion_fd_;
+  if (completion_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, completion_fd_, &event) < 0) {
+    auto message{ErrorString()};
+    if (completion_fd_ >= 0) {
+      close(completion_fd_);
+    }
+    close(epoll_fd_);
+    throw std::runtime_error("eventfd failed: " + message);
+  }
+}
+
+EventLoop::~EventLoop() {
+  {
+    std::lock_guard lock{file_mutex_};
+    stopping_ = true;
+  }
+  file_work_.notify_one();
+  if (file_worker_.joinable()) {
+    file_worker_.join();
+  }
+  for (const auto &[watch_fd, watch] : watches_) {
+    close(watch_fd);
+  }
+  close(completion_fd_);
+  close(epoll_fd_);
+}
+
+void EventLoop::AddWatch(int watch_fd, uint32_t events, std::unique_ptr<Watch> watch) {
+  epoll_event event{};
+  event.events = events;
+  event.data.fd = watch_fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, watch_fd, &event) < 0) {
+    auto message{ErrorString()};
+    close(watch_fd);
+    throw NativeError("Cannot watch fd: " + message);
+  }
+  watches_[watch_fd] = std::move(watch);
+}
+
+void EventLoop::RemoveWatch(int watch_fd) {
+  auto iter = watches_.find(watch_fd);
+  if (iter == watches_.end()) {
+    return;
+  }
+  if (iter->second->kind_ == WatchKind::IDLE) {
+    --idle_watches_;
+  }
+  watches_.erase(iter);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, watch_fd, nullptr);
+  close(watch_fd);
+}
+
+void EventLoop::Complete(const std::shared_ptr<LoxCallable> &callback, std::vector<std::any> arguments) {
+  // 回调可以少声明参数，多出来的参数补 nil
+  arguments.resize(callback->Arity(), std::any{nullptr});
+  ready_.emplace_back(callback, std::move(arguments));
+}
+
+auto EventLoop::SetTimer(double delay_ms, std::shared_ptr<LoxCallable> callback) -> int {
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd < 0) {
+    throw NativeError("Cannot create timer: " + ErrorString());
+  }
+  // it_value 全为 0 会解除定时器，所以至少等待 1ns
+  auto nanoseconds = std::max<int64_t>(static_cast<int64_t>(delay_ms * 1e6), 1);
+  itimerspec spec{};
+  spec.it_value.tv_sec = nanoseconds / 1000000000;
+  spec.it_value.tv_nsec = nanoseconds % 1000000000;
+  if (timerfd_settime(timer_fd, 0, &spec, nullptr) < 0) {
+    auto message{ErrorString()};
+    close(timer_fd);
+    throw NativeError("Cannot set timer: " + message);
+  }
+  int timer_id = next_timer_id_++;
+  AddWatch(timer_fd, EPOLLIN, std::make_unique<Watch>(Watch{WatchKind::TIMER, timer_id, std::move(callback)}));
+  timers_[timer_id] = timer_fd;
+  return timer_id;
+}
+
+void EventLoop::ClearTimer(int timer_id) {
+  auto iter = timers_.find(timer_id);
+  if (iter != timers_.end()) {
+    RemoveWatch(iter->second);
+    timers_.erase(iter);
+  }
+}
+
+void EventLoop::SubmitFile(std::shared_ptr<LoxCallable> callback, FileJob job) {
+  auto id {next_file_job_++};
+  file_callbacks_.emplace(id, std::move(callback));
+  {
+    std::lock_guard lock{file_mutex_};
+    file_jobs_.emplace_back(id, std::move(job));
+  }
+  file_work_.notify_one();
+  if (!file_worker_.joinable()) {
+    file_worker_ = std::thread([this] { WorkFiles(); });
+  }
+}
+
+void EventLoop::WorkFiles() {
+  std::unique_lock lock{file_mutex_};
+  for (;;) {
+    file_work_.wait(lock, [this] { return stopping_ || !file_jobs_.empty(); });
+    // job 里 dup 出来的 fd 要由 job 关闭，所以停止前也要做完
+    if (file_jobs_.empty()) {
+      return;
+    }
+    auto [id, job] {std::move(file_jobs_.front())};
+    file_jobs_.pop_front();
+    lock.unlock();
+    auto result = job();
+    lock.lock();
+    file_results_.emplace_back(id, std::move(result));
+    uint64_t one = 1;
+    ::write(completion_fd_, &one, sizeof(one));
+  }
+}
+
+void EventLoop::CompleteFiles() {
+  uint64_t count;
+  ::read(completion_fd_, &count, sizeof(count));
+  std::vector<std::pair<uint64_t, std::vector<std::any>>> results;
+  {
+    std::lock_guard lock{file_mutex_};
+    results.swap(file_results_);
+  }
+  for (auto &[id, arguments] : results) {
+    auto iter {file_callbacks_.find(id)};
+    Complete(iter->second, std::move(arguments));
+    file_callbacks_.erase(iter);
+  }
+}
+
+void EventLoop::ReadFile(const std::string &path, std::shared_ptr<LoxCallable> callback) {
+  SubmitFile(std::move(callback), [path]() -> std::vector<std::any> {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return {ErrorString(), nullptr};
+    }
+    std::string data;
+    bool read {ReadAll(fd, data)};
+    std::vector<std::any> result{read ? std::any{nullptr} : std::any{ErrorString()}, nullptr};
+    if (read) {
+      result[1] = std::move(data);
+    }
+    close(fd);
+    return result;
+  });
+}
+
+void EventLoop::WriteFile(const std::string &path, const std::string &data, std::shared_ptr<LoxCallable> callback) {
+  SubmitFile(std::move(callback), [path, data]() -> std::vector<std::any> {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return {ErrorString(), nullptr};
+    }
+    auto written {WriteAll(fd, data)};
+    std::vector<std::any> result{written < data.size() ? std::any{ErrorString()} : std::any{nullptr},
+                                 static_cast<double>(written)};
+    close(fd);
+    return result;
+  });
+}
+
+// 读到 EOF 后把全部数据交给回调。普通文件交给后台线程，用 dup 出来的 fd，脚本在完成前关闭 fd 也不影响
+void EventLoop::Read(int fd, std::shared_ptr<LoxCallable> callback) {
+  if (IsRegularFile(fd)) {
+    int file_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (file_fd < 0) {
+      throw NativeError("Cannot read fd: " + ErrorString());
+    }
+    SubmitFile(std::move(callback), [file_fd]() -> std::vector<std::any> {
+      std::string data;
+      bool read {ReadAll(file_fd, data)};
+      std::vector<std::any> result{read ? std::any{nullptr} : std::any{ErrorString()}, std::move(data)};
+      close(file_fd);
+      return result;
+    });
+    return;
+  }
+  SetNonBlocking(fd);
+  int watch_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (watch_fd < 0) {
+    throw NativeError("Cannot watch fd: " + ErrorString());
+  }
+  AddWatch(watch_fd, EPOLLIN | EPOLLRDHUP, std::make_unique<Watch>(Watch{WatchKind::READ, fd, std::move(callback)}));
+}
+
+void EventLoop::Write(int fd, std::string data, std::shared_ptr<LoxCallable> callback) {
+  if (IsRegularFile(fd)) {
+    int file_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (file_fd < 0) {
+      throw NativeError("Cannot write fd: " + ErrorString());
+    }
+    SubmitFile(std::move(callback), [file_fd, data = std::move(data)]() -> std::vector<std::any> {
+      auto written {WriteAll(file_fd, data)};
+      std::vector<std::any> result{written < data.size() ? std::any{ErrorString()} : std::any{nullptr},
+                                   static_cast<double>(written)};
+      close(file_fd);
+      return result;
+    });
+    return;
+  }
+  SetNonBlocking(fd);
+  int watch_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (watch_fd < 0) {
+    throw NativeError("Cannot watch fd: " + ErrorString());
+  }
+  AddWatch(watch_fd, EPOLLOUT,
+           std::make_unique<Watch>(Watch{WatchKind::WRITE, fd, std::move(callback), std::move(data)}));
+}
+
+auto EventLoop::Pipe() -> std::pair<int, int> {
+  std::array<int, 2> fds{};
+  if (pipe2(fds.data(), O_NONBLOCK | O_CLOEXEC) < 0) {
+    throw NativeError("Cannot create pipe: " + ErrorString());
+  }
+  return {fds[0], fds[1]};
+}
+
+// 只监听 127.0.0.1，每接受一个连接就调用一次 callback(error, fd)
+auto EventLoop::Listen(int port, std::shared_ptr<LoxCallable> callback) -> int {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw NativeError("Cannot create socket: " + ErrorString());
+  }
+  int reuse = 1;
+  auto address{LoopbackAddress(port)};
+  int watch_fd = -1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+      bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(fd, SOMAXCONN) < 0 ||
+      (watch_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+    auto message{ErrorString()};
+    close(fd);
+    throw NativeError("Cannot listen on port " + std::to_string(port) + ": " + message);
+  }
+  try {
+    AddWatch(watch_fd, EPOLLIN, std::make_unique<Watch>(Watch{WatchKind::LISTEN, fd, std::move(callback)}));
+  } catch (const NativeError &) {
+    close(fd);
+    throw;
+  }
+  return fd;
+}
+
+void EventLoop::Connect(int port, std::shared_ptr<LoxCallable> callback) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    Complete(callback, {ErrorString(), nullptr});
+    return;
+  }
+  auto address{LoopbackAddress(port)};
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0) {
+    Complete(callback, {nullptr, static_cast<double>(fd)});
+    return;
+  }
+  if (errno != EINPROGRESS) {
+    Complete(callback, {ErrorString(), nullptr});
+    close(fd);
+    return;
+  }
+  int watch_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (watch_fd < 0) {
+    Complete(callback, {ErrorString(), nullptr});
+    close(fd);
+    return;
+  }
+  try {
+    AddWatch(watch_fd, EPOLLOUT, std::make_unique<Watch>(Watch{WatchKind::CONNECT, fd, callback}));
+  } catch (const NativeError &error) {
+    Complete(callback, {std::string{error.what()}, nullptr});
+    close(fd);
+  }
+}
+
+void EventLoop::Close(int fd) {
+  std::vector<int> watch_fds;
+  for (const auto &[watch_fd, watch] : watches_) {
+    if (watch->kind_ != WatchKind::TIMER && watch->kind_ != WatchKind::IDLE && watch->user_fd_ == fd) {
+      watch_fds.push_back(watch_fd);
+    }
+  }
+  for (auto watch_fd : watch_fds) {
+    RemoveWatch(watch_fd);
+  }
+  close(fd);
+}
+
+void EventLoop::WatchIdle(int fd, std::function<void()> on_ready) {
+  int watch_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (watch_fd < 0) {
+    throw NativeError("Cannot watch fd: " + ErrorString());
+  }
+  auto watch {std::make_unique<Watch>(Watch{WatchKind::IDLE, fd, nullptr})};
+  watch->on_ready_ = std::move(on_ready);
+  AddWatch(watch_fd, EPOLLIN, std::move(watch));
+  ++idle_watches_;
+}
+
+void EventLoop::Dispatch(int watch_fd) {
+  if (watch_fd == completion_fd_) {
+    CompleteFiles();
+    return;
+  }
+  auto iter = watches_.find(watch_fd);
+  if (iter == watches_.end()) {
+    return;
+  }
+  auto &watch = *iter->second;
+  switch (watch.kind_) {
+    case WatchKind::IDLE: {
+      // on_ready 可能增删 watch，先拷贝出来再调用
+      auto on_ready {watch.on_ready_};
+      on_ready();
+      return;
+    }
+    case WatchKind::TIMER: {
+      uint64_t expirations;
+      ::read(watch_fd, &expirations, sizeof(expirations));
+      timers_.erase(watch.user_fd_);
+      Complete(watch.callback_, {});
+      RemoveWatch(watch_fd);
+      return;
+    }
+    case WatchKind::READ: {
+      std::array<char, 65536> buffer;
+      for (;;) {
+        auto count = ::read(watch_fd, buffer.data(), buffer.size());
+        if (count > 0) {
+          watch.buffer_.append(buffer.data(), count);
+          continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          return;
+        }
+        if (count < 0) {
+          Complete(watch.callback_, {ErrorString(), std::move(watch.buffer_)});
+        } else {
+          Complete(watch.callback_, {nullptr, std::move(watch.buffer_)});
+        }
+        RemoveWatch(watch_fd);
+        return;
+      }
+    }
+    case WatchKind::WRITE: {
+      while (watch.offset_ < watch.buffer_.size()) {
+        auto count = ::write(watch_fd, watch.buffer_.data() + watch.offset_, watch.buffer_.size() - watch.offset_);
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          return;
+        }
+        if (count < 0) {
+          Complete(watch.callback_, {ErrorString(), static_cast<double>(watch.offset_)});
+          RemoveWatch(watch_fd);
+          return;
+        }
+        watch.offset_ += count;
+      }
+      Complete(watch.callback_, {nullptr, static_cast<double>(watch.offset_)});
+      RemoveWatch(watch_fd);
+      return;
+    }
+    case WatchKind::LISTEN: {
+      int client;
+      while ((client = accept4(watch_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Complete(watch.callback_, {nullptr, static_cast<double>(client)});
+      }
+      // 连接在 accept 之前被对方关闭之类的错误只影响这一个连接，交给回调，继续监听
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        Complete(watch.callback_, {ErrorString(), nullptr});
+      }
+      return;
+    }
+    case WatchKind::CONNECT: {
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if (getsockopt(watch_fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        error = errno;
+      }
+      if (error != 0) {
+        Complete(watch.callback_, {std::string{std::strerror(error)}, nullptr});
+        close(watch.user_fd_);
+      } else {
+        Complete(watch.callback_, {nullptr, static_cast<double>(watch.user_fd_)});
+      }
+      RemoveWatch(watch_fd);
+      return;
+    }
+  }
+}
+
+void EventLoop::Run(Interpreter &interpreter) {
+  std::array<epoll_event, 64> events;
+  while (HasPendingWork()) {
+    while (!ready_.empty()) {
+      auto [callback, arguments] = std::move(ready_.front());
+      ready_.pop_front();
+      interpreter.CallCallback(callback, arguments);
+    }
+    if (watches_.size() == idle_watches_ && file_callbacks_.empty()) {
+      break;
+    }
+    int count = epoll_wait(epoll_fd_, events.data(), events.size(), -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("epoll_wait failed: " + ErrorString());
+    }
+    for (int i = 0; i < count; ++i) {
+      Dispatch(events[i].data.fd);
+    }
+  }
+}
+
+}  // namespace cpplox
@@ -0,0 +1,172 @@
+#include "hot_reload.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "error.h"
+#include "parser.h"
+#include "resolver.h"
+#include "runtime_error.h"
+#include "scanner.h"
+#include "type_checker.h"
+
+namespace cpplox {
+
+HotReloader::HotReloader(std::shared_ptr<Interpreter> interpreter, std::string path)
+    : interpreter_(std::move(interpreter)), path_(std::move(path)) {
+  std::error_code error;
+  modified_ = std::filesystem::last_write_time(path_, error);
+  auto tokens {ReadTokens()};
+  for (const auto &declaration : Split(tokens)) {
+    fingerprints_[declaration.name_] = declaration.fingerprint_;
+  }
+  // 监视目录而不是文件：编辑器保存时常常写新文件再 rename，文件上的监视会跟着旧文件失效
+  notify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (notify_fd_ >= 0) {
+    auto directory {std::filesystem::path(path_).parent_path()};
+    if (directory.empty()) {
+      directory = ".";
+    }
+    if (inotify_add_watch(notify_fd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+      close(notify_fd_);
+      notify_fd_ = -1;
+    }
+  }
+}
+
+HotReloader::~HotReloader() {
+  if (notify_fd_ >= 0) {
+    close(notify_fd_);
+  }
+}
+
+auto HotReloader::ReadTokens() const -> std::vector<Token> {
+  std::ifstream file{path_};
+  std::ostringstream source;
+  source << file.rdbuf();
+  try {
+    return Scanner(source.str()).ScanTokens();
+  } catch (const char *message) {
+    std::cerr << "reload " << path_ << ": " << message << "\n";
+    return {};
+  }
+}
+
+auto HotReloader::Split(const std::vector<Token> &tokens) -> std::vector<Declaration> {
+  std::vector<Declaration> declarations;
+  int depth = 0;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    auto type {tokens[i].GetTokenType()};
+    if (depth == 0 && (type == TokenType::FUN || type == TokenType::CLASS) && i + 1 < tokens.size()) {
+      // 声明在第一个 '{' 对应的 '}' 处结束
+      size_t end = i + 1;
+      int braces = 0;
+      for (; end < tokens.size() && tokens[end].GetTokenType() != TokenType::TOKEN_EOF; ++end) {
+        if (tokens[end].GetTokenType() == TokenType::LEFT_BRACE) {
+          ++braces;
+        } else if (tokens[end].GetTokenType() == TokenType::RIGHT_BRACE && --braces == 0) {
+          ++end;
+          break;
+        }
+      }
+      // FNV-1a，只看 token 的类型和文本，只有行号变化的声明不会重新加载
+      uint64_t fingerprint = 14695981039346656037ULL;
+      auto mix = [&fingerprint](unsigned char byte) { fingerprint = (fingerprint ^ byte) * 1099511628211ULL; };
+      for (size_t j = i; j < end; ++j) {
+        mix(static_cast<unsigned char>(tokens[j].GetTokenType()));
+        for (char ch : tokens[j].GetTokenLexeme()) {
+          mix(static_cast<unsigned char>(ch));
+        }
+      }
+      declarations.push_back({tokens[i + 1].GetTokenLexeme(), i, end, fingerprint});
+      i = end - 1;
+      continue;
+    }
+    if (type == TokenType::LEFT_BRACE || type == TokenType::LEFT_PAREN) {
+      ++depth;
+    } else if (type == TokenType::RIGHT_BRACE || type == TokenType::RIGHT_PAREN) {
+      --depth;
+    }
+  }
+  return declarations;
+}
+
+auto HotReloader::Reload() -> int {
+  auto tokens {ReadTokens()};
+  bool saved_error = had_error;
+  int replaced = 0;
+  for (const auto &declaration : Split(tokens)) {
+    auto iter {fingerprints_.find(declaration.name_)};
+    if (iter != fingerprints_.end() && iter->second == declaration.fingerprint_) {
+      continue;
+    }
+    // 只解析这一条声明，新的 Resolver 只给新的语法树节点添加侧表条目
+    std::vector<Token> slice(tokens.begin() + static_cast<std::ptrdiff_t>(declaration.begin_),
+                             tokens.begin() + static_cast<std::ptrdiff_t>(declaration.end_));
+    slice.emplace_back(TokenType::TOKEN_EOF, "", nullptr, slice.back().GetTokenLine());
+    had_error = false;
+    auto statements {Parser(slice).Parse()};
+    if (!had_error && statements.size() == 1 && statements.front() != nullptr) {
+      Resolver(interpreter_, std::filesystem::path(path_).parent_path()).Resolve(statements);
+      TypeChecker().Check(statements);
+    }
+    if (had_error || statements.size() != 1 || statements.front() == nullptr) {
+      continue;
+    }
+    try {
+      interpreter_->ReloadDeclaration(statements.front(), declaration.name_);
+    } catch (RuntimeError error) {
+      Log::RuntimeError(error);
+      continue;
+    }
+    fingerprints_[declaration.name_] = declaration.fingerprint_;
+    ++replaced;
+  }
+  had_error = saved_error;
+  return replaced;
+}
+
+void HotReloader::Poll() {
+  auto now {std::chrono::steady_clock::now()};
+  if (reloading_ || now < next_poll_) {
+    return;
+  }
+  next_poll_ = now + kPollInterval;
+  ReloadIfModified();
+}
+
+void HotReloader::Notify() {
+  // 目录里别的文件的事件也会唤醒，读完事件后只比较脚本的修改时间
+  std::array<char, 4096> events;
+  while (read(notify_fd_, events.data(), events.size()) > 0) {
+  }
+  if (!reloading_) {
+    ReloadIfModified();
+  }
+}
+
+void HotReloader::ReloadIfModified() {
+  std::error_code error;
+  auto modified {std::filesystem::last_write_time(path_, error)};
+  if (error || modified == modified_) {
+    return;
+  }
+  modified_ = modified;
+  // 重新执行声明时也会经过安全点，不能重入
+  reloading_ = true;
+  auto replaced {Reload()};
+  reloading_ = false;
+  if (replaced > 0) {
+    std::cerr << "reloaded " << replaced << " declaration(s) from " << path_ << "\n";
+  }
+}
+
+}  // namespace cpplox
@@ -0,0 +1,214 @@
+#include "inliner.h"
+#include <any>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "ast.h"
+#include "interpreter.h"
+#include "stmt.h"
+#include "token.h"
+
+namespace cpplox {
+
+void Inliner::Inline(Interpreter &interpreter, const std::vector<std::shared_ptr<Stmt>> &statements) {
+  interpreter_ = &interpreter;
+  for (const auto &statement : statements) {
+    if (auto function {std::dynamic_pointer_cast<FunctionStmt>(statement)}; function != nullptr) {
+      AddCandidate(function);
+    } else if (auto var {std::dynamic_pointer_cast<VarStmt>(statement)}; var != nullptr) {
+      candidates_.erase(var->GetName().GetTokenLexeme());
+    } else if (auto klass {std::dynamic_pointer_cast<ClassStmt>(statement)}; klass != nullptr) {
+      candidates_.erase(klass->GetClassName().GetTokenLexeme());
+    } else if (auto imported {std::dynamic_pointer_cast<ImportStmt>(statement)}; imported != nullptr) {
+      candidates_.erase(imported->GetName().GetTokenLexeme());
+    }
+  }
+  marking_ = true;
+  Walk(statements);
+  marking_ = false;
+}
+
+void Inliner::Walk(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  for (const auto &statement : statements) {
+    Walk(statement);
+  }
+}
+
+void Inliner::Walk(const std::shared_ptr<Stmt> &statement) {
+  if (statement != nullptr) {
+    statement->Accept(*this);
+  }
+}
+
+auto Inliner::Size(const std::shared_ptr<ExprAST> &expr) -> size_t {
+  return std::any_cast<size_t>(expr->Accept(*this));
+}
+
+void Inliner::AddCandidate(const std::shared_ptr<FunctionStmt> &function) {
+  const auto &name {function->GetFunctionName().GetTokenLexeme()};
+  candidates_.erase(name);
+  const auto &body {function->GetFunctionBody()};
+  auto stmt {body.size() == 1 ? std::dynamic_pointer_cast<ReturnStmt>(body.front()) : nullptr};
+  if (stmt == nullptr || stmt->GetReturnValue() == nullptr) {
+    return;
+  }
+  // frame 里只有参数并且没有被捕获，函数体只访问参数和全局变量，实参所在的槽位可以直接当作 frame
+  const auto *info {interpreter_->GetFunctionInfo(function)};
+  if (info->slot_count_ != static_cast<int>(function->GetFunctionParams().size()) ||
+      !info->captured_params_.empty() || !info->upvalues_.empty()) {
+    return;
+  }
+  if (Size(stmt->GetReturnValue()) > kMaxNodes) {
+    return;
+  }
+  candidates_[name] = InlineTarget{function, stmt->GetReturnValue(), nullptr};
+}
+
+auto Inliner::Reaches(const FunctionStmt *from, const FunctionStmt *to) const -> bool {
+  if (to == nullptr) {
+    return false;
+  }
+  std::vector<const FunctionStmt *> pending{from};
+  std::unordered_set<const FunctionStmt *> visited{from};
+  while (!pending.empty()) {
+    const auto *function {pending.back()};
+    pending.pop_back();
+    if (function == to) {
+      return true;
+    }
+    if (auto iter {edges_.find(function)}; iter != edges_.end()) {
+      for (const auto *callee : iter->second) {
+        if (visited.insert(callee).second) {
+          pending.push_back(callee);
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void Inliner::Report(const Token &token, const std::string &message) {
+  if (reporting_) {
+    report_.push_back("[line " + std::to_string(token.GetTokenLine()) + "] " + message);
+  }
+}
+
+void Inliner::VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) { Walk(stmt->GetBlockStatements()); }
+
+void Inliner::VisitVarStmt(std::shared_ptr<VarStmt> stmt) {
+  if (stmt->GetExpr() != nullptr) {
+    Size(stmt->GetExpr());
+  }
+}
+
+void Inliner::VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+  auto iter {candidates_.find(stmt->GetFunctionName().GetTokenLexeme())};
+  const auto *enclosing {current_};
+  current_ = iter != candidates_.end() && iter->second.declaration_ == stmt ? stmt.get() : nullptr;
+  Walk(stmt->GetFunctionBody());
+  current_ = enclosing;
+}
+
+void Inliner::VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) { Size(stmt->GetExpr()); }
+
+void Inliner::VisitIfStmt(std::shared_ptr<IfStmt> stmt) {
+  Size(stmt->GetConditionExpression());
+  Walk(stmt->GetThenBranch());
+  Walk(stmt->GetElseBranch());
+}
+
+void Inliner::VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) { Size(stmt->GetExpr()); }
+
+void Inliner::VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+  if (stmt->GetReturnValue() == nullptr) {
+    return;
+  }
+  Size(stmt->GetReturnValue());
+  // 内联的函数没有递归，不需要尾调用
+  auto *call {dynamic_cast<CallExprAST *>(stmt->GetReturnValue().get())};
+  if (call != nullptr && call->GetInlineTarget() != nullptr) {
+    interpreter_->UnmarkTailCall(stmt);
+  }
+}
+
+void Inliner::VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+  Size(stmt->GetConditionExpr());
+  Walk(stmt->GetWhileBody());
+}
+
+void Inliner::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+  const auto *enclosing {current_};
+  current_ = nullptr;
+  for (const auto &method : stmt->GetClassMethods()) {
+    Walk(method->GetFunctionBody());
+  }
+  current_ = enclosing;
+}
+
+auto Inliner::VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any { return size_t{1}; }
+
+auto Inliner::VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetValue());
+}
+
+auto Inliner::VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetLeftExpr()) + Size(expr_ast->GetRightExpr());
+}
+
+// 调用的是候选函数的全局变量时标记成内联；参数个数不对的调用照常在运行时报错
+auto Inliner::VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any {
+  size_t size = 1 + Size(expr_ast->GetCallee());
+  for (const auto &argument : expr_ast->GetArguments()) {
+    size += Size(argument);
+  }
+  auto *callee {dynamic_cast<VarExprAST *>(expr_ast->GetCallee().get())};
+  if (!marking_ || callee == nullptr || !Interpreter::IsGlobal(*callee)) {
+    return size;
+  }
+  const auto &name {callee->GetToken().GetTokenLexeme()};
+  auto iter {candidates_.find(name)};
+  if (iter == candidates_.end() ||
+      iter->second.declaration_->GetFunctionParams().size() != expr_ast->GetArguments().size()) {
+    return size;
+  }
+  const auto *function {iter->second.declaration_.get()};
+  if (function == current_ || Reaches(function, current_)) {
+    Report(expr_ast->GetToken(), "Not inlining recursive call to " + name + ".");
+    return size;
+  }
+  if (current_ != nullptr) {
+    edges_[current_].push_back(function);
+  }
+  expr_ast->SetInlineTarget(iter->second);
+  Report(expr_ast->GetToken(), "Inlined call to " + name + ".");
+  return size;
+}
+
+auto Inliner::VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetExpression());
+}
+
+auto Inliner::VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any { return size_t{1}; }
+
+auto Inliner::VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetLeftExpr()) + Size(expr_ast->GetRightExpr());
+}
+
+auto Inliner::VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetRightExpr());
+}
+
+auto Inliner::VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetObject());
+}
+
+auto Inliner::VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any {
+  return 1 + Size(expr_ast->GetSetObject()) + Size(expr_ast->GetSetValue());
+}
+
+auto Inliner::VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any { return size_t{1}; }
+
+auto Inliner::VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any { return size_t{1}; }
+
+}  // namespace cpplox
@@ -1,27 +1,126 @@
 #include "interpreter.h"
 #include <any>
+#include <array>
+#include <charconv>
 #include <exception>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <unordered_map>
 #include <vector>
 
 #include "ast.h"
 #include "environment.h"
+#include "event_loop.h"
+#include "isolate.h"
+#include "jit.h"
+#include "json.h"
 #include "lox_callable.h"
 #include "lox_class.h"
 #include "lox_function.h"
 #include "lox_instance.h"
+#include "lox_module.h"
+#include "native_extension.h"
+#include "native_function.h"
 #include "runtime_error.h"
 #include "stmt.h"
+#include "telemetry.h"
+#include "telemetry_exporter.h"
 #include "token.h"
+#include "type_checker.h"
 #include "error.h"
 
 namespace cpplox {
 
+Interpreter::Interpreter() {
+  globals_->Define("clock", std::shared_ptr<LoxCallable>{std::make_shared<NativeClock>()});
+  globals_->Define("coroutine", std::shared_ptr<LoxCallable>{std::make_shared<NativeCoroutine>()});
+  globals_->Define("resume", std::shared_ptr<LoxCallable>{std::make_shared<NativeResume>()});
+  globals_->Define("yield", std::shared_ptr<LoxCallable>{std::make_shared<NativeYield>()});
+  globals_->Define("status", std::shared_ptr<LoxCallable>{std::make_shared<NativeCoroutineStatus>()});
+  globals_->Define("setTimeout", std::shared_ptr<LoxCallable>{std::make_shared<NativeSetTimeout>()});
+  globals_->Define("clearTimeout", std::shared_ptr<LoxCallable>{std::make_shared<NativeClearTimeout>()});
+  globals_->Define("readFile", std::shared_ptr<LoxCallable>{std::make_shared<NativeReadFile>()});
+  globals_->Define("writeFile", std::shared_ptr<LoxCallable>{std::make_shared<NativeWriteFile>()});
+  globals_->Define("pipe", std::shared_ptr<LoxCallable>{std::make_shared<NativePipe>()});
+  globals_->Define("read", std::shared_ptr<LoxCallable>{std::make_shared<NativeRead>()});
+  globals_->Define("write", std::shared_ptr<LoxCallable>{std::make_shared<NativeWrite>()});
+  globals_->Define("listen", std::shared_ptr<LoxCallable>{std::make_shared<NativeListen>()});
+  globals_->Define("connect", std::shared_ptr<LoxCallable>{std::make_shared<NativeConnect>()});
+  globals_->Define("close", std::shared_ptr<LoxCallable>{std::make_shared<NativeClose>()});
+  globals_->Define("load_extension", std::shared_ptr<LoxCallable>{std::make_shared<NativeLoadExtension>()});
+  globals_->Define("heap_dump", std::shared_ptr<LoxCallable>{std::make_shared<NativeHeapDump>()});
+  globals_->Define("spawn", std::shared_ptr<LoxCallable>{std::make_shared<NativeSpawn>()});
+  globals_->Define("channel", std::shared_ptr<LoxCallable>{std::make_shared<NativeChannel>()});
+  globals_->Define("send", std::shared_ptr<LoxCallable>{std::make_shared<NativeSend>()});
+  globals_->Define("receive", std::shared_ptr<LoxCallable>{std::make_shared<NativeReceive>()});
+  // json_parse 创建的对象和数组的类。脚本也可以用 JsonObject() 和 JsonArray() 创建空的对象和数组
+  std::unordered_map<std::string, std::shared_ptr<LoxFunction>> no_methods;
+  auto json {std::make_shared<const Json>(std::make_shared<LoxClass>("JsonObject", nullptr, no_methods),
+                                          std::make_shared<LoxClass>("JsonArray", nullptr, no_methods))};
+  globals_->Define("JsonObject", std::shared_ptr<LoxCallable>{json->GetObjectClass()});
+  globals_->Define("JsonArray", std::shared_ptr<LoxCallable>{json->GetArrayClass()});
+  globals_->Define("json_parse", std::shared_ptr<LoxCallable>{std::make_shared<NativeJsonParse>(json)});
+  globals_->Define("json_stringify", std::shared_ptr<LoxCallable>{std::make_shared<NativeJsonStringify>(json)});
+  globals_->Define("json_get", std::shared_ptr<LoxCallable>{std::make_shared<NativeJsonGet>(json)});
+  globals_->Define("json_set", std::shared_ptr<LoxCallable>{std::make_shared<NativeJsonSet>(json)});
+}
+
+Interpreter::~Interpreter() {
+  // 挂起的协程栈上的 frame 还引用着解释器，趁成员都还在时展开。展开一个协程可能销毁别的协程
+  while (!coroutines_.empty()) {
+    (*coroutines_.begin())->Cancel();
+  }
+}
+
+void Interpreter::EnableJit(uint32_t hot_calls) {
+  if (jit_ == nullptr || jit_->GetHotCalls() != hot_calls) {
+    jit_ = std::make_unique<Jit>(hot_calls);
+  }
+}
+
+auto Interpreter::GetJitHotCalls() const -> uint32_t { return jit_ == nullptr ? 0 : jit_->GetHotCalls(); }
+
+void Interpreter::ExportTelemetry(std::string target, std::chrono::milliseconds interval) {
+  telemetry_exporter_.reset();
+  telemetry_exporter_ = std::make_unique<TelemetryExporter>(*telemetry_, std::move(target), interval);
+}
+
+auto Interpreter::GetEventLoop() -> EventLoop & {
+  if (event_loop_ == nullptr) {
+    event_loop_ = std::make_unique<EventLoop>();
+  }
+  return *event_loop_;
+}
+
+void Interpreter::RunEventLoop() {
+  if (event_loop_ == nullptr) {
+    return;
+  }
+  try {
+    event_loop_->Run(*this);
+  } catch (RuntimeError error) {
+    Log::RuntimeError(error);
+  }
+}
+
+auto Interpreter::CallCallback(const std::shared_ptr<LoxCallable> &callback, std::span<std::any> arguments)
+    -> std::any {
+  Token token{TokenType::IDENTIFIER, callback->ToString(), nullptr, 0};
+  return CallFunction(callback, arguments, token);
+}
+
 auto Interpreter::VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any  {
+  switch (expr_ast->GetUnboxed()) {
+    case Unboxed::NEGATE:
+      return EvaluateNumber(*expr_ast);
+    case Unboxed::NOT:
+      return EvaluateBool(*expr_ast);
+    default:
+      break;
+  }
   auto right{Evaluate(expr_ast->GetRightExpr())};
   switch (expr_ast->GetOperation().GetTokenType()) {
     case TokenType::MINUS:
@@ -45,11 +144,201 @@ auto Interpreter::IsTruthy(const std::any &value) -> bool {
   return true;
 }
 
+auto Interpreter::EvaluateNumber(ExprAST &expr) -> double {
+  switch (expr.GetUnboxed()) {
+    case Unboxed::LITERAL:
+      return *std::any_cast<double>(&static_cast<LiteralExprAST &>(expr).GetValue());
+    case Unboxed::GROUPING:
+      return EvaluateNumber(*static_cast<GroupingExprAST &>(expr).GetExpression());
+    case Unboxed::NEGATE:
+      return -EvaluateNumber(*static_cast<UnaryExprAST &>(expr).GetRightExpr());
+    case Unboxed::ARITHMETIC: {
+      auto &binary {static_cast<BinaryExprAST &>(expr)};
+      auto left {EvaluateNumber(*binary.GetLeftExpr())};
+      auto right {EvaluateNumber(*binary.GetRightExpr())};
+      switch (binary.GetOperation().GetTokenType()) {
+        case TokenType::PLUS:
+          return left + right;
+        case TokenType::MINUS:
+          return left - right;
+        case TokenType::STAR:
+          return left * right;
+        default:
+          return left / right;
+      }
+    }
+    case Unboxed::LOGICAL: {
+      // 数字总是真值：or 返回左边，and 返回右边
+      auto &logical {static_cast<LogicalExprAST &>(expr)};
+      auto left {EvaluateNumber(*logical.GetLeftExpr())};
+      return logical.GetToken().GetTokenType() == TokenType::OR ? left : EvaluateNumber(*logical.GetRightExpr());
+    }
+    default: {
+      auto value {expr.Accept(*this)};
+      return *std::any_cast<double>(&value);
+    }
+  }
+}
+
+auto Interpreter::EvaluateBool(ExprAST &expr) -> bool {
+  switch (expr.GetUnboxed()) {
+    case Unboxed::LITERAL:
+      return *std::any_cast<bool>(&static_cast<LiteralExprAST &>(expr).GetValue());
+    case Unboxed::GROUPING:
+      return EvaluateBool(*static_cast<GroupingExprAST &>(expr).GetExpression());
+    case Unboxed::NOT:
+      return !EvaluateCondition(static_cast<UnaryExprAST &>(expr).GetRightExpr());
+    case Unboxed::COMPARISON: {
+      auto &binary {static_cast<BinaryExprAST &>(expr)};
+      auto left {EvaluateNumber(*binary.GetLeftExpr())};
+      auto right {EvaluateNumber(*binary.GetRightExpr())};
+      switch (binary.GetOperation().GetTokenType()) {
+        case TokenType::LESS:
+          return left < right;
+        case TokenType::LESS_EQUAL:
+          return left <= right;
+        case TokenType::GREATER:
+          return left > right;
+        case TokenType::GREATER_EQUAL:
+          return left >= right;
+        case TokenType::EQUAL_EQUAL:
+          return left == right;
+        default:
+          return left != right;
+      }
+    }
+    case Unboxed::LOGICAL: {
+      auto &logical {static_cast<LogicalExprAST &>(expr)};
+      auto left {EvaluateBool(*logical.GetLeftExpr())};
+      if (logical.GetToken().GetTokenType() == TokenType::OR ? left : !left) {
+        return left;
+      }
+      return EvaluateBool(*logical.GetRightExpr());
+    }
+    default: {
+      auto value {expr.Accept(*this)};
+      return *std::any_cast<bool>(&value);
+    }
+  }
+}
+
+void Interpreter::CheckType(const std::any &value, StaticType type, const Token &token, const std::string &what) {
+  const auto &id {value.type()};
+  bool matches = (type == StaticType::NUMBER && id == typeid(double)) ||
+                 (type == StaticType::BOOL && id == typeid(bool)) ||
+                 (type == StaticType::STRING && id == typeid(std::string));
+  if (!matches) {
+    throw RuntimeError(token, what + " must be " + TypeChecker::TypeName(type) + ".");
+  }
+}
+
 auto Interpreter::VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any {
-  auto left {Evaluate(expr_ast)};
-  auto right {Evaluate(expr_ast)};
-  auto op {expr_ast->GetOperation()};
-  switch (expr_ast->GetOperation().GetTokenType()) {
+  // 操作数的类型已经被 TypeChecker 证明，不需要守卫
+  switch (expr_ast->GetUnboxed()) {
+    case Unboxed::ARITHMETIC:
+      return EvaluateNumber(*expr_ast);
+    case Unboxed::COMPARISON:
+      return EvaluateBool(*expr_ast);
+    default:
+      break;
+  }
+  auto left {Evaluate(expr_ast->GetLeftExpr())};
+  auto right {Evaluate(expr_ast->GetRightExpr())};
+  // 特化版本的守卫对每个操作数只检查一次类型：any_cast 的指针版本在类型相符时只比较一次 manager 指针，
+  // 之后直接读取。守卫失败时走通用路径并重新特化
+  auto specialization {expr_ast->GetSpecialization()};
+  switch (specialization) {
+    case BinarySpecialization::GENERIC:
+      return EvaluateBinary(expr_ast->GetOperation(), left, right);
+    case BinarySpecialization::UNINITIALIZED:
+      break;
+    case BinarySpecialization::STRING_CONCAT: {
+      const auto *lhs = std::any_cast<std::string>(&left);
+      const auto *rhs = lhs == nullptr ? nullptr : std::any_cast<std::string>(&right);
+      if (rhs != nullptr) {
+        CheckHeap(expr_ast->GetOperation(), lhs->size() + rhs->size());
+        TraceAllocation(expr_ast->GetOperation());
+        AllocationTag::Transient(AllocationKind::STRING, lhs->size() + rhs->size());
+        return *lhs + *rhs;
+      }
+      break;
+    }
+    default: {
+      const auto *lhs = std::any_cast<double>(&left);
+      const auto *rhs = lhs == nullptr ? nullptr : std::any_cast<double>(&right);
+      if (rhs != nullptr) {
+        return EvaluateSpecialized(specialization, *lhs, *rhs);
+      }
+      break;
+    }
+  }
+  expr_ast->Respecialize(Specialize(expr_ast->GetOperation().GetTokenType(), left, right));
+  return EvaluateBinary(expr_ast->GetOperation(), left, right);
+}
+
+auto Interpreter::EvaluateSpecialized(BinarySpecialization specialization, double left, double right) -> std::any {
+  switch (specialization) {
+    case BinarySpecialization::NUMBER_ADD:
+      return left + right;
+    case BinarySpecialization::NUMBER_SUBTRACT:
+      return left - right;
+    case BinarySpecialization::NUMBER_MULTIPLY:
+      return left * right;
+    case BinarySpecialization::NUMBER_DIVIDE:
+      return left / right;
+    case BinarySpecialization::NUMBER_LESS:
+      return left < right;
+    case BinarySpecialization::NUMBER_LESS_EQUAL:
+      return left <= right;
+    case BinarySpecialization::NUMBER_GREATER:
+      return left > right;
+    default:
+      return left >= right;
+  }
+}
+
+// 没有特化版本的运算符返回 GENERIC；有特化版本但这次的操作数类型不对时返回 UNINITIALIZED，算一次 miss
+auto Interpreter::Specialize(TokenType op, const std::any &left, const std::any &right) -> BinarySpecialization {
+  BinarySpecialization number;
+  switch (op) {
+    case TokenType::PLUS:
+      if (left.type() == typeid(std::string) && right.type() == typeid(std::string)) {
+        return BinarySpecialization::STRING_CONCAT;
+      }
+      number = BinarySpecialization::NUMBER_ADD;
+      break;
+    case TokenType::MINUS:
+      number = BinarySpecialization::NUMBER_SUBTRACT;
+      break;
+    case TokenType::STAR:
+      number = BinarySpecialization::NUMBER_MULTIPLY;
+      break;
+    case TokenType::SLASH:
+      number = BinarySpecialization::NUMBER_DIVIDE;
+      break;
+    case TokenType::LESS:
+      number = BinarySpecialization::NUMBER_LESS;
+      break;
+    case TokenType::LESS_EQUAL:
+      number = BinarySpecialization::NUMBER_LESS_EQUAL;
+      break;
+    case TokenType::GREATER:
+      number = BinarySpecialization::NUMBER_GREATER;
+      break;
+    case TokenType::GREATER_EQUAL:
+      number = BinarySpecialization::NUMBER_GREATER_EQUAL;
+      break;
+    default:
+      return BinarySpecialization::GENERIC;
+  }
+  if (left.type() == typeid(double) && right.type() == typeid(double)) {
+    return number;
+  }
+  return BinarySpecialization::UNINITIALIZED;
+}
+
+auto Interpreter::EvaluateBinary(const Token &op, const std::any &left, const std::any &right) -> std::any {
+  switch (op.GetTokenType()) {
     case TokenType::GREATER:
       CheckNumberOperand(op, left, right);
       return std::any_cast<double>(left) > std::any_cast<double>(right);
@@ -74,7 +363,12 @@ auto Interpreter::VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) ->
         return std::any_cast<double>(left) + std::any_cast<double>(right);
       }
       if (left.type() == typeid(std::string) && right.type() == typeid(std::string)) {
-        return std::any_cast<std::string>(left) + std::any_cast<std::string>(right);
+        const auto &lhs = std::any_cast<const std::string &>(left);
+        const auto &rhs = std::any_cast<const std::string &>(right);
+        CheckHeap(op, lhs.size() + rhs.size());
+        TraceAllocation(op);
+        AllocationTag::Transient(AllocationKind::STRING, lhs.size() + rhs.size());
+        return lhs + rhs;
       }
       throw RuntimeError(op, "Operands must be two numbers or two strings");
       break;
@@ -126,6 +420,10 @@ void Interpreter::Interpret(const std::shared_ptr<ExprAST> &expression) {
 }
 
 void Interpreter::Interpret(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  ResetBudget();
+  script_frame_.assign(script_slots_, std::any{nullptr});
+  frame_ = script_frame_.data();
+  upvalues_ = &no_upvalues_;
   try {
   for (const auto& statement : statements) {
     Execute(statement);
@@ -135,23 +433,184 @@ void Interpreter::Interpret(const std::vector<std::shared_ptr<Stmt>> &statements
   }
 }
 
+auto Interpreter::InterpretNext(const std::shared_ptr<Stmt> &statement) -> bool {
+  // Resolver 每处理一条语句都可能增加顶层 frame 的槽位
+  if (script_frame_.size() < static_cast<size_t>(script_slots_)) {
+    script_frame_.resize(script_slots_, std::any{nullptr});
+  }
+  frame_ = script_frame_.data();
+  upvalues_ = &no_upvalues_;
+  try {
+    Execute(statement);
+  } catch (RuntimeError error) {
+    Log::RuntimeError(error);
+    return false;
+  }
+  return true;
+}
+
+void Interpreter::ReloadDeclaration(const std::shared_ptr<Stmt> &declaration, const std::string &name) {
+  std::shared_ptr<LoxClass> old_class;
+  const auto *value {globals_->Find(name)};
+  if (value != nullptr && value->type() == typeid(std::shared_ptr<LoxCallable>)) {
+    old_class = std::dynamic_pointer_cast<LoxClass>(std::any_cast<std::shared_ptr<LoxCallable>>(*value));
+  }
+  // 重载可能发生在任意函数的执行中途，在单独的顶层 frame 上执行声明，结束后恢复
+  std::vector<std::any> frame(script_slots_, std::any{nullptr});
+  auto saved {GetCallFrame()};
+  SetCallFrame({frame.data(), &no_upvalues_, saved.stack_});
+  try {
+    Execute(declaration);
+  } catch (...) {
+    SetCallFrame(saved);
+    throw;
+  }
+  SetCallFrame(saved);
+  if (old_class == nullptr || std::dynamic_pointer_cast<ClassStmt>(declaration) == nullptr) {
+    return;
+  }
+  auto new_class {std::dynamic_pointer_cast<LoxClass>(
+      std::any_cast<std::shared_ptr<LoxCallable>>(*globals_->Find(name)))};
+  old_class->Redefine(*new_class);
+  globals_->Define(name, std::shared_ptr<LoxCallable>(old_class));
+}
+
+void Interpreter::VisitImportStmt(std::shared_ptr<ImportStmt> stmt) {
+  // 这里只绑定模块对象，模块文件在第一次访问成员时才加载
+  DeclareVariable(stmt, stmt->GetName().GetTokenLexeme(), imports_.at(stmt));
+}
+
+auto Interpreter::GetSharedGlobal(const std::string &name) -> std::any {
+  auto separator {name.rfind("::")};
+  if (separator == std::string::npos) {
+    return globals_->Get(Token{TokenType::IDENTIFIER, name, nullptr, 0});
+  }
+  Token member{TokenType::IDENTIFIER, name.substr(separator + 2), nullptr, 0};
+  return GetModuleMember(*ImportModule(name.substr(0, separator)), member);
+}
+
+auto Interpreter::GetModuleMember(LoxModule &module, const Token &name) -> std::any {
+  if (module.GetState() == LoxModule::State::UNLOADED) {
+    if (module_loader_ == nullptr) {
+      throw RuntimeError(name, "Cannot load module " + module.GetPath() + ".");
+    }
+    module.SetState(LoxModule::State::LOADING);
+    try {
+      module_loader_(module, name);
+    } catch (...) {
+      module.SetState(LoxModule::State::FAILED);
+      throw;
+    }
+    module.SetState(LoxModule::State::LOADED);
+  }
+  if (module.GetState() == LoxModule::State::FAILED) {
+    throw RuntimeError(name, "Module " + module.GetPath() + " failed to load.");
+  }
+  const auto *slot {module.FindExport(name.GetTokenLexeme())};
+  if (slot == nullptr) {
+    throw RuntimeError(name, "Undefined property " + name.GetTokenLexeme() + " in module " + module.GetName() + ".");
+  }
+  const auto &value {globals_->At(*slot)};
+  if (!value.has_value()) {
+    throw RuntimeError(name, "Module " + module.GetName() + " has not defined " + name.GetTokenLexeme() +
+                                 " yet (circular import).");
+  }
+  return value;
+}
+
+void Interpreter::ParseBody(const std::shared_ptr<FunctionStmt> &function) {
+  const auto &name {function->GetFunctionName()};
+  if (body_parser_ == nullptr) {
+    throw RuntimeError(name, "Cannot parse body of " + name.GetTokenLexeme() + ".");
+  }
+  body_parser_(function);
+}
+
+auto Interpreter::ParseLazyBodies() -> int {
+  // 出错的函数留在表里，之后的调用直接失败，不会重复报告语法错误
+  auto pending {std::exchange(lazy_functions_, {})};
+  for (const auto &function : pending) {
+    if (function->GetLazyBody() == nullptr) {
+      continue;
+    }
+    try {
+      ParseBody(function);
+    } catch (const RuntimeError &) {
+      lazy_functions_.push_back(function);
+    }
+  }
+  return static_cast<int>(lazy_functions_.size());
+}
+
+void Interpreter::Spawn(const std::string &function, Message argument, std::shared_ptr<LoxChannel> result) {
+  if (isolate_starter_ == nullptr) {
+    throw NativeError("Cannot spawn isolates here.");
+  }
+  isolate_starter_(function, std::move(argument), std::move(result));
+}
+
+auto Interpreter::RunIsolate(const std::string &function, Message argument) -> Message {
+  Token token{TokenType::IDENTIFIER, function, nullptr, 0};
+  try {
+    // spawn 已经检查过 function 是参数不超过一个的全局函数
+    auto callee {std::any_cast<std::shared_ptr<LoxCallable>>(GetSharedGlobal(function))};
+    std::vector<std::any> arguments;
+    if (callee->Arity() == 1) {
+      arguments.push_back(argument.Take(*this));
+    }
+    auto value {CallFunction(callee, arguments, token)};
+    RunEventLoop();
+    return Message::From(*globals_, std::move(value));
+  } catch (const RuntimeError &error) {
+    Log::RuntimeError(error);
+  } catch (const NativeError &error) {
+    Log::RuntimeError(RuntimeError{token, error.what()});
+  }
+  return {};
+}
+
+void Interpreter::ExecuteModule(const LoxModule &module) {
+  // 模块可能在任意函数的执行中途第一次被访问，和 ReloadDeclaration 一样在单独的顶层 frame 上执行
+  std::vector<std::any> frame(module.GetSlotCount(), std::any{nullptr});
+  auto saved {GetCallFrame()};
+  SetCallFrame({frame.data(), &no_upvalues_, saved.stack_});
+  try {
+    for (const auto &statement : module.GetStatements()) {
+      Execute(statement);
+    }
+  } catch (...) {
+    SetCallFrame(saved);
+    throw;
+  }
+  SetCallFrame(saved);
+}
+
+auto Interpreter::FormatNumber(double value, NumberBuffer &buffer) -> std::string_view {
+  // std::to_chars 给出最短的可往返表示，整数值不会带 ".0"
+  auto [end, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+  return {buffer.data(), static_cast<size_t>(end - buffer.data())};
+}
+
 auto Interpreter::StringIfy(const std::any &value) -> std::string {
   if (value.type() == typeid(nullptr)) {
     return "nil";
   }
   if (value.type() == typeid(double)) {
-    auto text {std::any_cast<std::string>(value)};
-    if (text.ends_with(".0")) {
-      text = text.substr(0, text.length() - 2);
-    }
-    return text;
+    NumberBuffer buffer;
+    return std::string{FormatNumber(std::any_cast<double>(value), buffer)};
+  }
+  if (value.type() == typeid(std::shared_ptr<LoxModule>)) {
+    return std::any_cast<const std::shared_ptr<LoxModule> &>(value)->ToString();
+  }
+  if (value.type() == typeid(std::shared_ptr<LoxChannel>)) {
+    return std::any_cast<const std::shared_ptr<LoxChannel> &>(value)->ToString();
   }
   return std::any_cast<std::string>(value);
 }
 
 void Interpreter::VisitIfStmt(std::shared_ptr<IfStmt> stmt) {
   // 对表达式进行求值，如果为真执行then_branch否则执行else_branch
-  if (IsTruthy(Evaluate(stmt->GetConditionExpression()))) {
+  if (EvaluateCondition(stmt->GetConditionExpression())) {
     Execute(stmt->GetThenBranch());
   } else if (stmt->GetElseBranch() != nullptr) {
     Execute(stmt->GetElseBranch());
@@ -159,7 +618,13 @@ void Interpreter::VisitIfStmt(std::shared_ptr<IfStmt> stmt) {
 }
 
 auto Interpreter::VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any {
-  auto left {Evaluate(expr_ast)};
+  if (expr_ast->GetUnboxed() == Unboxed::LOGICAL) {
+    if (expr_ast->GetStaticType() == StaticType::NUMBER) {
+      return EvaluateNumber(*expr_ast);
+    }
+    return EvaluateBool(*expr_ast);
+  }
+  auto left {Evaluate(expr_ast->GetLeftExpr())};
   if (expr_ast->GetToken().GetTokenType() == TokenType::OR) {
     if (IsTruthy(left)) {
       return left;
@@ -174,8 +639,45 @@ auto Interpreter::VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast)
 }
 
 void Interpreter::VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
-  while(IsTruthy(stmt->GetConditionExpr())) {
+  while(EvaluateCondition(stmt->GetConditionExpr())) {
     Execute(stmt->GetWhileBody());
+    if (returning_) {
+      return;
+    }
+    CheckBudget(stmt->GetKeyWord());
+  }
+}
+
+void Interpreter::ResetBudget() {
+  steps_ = 0;
+  next_check_ = 0;
+  if (limits_.timeout_.count() > 0) {
+    deadline_ = std::chrono::steady_clock::now() + limits_.timeout_;
+  }
+}
+
+void Interpreter::CheckLimits(const Token &token) {
+  // 读时钟比较贵，每 kCheckInterval 步才检查一次时间和内存
+  constexpr uint64_t kCheckInterval = 1024;
+  if (limits_.max_steps_ > 0 && steps_ > limits_.max_steps_) {
+    throw ResourceLimitError(token, "Instruction budget of " + std::to_string(limits_.max_steps_) + " exceeded.");
+  }
+  if (limits_.timeout_.count() > 0 && std::chrono::steady_clock::now() > deadline_) {
+    throw ResourceLimitError(token, "Deadline of " + std::to_string(limits_.timeout_.count()) + "ms exceeded.");
+  }
+  CheckHeap(token, 0);
+  if (safe_point_) {
+    safe_point_();
+  }
+  next_check_ = steps_ + kCheckInterval;
+  if (limits_.max_steps_ > 0 && limits_.max_steps_ < next_check_) {
+    next_check_ = limits_.max_steps_ + 1;
+  }
+}
+
+void Interpreter::CheckHeap(const Token &token, size_t extra_bytes) {
+  if (limits_.max_heap_bytes_ > 0 && telemetry.live_heap_bytes_.Get() + extra_bytes > limits_.max_heap_bytes_) {
+    throw ResourceLimitError(token, "Heap limit of " + std::to_string(limits_.max_heap_bytes_) + " bytes exceeded.");
   }
 }
 
@@ -184,113 +686,369 @@ void Interpreter::VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) {
 }
 
 void Interpreter::VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) {
-  auto value {stmt->GetExpr()};
+  auto value {Evaluate(stmt->GetExpr())};
+  if (value.type() == typeid(double)) {
+    NumberBuffer buffer;
+    std::cout << FormatNumber(std::any_cast<double>(value), buffer) << "\n";
+    return;
+  }
   std::cout << StringIfy(value) << "\n";
 }
 
 void Interpreter::Execute(const std::shared_ptr<Stmt> &stmt) {
+  telemetry.statements_.Add();
   stmt->Accept(*this);
 }
 
 void Interpreter::VisitVarStmt(std::shared_ptr<VarStmt> stmt) {
-  std::any value;
+  std::any value{nullptr};
   if (stmt->GetExpr() != nullptr) {
     value = Evaluate(stmt->GetExpr());
   }
-  environment_->Define(stmt->GetName().GetTokenLexeme(), value);
+  if (stmt->GetType() != StaticType::UNKNOWN && !stmt->IsChecked()) {
+    CheckType(value, stmt->GetType(), stmt->GetName(), "Variable '" + stmt->GetName().GetTokenLexeme() + "'");
+  }
+  TraceAllocation(stmt->GetName());
+  DeclareVariable(stmt, stmt->GetName().GetTokenLexeme(), std::move(value));
 }
 
 auto Interpreter::VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any {
   auto value {Evaluate(expr_ast->GetValue())};
-  environment_->Assign(expr_ast->GetName(), value);
+  if (expr_ast->GetGuard() != StaticType::UNKNOWN) {
+    const auto &name {expr_ast->GetName()};
+    CheckType(value, expr_ast->GetGuard(), name, "Variable '" + name.GetTokenLexeme() + "'");
+  }
+  const auto &variable {expr_ast->GetVariable()};
+  if (!variable.has_value()) {
+    // 没有 resolve 的名字由 Assign 报告错误
+    globals_->Assign(expr_ast->GetName(), value);
+  } else if (variable->kind_ == VariableKind::GLOBAL && !ReadVariable(*variable).has_value()) {
+    // 槽位可能是模块的全局变量，不能再按名字找
+    throw RuntimeError(expr_ast->GetName(), "Undefined variable " + expr_ast->GetName().GetTokenLexeme() + ".");
+  } else {
+    WriteVariable(*variable, value);
+  }
   return value;
 }
 
 void Interpreter::VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
-  auto function {std::make_shared<FunctionStmt>(stmt, environment_, false)};
-  environment_->Define(stmt->GetFunctionName().GetTokenLexeme(), function);
+  TraceAllocation(stmt->GetFunctionName());
+  // 先声明再创建闭包，这样函数可以通过 upvalue 递归引用自己
+  DeclareVariable(stmt, stmt->GetFunctionName().GetTokenLexeme(), nullptr);
+  std::shared_ptr<LoxCallable> function {MakeClosure(stmt, false)};
+  AssignDeclared(stmt, stmt->GetFunctionName(), function);
+}
+
+auto Interpreter::MakeClosure(const std::shared_ptr<FunctionStmt> &declaration, bool is_initializer)
+    -> std::shared_ptr<LoxFunction> {
+  const auto &info {functions_.at(declaration)};
+  // 只捕获函数真正用到的外层变量
+  std::vector<UpvaluePtr> upvalues;
+  upvalues.reserve(info.upvalues_.size());
+  for (const auto &upvalue : info.upvalues_) {
+    if (upvalue.is_local_) {
+      upvalues.push_back(std::any_cast<UpvaluePtr>(frame_[upvalue.index_]));
+    } else {
+      upvalues.push_back((*upvalues_)[upvalue.index_]);
+    }
+  }
+  return std::make_shared<LoxFunction>(declaration, &info, std::move(upvalues), is_initializer);
+}
+
+void Interpreter::DeclareVariable(const std::shared_ptr<Stmt> &declaration, const std::string &name, std::any value) {
+  auto iter = declarations_.find(declaration);
+  if (iter == declarations_.end()) {
+    if (auto global {global_declarations_.find(declaration)}; global != global_declarations_.end()) {
+      globals_->Define(global->second, value);
+    } else {
+      globals_->Define(name, value);
+    }
+    return;
+  }
+  auto &slot = frame_[iter->second.index_];
+  if (iter->second.captured_) {
+    // 每次执行声明都新建 Upvalue，循环里创建的闭包各自捕获自己那一次的变量
+    slot = std::make_shared<Upvalue>(Upvalue{std::move(value)});
+  } else {
+    slot = std::move(value);
+  }
+}
+
+void Interpreter::AssignDeclared(const std::shared_ptr<Stmt> &declaration, const Token &name, std::any value) {
+  auto iter = declarations_.find(declaration);
+  if (iter == declarations_.end()) {
+    if (auto global {global_declarations_.find(declaration)}; global != global_declarations_.end()) {
+      globals_->At(global->second) = std::move(value);
+    } else {
+      globals_->Assign(name, value);
+    }
+    return;
+  }
+  WriteSlot(frame_[iter->second.index_], std::move(value));
 }
 
 void Interpreter::VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
-  std::any value;
-  if (stmt->GetReturnValue() != nullptr) {
-    value = Evaluate(stmt->GetReturnValue());
+  if (tail_calls_.contains(stmt)) {
+    // return f(...) 在尾部：求值被调函数和参数后交给外层的 LoxFunction::Call 循环执行，C++ 栈不再增长
+    auto call {std::static_pointer_cast<CallExprAST>(stmt->GetReturnValue())};
+    auto callee {Evaluate(call->GetCallee())};
+    std::vector<std::any> arguments;
+    for (const auto &argument : call->GetArguments()) {
+      arguments.emplace_back(Evaluate(argument));
+    }
+    auto function {CheckCallee(callee, arguments.size(), call->GetToken())};
+    auto lox_function {std::dynamic_pointer_cast<LoxFunction>(function)};
+    if (lox_function != nullptr && !lox_function->IsInitializer()) {
+      tail_call_ = TailCall{std::move(lox_function), std::move(arguments), &call->GetToken()};
+      returning_ = true;
+      return;
+    }
+    return_value_ = CallFunction(function, arguments, call->GetToken());
+    returning_ = true;
+    return;
   }
-  throw Return(value);
+  return_value_ = stmt->GetReturnValue() == nullptr ? std::any{nullptr} : Evaluate(stmt->GetReturnValue());
+  returning_ = true;
 }
 
-void Interpreter::ExecuteBlock(const std::vector<std::shared_ptr<Stmt>> &statements, const std::shared_ptr<Environment> &env) {
-  auto previous = this->environment_;
-  try {
-    this->environment_ = env;
-    for (const auto &statement : statements) {
-      Execute(statement);
+void Interpreter::ExecuteBlock(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  for (const auto &statement : statements) {
+    Execute(statement);
+    if (returning_) {
+      return;
     }
+  }
+}
+
+void Interpreter::ExecuteFunction(const std::vector<std::shared_ptr<Stmt>> &statements, std::any *frame,
+                                  const std::vector<UpvaluePtr> *upvalues) {
+  auto previous {GetCallFrame()};
+  frame_ = frame;
+  upvalues_ = upvalues;
+  try {
+    ExecuteBlock(statements);
   } catch(...) {
-    this->environment_ = previous;
+    SetCallFrame(previous);
     throw;
   }
-  this->environment_ = previous;
+  SetCallFrame(previous);
 }
 
 auto Interpreter::VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any {
-  auto callee {Evaluate(expr_ast->GetCallee())};
-  std::vector<std::any> arguments;
-  for (const auto &argument : expr_ast->GetArguments()) {
-    arguments.emplace_back(Evaluate(argument));
+  // 被调用的通常是变量，直接取出它保存的 shared_ptr，不复制 std::any (shared_ptr 放不进 std::any 的内联存储，复制要分配内存)
+  const auto &callee_expr {expr_ast->GetCallee()};
+  const std::any *callee = nullptr;
+  if (auto *variable = dynamic_cast<VarExprAST *>(callee_expr.get()); variable != nullptr) {
+    callee = FindVariable(variable->GetToken(), variable->GetVariable());
+  }
+  std::any callee_value;
+  if (callee == nullptr) {
+    callee_value = Evaluate(callee_expr);
+    callee = &callee_value;
+  }
+  std::shared_ptr<LoxCallable> function;
+  if (const auto *callable = std::any_cast<std::shared_ptr<LoxCallable>>(callee); callable != nullptr) {
+    function = *callable;
+  } else if (callee != &callee_value) {
+    callee_value = *callee;
+    callee = &callee_value;
+  }
+
+  // 参数在值栈上求值，嵌套调用的参数和 frame 分配在它们上面
+  const auto &arguments {expr_ast->GetArguments()};
+  auto &stack {*stack_};
+  ValueStack::Mark mark{stack};
+  auto *values = stack.Allocate(arguments.size());
+  if (values == nullptr) {
+    throw RuntimeError{expr_ast->GetToken(), "Stack overflow."};
+  }
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    values[i] = Evaluate(arguments[i]);
+  }
+  if (function == nullptr) {
+    function = CheckCallee(*callee, arguments.size(), expr_ast->GetToken());
+  }
+  if (auto *target {expr_ast->GetInlineTarget()}; target != nullptr && MatchInline(*target, function)) {
+    return EvaluateInline(*target, values, expr_ast->GetToken());
+  }
+  CheckArity(*function, arguments.size(), expr_ast->GetToken());
+  return CallFunction(function, {values, arguments.size()}, expr_ast->GetToken());
+}
+
+auto Interpreter::MatchInline(InlineTarget &target, const std::shared_ptr<LoxCallable> &function) -> bool {
+  if (function == target.verified_) {
+    return true;
+  }
+  auto *lox_function {dynamic_cast<LoxFunction *>(function.get())};
+  if (lox_function == nullptr || lox_function->GetDeclaration() != target.declaration_) {
+    return false;
+  }
+  target.verified_ = function;
+  return true;
+}
+
+auto Interpreter::EvaluateInline(const InlineTarget &target, std::any *arguments, const Token &token) -> std::any {
+  CheckBudget(token);
+  telemetry.calls_.Add();
+  const auto &declaration {*target.declaration_};
+  const auto &param_types {declaration.GetParamTypes()};
+  for (size_t i = 0; i < param_types.size(); ++i) {
+    if (param_types[i] != StaticType::UNKNOWN) {
+      const auto &param {declaration.GetFunctionParams()[i]};
+      CheckType(arguments[i], param_types[i], param, "Parameter '" + param.GetTokenLexeme() + "'");
+    }
+  }
+  auto previous {GetCallFrame()};
+  SetCallFrame({arguments, &no_upvalues_, stack_});
+  std::any result;
+  try {
+    result = Evaluate(target.body_);
+  } catch (...) {
+    SetCallFrame(previous);
+    throw;
+  }
+  SetCallFrame(previous);
+  if (declaration.GetReturnType() != StaticType::UNKNOWN) {
+    CheckType(result, declaration.GetReturnType(), declaration.GetFunctionName(), "Return value");
+  }
+  return result;
+}
+
+auto Interpreter::CheckCallee(const std::any &callee, size_t argument_count, const Token &token)
+    -> std::shared_ptr<LoxCallable> {
+  if (callee.type() != typeid(std::shared_ptr<LoxCallable>)) {
+    throw RuntimeError{token, "Can only call functions and classes."};
+  }
+  auto function {std::any_cast<std::shared_ptr<LoxCallable>>(callee)};
+  CheckArity(*function, argument_count, token);
+  return function;
+}
+
+void Interpreter::CheckArity(LoxCallable &function, size_t argument_count, const Token &token) {
+  if (argument_count != function.Arity()) {
+    std::string message = "Expected ";
+    message += (std::to_string(function.Arity()) + " arguments but got " + std::to_string(argument_count) + ".");
+    throw RuntimeError{token, message};
   }
-  if (callee.type() == typeid(LoxCallable)) {
-    throw RuntimeError{expr_ast->GetToken(), "Can only call functions and classes."};
+}
+
+auto Interpreter::CallFunction(const std::shared_ptr<LoxCallable> &function, std::span<std::any> arguments,
+                               const Token &token) -> std::any {
+  CheckBudget(token);
+  TraceAllocation(token);
+  if (limits_.max_call_depth_ > 0 && call_depth_ >= limits_.max_call_depth_) {
+    throw ResourceLimitError{token, "Maximum call depth of " + std::to_string(limits_.max_call_depth_) + " exceeded."};
   }
-  auto function {std::any_cast<LoxFunction>(callee)};
-  if (arguments.size() != function.Arity()) {
-    std::string message = "Expected "; 
-    message += (std::to_string(function.Arity()) + " arguments but got " + std::to_string(arguments.size()) + ".");
-    throw RuntimeError{expr_ast->GetToken(), message};
+  if (!LoxCoroutine::HasStackRoom()) {
+    throw RuntimeError{token, "Stack overflow in coroutine."};
+  }
+  struct DepthGuard {
+    int &depth_;
+    explicit DepthGuard(int &depth) : depth_(++depth) {}
+    ~DepthGuard() { --depth_; }
+  } guard{call_depth_};
+  telemetry.calls_.Add();
+  try {
+    if (!function->IsNative()) {
+      return function->Call(*this, arguments);
+    }
+    // 原生函数正常返回和抛出异常都计时
+    struct NativeTimer {
+      std::chrono::steady_clock::time_point start_{std::chrono::steady_clock::now()};
+      ~NativeTimer() {
+        std::chrono::duration<double> elapsed {std::chrono::steady_clock::now() - start_};
+        telemetry.native_seconds_.Observe(elapsed.count());
+      }
+    } timer;
+    telemetry.native_calls_.Add();
+    return function->Call(*this, arguments);
+  } catch (const NativeError &error) {
+    throw RuntimeError{token, error.what()};
   }
-  return function.Call(*this, arguments);
 }
 
-void Interpreter::Resolve(const std::shared_ptr<ExprAST> &expr, int depth) {
-  locals_[expr] = depth;
+auto Interpreter::LookUpVariable(const Token &name, const std::optional<VariableRef> &variable) -> std::any {
+  if (!variable.has_value()) {
+    return globals_->Get(name);
+  }
+  const auto &value {ReadVariable(*variable)};
+  if (!value.has_value()) {
+    throw RuntimeError(name, "Undefined variable " + name.GetTokenLexeme() + ".");
+  }
+  return value;
 }
 
-auto Interpreter::LookUpVariable(const Token &name, const std::shared_ptr<ExprAST> &expr) -> std::any {
-  if (locals_.contains(expr)) {
-    return environment_->GetAt(locals_[expr], name.GetTokenLexeme());
-  }      
-  return globals_->Get(name);
+auto Interpreter::FindVariable(const Token &name, const std::optional<VariableRef> &variable) -> const std::any * {
+  if (!variable.has_value()) {
+    return globals_->Find(name.GetTokenLexeme());
+  }
+  const auto &value {ReadVariable(*variable)};
+  return value.has_value() ? &value : nullptr;
+}
+
+auto Interpreter::ReadVariable(VariableRef ref) -> const std::any & {
+  switch (ref.kind_) {
+    case VariableKind::LOCAL:
+      return ReadSlot(frame_[ref.index_]);
+    case VariableKind::UPVALUE:
+      return (*upvalues_)[ref.index_]->value_;
+    default:
+      return globals_->At(ref.index_);
+  }
+}
+
+void Interpreter::WriteVariable(VariableRef ref, std::any value) {
+  switch (ref.kind_) {
+    case VariableKind::LOCAL:
+      WriteSlot(frame_[ref.index_], std::move(value));
+      break;
+    case VariableKind::UPVALUE:
+      (*upvalues_)[ref.index_]->value_ = std::move(value);
+      break;
+    default:
+      globals_->At(ref.index_) = std::move(value);
+      break;
+  }
 }
 
 void Interpreter::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
-  std::any supper_class;
+  TraceAllocation(stmt->GetClassName());
+  std::shared_ptr<LoxClass> supper_class;
   if (stmt->GetSupperClass() != nullptr) {
-    supper_class = Evaluate(stmt->GetSupperClass());
-    if (supper_class.type() != typeid(LoxClass)) {
+    auto value {Evaluate(stmt->GetSupperClass())};
+    if (value.type() == typeid(std::shared_ptr<LoxCallable>)) {
+      supper_class = std::dynamic_pointer_cast<LoxClass>(std::any_cast<std::shared_ptr<LoxCallable>>(value));
+    }
+    if (supper_class == nullptr) {
       throw RuntimeError{stmt->GetSupperClass()->GetToken(), "Supper class must be a class"};
     }
   }
-  environment_->Define(stmt->GetClassName().GetTokenLexeme(), {});
-  if (stmt->GetSupperClass() != nullptr) {
-    environment_ = std::make_shared<Environment>(environment_);
-    environment_->Defind("super", supper_class);
+  DeclareVariable(stmt, stmt->GetClassName().GetTokenLexeme(), nullptr);
+  if (supper_class != nullptr) {
+    // super 放在类声明所在 frame 的槽位里，方法通过 upvalue 捕获它
+    auto slot {super_slots_.find(stmt)};
+    if (slot != super_slots_.end()) {
+      frame_[slot->second.index_] = slot->second.captured_
+                                        ? std::any{std::make_shared<Upvalue>(Upvalue{std::any{supper_class}})}
+                                        : std::any{supper_class};
+    }
   }
   std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
   for (const auto &method : stmt->GetClassMethods()) {
     bool is_init = (method->GetFunctionName().GetTokenLexeme() == "init");
-    auto function {std::make_shared<LoxFunction>(method, environment_, is_init)};
-    methods[method->GetFunctionName().GetTokenLexeme()] = function;
+    methods[method->GetFunctionName().GetTokenLexeme()] = MakeClosure(method, is_init);
   }
-  auto supper_class_ptr = std::any_cast<std::shared_ptr<VarExprAST>>(supper_class);
-  std::shared_ptr<LoxClass> klass = std::make_shared<LoxClass>(stmt->GetClassName().GetTokenLexeme(),supper_class_ptr, methods);
-  if (supper_class_ptr != nullptr) {
-    environment_ = environment_.enclosing_;
-  }
-  environment_->Assign(stmt->GetClassName(), std::move(klass));
+  std::shared_ptr<LoxCallable> klass {
+      std::make_shared<LoxClass>(stmt->GetClassName().GetTokenLexeme(), supper_class, methods)};
+  AssignDeclared(stmt, stmt->GetClassName(), std::move(klass));
 }
 
 auto Interpreter::VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any {
   auto object {Evaluate(expr_ast->GetObject())};
+  TraceAllocation(expr_ast->GetName());
+  if (object.type() == typeid(std::shared_ptr<LoxModule>)) {
+    return GetModuleMember(*std::any_cast<const std::shared_ptr<LoxModule> &>(object), expr_ast->GetName());
+  }
   if (object.type() == typeid(LoxInstance)) {
     return std::any_cast<LoxInstance>(object).Get(expr_ast->GetName());
   }
@@ -299,6 +1057,9 @@ auto Interpreter::VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::
 
 auto Interpreter::VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any {
   auto object {Evaluate(expr_ast->GetSetObject())};
+  if (object.type() == typeid(std::shared_ptr<LoxModule>)) {
+    throw RuntimeError{expr_ast->GetSetName(), "Module members are read-only."};
+  }
   if (object.type() != typeid(LoxInstance)) {
     throw RuntimeError{expr_ast->GetSetName(), "Only instances have fileds."};
   }
@@ -308,18 +1069,18 @@ auto Interpreter::VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::
 }
 
 auto Interpreter::VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any {
-  return LookUpVariable(expr_ast->GetThisKeyWord(), expr_ast);
+  return LookUpVariable(expr_ast->GetThisKeyWord(), expr_ast->GetVariable());
 }
 
 auto Interpreter::VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any {
-  int distance = locals_.Get(expr_ast);
-  auto supper_class = std::any_cast<std::shared_ptr<LoxClass>>(environment_.GetAt(distance, "super"));
-  auto object = std::any_cast<std::shared_ptr<LoxInstance>>(environment_.GetAt(distance - 1, "this"));
-  auto method = supper_class.FindMethod(expr_ast->GetSuperMethod().GetTokenLexeme());
+  const auto &[super_ref, this_ref] = super_refs_.at(expr_ast);
+  auto supper_class = std::any_cast<std::shared_ptr<LoxClass>>(ReadVariable(super_ref));
+  auto object = std::any_cast<std::shared_ptr<LoxInstance>>(ReadVariable(this_ref));
+  auto method = supper_class->FindMethod(expr_ast->GetSuperMethod().GetTokenLexeme());
   if (method == nullptr) {
     throw RuntimeError{expr_ast->GetSuperMethod(), "Undefined property " + expr_ast->GetSuperMethod().GetTokenLexeme() + "."};
   }
-  return method->Bind(object);
+  return std::shared_ptr<LoxCallable>{method->Bind(object)};
 }
 
 }  // namespace cpplox
\ No newline at end of file
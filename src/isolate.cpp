@@ -0,0 +1,280 @@
+#include "isolate.h"
+#include <algorithm>
+#include <any>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "interpreter.h"
+#include "lox_callable.h"
+#include "lox_class.h"
+#include "lox_function.h"
+#include "lox_instance.h"
+#include "runtime_error.h"
+
+namespace cpplox {
+
+namespace {
+
+// 当前线程所在的池，不是池里的线程时为 nullptr
+thread_local IsolatePool *current_pool{nullptr};
+
+// 函数和类声明时的名字，原生函数没有
+auto DeclaredName(const LoxCallable &callable) -> std::string {
+  if (const auto *function = dynamic_cast<const LoxFunction *>(&callable); function != nullptr) {
+    return function->GetDeclaration()->GetFunctionName().GetTokenLexeme();
+  }
+  if (const auto *klass = dynamic_cast<const LoxClass *>(&callable); klass != nullptr) {
+    return klass->GetName();
+  }
+  return {};
+}
+
+}  // namespace
+
+class MessageWriter {
+public:
+  MessageWriter(Environment &globals, Message &message) : globals_(globals), message_(message) {}
+
+  auto Write(const std::any &value) -> Message::Value {
+    if (!value.has_value() || value.type() == typeid(nullptr)) {
+      return nullptr;
+    }
+    if (value.type() == typeid(bool)) {
+      return std::any_cast<bool>(value);
+    }
+    if (value.type() == typeid(double)) {
+      return std::any_cast<double>(value);
+    }
+    if (value.type() == typeid(std::string)) {
+      return std::any_cast<const std::string &>(value);
+    }
+    if (value.type() == typeid(std::shared_ptr<LoxChannel>)) {
+      return std::any_cast<const std::shared_ptr<LoxChannel> &>(value);
+    }
+    if (value.type() == typeid(std::shared_ptr<LoxInstance>)) {
+      return WriteInstance(std::any_cast<const std::shared_ptr<LoxInstance> &>(value));
+    }
+    if (value.type() == typeid(std::shared_ptr<LoxCallable>)) {
+      const auto &callable {*std::any_cast<const std::shared_ptr<LoxCallable> &>(value)};
+      auto name {Name(callable)};
+      if (name.empty()) {
+        throw NativeError("Only global functions and classes can be sent to another isolate.");
+      }
+      return Message::GlobalRef{std::move(name)};
+    }
+    throw NativeError("Value cannot be sent to another isolate.");
+  }
+
+private:
+  auto WriteInstance(const std::shared_ptr<LoxInstance> &instance) -> Message::Value {
+    if (auto iter {instance_ids_.find(instance.get())}; iter != instance_ids_.end()) {
+      return Message::InstanceRef{iter->second};
+    }
+    const auto &klass {instance->GetClass()};
+    auto name {Name(*klass)};
+    if (name.empty()) {
+      throw NativeError("Cannot send instance of local class " + klass->GetName() + " to another isolate.");
+    }
+    auto index {message_.instances_.size()};
+    instance_ids_.emplace(instance.get(), index);
+    message_.instances_.push_back({std::move(name), {}});
+    // 写字段时还会追加实例，先写到局部变量里
+    std::vector<std::pair<std::string, Message::Value>> fields;
+    for (const auto &[field, value] : instance->GetFields()) {
+      fields.emplace_back(field, Write(value));
+    }
+    message_.instances_[index].fields_ = std::move(fields);
+    return Message::InstanceRef{index};
+  }
+
+  auto Name(const LoxCallable &callable) -> const std::string & {
+    auto [iter, inserted] = names_.try_emplace(&callable);
+    if (inserted) {
+      iter->second = Message::GlobalName(globals_, callable);
+    }
+    return iter->second;
+  }
+
+  Environment &globals_;
+  Message &message_;
+  std::unordered_map<const LoxInstance *, size_t> instance_ids_;
+  std::unordered_map<const LoxCallable *, std::string> names_;
+};
+
+class MessageReader {
+public:
+  MessageReader(Interpreter &interpreter, Message &message) : interpreter_(interpreter), message_(message) {}
+
+  // 先创建所有实例再填字段，字段可以引用后面的实例
+  auto Read() -> std::any {
+    instances_.reserve(message_.instances_.size());
+    for (const auto &instance : message_.instances_) {
+      auto klass {std::dynamic_pointer_cast<LoxClass>(Global(instance.class_))};
+      if (klass == nullptr) {
+        throw NativeError(instance.class_ + " is not a class in the receiving isolate.");
+      }
+      instances_.push_back(std::make_shared<LoxInstance>(klass));
+    }
+    for (size_t i = 0; i < instances_.size(); ++i) {
+      for (auto &[field, value] : message_.instances_[i].fields_) {
+        instances_[i]->SetField(std::move(field), Read(value));
+      }
+    }
+    return Read(message_.root_);
+  }
+
+private:
+  auto Read(Message::Value &value) -> std::any {
+    if (const auto *flag = std::get_if<bool>(&value)) {
+      return *flag;
+    }
+    if (const auto *number = std::get_if<double>(&value)) {
+      return *number;
+    }
+    if (auto *string = std::get_if<std::string>(&value)) {
+      return std::move(*string);
+    }
+    if (const auto *channel = std::get_if<std::shared_ptr<LoxChannel>>(&value)) {
+      return *channel;
+    }
+    if (const auto *global = std::get_if<Message::GlobalRef>(&value)) {
+      return Global(global->name_);
+    }
+    if (const auto *instance = std::get_if<Message::InstanceRef>(&value)) {
+      return instances_[instance->index_];
+    }
+    return nullptr;
+  }
+
+  // 模块的成员要经过 GetModuleMember，接收方可能还没有加载这个模块
+  auto Global(const std::string &name) -> std::shared_ptr<LoxCallable> {
+    std::any value;
+    try {
+      value = interpreter_.GetSharedGlobal(name);
+    } catch (const RuntimeError &error) {
+      throw NativeError(error.what());
+    }
+    if (value.type() != typeid(std::shared_ptr<LoxCallable>)) {
+      throw NativeError("Undefined global " + name + " in the receiving isolate.");
+    }
+    return std::any_cast<std::shared_ptr<LoxCallable>>(std::move(value));
+  }
+
+  Interpreter &interpreter_;
+  Message &message_;
+  std::vector<std::shared_ptr<LoxInstance>> instances_;
+};
+
+auto Message::From(Environment &globals, std::any value) -> Message {
+  Message message;
+  if (value.type() == typeid(std::string)) {
+    message.root_ = std::move(*std::any_cast<std::string>(&value));
+    return message;
+  }
+  message.root_ = MessageWriter(globals, message).Write(value);
+  return message;
+}
+
+auto Message::Take(Interpreter &interpreter) -> std::any { return MessageReader(interpreter, *this).Read(); }
+
+// 同一个对象可能还保存在别的全局变量里 (var g = f;)，isolate 只执行声明，所以要找声明它的那个槽位：
+// 名字和声明的名字相同，或者是模块里的 "path::name"
+auto Message::GlobalName(Environment &globals, const LoxCallable &callable) -> std::string {
+  auto declared {DeclaredName(callable)};
+  for (int slot = 0; slot < globals.SlotCount(); ++slot) {
+    const auto &value {globals.At(slot)};
+    if (value.type() != typeid(std::shared_ptr<LoxCallable>) ||
+        std::any_cast<const std::shared_ptr<LoxCallable> &>(value).get() != &callable) {
+      continue;
+    }
+    const auto &name {globals.GetName(slot)};
+    if (declared.empty() || name == declared || name.ends_with("::" + declared)) {
+      return name;
+    }
+  }
+  return {};
+}
+
+auto LoxChannel::Receive() -> Message {
+  std::unique_lock lock{mutex_};
+  if (messages_.empty()) {
+    IsolatePool::BeginBlocking();
+    ready_.wait(lock, [this] { return !messages_.empty(); });
+    IsolatePool::EndBlocking();
+  }
+  auto message {std::move(messages_.front())};
+  messages_.pop_front();
+  return message;
+}
+
+IsolatePool::IsolatePool() : concurrency_(std::max(1U, std::thread::hardware_concurrency())) {}
+
+auto IsolatePool::Shared() -> IsolatePool & {
+  // 线程一直运行到进程退出，池也不销毁
+  static auto *pool {new IsolatePool()};
+  return *pool;
+}
+
+void IsolatePool::Submit(std::function<void()> task) {
+  std::lock_guard lock{mutex_};
+  tasks_.push_back(std::move(task));
+  Grow();
+  work_.notify_one();
+}
+
+void IsolatePool::Wait() {
+  std::unique_lock lock{mutex_};
+  done_.wait(lock, [this] { return tasks_.empty() && running_ == 0; });
+}
+
+void IsolatePool::BeginBlocking() {
+  if (current_pool == nullptr) {
+    return;
+  }
+  std::lock_guard lock{current_pool->mutex_};
+  ++current_pool->blocked_;
+  current_pool->Grow();
+}
+
+void IsolatePool::EndBlocking() {
+  if (current_pool == nullptr) {
+    return;
+  }
+  std::lock_guard lock{current_pool->mutex_};
+  --current_pool->blocked_;
+}
+
+void IsolatePool::Grow() {
+  // 空闲的线程不够取走排队的 isolate，并且没在等待消息的线程少于核数
+  while (tasks_.size() > idle_ && threads_ - blocked_ < concurrency_) {
+    ++threads_;
+    ++idle_;
+    std::thread([this] { Work(); }).detach();
+  }
+}
+
+void IsolatePool::Work() {
+  current_pool = this;
+  std::unique_lock lock{mutex_};
+  for (;;) {
+    work_.wait(lock, [this] { return !tasks_.empty(); });
+    auto task {std::move(tasks_.front())};
+    tasks_.pop_front();
+    --idle_;
+    ++running_;
+    lock.unlock();
+    task();
+    lock.lock();
+    --running_;
+    ++idle_;
+    if (tasks_.empty() && running_ == 0) {
+      done_.notify_all();
+    }
+  }
+}
+
+}  // namespace cpplox
@@ -0,0 +1,532 @@
+#include "jit.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "environment.h"
+#include "interpreter.h"
+#include "lox_callable.h"
+#include "lox_coroutine.h"
+#include "stmt.h"
+
+namespace cpplox {
+
+namespace {
+
+// 只实现 JIT 用到的几条指令。double 放在 xmm0/xmm1，局部变量槽位 i 在 [rbp - 8 * (i + 1)]。
+// rsi 始终指向递归深度的计数，生成的代码不会改写它
+class Assembler {
+public:
+  using Label = size_t;
+
+  auto NewLabel() -> Label {
+    labels_.push_back(kUnbound);
+    return labels_.size() - 1;
+  }
+  void Bind(Label label) { labels_[label] = code_.size(); }
+  auto Finish() -> std::vector<uint8_t> {
+    for (auto [position, label] : fixups_) {
+      Patch32(position, static_cast<int32_t>(labels_[label] - (position + 4)));
+    }
+    return std::move(code_);
+  }
+
+  // 进入函数时先扣掉一层递归深度，用完时跳到 overflow
+  void CheckDepth(Label overflow) {
+    Emit({0x48, 0x83, 0x2E, 0x01});  // sub qword [rsi], 1
+    JumpIf(SIGN, overflow);
+  }
+  // 放弃执行：depth 写成一个很大的负数，逐层返回时加回去的层数不会让它变成非负
+  void Overflow() {
+    Emit({0x48, 0xB8});  // mov rax, imm64
+    for (int shift = 0; shift < 64; shift += 8) {
+      code_.push_back(static_cast<uint8_t>(static_cast<uint64_t>(kOverflowDepth) >> shift));
+    }
+    Emit({0x48, 0x89, 0x06, 0xC3});  // mov [rsi], rax; ret
+  }
+  // 递归调用返回后 depth 为负说明已经放弃执行，直接返回
+  void CheckOverflow(Label epilogue) {
+    Emit({0x48, 0x83, 0x3E, 0x00});  // cmp qword [rsi], 0
+    JumpIf(SIGN, epilogue);
+  }
+  static constexpr int64_t kOverflowDepth = std::numeric_limits<int64_t>::min() / 2;
+
+  void Prologue(int frame_bytes) {
+    Emit({0x55});              // push rbp
+    Emit({0x48, 0x89, 0xE5});  // mov rbp, rsp
+    Emit({0x48, 0x81, 0xEC});  // sub rsp, imm32
+    Emit32(frame_bytes);
+  }
+  void Epilogue() { Emit({0x48, 0x83, 0x06, 0x01, 0xC9, 0xC3}); }  // add qword [rsi], 1; leave; ret
+
+  // movsd xmm0, [rdi + 8 * index]
+  void LoadArgument(int index) {
+    Emit({0xF2, 0x0F, 0x10, 0x87});
+    Emit32(8 * index);
+  }
+  // movsd xmm0, [rbp + disp32]
+  void LoadSlot(int slot) {
+    Emit({0xF2, 0x0F, 0x10, 0x85});
+    Emit32(SlotOffset(slot));
+  }
+  // movsd [rbp + disp32], xmm0
+  void StoreSlot(int slot) {
+    Emit({0xF2, 0x0F, 0x11, 0x85});
+    Emit32(SlotOffset(slot));
+  }
+  // mov rax, imm64; movq xmm0, rax
+  void LoadConstant(double value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    Emit({0x48, 0xB8});
+    for (int shift = 0; shift < 64; shift += 8) {
+      code_.push_back(static_cast<uint8_t>(bits >> shift));
+    }
+    Emit({0x66, 0x48, 0x0F, 0x6E, 0xC0});
+  }
+  // sub rsp, 8; movsd [rsp], xmm0
+  void Push() {
+    Emit({0x48, 0x83, 0xEC, 0x08, 0xF2, 0x0F, 0x11, 0x04, 0x24});
+    max_pushed_ = std::max(max_pushed_, ++pushed_);
+  }
+  // movapd xmm1, xmm0; movsd xmm0, [rsp]; add rsp, 8
+  void PopLeft() {
+    Emit({0x66, 0x0F, 0x28, 0xC8, 0xF2, 0x0F, 0x10, 0x04, 0x24, 0x48, 0x83, 0xC4, 0x08});
+    --pushed_;
+  }
+  // 同时压在栈上的 double 最多有几个
+  auto MaxPushed() const -> int { return max_pushed_; }
+  void Add() { Emit({0xF2, 0x0F, 0x58, 0xC1}); }       // addsd xmm0, xmm1
+  void Subtract() { Emit({0xF2, 0x0F, 0x5C, 0xC1}); }  // subsd xmm0, xmm1
+  void Multiply() { Emit({0xF2, 0x0F, 0x59, 0xC1}); }  // mulsd xmm0, xmm1
+  void Divide() { Emit({0xF2, 0x0F, 0x5E, 0xC1}); }    // divsd xmm0, xmm1
+  // 翻转符号位：mov rax, 0x8000000000000000; movq xmm1, rax; xorpd xmm0, xmm1
+  void Negate() {
+    Emit({0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0x80});
+    Emit({0x66, 0x48, 0x0F, 0x6E, 0xC8, 0x66, 0x0F, 0x57, 0xC1});
+  }
+  void Compare() { Emit({0x66, 0x0F, 0x2E, 0xC1}); }         // ucomisd xmm0, xmm1
+  void CompareSwapped() { Emit({0x66, 0x0F, 0x2E, 0xC8}); }  // ucomisd xmm1, xmm0
+
+  // 调用自己：参数已经压在栈上，rsp 指向第一个参数
+  void CallSelf(int argument_count) {
+    Emit({0x48, 0x89, 0xE7});  // mov rdi, rsp
+    code_.push_back(0xE8);     // call rel32
+    Emit32(-static_cast<int32_t>(code_.size() + 4));
+    if (argument_count > 0) {
+      Emit({0x48, 0x81, 0xC4});  // add rsp, imm32
+      Emit32(8 * argument_count);
+    }
+    pushed_ -= argument_count;
+  }
+
+  enum Condition : uint8_t { BELOW = 0x82, ABOVE_EQUAL = 0x83, EQUAL = 0x84, NOT_EQUAL = 0x85, BELOW_EQUAL = 0x86,
+                             ABOVE = 0x87, SIGN = 0x88, PARITY = 0x8A, NOT_PARITY = 0x8B };
+  void Jump(Label label) {
+    code_.push_back(0xE9);
+    EmitLabel(label);
+  }
+  void JumpIf(Condition condition, Label label) {
+    Emit({0x0F, condition});
+    EmitLabel(label);
+  }
+
+private:
+  static constexpr size_t kUnbound = static_cast<size_t>(-1);
+
+  static auto SlotOffset(int slot) -> int32_t { return -8 * (slot + 1); }
+  void Emit(std::initializer_list<uint8_t> bytes) { code_.insert(code_.end(), bytes); }
+  void Emit32(int32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      code_.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> shift));
+    }
+  }
+  void EmitLabel(Label label) {
+    fixups_.emplace_back(code_.size(), label);
+    Emit32(0);
+  }
+  void Patch32(size_t position, int32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code_[position + i] = static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i));
+    }
+  }
+
+  std::vector<uint8_t> code_;
+  std::vector<size_t> labels_;
+  std::vector<std::pair<size_t, Label>> fixups_;
+  int pushed_{0};
+  int max_pushed_{0};
+};
+
+// 遇到不支持的节点时抛出，整个函数退回解释执行
+class Unsupported {};
+
+}  // namespace
+
+// 表达式的值总是留在 xmm0；比较和逻辑运算只能出现在条件里，直接编译成跳转
+class JitCompiler : public ExprASTVisitor, public StmtVisitor {
+public:
+  JitCompiler(Interpreter &interpreter, const std::shared_ptr<FunctionStmt> &declaration, const FunctionInfo &info)
+      : interpreter_(interpreter), declaration_(declaration), info_(info) {}
+
+  auto Compile() -> std::optional<std::vector<uint8_t>> {
+    auto body {declaration_->GetFunctionBody()};
+    // 只处理所有路径都以 return 结束的函数，省去返回 nil 的情况
+    if (info_.has_receiver_ || !info_.captured_params_.empty() || !info_.upvalues_.empty() || !AlwaysReturns(body)) {
+      return std::nullopt;
+    }
+    try {
+      epilogue_ = assembler_.NewLabel();
+      auto overflow {assembler_.NewLabel()};
+      assembler_.CheckDepth(overflow);
+      frame_bytes_ = (8 * info_.slot_count_ + 15) / 16 * 16;
+      assembler_.Prologue(frame_bytes_);
+      auto arity {declaration_->GetFunctionParams().size()};
+      for (size_t i = 0; i < arity; ++i) {
+        assembler_.LoadArgument(static_cast<int>(i));
+        assembler_.StoreSlot(static_cast<int>(i));
+      }
+      for (const auto &stmt : body) {
+        stmt->Accept(*this);
+      }
+      assembler_.Bind(epilogue_);
+      assembler_.Epilogue();
+      assembler_.Bind(overflow);
+      assembler_.Overflow();
+    } catch (const Unsupported &) {
+      return std::nullopt;
+    }
+    return assembler_.Finish();
+  }
+  auto IsSelfRecursive() const -> bool { return self_recursive_; }
+  // 返回地址、rbp、局部变量和压栈的临时值
+  auto FrameBytes() const -> size_t { return 16 + frame_bytes_ + 8 * assembler_.MaxPushed(); }
+
+  auto VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any override {
+    Value(expr_ast->GetLeftExpr());
+    assembler_.Push();
+    Value(expr_ast->GetRightExpr());
+    assembler_.PopLeft();
+    switch (expr_ast->GetOperation().GetTokenType()) {
+      case TokenType::PLUS:
+        assembler_.Add();
+        break;
+      case TokenType::MINUS:
+        assembler_.Subtract();
+        break;
+      case TokenType::STAR:
+        assembler_.Multiply();
+        break;
+      case TokenType::SLASH:
+        assembler_.Divide();
+        break;
+      default:
+        throw Unsupported{};
+    }
+    return {};
+  }
+  auto VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any override {
+    Value(expr_ast->GetExpression());
+    return {};
+  }
+  auto VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any override {
+    auto value {expr_ast->GetValue()};
+    if (value.type() != typeid(double)) {
+      throw Unsupported{};
+    }
+    assembler_.LoadConstant(std::any_cast<double>(value));
+    return {};
+  }
+  auto VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any override {
+    if (expr_ast->GetOperation().GetTokenType() != TokenType::MINUS) {
+      throw Unsupported{};
+    }
+    Value(expr_ast->GetRightExpr());
+    assembler_.Negate();
+    return {};
+  }
+  auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override {
+    assembler_.LoadSlot(LocalSlot(expr_ast->GetVariable()));
+    return {};
+  }
+  auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override {
+    Value(expr_ast->GetValue());
+    assembler_.StoreSlot(LocalSlot(expr_ast->GetVariable()));
+    return {};
+  }
+  // 只支持对自己的递归调用；全局变量是否仍然指向这个函数由 JitCode::Run 在进入时检查
+  auto VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any override {
+    auto callee {std::dynamic_pointer_cast<VarExprAST>(expr_ast->GetCallee())};
+    auto arguments {expr_ast->GetArguments()};
+    if (callee == nullptr || !Interpreter::IsGlobal(*callee) ||
+        callee->GetToken().GetTokenLexeme() != declaration_->GetFunctionName().GetTokenLexeme() ||
+        arguments.size() != declaration_->GetFunctionParams().size()) {
+      throw Unsupported{};
+    }
+    // 函数体没有副作用，参数从后往前求值并压栈，这样栈上的顺序就是参数数组
+    for (auto iter {arguments.rbegin()}; iter != arguments.rend(); ++iter) {
+      Value(*iter);
+      assembler_.Push();
+    }
+    assembler_.CallSelf(static_cast<int>(arguments.size()));
+    assembler_.CheckOverflow(epilogue_);
+    self_recursive_ = true;
+    return {};
+  }
+  auto VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any override { throw Unsupported{}; }
+  auto VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any override { throw Unsupported{}; }
+  auto VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any override { throw Unsupported{}; }
+  auto VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any override { throw Unsupported{}; }
+  auto VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any override { throw Unsupported{}; }
+
+  void VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override { Value(stmt->GetExpr()); }
+  void VisitIfStmt(std::shared_ptr<IfStmt> stmt) override {
+    auto else_label {assembler_.NewLabel()};
+    auto end_label {assembler_.NewLabel()};
+    Branch(stmt->GetConditionExpression(), false, else_label);
+    stmt->GetThenBranch()->Accept(*this);
+    assembler_.Jump(end_label);
+    assembler_.Bind(else_label);
+    if (stmt->GetElseBranch() != nullptr) {
+      stmt->GetElseBranch()->Accept(*this);
+    }
+    assembler_.Bind(end_label);
+  }
+  void VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) override {
+    auto loop_label {assembler_.NewLabel()};
+    auto end_label {assembler_.NewLabel()};
+    assembler_.Bind(loop_label);
+    Branch(stmt->GetConditionExpr(), false, end_label);
+    stmt->GetWhileBody()->Accept(*this);
+    assembler_.Jump(loop_label);
+    assembler_.Bind(end_label);
+  }
+  void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override {
+    auto slot {interpreter_.declarations_.find(stmt)};
+    if (stmt->GetExpr() == nullptr || slot == interpreter_.declarations_.end() || slot->second.captured_) {
+      throw Unsupported{};
+    }
+    Value(stmt->GetExpr());
+    assembler_.StoreSlot(slot->second.index_);
+  }
+  void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override {
+    for (const auto &statement : stmt->GetBlockStatements()) {
+      statement->Accept(*this);
+    }
+  }
+  void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override {
+    if (stmt->GetReturnValue() == nullptr) {
+      throw Unsupported{};
+    }
+    Value(stmt->GetReturnValue());
+    assembler_.Jump(epilogue_);
+  }
+  void VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) override { throw Unsupported{}; }
+  void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override { throw Unsupported{}; }
+  void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override { throw Unsupported{}; }
+  void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) override { throw Unsupported{}; }
+
+private:
+  static auto AlwaysReturns(const std::vector<std::shared_ptr<Stmt>> &statements) -> bool {
+    return std::any_of(statements.begin(), statements.end(), [](const auto &stmt) { return AlwaysReturns(stmt); });
+  }
+  static auto AlwaysReturns(const std::shared_ptr<Stmt> &stmt) -> bool {
+    if (std::dynamic_pointer_cast<ReturnStmt>(stmt) != nullptr) {
+      return true;
+    }
+    if (auto block {std::dynamic_pointer_cast<BlockStmt>(stmt)}) {
+      return AlwaysReturns(block->GetBlockStatements());
+    }
+    if (auto branch {std::dynamic_pointer_cast<IfStmt>(stmt)}) {
+      return branch->GetElseBranch() != nullptr && AlwaysReturns(branch->GetThenBranch()) &&
+             AlwaysReturns(branch->GetElseBranch());
+    }
+    return false;
+  }
+
+  void Value(const std::shared_ptr<ExprAST> &expr) { expr->Accept(*this); }
+
+  static auto LocalSlot(const std::optional<VariableRef> &variable) -> int {
+    if (!variable.has_value() || variable->kind_ != VariableKind::LOCAL) {
+      throw Unsupported{};
+    }
+    return variable->index_;
+  }
+
+  // 条件的值等于 jump_if 时跳到 target，否则继续执行。ucomisd 遇到 NaN 时 ZF=PF=CF=1，
+  // 所以 < 和 <= 交换操作数后用 above 判断，保证和 NaN 比较的结果都是 false
+  void Branch(const std::shared_ptr<ExprAST> &expr, bool jump_if, Assembler::Label target) {
+    if (auto grouping {std::dynamic_pointer_cast<GroupingExprAST>(expr)}) {
+      Branch(grouping->GetExpression(), jump_if, target);
+      return;
+    }
+    if (auto literal {std::dynamic_pointer_cast<LiteralExprAST>(expr)}) {
+      auto value {literal->GetValue()};
+      if (value.type() != typeid(bool)) {
+        throw Unsupported{};
+      }
+      if (std::any_cast<bool>(value) == jump_if) {
+        assembler_.Jump(target);
+      }
+      return;
+    }
+    if (auto unary {std::dynamic_pointer_cast<UnaryExprAST>(expr)}) {
+      if (unary->GetOperation().GetTokenType() != TokenType::BANG) {
+        throw Unsupported{};
+      }
+      Branch(unary->GetRightExpr(), !jump_if, target);
+      return;
+    }
+    if (auto logical {std::dynamic_pointer_cast<LogicalExprAST>(expr)}) {
+      // and 为 false / or 为 true 时可以短路
+      bool short_circuit = logical->GetToken().GetTokenType() == TokenType::OR;
+      if (short_circuit == jump_if) {
+        Branch(logical->GetLeftExpr(), jump_if, target);
+        Branch(logical->GetRightExpr(), jump_if, target);
+      } else {
+        auto skip {assembler_.NewLabel()};
+        Branch(logical->GetLeftExpr(), !jump_if, skip);
+        Branch(logical->GetRightExpr(), jump_if, target);
+        assembler_.Bind(skip);
+      }
+      return;
+    }
+    auto binary {std::dynamic_pointer_cast<BinaryExprAST>(expr)};
+    if (binary == nullptr) {
+      throw Unsupported{};
+    }
+    auto op {binary->GetOperation().GetTokenType()};
+    if (op != TokenType::LESS && op != TokenType::LESS_EQUAL && op != TokenType::GREATER &&
+        op != TokenType::GREATER_EQUAL && op != TokenType::EQUAL_EQUAL && op != TokenType::BANG_EQUAL) {
+      throw Unsupported{};
+    }
+    Value(binary->GetLeftExpr());
+    assembler_.Push();
+    Value(binary->GetRightExpr());
+    assembler_.PopLeft();
+    switch (op) {
+      case TokenType::GREATER:
+      case TokenType::GREATER_EQUAL:
+        assembler_.Compare();
+        break;
+      default:
+        assembler_.CompareSwapped();
+        break;
+    }
+    switch (op) {
+      case TokenType::GREATER:
+      case TokenType::LESS:
+        assembler_.JumpIf(jump_if ? Assembler::ABOVE : Assembler::BELOW_EQUAL, target);
+        break;
+      case TokenType::GREATER_EQUAL:
+      case TokenType::LESS_EQUAL:
+        assembler_.JumpIf(jump_if ? Assembler::ABOVE_EQUAL : Assembler::BELOW, target);
+        break;
+      default: {
+        // 相等要求 ZF=1 且 PF=0
+        bool equal = (op == TokenType::EQUAL_EQUAL) == jump_if;
+        if (equal) {
+          auto skip {assembler_.NewLabel()};
+          assembler_.JumpIf(Assembler::PARITY, skip);
+          assembler_.JumpIf(Assembler::EQUAL, target);
+          assembler_.Bind(skip);
+        } else {
+          assembler_.JumpIf(Assembler::NOT_EQUAL, target);
+          assembler_.JumpIf(Assembler::PARITY, target);
+        }
+        break;
+      }
+    }
+  }
+
+  Interpreter &interpreter_;
+  const std::shared_ptr<FunctionStmt> &declaration_;
+  const FunctionInfo &info_;
+  Assembler assembler_;
+  Assembler::Label epilogue_{0};
+  int frame_bytes_{0};
+  bool self_recursive_{false};
+};
+
+JitCode::~JitCode() { munmap(memory_, size_); }
+
+auto JitCode::Run(Interpreter &interpreter, const LoxCallable *function, std::span<const std::any> arguments,
+                  std::any &result) const -> bool {
+  std::array<double, 256> values;
+  if (interpreter.GetCallDepth() > fallback_depth_ || arguments.size() != arity_ || arity_ > values.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < arity_; ++i) {
+    const auto *number = std::any_cast<double>(&arguments[i]);
+    if (number == nullptr) {
+      return false;
+    }
+    values[i] = *number;
+  }
+  if (self_recursive_) {
+    const auto *global {interpreter.GetGlobalEnvironment()->Find(name_)};
+    if (global == nullptr) {
+      return false;
+    }
+    const auto *callee = std::any_cast<std::shared_ptr<LoxCallable>>(global);
+    if (callee == nullptr || callee->get() != function) {
+      return false;
+    }
+  }
+  // 机器码里的递归调用不经过 CallFunction，没有值栈和协程栈的检查，按剩下的 C 栈和值栈空间限制递归深度
+  auto levels {LoxCoroutine::StackRoom() / frame_bytes_};
+  if (slots_per_call_ > 0) {
+    levels = std::min(levels, interpreter.GetStack().Remaining() / slots_per_call_);
+  }
+  auto depth {static_cast<int64_t>(levels)};
+  auto value {reinterpret_cast<Entry>(memory_)(values.data(), &depth)};
+  if (depth < 0) {
+    fallback_depth_ = interpreter.GetCallDepth();
+    return false;
+  }
+  fallback_depth_ = std::numeric_limits<int>::max();
+  result = value;
+  return true;
+}
+
+auto Jit::Compile(Interpreter &interpreter, const std::shared_ptr<FunctionStmt> &declaration,
+                  const FunctionInfo &info) -> const JitCode * {
+  auto [iter, inserted] = code_.try_emplace(declaration);
+  if (!inserted) {
+    return iter->second.get();
+  }
+#if defined(__x86_64__) && defined(__linux__)
+  JitCompiler compiler(interpreter, declaration, info);
+  auto code {compiler.Compile()};
+  if (!code) {
+    return nullptr;
+  }
+  // 先以可写方式映射并拷贝机器码，再改成只读可执行
+  auto page_size {static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+  auto size {(code->size() + page_size - 1) / page_size * page_size};
+  void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  std::memcpy(memory, code->data(), code->size());
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return nullptr;
+  }
+  iter->second = std::make_unique<JitCode>(memory, size, declaration->GetFunctionName().GetTokenLexeme(),
+                                           declaration->GetFunctionParams().size(), compiler.IsSelfRecursive(),
+                                           compiler.FrameBytes(), info.slot_count_);
+#endif
+  return iter->second.get();
+}
+
+}  // namespace cpplox
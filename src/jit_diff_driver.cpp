@@ -0,0 +1,239 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// JIT 的差分测试：每个程序分别用 "--jit --jit-threshold=1" 和不带 --jit 运行 cpplox，
+// 标准输出、标准错误和退出码必须完全一致。阈值为 1 时函数第一次调用就编译，后面的调用都走机器码或者守卫失败的退回路径。
+// 函数体都不止一条 return 语句，否则会被 Inliner 内联到调用处，不经过 JIT。
+// deep_recursion 在协程里递归到超出机器码的深度上限，机器码要退回解释器，和解释器报告同样的栈溢出错误
+// 用法: jit_diff_driver path/to/cpplox
+namespace {
+
+struct Program {
+  const char *name_;
+  const char *source_;
+};
+
+const std::vector<Program> kPrograms{
+    {"arithmetic", R"(
+fun poly(x, y) {
+  var t = x * x - 3 * y;
+  if (t > 10) {
+    return t / 2;
+  }
+  return -t + y / 4;
+}
+fun sumTo(n) {
+  var sum = 0;
+  var i = 0;
+  while (i < n) {
+    sum = sum + i * 0.5;
+    i = i + 1;
+  }
+  return sum;
+}
+var i = 0;
+var total = 0;
+while (i < 50) {
+  total = total + poly(i, i / 3);
+  i = i + 1;
+}
+print total;
+print poly(0.1, 0.2);
+print poly(1e200, 1);
+print poly(-1e200, -1e300);
+print sumTo(1000);
+print sumTo(-5);
+print 1 / 3 + poly(2, 7);
+)"},
+    {"nan_comparisons", R"(
+fun lt(a, b) { if (a < b) { return 1; } return 0; }
+fun le(a, b) { if (a <= b) { return 1; } return 0; }
+fun gt(a, b) { if (a > b) { return 1; } return 0; }
+fun ge(a, b) { if (a >= b) { return 1; } return 0; }
+fun eq(a, b) { if (a == b) { return 1; } return 0; }
+fun ne(a, b) { if (a != b) { return 1; } return 0; }
+fun whileNan(a) {
+  var n = 0;
+  while (a < 10) {
+    a = a + 1;
+    n = n + 1;
+  }
+  return n;
+}
+var nan = 0 / 0;
+fun all(a, b) {
+  print lt(a, b);
+  print le(a, b);
+  print gt(a, b);
+  print ge(a, b);
+  print eq(a, b);
+  print ne(a, b);
+}
+all(nan, 1);
+all(1, nan);
+all(nan, nan);
+all(1, 1);
+all(1, 2);
+all(-0, 0);
+print whileNan(nan);
+print whileNan(5);
+print nan;
+print -nan;
+)"},
+    {"rebound_recursion", R"(
+fun fib(n) {
+  if (n < 2) {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+}
+fun half(n) {
+  var h = n / 2;
+  return h;
+}
+print fib(20);
+var original = fib;
+fib = half;
+print original(10);
+print fib(10);
+fib = original;
+print fib(15);
+fib = nil;
+print original(1);
+)"},
+    {"mixed_type_fallback", R"(
+fun add(a, b) {
+  var sum = a + b;
+  return sum;
+}
+fun twice(x) {
+  var sum = x + x;
+  return sum;
+}
+print add(1, 2);
+print add("a", "b");
+print add(1.5, 2);
+print twice(21);
+print twice("ab");
+print twice(0.25);
+var i = 0;
+var s = "";
+while (i < 5) {
+  s = add(s, "x");
+  i = add(i, 1);
+}
+print s;
+print i;
+)"},
+    {"runtime_error_operand", R"(
+fun scale(x) {
+  var y = x * 2;
+  return y;
+}
+print scale(4);
+print scale(nil);
+print "not reached";
+)"},
+    {"runtime_error_in_recursion", R"(
+fun count(n) {
+  if (n < 1) {
+    return 0;
+  }
+  return 1 + count(n - 1);
+}
+print count(100);
+print count("ten");
+)"},
+    {"deep_recursion", R"(
+fun depth(n) {
+  if (n < 1) {
+    return 0;
+  }
+  return 1 + depth(n - 1);
+}
+print depth(10);
+print depth(1000);
+fun deep(n) {
+  print depth(20);
+  print depth(n);
+  return 0;
+}
+var co = coroutine(deep);
+print resume(co, 100000);
+print "not reached";
+)"},
+    {"runtime_error_arity", R"(
+fun div(a, b) {
+  var q = a / b;
+  return q;
+}
+print div(1, 0);
+print div(-1, 0);
+print div(6, 3);
+print div(1);
+)"},
+};
+
+struct Result {
+  std::string output_;
+  int status_{-1};
+};
+
+auto Run(const std::string &cpplox, const std::string &flags, const std::filesystem::path &script) -> Result {
+  auto command {"'" + cpplox + "' " + flags + " '" + script.string() + "' 2>&1"};
+  Result result;
+  auto *pipe {popen(command.c_str(), "r")};
+  if (pipe == nullptr) {
+    return result;
+  }
+  std::array<char, 4096> buffer;
+  size_t count;
+  while ((count = fread(buffer.data(), 1, buffer.size(), pipe)) > 0) {
+    result.output_.append(buffer.data(), count);
+  }
+  auto status {pclose(pipe)};
+  result.status_ = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  return result;
+}
+
+}  // namespace
+
+auto main(int argc, const char *argv[]) -> int {
+  if (argc != 2) {
+    std::cerr << "Usage: jit_diff_driver path/to/cpplox\n";
+    return 64;
+  }
+  std::string cpplox{argv[1]};
+  // 找不到解释器时两次运行的输出一样，不能算通过
+  if (access(cpplox.c_str(), X_OK) != 0) {
+    std::cerr << "Cannot execute " << cpplox << "\n";
+    return 1;
+  }
+  auto directory {std::filesystem::temp_directory_path() / ("cpplox_jit_diff_" + std::to_string(getpid()))};
+  std::filesystem::create_directories(directory);
+  int failures = 0;
+  for (const auto &program : kPrograms) {
+    auto script {directory / (std::string{program.name_} + ".lox")};
+    std::ofstream{script} << program.source_;
+    auto interpreted {Run(cpplox, "", script)};
+    auto compiled {Run(cpplox, "--jit --jit-threshold=1", script)};
+    if (interpreted.output_ == compiled.output_ && interpreted.status_ == compiled.status_) {
+      std::cerr << "ok    " << program.name_ << "\n";
+      continue;
+    }
+    ++failures;
+    std::cerr << "FAIL  " << program.name_ << "\n--- interpreter (exit " << interpreted.status_ << ")\n"
+              << interpreted.output_ << "--- jit (exit " << compiled.status_ << ")\n"
+              << compiled.output_;
+  }
+  std::filesystem::remove_all(directory);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,496 @@
+#include "json.h"
+#include <algorithm>
+#include <any>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "byte_scan.h"
+#include "interpreter.h"
+#include "lox_class.h"
+#include "lox_instance.h"
+#include "runtime_error.h"
+
+namespace cpplox {
+
+namespace {
+
+auto IsDigit(char ch) -> bool { return ch >= '0' && ch <= '9'; }
+
+auto SkipDigits(const char *p, const char *end) -> const char * {
+  return SkipWhile(
+      p, end, [](const auto &chunk) { return chunk.InRange('0', '9'); }, IsDigit);
+}
+
+// 字符串里第一个要特殊处理的字节：引号、反斜杠或者控制字符。解析和输出都只在这些位置停下来，其余的字节整段复制
+auto FindStringSpecial(const char *p, const char *end) -> const char * {
+  return SkipWhile(
+      p, end, [](const auto &chunk) { return ~(chunk.Equal('"') | chunk.Equal('\\') | chunk.InRange('\0', '\x1f')); },
+      [](char ch) { return ch != '"' && ch != '\\' && static_cast<unsigned char>(ch) >= 0x20; });
+}
+
+// 数组下标对应的字段名
+auto IndexName(size_t index) -> std::string { return std::to_string(index); }
+
+// 非负整数的下标，其它数字返回 false
+auto AsIndex(double number, size_t &index) -> bool {
+  if (!(number >= 0) || std::floor(number) != number || number > 9007199254740992.0) {
+    return false;
+  }
+  index = static_cast<size_t>(number);
+  return true;
+}
+
+auto FieldName(const std::any &key) -> std::string {
+  if (key.type() == typeid(std::string)) {
+    return std::any_cast<const std::string &>(key);
+  }
+  size_t index = 0;
+  if (key.type() == typeid(double) && AsIndex(std::any_cast<double>(key), index)) {
+    return IndexName(index);
+  }
+  throw NativeError("Key must be a string or a non-negative integer.");
+}
+
+class JsonReader {
+public:
+  JsonReader(const Json &json, std::string_view text)
+      : json_(json), begin_(text.data()), p_(text.data()), end_(text.data() + text.size()) {}
+
+  auto ParseDocument() -> std::any {
+    auto value {ParseValue(0)};
+    p_ = SkipSpaces(p_, end_);
+    if (p_ != end_) {
+      Fail("unexpected data after value");
+    }
+    return value;
+  }
+
+private:
+  [[noreturn]] void Fail(const std::string &message) const {
+    throw NativeError("Invalid JSON at offset " + std::to_string(p_ - begin_) + ": " + message + ".");
+  }
+
+  auto Consume(char ch) -> bool {
+    if (p_ != end_ && *p_ == ch) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  auto ParseValue(size_t depth) -> std::any {
+    p_ = SkipSpaces(p_, end_);
+    if (p_ == end_) {
+      Fail("unexpected end of input");
+    }
+    switch (*p_) {
+      case '{':
+        return ParseObject(depth + 1);
+      case '[':
+        return ParseArray(depth + 1);
+      case '"':
+        return ParseString();
+      case 't':
+        ExpectLiteral("true");
+        return true;
+      case 'f':
+        ExpectLiteral("false");
+        return false;
+      case 'n':
+        ExpectLiteral("null");
+        return nullptr;
+      default:
+        return ParseNumber();
+    }
+  }
+
+  void ExpectLiteral(std::string_view literal) {
+    if (static_cast<size_t>(end_ - p_) < literal.size() || std::string_view(p_, literal.size()) != literal) {
+      Fail("unexpected character");
+    }
+    p_ += literal.size();
+  }
+
+  void CheckDepth(size_t depth) const {
+    if (depth > Json::kMaxDepth) {
+      Fail("nested too deeply");
+    }
+  }
+
+  auto ParseObject(size_t depth) -> std::any {
+    CheckDepth(depth);
+    ++p_;
+    auto object {std::make_shared<LoxInstance>(json_.GetObjectClass())};
+    p_ = SkipSpaces(p_, end_);
+    if (Consume('}')) {
+      return object;
+    }
+    for (;;) {
+      p_ = SkipSpaces(p_, end_);
+      if (p_ == end_ || *p_ != '"') {
+        Fail("expected string key");
+      }
+      auto key {ParseString()};
+      p_ = SkipSpaces(p_, end_);
+      if (!Consume(':')) {
+        Fail("expected ':'");
+      }
+      object->SetField(std::move(key), ParseValue(depth));
+      p_ = SkipSpaces(p_, end_);
+      if (Consume('}')) {
+        return object;
+      }
+      if (!Consume(',')) {
+        Fail("expected ',' or '}'");
+      }
+    }
+  }
+
+  auto ParseArray(size_t depth) -> std::any {
+    CheckDepth(depth);
+    ++p_;
+    auto array {std::make_shared<LoxInstance>(json_.GetArrayClass())};
+    size_t length = 0;
+    p_ = SkipSpaces(p_, end_);
+    if (!Consume(']')) {
+      for (;;) {
+        array->SetField(IndexName(length++), ParseValue(depth));
+        p_ = SkipSpaces(p_, end_);
+        if (Consume(']')) {
+          break;
+        }
+        if (!Consume(',')) {
+          Fail("expected ',' or ']'");
+        }
+      }
+    }
+    array->SetField("length", static_cast<double>(length));
+    return array;
+  }
+
+  // 没有转义的字符串直接从输入的那一段构造，只复制一次；有转义时逐段复制，在反斜杠处解码
+  auto ParseString() -> std::string {
+    const char *start {++p_};
+    p_ = FindStringSpecial(p_, end_);
+    std::string result(start, p_);
+    for (;;) {
+      if (p_ == end_) {
+        Fail("unterminated string");
+      }
+      if (*p_ == '"') {
+        ++p_;
+        return result;
+      }
+      if (*p_ != '\\') {
+        Fail("control character in string");
+      }
+      ++p_;
+      Unescape(result);
+      const char *run {p_};
+      p_ = FindStringSpecial(p_, end_);
+      result.append(run, p_);
+    }
+  }
+
+  void Unescape(std::string &out) {
+    if (p_ == end_) {
+      Fail("unterminated string");
+    }
+    switch (*p_++) {
+      case '"':
+        out += '"';
+        return;
+      case '\\':
+        out += '\\';
+        return;
+      case '/':
+        out += '/';
+        return;
+      case 'b':
+        out += '\b';
+        return;
+      case 'f':
+        out += '\f';
+        return;
+      case 'n':
+        out += '\n';
+        return;
+      case 'r':
+        out += '\r';
+        return;
+      case 't':
+        out += '\t';
+        return;
+      case 'u':
+        AppendUtf8(out, ParseCodePoint());
+        return;
+      default:
+        --p_;
+        Fail("invalid escape");
+    }
+  }
+
+  auto ParseHex4() -> uint32_t {
+    if (end_ - p_ < 4) {
+      Fail("invalid \\u escape");
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i, ++p_) {
+      char ch = *p_;
+      value <<= 4;
+      if (IsDigit(ch)) {
+        value |= ch - '0';
+      } else if (ch >= 'a' && ch <= 'f') {
+        value |= ch - 'a' + 10;
+      } else if (ch >= 'A' && ch <= 'F') {
+        value |= ch - 'A' + 10;
+      } else {
+        Fail("invalid \\u escape");
+      }
+    }
+    return value;
+  }
+
+  // 基本平面以外的字符是一对 \uD800-\uDBFF \uDC00-\uDFFF
+  auto ParseCodePoint() -> uint32_t {
+    auto code {ParseHex4()};
+    if (code >= 0xDC00 && code <= 0xDFFF) {
+      Fail("unpaired surrogate");
+    }
+    if (code < 0xD800 || code > 0xDBFF) {
+      return code;
+    }
+    if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') {
+      Fail("unpaired surrogate");
+    }
+    p_ += 2;
+    auto low {ParseHex4()};
+    if (low < 0xDC00 || low > 0xDFFF) {
+      Fail("unpaired surrogate");
+    }
+    return 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+  }
+
+  static void AppendUtf8(std::string &out, uint32_t code) {
+    if (code < 0x80) {
+      out += static_cast<char>(code);
+    } else if (code < 0x800) {
+      out += static_cast<char>(0xC0 | (code >> 6));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+      out += static_cast<char>(0xE0 | (code >> 12));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (code >> 18));
+      out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+  }
+
+  // 先按 JSON 的语法找出数字的范围 (from_chars 接受的写法更宽)，再整段转换
+  auto ParseNumber() -> std::any {
+    const char *start {p_};
+    Consume('-');
+    if (!Consume('0')) {
+      if (p_ == end_ || !IsDigit(*p_)) {
+        Fail("unexpected character");
+      }
+      p_ = SkipDigits(p_, end_);
+    }
+    if (Consume('.')) {
+      ExpectDigits();
+    }
+    if (Consume('e') || Consume('E')) {
+      if (!Consume('+')) {
+        Consume('-');
+      }
+      ExpectDigits();
+    }
+    double value = 0;
+    // 超出 double 范围时 from_chars 不写结果，按 strtod 的规则变成无穷大或者 0
+    if (std::from_chars(start, p_, value).ec == std::errc::result_out_of_range) {
+      value = std::strtod(std::string(start, p_).c_str(), nullptr);
+    }
+    return value;
+  }
+
+  void ExpectDigits() {
+    const char *digits {p_};
+    p_ = SkipDigits(p_, end_);
+    if (p_ == digits) {
+      Fail("expected digit");
+    }
+  }
+
+  const Json &json_;
+  const char *begin_;
+  const char *p_;
+  const char *end_;
+};
+
+class JsonWriter {
+public:
+  explicit JsonWriter(const Json &json) : json_(json) {}
+
+  auto Take() -> std::string { return std::move(out_); }
+
+  void Write(const std::any &value) {
+    if (!value.has_value() || value.type() == typeid(nullptr)) {
+      out_ += "null";
+    } else if (value.type() == typeid(bool)) {
+      out_ += std::any_cast<bool>(value) ? "true" : "false";
+    } else if (value.type() == typeid(double)) {
+      WriteNumber(std::any_cast<double>(value));
+    } else if (value.type() == typeid(std::string)) {
+      WriteString(std::any_cast<const std::string &>(value));
+    } else if (value.type() == typeid(std::shared_ptr<LoxInstance>)) {
+      WriteInstance(*std::any_cast<const std::shared_ptr<LoxInstance> &>(value));
+    } else {
+      throw NativeError("Value cannot be converted to JSON.");
+    }
+  }
+
+private:
+  void WriteNumber(double number) {
+    if (!std::isfinite(number)) {
+      out_ += "null";
+      return;
+    }
+    Interpreter::NumberBuffer buffer;
+    out_ += Interpreter::FormatNumber(number, buffer);
+  }
+
+  void WriteString(std::string_view text) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    out_ += '"';
+    const char *p {text.data()};
+    const char *end {p + text.size()};
+    for (;;) {
+      const char *run {p};
+      p = FindStringSpecial(p, end);
+      out_.append(run, p);
+      if (p == end) {
+        break;
+      }
+      switch (char ch = *p++) {
+        case '"':
+          out_ += "\\\"";
+          break;
+        case '\\':
+          out_ += "\\\\";
+          break;
+        case '\n':
+          out_ += "\\n";
+          break;
+        case '\r':
+          out_ += "\\r";
+          break;
+        case '\t':
+          out_ += "\\t";
+          break;
+        default:
+          out_ += "\\u00";
+          out_ += kHex[(ch >> 4) & 0xF];
+          out_ += kHex[ch & 0xF];
+      }
+    }
+    out_ += '"';
+  }
+
+  void WriteInstance(const LoxInstance &instance) {
+    if (std::find(active_.begin(), active_.end(), &instance) != active_.end()) {
+      throw NativeError("Cannot convert a cyclic structure to JSON.");
+    }
+    if (active_.size() >= Json::kMaxDepth) {
+      throw NativeError("Structure is nested too deeply for JSON.");
+    }
+    active_.push_back(&instance);
+    const auto &fields {instance.GetFields()};
+    if (json_.IsArray(instance)) {
+      out_ += '[';
+      auto length {Json::Length(instance)};
+      for (size_t i = 0; i < length; ++i) {
+        if (i > 0) {
+          out_ += ',';
+        }
+        auto iter {fields.find(IndexName(i))};
+        Write(iter == fields.end() ? std::any{nullptr} : iter->second);
+      }
+      out_ += ']';
+    } else {
+      // 字段没有顺序，按名字排序让输出稳定
+      std::vector<const std::pair<const std::string, std::any> *> sorted;
+      sorted.reserve(fields.size());
+      for (const auto &field : fields) {
+        sorted.push_back(&field);
+      }
+      std::sort(sorted.begin(), sorted.end(), [](const auto *lhs, const auto *rhs) { return lhs->first < rhs->first; });
+      out_ += '{';
+      for (size_t i = 0; i < sorted.size(); ++i) {
+        if (i > 0) {
+          out_ += ',';
+        }
+        WriteString(sorted[i]->first);
+        out_ += ':';
+        Write(sorted[i]->second);
+      }
+      out_ += '}';
+    }
+    active_.pop_back();
+  }
+
+  const Json &json_;
+  std::string out_;
+  // 正在输出的实例，用来发现环
+  std::vector<const LoxInstance *> active_;
+};
+
+}  // namespace
+
+auto Json::IsArray(const LoxInstance &instance) const -> bool { return instance.GetClass() == array_class_; }
+
+auto Json::Parse(std::string_view text) const -> std::any { return JsonReader(*this, text).ParseDocument(); }
+
+auto Json::Stringify(const std::any &value) const -> std::string {
+  JsonWriter writer{*this};
+  writer.Write(value);
+  return writer.Take();
+}
+
+auto Json::Get(const LoxInstance &instance, const std::any &key) const -> std::any {
+  const auto &fields {instance.GetFields()};
+  auto iter {fields.find(FieldName(key))};
+  return iter == fields.end() ? std::any{nullptr} : iter->second;
+}
+
+void Json::Set(LoxInstance &instance, const std::any &key, std::any value) const {
+  instance.SetField(FieldName(key), std::move(value));
+  size_t index = 0;
+  if (IsArray(instance) && key.type() == typeid(double) && AsIndex(std::any_cast<double>(key), index) &&
+      index >= Length(instance)) {
+    instance.SetField("length", static_cast<double>(index + 1));
+  }
+}
+
+auto Json::Length(const LoxInstance &array) -> size_t {
+  const auto &fields {array.GetFields()};
+  auto iter {fields.find("length")};
+  size_t length = 0;
+  if (iter == fields.end() || iter->second.type() != typeid(double) ||
+      !AsIndex(std::floor(std::any_cast<double>(iter->second)), length)) {
+    return 0;
+  }
+  return length;
+}
+
+}  // namespace cpplox
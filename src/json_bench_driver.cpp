@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <any>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "json.h"
+#include "lox_class.h"
+#include "runtime_error.h"
+
+// json_parse/json_stringify 吞吐量的基准测试。参数是 JSON 文件，没有参数时用生成的数据，报告 GB/s
+namespace {
+
+// 一个记录数组，字符串大多不需要转义，少数带转义和 \u 字符
+auto SampleJson(int count) -> std::string {
+  std::ostringstream json;
+  json << "[\n";
+  for (int i = 0; i < count; ++i) {
+    json << "  {\"id\": " << i << ", \"name\": \"user number " << i << "\", \"email\": \"user" << i
+         << "@example.com\", \"score\": " << i * 1.25 << ", \"active\": " << (i % 3 == 0 ? "true" : "false")
+         << ", \"tags\": [\"alpha\", \"beta\", \"gamma\"], \"parent\": null,\n"
+         << "   \"bio\": \"" << (i % 10 == 0 ? "line one\\nline \\\"two\\\" \\u00e9t\\u00e9" : "plain text biography")
+         << "\", \"address\": {\"street\": \"" << i << " Long Street Name\", \"zip\": \"" << 10000 + i % 90000
+         << "\"}}" << (i + 1 == count ? "\n" : ",\n");
+  }
+  json << "]\n";
+  return json.str();
+}
+
+auto ReadFile(const std::string &path) -> std::string {
+  std::ifstream file{path};
+  if (!file) {
+    throw std::runtime_error("Cannot open file " + path);
+  }
+  std::ostringstream text;
+  text << file.rdbuf();
+  return text.str();
+}
+
+template <typename F>
+auto TimeMs(F &&func) -> double {
+  auto begin = std::chrono::steady_clock::now();
+  func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+auto GigabytesPerSecond(size_t bytes, double ms) -> double { return static_cast<double>(bytes) / 1e9 / (ms / 1000); }
+
+}  // namespace
+
+auto main(int argc, const char *argv[]) -> int {
+  const int rounds = 5;
+  std::unordered_map<std::string, std::shared_ptr<cpplox::LoxFunction>> no_methods;
+  cpplox::Json json{std::make_shared<cpplox::LoxClass>("JsonObject", nullptr, no_methods),
+                    std::make_shared<cpplox::LoxClass>("JsonArray", nullptr, no_methods)};
+  std::vector<std::pair<std::string, std::string>> inputs;
+  if (argc == 1) {
+    inputs.emplace_back("generated", SampleJson(100000));
+  }
+  for (int i = 1; i < argc; ++i) {
+    inputs.emplace_back(argv[i], ReadFile(argv[i]));
+  }
+
+  for (const auto &[name, text] : inputs) {
+    std::any value;
+    std::string output;
+    double parse_ms = 0;
+    double stringify_ms = 0;
+    try {
+      for (int round = 0; round < rounds; ++round) {
+        // 上一轮的值在计时之外释放
+        value.reset();
+        auto ms = TimeMs([&] { value = json.Parse(text); });
+        parse_ms = round == 0 ? ms : std::min(parse_ms, ms);
+        ms = TimeMs([&] { output = json.Stringify(value); });
+        stringify_ms = round == 0 ? ms : std::min(stringify_ms, ms);
+      }
+    } catch (const cpplox::NativeError &error) {
+      std::cerr << name << ": " << error.what() << "\n";
+      return 1;
+    }
+    std::cerr << name << "  " << static_cast<double>(text.size()) / (1024 * 1024) << " MB  parse " << parse_ms
+              << " ms (" << GigabytesPerSecond(text.size(), parse_ms) << " GB/s)  stringify " << stringify_ms
+              << " ms (" << GigabytesPerSecond(output.size(), stringify_ms) << " GB/s)\n";
+  }
+  return 0;
+}
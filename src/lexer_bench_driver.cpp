@@ -0,0 +1,51 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "scanner.h"
+
+// 词法分析吞吐量的基准测试，输入是生成的大文件，报告 MB/s
+namespace {
+
+auto LexerSource(int count) -> std::string {
+  std::ostringstream source;
+  for (int i = 0; i < count; ++i) {
+    source << "// function number " << i << " with a comment long enough to cross several vector chunks\n"
+           << "fun computeValue" << i << "(firstArgument, secondArgument) {\n"
+           << "    var accumulator = firstArgument * " << i << ".25 + secondArgument;\n"
+           << "    while (accumulator >= 1000000) { accumulator = accumulator / 2; }\n"
+           << "    if (accumulator != nil and true) print \"result of computeValue" << i << " is\";\n"
+           << "    return thisIsNotAKeyword or accumulator;\n"
+           << "}\n\n";
+  }
+  return source.str();
+}
+
+template <typename F>
+auto TimeMs(F &&func) -> double {
+  auto begin = std::chrono::steady_clock::now();
+  func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+}  // namespace
+
+auto main() -> int {
+  const int count = 100000;
+  const int rounds = 5;
+  auto source = LexerSource(count);
+
+  size_t tokens = 0;
+  double best_ms = 0;
+  for (int round = 0; round < rounds; ++round) {
+    auto ms = TimeMs([&] { tokens = cpplox::Scanner(source).ScanTokens().size(); });
+    best_ms = round == 0 ? ms : std::min(best_ms, ms);
+  }
+  auto megabytes = static_cast<double>(source.size()) / (1024 * 1024);
+  std::cerr << "scan    " << megabytes << " MB, " << tokens << " tokens in " << best_ms << " ms ("
+            << megabytes / (best_ms / 1000) << " MB/s)\n";
+  return 0;
+}
@@ -1,10 +1,27 @@
 #include "lox.h"
 #include <error.h>
 #include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iterator>
 #include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "allocation_profiler.h"
+#include "cpp_emitter.h"
+#include "event_loop.h"
+#include "inliner.h"
 #include "interpreter.h"
+#include "isolate.h"
 #include "parser.h"
 #include "resolver.h"
+#include "runtime_error.h"
+#include "snapshot.h"
+#include "spsc_queue.h"
+#include "telemetry.h"
+#include "type_checker.h"
 
 namespace cpplox {
 
@@ -16,7 +33,23 @@ auto Lox::RunFile(const std::string &filePath) -> void {
   std::ostringstream str;
   str << file.rdbuf();
   auto source_str = str.str();
-  Run(source_str);
+  script_directory_ = std::filesystem::path(filePath).parent_path();
+  if (watch_) {
+    reloader_ = std::make_unique<HotReloader>(interpreter, filePath);
+    interpreter->SetSafePoint([this] { reloader_->Poll(); });
+    // 守护进程式的脚本大部分时间等在 epoll_wait 里，不经过安全点，由 inotify 事件唤醒
+    if (reloader_->GetNotifyFd() >= 0) {
+      interpreter->GetEventLoop().WatchIdle(reloader_->GetNotifyFd(), [this] { reloader_->Notify(); });
+    }
+  }
+  if (pipeline_) {
+    RunPipelined(std::move(source_str));
+  } else {
+    Run(source_str);
+  }
+  // 和事件循环一样，等 spawn 出去的 isolate 都结束再退出
+  IsolatePool::Shared().Wait();
+  SaveHeapDump();
   if (had_error) {
     exit(-1);
   }
@@ -25,6 +58,88 @@ auto Lox::RunFile(const std::string &filePath) -> void {
   }
 }
 
+auto Lox::SaveHeapDump() -> void {
+  if (heap_dump_path_.empty()) {
+    return;
+  }
+  std::ofstream out{heap_dump_path_};
+  if (!(out << allocation_profiler->Dump())) {
+    std::cerr << "Cannot write heap dump " << heap_dump_path_ << "\n";
+  }
+}
+
+auto Lox::DiffHeapDumps(const std::string &before, const std::string &after) -> void {
+  auto read = [](const std::string &path) {
+    std::ifstream file{path};
+    if (!file) {
+      throw std::runtime_error("Cannot open file " + path + "\n");
+    }
+    std::ostringstream str;
+    str << file.rdbuf();
+    return str.str();
+  };
+  std::cout << AllocationProfiler::Diff(read(before), read(after));
+}
+
+auto Lox::LoadSnapshot(const std::string &path) -> void { Snapshot::Load(*interpreter, path); }
+
+auto Lox::SaveSnapshot(const std::string &path) -> void {
+  // 快照里保存的是函数体的语法树，还没有调用过的预解析函数先解析出来
+  if (interpreter->ParseLazyBodies() > 0) {
+    throw SnapshotError("Cannot snapshot functions whose bodies have errors.");
+  }
+  Snapshot::Save(*interpreter, path);
+}
+
+auto Lox::CheckFile(const std::string &path) -> bool {
+  std::ifstream file{path};
+  if (!file) {
+    throw std::runtime_error("Cannot open file\n");
+  }
+  std::ostringstream str;
+  str << file.rdbuf();
+  auto statements {Parse(str.str(), false)};
+  if (!had_error) {
+    Resolver(interpreter, std::filesystem::path(path).parent_path()).Resolve(statements);
+    TypeChecker().Check(statements);
+  }
+  return !had_error;
+}
+
+auto Lox::EmitCpp(const std::string &script_path, const std::string &output) -> void {
+  std::ifstream file{script_path};
+  if (!file) {
+    throw std::runtime_error("Cannot open file\n");
+  }
+  std::ostringstream str;
+  str << file.rdbuf();
+  auto scanner = std::make_unique<cpplox::Scanner>(str.str());
+  auto tokens = scanner->ScanTokens();
+  auto parser{std::make_unique<Parser>(tokens)};
+  auto statements {parser->Parse()};
+  if (had_error) {
+    exit(65);
+  }
+  // import 按脚本所在目录找模块，和 RunFile 一样
+  script_directory_ = std::filesystem::path(script_path).parent_path();
+  auto resolver = std::make_unique<Resolver>(interpreter, script_directory_);
+  resolver->Resolve(statements);
+  TypeChecker().Check(statements);
+  if (had_error) {
+    exit(65);
+  }
+  auto code {CppEmitter(*interpreter, script_path).Emit(statements)};
+  if (output == "-") {
+    std::cout << code;
+    return;
+  }
+  std::ofstream out{output};
+  if (!out) {
+    throw std::runtime_error("Cannot open file " + output + "\n");
+  }
+  out << code;
+}
+
 auto Lox::RunPrompt() -> void {
   std::cout << "Cpplox\n";
   std::string line;
@@ -37,25 +152,246 @@ auto Lox::RunPrompt() -> void {
     }
     Run(line);
   }
+  IsolatePool::Shared().Wait();
+  SaveHeapDump();
 }
 
 auto Lox::Run(const std::string &source) -> void {
-  auto scanner = std::make_unique<cpplox::Scanner>(source);
-  auto tokens = scanner->ScanTokens();
-
-  auto parser{std::make_unique<Parser>(tokens)};
-  // auto expression {parser->Parse()};
-  auto statements {parser->Parse()};
+  auto statements {Parse(source, lazy_parse)};
   if (had_error) {
     return;
   }
-  auto resolver = std::make_unique<Resolver>(interpreter);
+  auto resolver = std::make_unique<Resolver>(interpreter, script_directory_);
   resolver->Resolve(statements);
+  checker_.Check(statements);
   if (had_error) {
     return;
   }
+  // REPL 里编译通过的行都追加到 isolate 的脚本里，后面的行 spawn 的函数可以是前面的行声明的
+  auto previous {isolate_script == nullptr ? std::string{} : isolate_script->source_ + "\n"};
+  isolate_script = std::make_shared<const IsolateScript>(previous + source, script_directory_);
+  Optimize(statements);
   interpreter->Interpret(statements);
+  if (!had_error) {
+    interpreter->RunEventLoop();
+  }
 }
 
+auto Lox::LoadModule(LoxModule &module, const Token &token) -> void {
+  std::ifstream file{module.GetPath()};
+  if (!file) {
+    throw RuntimeError(token, "Cannot open module " + module.GetPath() + ".");
+  }
+  std::ostringstream str;
+  str << file.rdbuf();
+  // 模块里的语法和 resolve 错误照常报告，但只让这次访问失败，不改变脚本自己的 had_error
+  bool had_error_before {std::exchange(had_error, false)};
+  auto statements {Parse(str.str(), lazy_parse)};
+  if (!had_error) {
+    Resolver(interpreter, std::filesystem::path(module.GetPath()).parent_path(), &module).Resolve(statements);
+    TypeChecker().Check(statements);
+  }
+  if (std::exchange(had_error, had_error_before)) {
+    throw RuntimeError(token, "Cannot compile module " + module.GetPath() + ".");
+  }
+  Inliner().Inline(*interpreter, statements);
+  module.SetStatements(std::move(statements));
+  interpreter->ExecuteModule(module);
+}
+
+auto Lox::Parse(const std::string &source, bool lazy) -> std::vector<std::shared_ptr<Stmt>> {
+  Parser parser{Scanner(source).ScanTokens()};
+  if (lazy) {
+    parser.EnableLazyBodies();
+  }
+  return parser.Parse();
+}
+
+auto Lox::Parse(const std::vector<Token> &tokens, bool lazy) -> std::vector<std::shared_ptr<Stmt>> {
+  Parser parser{tokens};
+  if (lazy) {
+    parser.EnableLazyBodies();
+  }
+  return parser.Parse();
+}
+
+auto Lox::ParseBody(const std::shared_ptr<FunctionStmt> &function) -> void {
+  auto lazy {function->GetLazyBody()};
+  const auto &name {function->GetFunctionName()};
+  // 失败的 resolve 已经给丢弃的语法树写了侧表条目，每次调用都重新解析的话这些表会越来越大
+  if (lazy->failed_) {
+    throw RuntimeError(name, "Error in body of " + name.GetTokenLexeme() + ".");
+  }
+  // 和模块一样，函数体里的错误照常报告，但只让调用失败。出错时恢复成未解析的状态并记下失败，之后的调用直接失败
+  bool had_error_before {std::exchange(had_error, false)};
+  auto body {Parser(lazy->tokens_).Parse()};
+  if (!had_error) {
+    function->SetFunctionBody(std::move(body));
+    Resolver(interpreter, lazy->directory_, lazy->module_).ResolveLazyFunction(function);
+    TypeChecker().Check(std::vector<std::shared_ptr<Stmt>>{function});
+  }
+  if (std::exchange(had_error, had_error_before)) {
+    function->SetFunctionBody({});
+    lazy->failed_ = true;
+    function->SetLazyBody(std::move(lazy));
+    throw RuntimeError(name, "Error in body of " + name.GetTokenLexeme() + ".");
+  }
+}
+
+auto Lox::NewInterpreter() -> std::shared_ptr<Interpreter> {
+  auto result {std::make_shared<Interpreter>()};
+  result->SetModuleLoader(&Lox::LoadModule);
+  result->SetBodyParser(&Lox::ParseBody);
+  result->SetIsolateStarter(&Lox::Spawn);
+  return result;
+}
+
+auto Lox::Spawn(const std::string &function, Message argument, std::shared_ptr<LoxChannel> result) -> void {
+  if (isolate_script == nullptr) {
+    throw NativeError("Cannot spawn isolates outside a script.");
+  }
+  IsolatePool::Shared().Submit([script = isolate_script, limits = interpreter->GetLimits(),
+                                jit_hot_calls = interpreter->GetJitHotCalls(), function, argument = std::move(argument),
+                                result = std::move(result)]() mutable {
+    RunIsolate(script, limits, jit_hot_calls, function, std::move(argument), *result);
+  });
+}
+
+auto Lox::RunIsolate(const std::shared_ptr<const IsolateScript> &script, const ExecutionLimits &limits,
+                     uint32_t jit_hot_calls, const std::string &function, Message argument, LoxChannel &result)
+    -> void {
+  had_error = false;
+  interpreter = NewInterpreter();
+  isolate_script = script;
+  interpreter->SetLimits(limits);
+  if (jit_hot_calls > 0) {
+    interpreter->EnableJit(jit_hot_calls);
+  }
+  Message value;
+  try {
+    auto statements {Parse(script->Tokens(), lazy_parse)};
+    if (!had_error) {
+      Resolver(interpreter, script->directory_).Resolve(statements);
+      TypeChecker().Check(statements);
+    }
+    if (!had_error) {
+      std::erase_if(statements, [](const std::shared_ptr<Stmt> &statement) {
+        return std::dynamic_pointer_cast<FunctionStmt>(statement) == nullptr &&
+               std::dynamic_pointer_cast<ClassStmt>(statement) == nullptr &&
+               std::dynamic_pointer_cast<ImportStmt>(statement) == nullptr;
+      });
+      Inliner().Inline(*interpreter, statements);
+      interpreter->Interpret(statements);
+      value = interpreter->RunIsolate(function, std::move(argument));
+    }
+  } catch (const std::exception &error) {
+    std::cerr << error.what() << "\n";
+  }
+  // 出错时也要发送，等待结果的 isolate 收到 nil
+  result.Send(std::move(value));
+  // 线程会被下一个 isolate 复用，先释放这个 isolate 的堆
+  interpreter.reset();
+  isolate_script.reset();
+  FinishIsolateTelemetry();
+}
+
+auto Lox::Optimize(const std::vector<std::shared_ptr<Stmt>> &statements) -> void {
+  inliner_.Inline(*interpreter, statements);
+  for (const auto &line : inliner_.TakeReport()) {
+    std::cerr << line << "\n";
+  }
+}
+
+// 扫描线程 -> token 批次队列 -> 解析线程 -> 顶层语句队列 -> 当前线程 resolve 并执行。
+// Resolver 写的是解释器的侧表，和执行放在同一个线程上，不需要给这些表加锁
+auto Lox::RunPipelined(std::string source) -> void {
+  constexpr size_t kTokenBatch = 256;
+  SpscQueue<std::vector<Token>, 64> token_batches;
+  SpscQueue<std::optional<std::shared_ptr<Stmt>>, 64> statements;
+  std::exception_ptr scan_error;
+  std::exception_ptr parse_error;
+  std::exception_ptr run_error;
+  bool parse_failed = false;
+  isolate_script = std::make_shared<const IsolateScript>(source, script_directory_);
+
+  std::jthread scanner_thread([&] {
+    try {
+      Scanner(std::move(source)).ScanTokens(kTokenBatch, [&](std::vector<Token> &&batch) {
+        token_batches.Push(std::move(batch));
+      });
+    } catch (...) {
+      scan_error = std::current_exception();
+      token_batches.Push({Token(TokenType::TOKEN_EOF, "", nullptr, 0)});
+    }
+  });
+  std::jthread parser_thread([&] {
+    bool scanned_all = false;
+    try {
+      Parser parser([&](std::deque<Token> &tokens) {
+        auto batch {token_batches.Pop()};
+        scanned_all = !batch.empty() && batch.back().GetTokenType() == TokenType::TOKEN_EOF;
+        tokens.insert(tokens.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        return true;
+      });
+      if (lazy_parse) {
+        parser.EnableLazyBodies();
+      }
+      // 出错后送一条空语句，执行线程按顺序取到它时才停下来。had_error 是每个线程自己的，
+      // 后面的语法错误不会让执行线程提前停在前面的正确语句上
+      parser.Parse([&](std::shared_ptr<Stmt> statement) {
+        statements.Push(had_error ? nullptr : std::move(statement));
+      });
+    } catch (...) {
+      parse_error = std::current_exception();
+      // 扫描线程可能阻塞在满的队列上，取完剩下的批次让它结束
+      while (!scanned_all) {
+        auto batch {token_batches.Pop()};
+        scanned_all = !batch.empty() && batch.back().GetTokenType() == TokenType::TOKEN_EOF;
+      }
+    }
+    parse_failed = had_error;
+    statements.Push(std::nullopt);
+  });
+
+  auto resolver = std::make_unique<Resolver>(interpreter, script_directory_);
+  interpreter->BeginScript();
+  bool running = true;
+  // 出错之后不再执行，但要取完队列，让前面的线程能够结束
+  while (auto statement = statements.Pop()) {
+    if (!running || had_error || *statement == nullptr) {
+      running = false;
+      continue;
+    }
+    // InterpretNext 只处理 RuntimeError，其它异常 (比如 std::bad_any_cast) 也要等取完队列、
+    // 两个线程结束之后再抛出，否则解析线程阻塞在满的队列上，jthread 的析构永远等不到它
+    try {
+      std::vector batch{*statement};
+      resolver->Resolve(batch);
+      checker_.Check(batch);
+      if (!had_error) {
+        Optimize(batch);
+      }
+      running = !had_error && interpreter->InterpretNext(*statement);
+    } catch (...) {
+      run_error = std::current_exception();
+      running = false;
+    }
+  }
+  scanner_thread.join();
+  parser_thread.join();
+  had_error = had_error || parse_failed;
+  if (scan_error) {
+    std::rethrow_exception(scan_error);
+  }
+  if (parse_error) {
+    std::rethrow_exception(parse_error);
+  }
+  if (run_error) {
+    std::rethrow_exception(run_error);
+  }
+  if (!had_error) {
+    interpreter->RunEventLoop();
+  }
+}
 
 }  // namespace cpplox
\ No newline at end of file
@@ -1,19 +1,158 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <string_view>
+#include "execution_limits.h"
+#include "jit.h"
 #include "lox.h"
+#include "snapshot.h"
 #include "token.h"
 
+namespace {
+
+auto Usage() -> int {
+  std::cout << "Usage: cpplox [--max-steps=N] [--timeout-ms=N] [--max-heap=BYTES] [--max-depth=N] [--jit]\n"
+               "              [--jit-threshold=N] [--snapshot=FILE] [--make-snapshot=FILE] [--emit-cpp[=FILE]]\n"
+               "              [--pipeline] [--watch] [--inline-report] [--telemetry=FILE|unix:PATH]\n"
+               "              [--telemetry-interval-ms=N] [--alloc-profile=FILE] [--heap-diff=OLD,NEW]\n"
+               "              [--lazy-parse] [--check] [script]\n";
+  return 64;
+}
+
+// 解析 "--name=value" 形式的数字参数
+auto ParseFlag(std::string_view arg, std::string_view name, uint64_t &value) -> bool {
+  if (!arg.starts_with(name) || arg.size() <= name.size() || arg[name.size()] != '=') {
+    return false;
+  }
+  value = std::strtoull(arg.data() + name.size() + 1, nullptr, 10);
+  return true;
+}
+
+// 解析 "--name=value" 形式的字符串参数
+auto ParseOption(std::string_view arg, std::string_view name, std::string &value) -> bool {
+  if (!arg.starts_with(name) || arg.size() <= name.size() || arg[name.size()] != '=') {
+    return false;
+  }
+  value = arg.substr(name.size() + 1);
+  return true;
+}
+
+}  // namespace
 
 auto main(int argc, const char *argv[]) -> int {
   cpplox::Lox driver;
-  if (argc > 1) {
-    std::cout << "Usage: cpplox [script]\n";
+  cpplox::ExecutionLimits limits;
+  std::string script;
+  std::string load_snapshot;
+  std::string make_snapshot;
+  std::string emit_cpp;
+  std::string telemetry;
+  std::string alloc_profile;
+  std::string heap_diff;
+  uint64_t telemetry_interval_ms = 10000;
+  uint64_t jit_hot_calls = cpplox::Jit::kHotCalls;
+  bool watch = false;
+  bool jit = false;
+  bool check = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    uint64_t value = 0;
+    if (ParseFlag(arg, "--max-steps", value)) {
+      limits.max_steps_ = value;
+    } else if (ParseFlag(arg, "--timeout-ms", value)) {
+      limits.timeout_ = std::chrono::milliseconds{value};
+    } else if (ParseFlag(arg, "--max-heap", value)) {
+      limits.max_heap_bytes_ = value;
+    } else if (ParseFlag(arg, "--max-depth", value)) {
+      limits.max_call_depth_ = static_cast<int>(value);
+    } else if (ParseFlag(arg, "--telemetry-interval-ms", value)) {
+      telemetry_interval_ms = value;
+    } else if (ParseFlag(arg, "--jit-threshold", value)) {
+      jit_hot_calls = value;
+    } else if (arg == "--emit-cpp") {
+      emit_cpp = "-";
+    } else if (ParseOption(arg, "--emit-cpp", emit_cpp)) {
+      continue;
+    } else if (arg == "--jit") {
+      jit = true;
+    } else if (arg == "--inline-report") {
+      driver.EnableInlineReport();
+    } else if (arg == "--lazy-parse") {
+      driver.EnableLazyParse();
+    } else if (arg == "--check") {
+      check = true;
+    } else if (arg == "--pipeline") {
+      driver.EnablePipeline();
+    } else if (arg == "--watch") {
+      watch = true;
+      driver.EnableWatch();
+    } else if (ParseOption(arg, "--snapshot", load_snapshot) || ParseOption(arg, "--make-snapshot", make_snapshot) ||
+               ParseOption(arg, "--telemetry", telemetry) || ParseOption(arg, "--alloc-profile", alloc_profile) ||
+               ParseOption(arg, "--heap-diff", heap_diff)) {
+      continue;
+    } else if (arg.starts_with("--") || !script.empty()) {
+      return Usage();
+    } else {
+      script = arg;
+    }
+  }
+  // --make-snapshot 运行 prelude 脚本后保存全局变量，--watch 监视脚本文件
+  if ((!make_snapshot.empty() || watch) && script.empty()) {
+    return Usage();
+  }
+  // --heap-diff 只比较两份 heap_dump/--alloc-profile 写出的文件
+  if (!heap_diff.empty()) {
+    auto comma {heap_diff.find(',')};
+    if (comma == std::string::npos) {
+      return Usage();
+    }
+    cpplox::Lox::DiffHeapDumps(heap_diff.substr(0, comma), heap_diff.substr(comma + 1));
     return 0;
-  } 
-  if (argc == 1) {
-    driver.RunFile(argv[0]);
-  } else {
-    driver.RunPrompt();  
+  }
+  // --check 完整地解析并检查脚本里所有的函数体，不运行
+  if (check) {
+    if (script.empty()) {
+      return Usage();
+    }
+    return driver.CheckFile(script) ? 0 : 65;
+  }
+  // --emit-cpp 只翻译脚本，不运行
+  if (!emit_cpp.empty()) {
+    if (script.empty()) {
+      return Usage();
+    }
+    driver.EmitCpp(script, emit_cpp);
+    return 0;
+  }
+  driver.SetLimits(limits);
+  // --jit-threshold 是函数被调用多少次后编译，差分测试用 1 让每个函数第一次调用就走机器码
+  if (jit) {
+    driver.EnableJit(static_cast<uint32_t>(std::max<uint64_t>(jit_hot_calls, 1)));
+  }
+  if (!alloc_profile.empty()) {
+    driver.EnableAllocationProfile(alloc_profile);
+  }
+  if (!telemetry.empty()) {
+    driver.ExportTelemetry(telemetry, std::chrono::milliseconds{std::max<uint64_t>(telemetry_interval_ms, 1)});
+  }
+  try {
+    if (!load_snapshot.empty()) {
+      driver.LoadSnapshot(load_snapshot);
+    }
+    if (!script.empty()) {
+      driver.RunFile(script);
+    } else {
+      driver.RunPrompt();
+    }
+    if (!make_snapshot.empty()) {
+      driver.SaveSnapshot(make_snapshot);
+    }
+  } catch (const cpplox::SnapshotError &error) {
+    std::cerr << error.what() << "\n";
+    return 74;
   }
   return 0;
-}
\ No newline at end of file
+}
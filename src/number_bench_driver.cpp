@@ -0,0 +1,59 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include "interpreter.h"
+#include "parser.h"
+#include "resolver.h"
+#include "scanner.h"
+
+// 数字字面量扫描和数字输出的微基准测试
+namespace {
+
+auto NumericSource(int count) -> std::string {
+  std::ostringstream source;
+  for (int i = 0; i < count; ++i) {
+    source << "print " << i << "." << (i * 7919) % 1000 << " * " << (i % 97) + 0.25 << ";\n";
+  }
+  return source.str();
+}
+
+template <typename F>
+auto TimeMs(F &&func) -> double {
+  auto begin = std::chrono::steady_clock::now();
+  func();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+}  // namespace
+
+auto main() -> int {
+  const int count = 200000;
+  auto source = NumericSource(count);
+
+  std::vector<cpplox::Token> tokens;
+  auto scan_ms = TimeMs([&] { tokens = cpplox::Scanner(source).ScanTokens(); });
+  std::cerr << "scan    " << tokens.size() << " tokens in " << scan_ms << " ms\n";
+
+  cpplox::Interpreter::NumberBuffer buffer;
+  size_t total = 0;
+  auto format_ms = TimeMs([&] {
+    for (int i = 0; i < count; ++i) {
+      total += cpplox::Interpreter::FormatNumber(i * 0.37 + 1e-3, buffer).size();
+    }
+  });
+  std::cerr << "format  " << count << " numbers (" << total << " chars) in " << format_ms << " ms\n";
+
+  // print 密集的程序，输出丢弃到空流中
+  auto interpreter = std::make_shared<cpplox::Interpreter>();
+  auto statements = cpplox::Parser(tokens).Parse();
+  std::make_unique<cpplox::Resolver>(interpreter)->Resolve(statements);
+  std::ostringstream sink;
+  auto *old_buf = std::cout.rdbuf(sink.rdbuf());
+  auto print_ms = TimeMs([&] { interpreter->Interpret(statements); });
+  std::cout.rdbuf(old_buf);
+  std::cerr << "print   " << count << " statements in " << print_ms << " ms\n";
+  return 0;
+}
@@ -1,6 +1,10 @@
 #include <algorithm>
-#include <initializer_list>
-#include <list>
+#include <any>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <memory>
 #include <string>
 #include <vector>
@@ -13,12 +17,16 @@
 
 namespace cpplox {
 
-// 语法的优先级规则，优先级由低到高排序
+// 表达式用 Pratt parser 解析，每个 TokenType 的前缀/中缀处理函数和优先级见 BuildRules，优先级由低到高
+// Assignment =
+// Or or
+// And and
 // Equality == !=
 // Comparison > >= < <=
 // Term - +
 // Factor / *
 // Unary ! -
+// Call . ()
 
 // auto Parser::Parse() -> std::shared_ptr<ExprAST> {
 //   try {
@@ -36,142 +44,189 @@ auto Parser::Parse() -> std::vector<std::shared_ptr<Stmt>> {
   return statements;
 }
 
-auto Parser::Equality() -> std::shared_ptr<ExprAST> {
-  auto expr_ast{Comparsion()};
-  while (Match({TokenType::BANG_EQUAL, TokenType::EQUAL_EQUAL})) {
-    Token op = Previous();
-    auto right{Comparsion()};
-    // Todo(gaoxiang): Add BinaryExprAST ctor parameter
-    expr_ast = std::make_shared<BinaryExprAST>(expr_ast, op, right);
+void Parser::Parse(const std::function<void(std::shared_ptr<Stmt>)> &emit) {
+  while (!IsAtEnd()) {
+    emit(Declaration());
+    // 语法树里保存的是 Token 的副本，只需留下 Previous() 要用的最后一个
+    if (current_ > 1) {
+      tokens_.erase(tokens_.begin(), tokens_.begin() + static_cast<std::ptrdiff_t>(current_ - 1));
+      current_ = 1;
+    }
   }
-  return nullptr;
 }
 
-// comparison     → term ( ( ">" | ">=" | "<" | "<=" ) term )* ;
-auto Parser::Comparsion() -> std::shared_ptr<ExprAST> {
-  auto expr_ast{Term()};
-  while (Match({TokenType::GREATER, TokenType::GREATER_EQUAL, TokenType::LESS, TokenType::LESS_EQUAL})) {
-    Token op = Previous();
-    auto right{Term()};
-    // Todo(gaoxiang): Add BinaryExprAST ctor parameter
-    expr_ast = std::make_shared<BinaryExprAST>(expr_ast, op, right);
-  }
-  return expr_ast;
+auto Parser::BuildRules() -> std::array<ParseRule, kTokenTypeCount> {
+  std::array<ParseRule, kTokenTypeCount> rules{};
+  auto set = [&rules](TokenType type, PrefixFn prefix, InfixFn infix, Precedence precedence) {
+    rules[static_cast<size_t>(type)] = ParseRule{prefix, infix, precedence};
+  };
+  set(TokenType::LEFT_PAREN, &Parser::Grouping, &Parser::Call, Precedence::CALL);
+  set(TokenType::DOT, nullptr, &Parser::Dot, Precedence::CALL);
+  set(TokenType::MINUS, &Parser::Unary, &Parser::Binary, Precedence::TERM);
+  set(TokenType::PLUS, nullptr, &Parser::Binary, Precedence::TERM);
+  set(TokenType::SLASH, nullptr, &Parser::Binary, Precedence::FACTOR);
+  set(TokenType::STAR, nullptr, &Parser::Binary, Precedence::FACTOR);
+  set(TokenType::BANG, &Parser::Unary, nullptr, Precedence::NONE);
+  set(TokenType::BANG_EQUAL, nullptr, &Parser::Binary, Precedence::EQUALITY);
+  set(TokenType::EQUAL_EQUAL, nullptr, &Parser::Binary, Precedence::EQUALITY);
+  set(TokenType::GREATER, nullptr, &Parser::Binary, Precedence::COMPARISON);
+  set(TokenType::GREATER_EQUAL, nullptr, &Parser::Binary, Precedence::COMPARISON);
+  set(TokenType::LESS, nullptr, &Parser::Binary, Precedence::COMPARISON);
+  set(TokenType::LESS_EQUAL, nullptr, &Parser::Binary, Precedence::COMPARISON);
+  set(TokenType::IDENTIFIER, &Parser::Variable, nullptr, Precedence::NONE);
+  set(TokenType::STRING, &Parser::Literal, nullptr, Precedence::NONE);
+  set(TokenType::NUMBER, &Parser::Literal, nullptr, Precedence::NONE);
+  set(TokenType::AND, nullptr, &Parser::Logical, Precedence::AND);
+  set(TokenType::OR, nullptr, &Parser::Logical, Precedence::OR);
+  set(TokenType::FALSE, &Parser::Literal, nullptr, Precedence::NONE);
+  set(TokenType::TRUE, &Parser::Literal, nullptr, Precedence::NONE);
+  set(TokenType::NIL, &Parser::Literal, nullptr, Precedence::NONE);
+  set(TokenType::THIS, &Parser::This, nullptr, Precedence::NONE);
+  set(TokenType::SUPER, &Parser::Super, nullptr, Precedence::NONE);
+  return rules;
 }
 
-auto Parser::Term() -> std::shared_ptr<ExprAST> {
-  auto expr_ast{Factor()};
-  // 先做加减法
-  while (Match({TokenType::MINUS, TokenType::PLUS})) {
-    Token op = Previous();
-    auto right{Factor()};
-    expr_ast = std::make_shared<BinaryExprAST>(expr_ast, op, right);
-  }
-  return expr_ast;
+auto Parser::GetRule(TokenType type) -> const ParseRule & {
+  static const auto kRules {BuildRules()};
+  return kRules[static_cast<size_t>(type)];
 }
 
-// factor         → factor ( "/" | "*" ) unary | unary ;
-
-auto Parser::Factor() -> std::shared_ptr<ExprAST> {
-  auto expr_ast{Unary()};
-  while (Match({TokenType::SLASH, TokenType::STAR})) {
-    Token op{Previous()};
-    auto right{Unary()};
-    expr_ast = std::make_shared<BinaryExprAST>(expr_ast, op, right);
+// 先用前缀规则解析一个操作数，然后只要下一个运算符的优先级不低于 precedence 就继续向右结合
+auto Parser::ParsePrecedence(Precedence precedence) -> std::shared_ptr<ExprAST> {
+  auto prefix {GetRule(Peek().GetTokenType()).prefix_};
+  if (prefix == nullptr) {
+    throw Error(Peek(), "Expect expression");
+  }
+  Advance();
+  // 只有在最低优先级时 "=" 才能作为赋值，a + b = c 这样的目标是非法的
+  bool can_assign = precedence <= Precedence::ASSIGNMENT;
+  auto expr_ast {(this->*prefix)(can_assign)};
+  while (precedence <= GetRule(Peek().GetTokenType()).precedence_) {
+    auto infix {GetRule(Advance().GetTokenType()).infix_};
+    expr_ast = (this->*infix)(expr_ast, can_assign);
+  }
+  if (can_assign && Match(TokenType::EQUAL)) {
+    Log::Error(Previous(), "Invalid assignment target.");
   }
   return expr_ast;
 }
 
-auto Parser::Match(const std::initializer_list<TokenType> &types) -> bool {
-  return std::ranges::all_of(types.begin(), types.end(), [this](const TokenType &type) {
-    if (Check(type)) {
-      Advance();
-      return true;
-    }
-    return false;
-  });
+auto Parser::Grouping(bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  auto expr_ast {Expression()};
+  Consume(TokenType::RIGHT_PAREN, "Expect ')' after expression");
+  return std::make_shared<GroupingExprAST>(expr_ast);
 }
 
-// unary          → ( "!" | "-" ) unary | primary ;
-// 处理一元运算符
-auto Parser::Unary() -> std::shared_ptr<ExprAST> {
-  if (Match({TokenType::BANG, TokenType::MINUS})) {
-    Token op{Previous()};
-    // 采用递归的方式来解析操作数
-    auto right{Unary()};
-    return std::make_shared<UnaryExprAST>(op, right);
+auto Parser::Literal(bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  switch (Previous().GetTokenType()) {
+    case TokenType::FALSE:
+      return std::make_shared<LiteralExprAST>(false);
+    case TokenType::TRUE:
+      return std::make_shared<LiteralExprAST>(true);
+    case TokenType::NIL:
+      return std::make_shared<LiteralExprAST>(nullptr);
+    default:
+      return std::make_shared<LiteralExprAST>(Previous().GetLiteral());
   }
-  return Call();
 }
 
-// primary        → NUMBER | STRING | "true" | "false" | "nil" | "(" expression ")" ;
-// 处理最高优先级
-auto Parser::Primary() -> std::shared_ptr<ExprAST> {
-  if (Match({TokenType::FALSE})) {
-    return std::make_shared<LiteralExprAST>(false);
-  }
-  if (Match({TokenType::TRUE})) {
-    return std::make_shared<LiteralExprAST>(true);
-  }
-  if (Match({TokenType::NIL})) {
-    return std::make_shared<LiteralExprAST>(nullptr);
+auto Parser::Variable(bool can_assign) -> std::shared_ptr<ExprAST> {
+  const auto &name {Previous()};
+  if (can_assign && Match(TokenType::EQUAL)) {
+    return std::make_shared<AssignExprAST>(name, Expression());
   }
+  return std::make_shared<VarExprAST>(name);
+}
 
-  if (Match({TokenType::NUMBER, TokenType::STRING})) {
-    return std::make_shared<LiteralExprAST>(Previous().GetLiteral());
-  }
+auto Parser::This(bool /*can_assign*/) -> std::shared_ptr<ExprAST> { return std::make_shared<ThisExprAST>(Previous()); }
 
-  if (Match({TokenType::SUPER})) {
-    auto keyword {Previous()};
-    Consume(TokenType::DOT, "Expect '.' after super .");
-    auto method {Consume(TokenType::IDENTIFIER, "Expect supper class method name")};
-    return std::make_shared<SuperExprAST>(keyword, method);
-  }
+auto Parser::Super(bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  const auto &keyword {Previous()};
+  Consume(TokenType::DOT, "Expect '.' after super .");
+  const auto &method {Consume(TokenType::IDENTIFIER, "Expect supper class method name")};
+  return std::make_shared<SuperExprAST>(keyword, method);
+}
 
-  if (Match({TokenType::THIS})) {
-    return std::make_shared<ThisExprAST>(Previous());
-  }
+// unary          → ( "!" | "-" ) unary | call ;
+auto Parser::Unary(bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  const auto &op {Previous()};
+  auto right {ParsePrecedence(Precedence::UNARY)};
+  return std::make_shared<UnaryExprAST>(right, op);
+}
 
-  if (Match({TokenType::IDENTIFIER})) {
-    return std::make_shared<VarExprAST>(Previous());
+// 二元运算都是左结合，右操作数只接受更高优先级的表达式
+auto Parser::Binary(const std::shared_ptr<ExprAST> &left, bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  const auto &op {Previous()};
+  auto precedence {GetRule(op.GetTokenType()).precedence_};
+  auto right {ParsePrecedence(static_cast<Precedence>(static_cast<uint8_t>(precedence) + 1))};
+  return std::make_shared<BinaryExprAST>(left, op, right);
+}
+
+auto Parser::Logical(const std::shared_ptr<ExprAST> &left, bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  const auto &op {Previous()};
+  auto precedence {GetRule(op.GetTokenType()).precedence_};
+  auto right {ParsePrecedence(static_cast<Precedence>(static_cast<uint8_t>(precedence) + 1))};
+  return std::make_shared<LogicalExprAST>(left, op, right);
+}
+
+auto Parser::Call(const std::shared_ptr<ExprAST> &callee, bool /*can_assign*/) -> std::shared_ptr<ExprAST> {
+  std::vector<std::shared_ptr<ExprAST>> arguments;
+  if (!Check(TokenType::RIGHT_PAREN)) {
+    do {
+      if (arguments.size() >= 255) {
+        Error(Peek(), "Can`t have more than 255 arguments");
+      }
+      arguments.emplace_back(Expression());
+    } while (Match(TokenType::COMMA));
   }
-  if (Match({TokenType::LEFT_PAREN})) {
-    auto expr_ast{Expression()};
-    Consume(TokenType::RIGHT_PAREN, "Expect ')' after expression");
-    return std::make_shared<GroupingExprAST>(expr_ast);
+  const auto &paren {Consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.")};
+  return std::make_shared<CallExprAST>(callee, paren, arguments);
+}
+
+auto Parser::Dot(const std::shared_ptr<ExprAST> &object, bool can_assign) -> std::shared_ptr<ExprAST> {
+  const auto &name {Consume(TokenType::IDENTIFIER, "Expect property name after '.' .")};
+  if (can_assign && Match(TokenType::EQUAL)) {
+    return std::make_shared<SetExprAST>(object, name, Expression());
   }
+  return std::make_shared<GetExprAST>(object, name);
+}
 
-  throw Error(Peek(), "Expect expression");
-  return nullptr;
+auto Parser::Match(TokenType type) -> bool {
+  if (!Check(type)) {
+    return false;
+  }
+  Advance();
+  return true;
 }
 
-auto Parser::Consume(const TokenType &type, const std::string &message) -> Token {
+auto Parser::Consume(TokenType type, const std::string &message) -> const Token & {
   if (Check(type)) {
     return Advance();
   }
   throw Error(Peek(), message);
 }
 
-auto Parser::Check(const TokenType &type) -> bool {
-  if (IsAtEnd()) {
-    return false;
-  }
-  return Peek().GetTokenType() == type;
-}
+auto Parser::Check(TokenType type) const -> bool { return Peek().GetTokenType() == type; }
 
-auto Parser::IsAtEnd() -> bool { return Peek().GetTokenType() == TokenType::TOKEN_EOF; }
+auto Parser::IsAtEnd() const -> bool { return Peek().GetTokenType() == TokenType::TOKEN_EOF; }
 
-auto Parser::Peek() -> Token { return tokens_[current_]; }
+auto Parser::Peek() const -> const Token & { return tokens_[current_]; }
 
-auto Parser::Previous() -> Token { return tokens_[current_ - 1]; }
+auto Parser::Previous() const -> const Token & { return tokens_[current_ - 1]; }
 
-auto Parser::Advance() -> Token {
+auto Parser::Advance() -> const Token & {
   if (!IsAtEnd()) {
     current_++;
+    Fill();
   }
   return Previous();
 }
 
+void Parser::Fill() {
+  while (current_ >= tokens_.size() && source_ && source_(tokens_)) {
+  }
+}
+
 void Parser::Synchronize() {
   Advance();
   while (!IsAtEnd()) {
@@ -187,6 +242,7 @@ void Parser::Synchronize() {
       case TokenType::WHILE:
       case TokenType::PRINT:
       case TokenType::RETURN:
+      case TokenType::IMPORT:
         return;
       default:
         break;
@@ -205,7 +261,7 @@ auto Parser::IfStatement() -> std::shared_ptr<Stmt> {
 
   auto then_branch{Statement()};
   std::shared_ptr<Stmt> else_branch = nullptr;
-  if (Match({TokenType::ELSE})) {
+  if (Match(TokenType::ELSE)) {
     else_branch = Statement();
   }
 
@@ -213,24 +269,24 @@ auto Parser::IfStatement() -> std::shared_ptr<Stmt> {
 }
 
 auto Parser::Statement() -> std::shared_ptr<Stmt> {
-  if (Match({TokenType::FOR})) {
+  if (Match(TokenType::FOR)) {
     return ForStatement();
   }
 
-  if (Match({TokenType::IF})) {
+  if (Match(TokenType::IF)) {
     return IfStatement();
   }
-  if (Match({TokenType::PRINT})) {
+  if (Match(TokenType::PRINT)) {
     return PrintStatement();
   }
   // Todo(gaoxiang)
-  if (Match({TokenType::RETURN})) {
+  if (Match(TokenType::RETURN)) {
     return ReturnStatement();
   }
-  if (Match({TokenType::LEFT_BRACE})) {
+  if (Match(TokenType::LEFT_BRACE)) {
     return std::make_shared<BlockStmt>(Block());
   }
-  if (Match({TokenType::WHILE})) {
+  if (Match(TokenType::WHILE)) {
     return WhileStatement();
   }
 
@@ -249,40 +305,22 @@ auto Parser::ExpressionStatement() -> std::shared_ptr<Stmt> {
   return std::make_shared<PrintStmt>(expr);
 }
 
-auto Parser::Or() -> std::shared_ptr<ExprAST> {
-  auto expr{And()};
-  while (Match({TokenType::OR})) {
-    auto op{Previous()};
-    auto right{And()};
-    expr = std::make_shared<LogicalExprAST>(expr, op, right);
-  }
-  return expr;
-}
-
-auto Parser::And() -> std::shared_ptr<ExprAST> {
-  auto expr{Equality()};
-  while (Match({TokenType::AND})) {
-    auto op{Previous()};
-    auto right{Equality()};
-    expr = std::make_shared<LogicalExprAST>(expr, op, right);
-  }
-  return expr;
-}
-
 auto Parser::WhileStatement() -> std::shared_ptr<Stmt> {
+  auto keyword{Previous()};
   Consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
   auto condition{Expression()};
   Consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
   auto body{Statement()};
-  return std::make_shared<WhileStmt>(condition, body);
+  return std::make_shared<WhileStmt>(keyword, condition, body);
 }
 
 auto Parser::ForStatement() -> std::shared_ptr<Stmt> {
+  auto keyword{Previous()};
   Consume(TokenType::LEFT_PAREN, "Expect '(' after 'for' .");
   std::shared_ptr<Stmt> initializer;
-  if (Match({TokenType::SEMICOLON})) {
+  if (Match(TokenType::SEMICOLON)) {
     initializer = nullptr;
-  } else if (Match({TokenType::VAR})) {
+  } else if (Match(TokenType::VAR)) {
     initializer = VarDeclaration();
   } else {
     initializer = ExpressionStatement();
@@ -306,7 +344,7 @@ auto Parser::ForStatement() -> std::shared_ptr<Stmt> {
 
   if (condition == nullptr) {
     condition = std::make_shared<LiteralExprAST>(true);
-    body = std::make_shared<WhileStmt>(condition, body);
+    body = std::make_shared<WhileStmt>(keyword, condition, body);
   }
 
   if (initializer != nullptr) {
@@ -318,15 +356,19 @@ auto Parser::ForStatement() -> std::shared_ptr<Stmt> {
 
 auto Parser::Declaration() -> std::shared_ptr<Stmt> {
   try {
-    if (Match({TokenType::CLASS})) {
+    if (Match(TokenType::CLASS)) {
       return ClassDeclaration();
     }
-    if (Match({TokenType::FUN})) {
+    if (Match(TokenType::FUN)) {
       return Function("function");
     }
-    if (Match({TokenType::VAR})) {
+    if (Match(TokenType::VAR)) {
       return VarDeclaration();
     }
+    if (Match(TokenType::IMPORT)) {
+      return ImportDeclaration();
+    }
+    return Statement();
   } catch (ParseError error) {
     Synchronize();
     return nullptr;
@@ -337,14 +379,14 @@ auto Parser::Declaration() -> std::shared_ptr<Stmt> {
 auto Parser::ClassDeclaration() -> std::shared_ptr<Stmt> {
   auto name {Consume(TokenType::IDENTIFIER, "Expect class name.")};
   std::shared_ptr<VarExprAST> supper_class;
-  if (Match({TokenType::LESS})) {
+  if (Match(TokenType::LESS)) {
     Consume(TokenType::IDENTIFIER, "Expect supper class name.");
     supper_class = std::make_shared<VarExprAST>(Previous());
   }
   Consume(TokenType::LEFT_BRACE, "Expect '{' before class body.");
   // use std::vector<std::shared_ptr<Stmt>> ? or FunctionStmt
   std::vector<std::shared_ptr<Stmt>> methods;
-  while(!Check({TokenType::RIGHT_BRACE}) && !IsAtEnd()) {
+  while(!Check(TokenType::RIGHT_BRACE) && !IsAtEnd()) {
     methods.push_back(Function("method"));
   }
   Consume(TokenType::RIGHT_BRACE, "Expect '}' after class body.");
@@ -353,94 +395,121 @@ auto Parser::ClassDeclaration() -> std::shared_ptr<Stmt> {
 
 auto Parser::VarDeclaration() -> std::shared_ptr<Stmt> {
   auto name{Consume(TokenType::IDENTIFIER, "Expect variable name.")};
+  auto type{TypeAnnotation()};
   std::shared_ptr<ExprAST> initializer;
-  if (Match({TokenType::EQUAL})) {
+  if (Match(TokenType::EQUAL)) {
     initializer = Expression();
   }
   Consume(TokenType::SEMICOLON, "Expect ';' after variable declaration");
-  return std::make_shared<VarStmt>(name, initializer);
+  return std::make_shared<VarStmt>(name, initializer, type);
 }
 
-auto Parser::Assignment() -> std::shared_ptr<ExprAST> {
-  auto expr{Equality()};
-
-  if (Match({TokenType::EQUAL})) {
-    auto equals{Previous()};
-    auto value{Assignment()};
-    if (auto *e = dynamic_cast<VarExprAST *>(value.get())) {
-      auto name{e->GetToken()};
-      return std::make_shared<AssignExprAST>(name, value);
-    } 
-    if (auto *e = dynamic_cast<GetExprAST*>(value.get())) {
-      return std::make_shared<SetExprAST>(e->GetObject(), e->GetName(), value);
-    }
+auto Parser::ImportDeclaration() -> std::shared_ptr<Stmt> {
+  auto keyword {Previous()};
+  auto path {Consume(TokenType::STRING, "Expect module path after 'import'.")};
+  if (Check(TokenType::IDENTIFIER) && Peek().GetTokenLexeme() == "as") {
+    Advance();
+    auto name {Consume(TokenType::IDENTIFIER, "Expect module name after 'as'.")};
+    Consume(TokenType::SEMICOLON, "Expect ';' after import.");
+    return std::make_shared<ImportStmt>(keyword, path, name);
+  }
+  // 没有 as 时用文件名 (去掉目录和扩展名) 作为模块名
+  auto stem {std::filesystem::path(std::any_cast<std::string>(path.GetLiteral())).stem().string()};
+  bool identifier = !stem.empty() && std::isdigit(static_cast<unsigned char>(stem.front())) == 0 &&
+                    std::all_of(stem.begin(), stem.end(), [](char c) { return std::isalnum(c) != 0 || c == '_'; });
+  if (!identifier || LookupKeyword(stem) != TokenType::IDENTIFIER) {
+    throw Error(path, "Module file name is not an identifier, use 'import \"...\" as name;'.");
+  }
+  Consume(TokenType::SEMICOLON, "Expect ';' after import.");
+  return std::make_shared<ImportStmt>(keyword, path, Token(TokenType::IDENTIFIER, stem, nullptr, path.GetTokenLine()));
+}
 
-    Log::Error(equals, "Invalid assignment target.");
+auto Parser::TypeAnnotation() -> StaticType {
+  if (!Match(TokenType::COLON)) {
+    return StaticType::UNKNOWN;
   }
-
-  return expr;
+  const auto &name {Consume(TokenType::IDENTIFIER, "Expect type name after ':'.")};
+  auto lexeme {name.GetTokenLexeme()};
+  if (lexeme == "num") {
+    return StaticType::NUMBER;
+  }
+  if (lexeme == "bool") {
+    return StaticType::BOOL;
+  }
+  if (lexeme == "str") {
+    return StaticType::STRING;
+  }
+  Log::Error(name, "Unknown type '" + lexeme + "', expect num, bool or str.");
+  return StaticType::UNKNOWN;
 }
 
 auto Parser::Block() -> std::vector<std::shared_ptr<Stmt>> {
+  struct Depth {
+    int &depth_;
+    explicit Depth(int &depth) : depth_(++depth) {}
+    ~Depth() { --depth_; }
+  } depth{block_depth_};
   std::vector<std::shared_ptr<Stmt>> statements;
-  while (!Check({TokenType::RIGHT_BRACE}) && !IsAtEnd()) {
+  while (!Check(TokenType::RIGHT_BRACE) && !IsAtEnd()) {
     statements.push_back(Declaration());
   }
   Consume(TokenType::RIGHT_BRACE, "Expect '}' after block");
   return statements;
 }
 
-auto Parser::Call() -> std::shared_ptr<ExprAST> {
-  auto expr = Primary();
-  while (true) {
-    if (Match({TokenType::LEFT_PAREN})) {
-      expr = FinishCall(expr);
-    } else if(Match({TokenType::DOT})){
-      auto name {Consume(TokenType::IDENTIFIER, "Expect property name after '.' .")};
-      expr = std::make_shared<GetExprAST>(expr, name);
-    } else {
-      break;
-    }
-  }
-  return expr;
-}
-
-auto Parser::FinishCall(const std::shared_ptr<ExprAST> &callee) -> std::shared_ptr<ExprAST> {
-  std::vector<std::shared_ptr<ExprAST>> arguments;
-  if (!Check({TokenType::RIGHT_PAREN})) {
-    do {
-      if (arguments.size() >= 255) {
-        Error(Peek(), "Can`t have more than 255 arguments");
-      }
-      arguments.emplace_back(Expression());
-    } while (Match({TokenType::COMMA}));
-  }
-  auto paren{Consume({TokenType::RIGHT_PAREN}, "Expect ')' after arguments.")};
-  return std::make_shared<CallExprAST>(callee, paren, arguments);
-}
-
 auto Parser::Function(const std::string &kind) -> std::shared_ptr<Stmt> {
   Token name{Consume(TokenType::IDENTIFIER, "Expect" + kind + " name.")};
   Consume(TokenType::LEFT_PAREN, "Expect '(' after " + kind + " name.");
   std::vector<Token> parameters;
+  std::vector<StaticType> param_types;
+  bool typed = false;
   if (!Check(TokenType::RIGHT_PAREN)) {
     do {
       if (parameters.size() >= 255) {
         Log::Error(Peek(), "Can`t have more than 255 parameters");
       }
       parameters.emplace_back(Consume(TokenType::IDENTIFIER, "Expect parameter name."));
-    } while (Match({TokenType::COMMA}));
+      param_types.push_back(TypeAnnotation());
+      typed = typed || param_types.back() != StaticType::UNKNOWN;
+    } while (Match(TokenType::COMMA));
   }
   Consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+  auto return_type{TypeAnnotation()};
   Consume(TokenType::LEFT_BRACE, "Expect '{' before " + kind + " body.");
+  if (!typed) {
+    param_types.clear();
+  }
+  // 顶层函数不捕获局部变量，函数体可以留到第一次调用时再解析和 resolve
+  if (lazy_bodies_ && kind == "function" && block_depth_ == 0) {
+    auto function {std::make_shared<FunctionStmt>(name, parameters, std::vector<std::shared_ptr<Stmt>>{},
+                                                  std::move(param_types), return_type)};
+    function->SetLazyBody(SkipBody());
+    return function;
+  }
   auto body{Block()};
-  return std::make_shared<FunctionStmt>(name, parameters, body);
+  return std::make_shared<FunctionStmt>(name, parameters, body, std::move(param_types), return_type);
+}
+
+auto Parser::SkipBody() -> std::shared_ptr<LazyBody> {
+  auto lazy {std::make_shared<LazyBody>()};
+  int depth = 1;
+  while (!IsAtEnd()) {
+    const auto &token {Advance()};
+    if (token.GetTokenType() == TokenType::LEFT_BRACE) {
+      ++depth;
+    } else if (token.GetTokenType() == TokenType::RIGHT_BRACE && --depth == 0) {
+      lazy->tokens_.emplace_back(TokenType::TOKEN_EOF, "", nullptr, token.GetTokenLine());
+      return lazy;
+    }
+    lazy->tokens_.push_back(token);
+  }
+  throw Error(Peek(), "Expect '}' after block");
 }
 
 auto Parser::ReturnStatement() -> std::shared_ptr<Stmt> {
   auto keyword{Previous()};
   std::shared_ptr<ExprAST> value;
-  if (!Check({TokenType::SEMICOLON})) {
+  if (!Check(TokenType::SEMICOLON)) {
     value = Expression();
   }
   Consume(TokenType::SEMICOLON, "Expect ';' after return value.");
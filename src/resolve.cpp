@@ -1,7 +1,9 @@
 #include <error.h>
 #include <algorithm>
 #include <any>
+#include <filesystem>
 #include <memory>
+#include <string>
 #include <vector>
 #include "ast.h"
 #include "lox_class.h"
@@ -12,9 +14,38 @@
 namespace cpplox {
 
 void Resolver::Resolve(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  if (module_ != nullptr && IsGlobalScope()) {
+    ExportDeclarations(statements);
+  }
   for (auto &statement : statements) {
     Resolve(statement);
   }
+  if (functions_.size() == 1) {
+    if (module_ != nullptr) {
+      module_->SetSlotCount(functions_.front().slot_count_);
+    } else {
+      interpreter_->SetScriptSlots(functions_.front().slot_count_);
+    }
+  }
+}
+
+// 函数体可以引用写在后面的顶层声明，所以先把模块所有的顶层声明登记好
+void Resolver::ExportDeclarations(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  for (const auto &statement : statements) {
+    std::string name;
+    if (auto var {std::dynamic_pointer_cast<VarStmt>(statement)}; var != nullptr) {
+      name = var->GetName().GetTokenLexeme();
+    } else if (auto function {std::dynamic_pointer_cast<FunctionStmt>(statement)}; function != nullptr) {
+      name = function->GetFunctionName().GetTokenLexeme();
+    } else if (auto klass {std::dynamic_pointer_cast<ClassStmt>(statement)}; klass != nullptr) {
+      name = klass->GetClassName().GetTokenLexeme();
+    } else if (auto imported {std::dynamic_pointer_cast<ImportStmt>(statement)}; imported != nullptr) {
+      name = imported->GetName().GetTokenLexeme();
+    } else {
+      continue;
+    }
+    module_->Export(name, interpreter_->DeclareGlobal(statement, module_->GlobalName(name)));
+  }
 }
 
 void Resolver::Resolve(const std::shared_ptr<Stmt> &statement) {
@@ -26,79 +57,178 @@ void Resolver::Resolve(const std::shared_ptr<ExprAST> &expr) {
 }
 
 void Resolver::BeginScope() {
-  // scopes_.emplace();
+  functions_.back().scope_depth_++;
 }
 
 void Resolver::EndScope() {
-  scopes_.pop_back();
+  auto &function = functions_.back();
+  function.scope_depth_--;
+  PopLocals(function.scope_depth_);
+}
+
+// 离开作用域时局部变量是否被捕获已经确定，把槽位告诉解释器
+void Resolver::PopLocals(int depth) {
+  auto &locals = functions_.back().locals_;
+  while (!locals.empty() && locals.back().depth_ > depth) {
+    auto &local = locals.back();
+    SlotInfo slot{static_cast<int>(locals.size()) - 1, local.captured_};
+    if (local.is_super_) {
+      interpreter_->DeclareSuperSlot(std::static_pointer_cast<ClassStmt>(local.declaration_), slot);
+    } else if (local.declaration_ != nullptr) {
+      interpreter_->DeclareSlot(local.declaration_, slot);
+    }
+    locals.pop_back();
+  }
+}
+
+void Resolver::AddLocal(const std::string &name, const std::shared_ptr<Stmt> &declaration, bool is_super) {
+  auto &function = functions_.back();
+  function.locals_.push_back(Local{name, function.scope_depth_, false, false, declaration, is_super});
+  function.slot_count_ = std::max(function.slot_count_, static_cast<int>(function.locals_.size()));
+}
+
+void Resolver::VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+  BeginScope();
+  Resolve(stmt->GetBlockStatements());
+  EndScope();
 }
 
 void Resolver::VisitVarStmt(std::shared_ptr<VarStmt> stmt) {
-  Declare(stmt->GetName());
+  Declare(stmt->GetName(), stmt);
   if (stmt->GetExpr() != nullptr) {
     Resolve(stmt->GetExpr());
   }
   Define(stmt->GetName());
 }
 
-void Resolver::Declare(const Token &name) {
-  if (scopes_.empty()) {
+void Resolver::Declare(const Token &name, const std::shared_ptr<Stmt> &declaration) {
+  if (IsGlobalScope()) {
     return;
   }
-  auto &scope = scopes_.back();
-  if (scope.contains(name.GetTokenLexeme())) {
-    Log::Error(name, "Already variable with this name in this scope");
+  const auto &function = functions_.back();
+  for (auto iter = function.locals_.rbegin(); iter != function.locals_.rend(); ++iter) {
+    if (iter->depth_ < function.scope_depth_) {
+      break;
+    }
+    if (iter->name_ == name.GetTokenLexeme()) {
+      Log::Error(name, "Already variable with this name in this scope");
+    }
   }
-  scope.emplace(name.GetTokenLexeme(), false);
+  AddLocal(name.GetTokenLexeme(), declaration);
 }
 
 void Resolver::Define(const Token &name) {
-  if  (scopes_.empty()) {
+  if (IsGlobalScope()) {
     return;
   }
-  scopes_.front().emplace(name.GetTokenLexeme(), true);
+  functions_.back().locals_.back().defined_ = true;
 }
 
 auto Resolver::VisitVariableExprAST(std::shared_ptr<VarExprAST> expr) -> std::any{
-  if (!scopes_.empty() && !scopes_.front()[expr->GetToken().GetTokenLexeme()]) {
-    Log::Error(expr->GetToken(), "Can`t read local variable in its own initializer.");
+  const auto &locals = functions_.back().locals_;
+  for (auto iter = locals.rbegin(); iter != locals.rend(); ++iter) {
+    if (iter->name_ == expr->GetToken().GetTokenLexeme()) {
+      if (!iter->defined_) {
+        Log::Error(expr->GetToken(), "Can`t read local variable in its own initializer.");
+      }
+      break;
+    }
   }
-  ResolveLocal(expr, expr->GetToken());
+  expr->SetVariable(ResolveLocal(expr->GetToken()));
   return {};
 }
 
-void Resolver::ResolveLocal(const std::shared_ptr<ExprAST> &expr, const Token &name) {
-  for (int i = scopes_.size() - 1; i >= 0; -- i) {
-    if (scopes_[i].contains(name.GetTokenLexeme())) {
-      interpreter_->Resolve(expr, scopes_[scopes_.size() - 1 - i]);
-      return;
+auto Resolver::ResolveLocal(const Token &name) -> VariableRef {
+  auto ref {ResolveName(functions_.size() - 1, name.GetTokenLexeme())};
+  if (ref.has_value()) {
+    return *ref;
+  }
+  return interpreter_->ResolveGlobal(GlobalName(name.GetTokenLexeme()));
+}
+
+// 先找当前函数的局部变量，再沿外层函数查找并把途经的函数都加上 upvalue；都找不到就是全局变量
+auto Resolver::ResolveName(size_t function_index, const std::string &name) -> std::optional<VariableRef> {
+  auto &locals = functions_[function_index].locals_;
+  for (int i = static_cast<int>(locals.size()) - 1; i >= 0; --i) {
+    if (locals[i].name_ == name) {
+      return VariableRef{VariableKind::LOCAL, i};
     }
   }
+  if (function_index == 0) {
+    return std::nullopt;
+  }
+  auto enclosing {ResolveName(function_index - 1, name)};
+  if (!enclosing.has_value()) {
+    return std::nullopt;
+  }
+  if (enclosing->kind_ == VariableKind::LOCAL) {
+    functions_[function_index - 1].locals_[enclosing->index_].captured_ = true;
+    return VariableRef{VariableKind::UPVALUE, AddUpvalue(function_index, UpvalueRef{enclosing->index_, true})};
+  }
+  return VariableRef{VariableKind::UPVALUE, AddUpvalue(function_index, UpvalueRef{enclosing->index_, false})};
+}
+
+auto Resolver::AddUpvalue(size_t function_index, UpvalueRef upvalue) -> int {
+  auto &upvalues = functions_[function_index].upvalues_;
+  for (size_t i = 0; i < upvalues.size(); ++i) {
+    if (upvalues[i].index_ == upvalue.index_ && upvalues[i].is_local_ == upvalue.is_local_) {
+      return static_cast<int>(i);
+    }
+  }
+  upvalues.push_back(upvalue);
+  return static_cast<int>(upvalues.size()) - 1;
 }
 
 auto Resolver::VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr) -> std::any {
   Resolve(expr->GetValue());
-  ResolveLocal(expr, expr->GetName());
+  expr->SetVariable(ResolveLocal(expr->GetName()));
   return {};
 }
 
 void Resolver::VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
-  Declare(stmt->GetFunctionName());
+  Declare(stmt->GetFunctionName(), stmt);
   Define(stmt->GetFunctionName());
+  if (const auto &lazy {stmt->GetLazyBody()}; lazy != nullptr) {
+    // 顶层函数没有 upvalue，创建闭包只需要空的 FunctionInfo
+    lazy->module_ = module_;
+    lazy->directory_ = directory_.string();
+    interpreter_->DeclareFunction(stmt, FunctionInfo{});
+    interpreter_->DeclareLazyFunction(stmt);
+    return;
+  }
   ResolveFunction(stmt, FunctionType::FUNCTION);
 }
 
 void Resolver::ResolveFunction(const std::shared_ptr<FunctionStmt> &function, const FunctionType &function_type) {
   FunctionType enclosing_function {current_function_};
   current_function_ = function_type;
+  functions_.push_back(FunctionScope{});
   BeginScope();
+  FunctionInfo info;
+  if (function_type == FunctionType::METHOD || function_type == FunctionType::INITIALIZER) {
+    info.has_receiver_ = true;
+    AddLocal("this", nullptr);
+    functions_.back().locals_.back().defined_ = true;
+  }
   for (const auto &param : function->GetFunctionParams()) {
-    Declare(param);
+    Declare(param, nullptr);
     Define(param);
   }
+  auto param_count {functions_.back().locals_.size()};
   Resolve(function->GetFunctionBody());
+
+  auto &scope = functions_.back();
+  for (size_t i = 0; i < param_count; ++i) {
+    if (scope.locals_[i].captured_) {
+      info.captured_params_.push_back(static_cast<int>(i));
+    }
+  }
+  PopLocals(0);
+  info.slot_count_ = scope.slot_count_;
+  info.upvalues_ = std::move(scope.upvalues_);
+  interpreter_->DeclareFunction(function, std::move(info));
+  functions_.pop_back();
   current_function_ = enclosing_function;
-  EndScope();
 }
 
 void Resolver::VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) {
@@ -126,6 +256,10 @@ void Resolver::VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
       Log::Error(stmt->GetReturnKeyWord(), "Can`t return a value from an initializer.");
     }
     Resolve(stmt->GetReturnValue());
+    if (current_function_ != FunctionType::NONE && current_function_ != FunctionType::INITIALIZER &&
+        std::dynamic_pointer_cast<CallExprAST>(stmt->GetReturnValue()) != nullptr) {
+      interpreter_->MarkTailCall(stmt);
+    }
   }
 }
 
@@ -169,7 +303,7 @@ auto Resolver::VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std:
 void Resolver::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
   auto enclosing_class {current_class_};
   current_class_ = ClassType::CLASS;
-  Declare(stmt->GetClassName());
+  Declare(stmt->GetClassName(), stmt);
   Define(stmt->GetClassName());
   if (stmt->GetSupperClass() != nullptr && 
       stmt->GetClassName().GetTokenLexeme() == stmt->GetSupperClass()->GetToken().GetTokenLexeme()) {
@@ -179,12 +313,12 @@ void Resolver::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
     current_class_ = ClassType::SUBCLASS;
     Resolve(stmt->GetSupperClass());
   }
+  // super 是包住所有方法的作用域里的局部变量，方法通过 upvalue 引用它；this 是方法 frame 的 slot 0
   if (stmt->GetSupperClass() != nullptr) {
     BeginScope();
-    scopes_.front().emplace("supper", true);
+    AddLocal("super", stmt, true);
+    functions_.back().locals_.back().defined_ = true;
   }
-  BeginScope();
-  scopes_.front().emplace("this", true);
   for (const auto &method : stmt->GetClassMethods()) {
     auto declaration {FunctionType::METHOD};
     if (method->GetFunctionName().GetTokenLexeme() == "init") {
@@ -192,11 +326,18 @@ void Resolver::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
     }
     ResolveFunction(method, declaration);
   }
-  EndScope();
   if (stmt->GetSupperClass() != nullptr) { EndScope(); }
   current_class_ = enclosing_class;
 }
 
+void Resolver::VisitImportStmt(std::shared_ptr<ImportStmt> stmt) {
+  Declare(stmt->GetName(), stmt);
+  Define(stmt->GetName());
+  // 只确定模块是哪个文件，不读取文件
+  auto path {std::filesystem::absolute(directory_ / stmt->GetPath()).lexically_normal()};
+  interpreter_->DeclareImport(stmt, interpreter_->ImportModule(path.string()));
+}
+
 auto Resolver::VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any {
   Resolve(expr_ast->GetObject());
   return {};
@@ -213,7 +354,7 @@ auto Resolver::VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::a
     Log::Error(expr_ast->GetThisKeyWord(), "Can`t use 'this' outside of a class");
     return {};
   }
-  ResolveLocal(expr_ast, expr_ast->GetThisKeyWord());
+  expr_ast->SetVariable(ResolveLocal(expr_ast->GetThisKeyWord()));
   return {};
 }
 
@@ -223,7 +364,11 @@ auto Resolver::VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std:
   } else if (current_class_ != ClassType::SUBCLASS) {
     Log::Error(expr_ast->GetSuperkeyWord(), "Can`t use 'super' in a class with no superclass");
   }
-  ResolveLocal(expr_ast, expr_ast->GetSuperkeyWord());
+  auto super_ref {ResolveName(functions_.size() - 1, "super")};
+  auto this_ref {ResolveName(functions_.size() - 1, "this")};
+  if (super_ref.has_value() && this_ref.has_value()) {
+    interpreter_->ResolveSuper(expr_ast, *super_ref, *this_ref);
+  }
   return {};
 }
 
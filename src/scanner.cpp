@@ -1,21 +1,60 @@
 #include "scanner.h"
-#include <cctype>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <list>
+#include <string_view>
+#include "byte_scan.h"
 #include "token.h"
 #include "lox.h"
 
 namespace cpplox {
 
-auto Scanner::ScanTokens() -> std::list<Token> {
+namespace {
+
+auto IsDigit(char ch) -> bool { return ch >= '0' && ch <= '9'; }
+auto IsAlpha(char ch) -> bool { return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'); }
+
+auto SkipDigits(const char *p, const char *end) -> const char * {
+  return SkipWhile(
+      p, end, [](const auto &chunk) { return chunk.InRange('0', '9'); }, IsDigit);
+}
+
+auto SkipAlphaNumeric(const char *p, const char *end) -> const char * {
+  return SkipWhile(
+      p, end,
+      [](const auto &chunk) { return chunk.InRange('a', 'z') | chunk.InRange('A', 'Z') | chunk.InRange('0', '9'); },
+      [](char ch) { return IsAlpha(ch) || IsDigit(ch); });
+}
+
+}  // namespace
+
+auto Scanner::ScanTokens() -> std::vector<Token> {
   while(!IsAtEnd()) {
     start_ = current_;
     ScanToken();
   }
 
-  tokens_.emplace_back(TokenType::TOKEN_EOF, "", line_);
+  tokens_.emplace_back(TokenType::TOKEN_EOF, "", nullptr, line_);
   return tokens_;
 }
 
+void Scanner::ScanTokens(size_t batch, const std::function<void(std::vector<Token> &&)> &flush) {
+  tokens_.reserve(batch);
+  while (!IsAtEnd()) {
+    start_ = current_;
+    ScanToken();
+    if (tokens_.size() >= batch) {
+      flush(std::move(tokens_));
+      tokens_.clear();
+      tokens_.reserve(batch);
+    }
+  }
+  tokens_.emplace_back(TokenType::TOKEN_EOF, "", nullptr, line_);
+  flush(std::move(tokens_));
+  tokens_.clear();
+}
+
 auto Scanner::ScanToken() -> void {
   auto ch = Advance();
   switch (ch) {
@@ -34,6 +73,9 @@ auto Scanner::ScanToken() -> void {
     case ',':
       AddToken(TokenType::COMMA);
       break;
+    case ':':
+      AddToken(TokenType::COLON);
+      break;
     case '.':
       AddToken(TokenType::DOT);
       break;
@@ -57,7 +99,7 @@ auto Scanner::ScanToken() -> void {
       AddToken(Match('=') ? TokenType::LESS_EQUAL : TokenType::LESS);
       break;
     case '>':
-      AddToken(Match('>') ? TokenType::GREATER_EQUAL : TokenType::GREATER);
+      AddToken(Match('=') ? TokenType::GREATER_EQUAL : TokenType::GREATER);
       break;
     case ';':
       AddToken(TokenType::SEMICOLON);
@@ -65,9 +107,8 @@ auto Scanner::ScanToken() -> void {
     // deal with comment //
     case '/':
       if (Match('/')) {
-        while(Peek() != '\n' && !IsAtEnd()) { 
-          Advance();
-        }
+        current_ = static_cast<int>(FindByte(source_.data() + current_, source_.data() + source_.size(), '\n') -
+                                    source_.data());
       } else {
         AddToken(TokenType::SLASH);
       }
@@ -75,19 +116,23 @@ auto Scanner::ScanToken() -> void {
     case ' ':
     case '\r':
     case '\t':
+    case '\n': {
+      // 一次跳过整段空白，行号按跳过的换行符数量增加
+      const auto *begin {source_.data() + start_};
+      const auto *stop {SkipSpaces(begin, source_.data() + source_.size())};
+      line_ += static_cast<int>(std::count(begin, stop, '\n'));
+      current_ = static_cast<int>(stop - source_.data());
       break;
-    case '\n':
-      line_++;
-      break;
+    }
     // deal with const string
     case '"':
       String();
       break;
     // TODO(gaoxiang): deal with not defined operator
     default:
-      if (std::isdigit(ch) != 0) {
+      if (IsDigit(ch)) {
         Number();
-      } else if(isalpha(ch) != 0) {
+      } else if (IsAlpha(ch)) {
         Identifier();
       } else {
         throw "not defined operator";
@@ -107,13 +152,13 @@ auto Scanner::Advance() -> char {
 }
 
 auto Scanner::AddToken(TokenType token_type) -> void {
-  // get a complete token
-  std::string text = source_.substr(start_, current_);
-  tokens_.emplace_back(token_type, text, line_);
+  AddToken(token_type, {});
 }
 
-auto Scanner::AddToken(TokenType token_type, const std::string &val) -> void {
-  tokens_.emplace_back(token_type, val, line_);
+auto Scanner::AddToken(TokenType token_type, const std::any &literal) -> void {
+  // get a complete token
+  std::string text = source_.substr(start_, current_ - start_);
+  tokens_.emplace_back(token_type, text, literal, line_);
 }
 
 auto Scanner::Match(char expected) -> bool {
@@ -135,12 +180,10 @@ auto Scanner::Peek() -> char {
 }
 
 auto Scanner::String() -> void {
-  while(Peek() != '"' && !IsAtEnd()) {
-    if (Peek() == '\n') {
-      line_++;
-    }
-    Advance();
-  }
+  const auto *begin {source_.data() + current_};
+  const auto *quote {FindByte(begin, source_.data() + source_.size(), '"')};
+  line_ += static_cast<int>(std::count(begin, quote, '\n'));
+  current_ = static_cast<int>(quote - source_.data());
 
   if (IsAtEnd()) {
     // TODO(gaoxiang): error
@@ -149,22 +192,21 @@ auto Scanner::String() -> void {
   Advance();
 
   // get the const string
-  std::string val = source_.substr(start_ + 1, current_ - 1);
+  std::string val = source_.substr(start_ + 1, current_ - start_ - 2);
   AddToken(TokenType::STRING, val);
 }
 
 auto Scanner::Number() -> void {
-  while(isdigit(Peek()) != 0) {
-    Advance();
-  }
+  const auto *end {source_.data() + source_.size()};
+  current_ = static_cast<int>(SkipDigits(source_.data() + current_, end) - source_.data());
   // 处理小数点
-  if (Peek() == '.' && (isdigit(PeekNext()) != 0)) {
-    Advance();
-    while(isdigit(Peek()) != 0) {
-      Advance();
-    }
+  if (Peek() == '.' && IsDigit(PeekNext())) {
+    current_ = static_cast<int>(SkipDigits(source_.data() + current_ + 1, end) - source_.data());
   }
-  AddToken(TokenType::NUMBER, source_.substr(start_, current_));
+  // 在扫描阶段就把字面量转换成double，解释器不再需要重复解析
+  double value{0};
+  std::from_chars(source_.data() + start_, source_.data() + current_, value);
+  AddToken(TokenType::NUMBER, value);
 }
 
 auto Scanner::PeekNext() -> char {
@@ -175,21 +217,9 @@ auto Scanner::PeekNext() -> char {
 }
 
 auto Scanner::Identifier() -> void {
-  while(IsAlphaNumeric(Peek())) {
-    Advance();
-  }
-  std::string text = source_.substr(start_, current_);
-  TokenType type;
-  if (!Token::key_words.contains(text)) {
-    type = TokenType::IDENTIFIER;
-  } else {
-    type = Token::key_words[text];
-  }
-  AddToken(TokenType::IDENTIFIER);
-}
-
-auto Scanner::IsAlphaNumeric(char ch) -> bool {
-  return (isalpha(ch) != 0) || (isdigit(ch) != 0);
+  current_ = static_cast<int>(SkipAlphaNumeric(source_.data() + current_, source_.data() + source_.size()) -
+                              source_.data());
+  AddToken(LookupKeyword(std::string_view{source_}.substr(start_, current_ - start_)));
 }
 
 }  // namespace cpplox
\ No newline at end of file
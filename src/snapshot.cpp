@@ -0,0 +1,974 @@
+#include "snapshot.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <any>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "environment.h"
+#include "interpreter.h"
+#include "lox_callable.h"
+#include "lox_class.h"
+#include "lox_function.h"
+#include "lox_instance.h"
+#include "stmt.h"
+#include "token.h"
+
+namespace cpplox {
+
+namespace {
+
+constexpr std::string_view kMagic{"LOXSNAP"};
+constexpr uint8_t kVersion = 2;
+
+enum class ExprTag : uint8_t { NONE, BINARY, GROUPING, LITERAL, UNARY, LOGICAL, VARIABLE, ASSIGN, CALL, GET, SET, THIS, SUPER };
+enum class StmtTag : uint8_t { NONE, EXPRESSION, IF, WHILE, PRINT, VAR, BLOCK, FUNCTION, RETURN, CLASS };
+enum class ValueTag : uint8_t { NIL, BOOLEAN, NUMBER, STRING, FUNCTION, CLASS, INSTANCE };
+
+// 0 表示全局变量，否则是 VariableKind + 1
+constexpr uint8_t kNoRef = 0;
+
+}  // namespace
+
+// 按小端序把 AST、Resolver 的结果和对象图写进 out_。对象分成 Upvalue、函数、类、实例四张表，
+// 先写出创建对象需要的信息，最后再写出可能成环的引用 (Upvalue 的值、实例的字段、方法的 this)
+class SnapshotWriter : public ExprASTVisitor, public StmtVisitor {
+public:
+  explicit SnapshotWriter(Interpreter &interpreter) : interpreter_(interpreter) {}
+
+  auto Write() -> std::string {
+    // 模块的全局变量和 import 都是按文件路径 resolve 的，快照里没有办法还原
+    if (!interpreter_.modules_.empty()) {
+      throw SnapshotError("Cannot snapshot a program that imports modules.");
+    }
+    const auto &globals {interpreter_.globals_->GetValues()};
+    for (const auto &[name, value] : globals) {
+      if (!IsNative(value)) {
+        Collect(value);
+      }
+    }
+    SortClasses();
+
+    out_.append(kMagic);
+    WriteU8(kVersion);
+    WriteU32(declarations_.size());
+    for (const auto &declaration : declarations_) {
+      WriteFunction(declaration);
+    }
+    WriteU32(cells_.size());
+    WriteU32(functions_.size());
+    for (const auto &function : functions_) {
+      WriteU32(declaration_ids_.at(function->GetDeclaration().get()));
+      WriteU8(function->IsInitializer() ? 1 : 0);
+      WriteU32(function->GetUpvalues().size());
+      for (const auto &cell : function->GetUpvalues()) {
+        WriteU32(cell_ids_.at(cell.get()));
+      }
+    }
+    WriteU32(classes_.size());
+    for (const auto &klass : classes_) {
+      WriteString(klass->ToString());
+      WriteU32(klass->GetSuperClass() == nullptr ? 0 : class_ids_.at(klass->GetSuperClass().get()) + 1);
+      WriteU32(klass->GetMethods().size());
+      for (const auto &[name, method] : klass->GetMethods()) {
+        WriteString(name);
+        WriteU32(function_ids_.at(method.get()));
+      }
+    }
+    WriteU32(instances_.size());
+    for (const auto &instance : instances_) {
+      WriteU32(class_ids_.at(instance->GetClass().get()));
+    }
+
+    for (const auto &function : functions_) {
+      WriteValue(function->GetReceiver().has_value() ? function->GetReceiver() : std::any{nullptr});
+    }
+    for (const auto &cell : cells_) {
+      WriteValue(cell->value_);
+    }
+    for (const auto &instance : instances_) {
+      WriteU32(instance->GetFields().size());
+      for (const auto &[name, value] : instance->GetFields()) {
+        WriteString(name);
+        WriteValue(value);
+      }
+    }
+    uint32_t count = std::count_if(globals.begin(), globals.end(), [](const auto &entry) { return !IsNative(entry.second); });
+    WriteU32(count);
+    for (const auto &[name, value] : globals) {
+      if (!IsNative(value)) {
+        WriteString(name);
+        WriteValue(value);
+      }
+    }
+    return std::move(out_);
+  }
+
+  auto VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::BINARY);
+    WriteExpr(expr_ast->GetLeftExpr());
+    WriteToken(expr_ast->GetOperation());
+    WriteExpr(expr_ast->GetRightExpr());
+    return {};
+  }
+  auto VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::GROUPING);
+    WriteExpr(expr_ast->GetExpression());
+    return {};
+  }
+  auto VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::LITERAL);
+    WriteValue(expr_ast->GetValue());
+    return {};
+  }
+  auto VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::UNARY);
+    WriteExpr(expr_ast->GetRightExpr());
+    WriteToken(expr_ast->GetOperation());
+    return {};
+  }
+  auto VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::LOGICAL);
+    WriteExpr(expr_ast->GetLeftExpr());
+    WriteToken(expr_ast->GetToken());
+    WriteExpr(expr_ast->GetRightExpr());
+    return {};
+  }
+  auto VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::VARIABLE);
+    WriteToken(expr_ast->GetToken());
+    WriteRef(expr_ast->GetVariable());
+    return {};
+  }
+  auto VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::ASSIGN);
+    WriteToken(expr_ast->GetName());
+    WriteExpr(expr_ast->GetValue());
+    WriteRef(expr_ast->GetVariable());
+    return {};
+  }
+  auto VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::CALL);
+    WriteExpr(expr_ast->GetCallee());
+    WriteToken(expr_ast->GetToken());
+    auto arguments {expr_ast->GetArguments()};
+    WriteU32(arguments.size());
+    for (const auto &argument : arguments) {
+      WriteExpr(argument);
+    }
+    return {};
+  }
+  auto VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::GET);
+    WriteExpr(expr_ast->GetObject());
+    WriteToken(expr_ast->GetName());
+    return {};
+  }
+  auto VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::SET);
+    WriteExpr(expr_ast->GetSetObject());
+    WriteToken(expr_ast->GetSetName());
+    WriteExpr(expr_ast->GetSetValue());
+    return {};
+  }
+  auto VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::THIS);
+    WriteToken(expr_ast->GetThisKeyWord());
+    WriteRef(expr_ast->GetVariable());
+    return {};
+  }
+  auto VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any override {
+    WriteTag(ExprTag::SUPER);
+    WriteToken(expr_ast->GetSuperkeyWord());
+    WriteToken(expr_ast->GetSuperMethod());
+    auto iter {interpreter_.super_refs_.find(expr_ast)};
+    WriteU8(iter == interpreter_.super_refs_.end() ? 0 : 1);
+    if (iter != interpreter_.super_refs_.end()) {
+      WriteRef(iter->second.first);
+      WriteRef(iter->second.second);
+    }
+    return {};
+  }
+
+  void VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) override {
+    WriteTag(StmtTag::EXPRESSION);
+    WriteExpr(stmt->GetExpr());
+  }
+  void VisitIfStmt(std::shared_ptr<IfStmt> stmt) override {
+    WriteTag(StmtTag::IF);
+    WriteExpr(stmt->GetConditionExpression());
+    WriteStmt(stmt->GetThenBranch());
+    WriteStmt(stmt->GetElseBranch());
+  }
+  void VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) override {
+    WriteTag(StmtTag::WHILE);
+    WriteToken(stmt->GetKeyWord());
+    WriteExpr(stmt->GetConditionExpr());
+    WriteStmt(stmt->GetWhileBody());
+  }
+  void VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) override {
+    WriteTag(StmtTag::PRINT);
+    WriteExpr(stmt->GetExpr());
+  }
+  void VisitVarStmt(std::shared_ptr<VarStmt> stmt) override {
+    WriteTag(StmtTag::VAR);
+    WriteToken(stmt->GetName());
+    WriteExpr(stmt->GetExpr());
+    WriteU8(static_cast<uint8_t>(stmt->GetType()));
+    WriteSlot(stmt);
+  }
+  void VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) override {
+    WriteTag(StmtTag::BLOCK);
+    WriteStatements(stmt->GetBlockStatements());
+  }
+  void VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) override {
+    WriteTag(StmtTag::FUNCTION);
+    WriteFunction(stmt);
+  }
+  void VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) override {
+    WriteTag(StmtTag::RETURN);
+    WriteToken(stmt->GetReturnKeyWord());
+    WriteExpr(stmt->GetReturnValue());
+    WriteU8(interpreter_.tail_calls_.contains(stmt) ? 1 : 0);
+  }
+  void VisitClassStmt(std::shared_ptr<ClassStmt> stmt) override {
+    WriteTag(StmtTag::CLASS);
+    WriteToken(stmt->GetClassName());
+    auto supper_class {stmt->GetSupperClass()};
+    WriteU8(supper_class == nullptr ? 0 : 1);
+    if (supper_class != nullptr) {
+      WriteToken(supper_class->GetToken());
+      WriteRef(supper_class->GetVariable());
+    }
+    auto methods {stmt->GetClassMethods()};
+    WriteU32(methods.size());
+    for (const auto &method : methods) {
+      WriteFunction(method);
+    }
+    WriteSlot(stmt);
+    auto iter {interpreter_.super_slots_.find(stmt)};
+    WriteSlot(iter == interpreter_.super_slots_.end() ? nullptr : &iter->second);
+  }
+  void VisitImportStmt(std::shared_ptr<ImportStmt> stmt) override {
+    throw SnapshotError("Cannot snapshot a program that imports modules.");
+  }
+
+private:
+  static auto IsNative(const std::any &value) -> bool {
+    if (value.type() != typeid(std::shared_ptr<LoxCallable>)) {
+      return false;
+    }
+    const auto &callable {std::any_cast<const std::shared_ptr<LoxCallable> &>(value)};
+    return std::dynamic_pointer_cast<LoxFunction>(callable) == nullptr &&
+           std::dynamic_pointer_cast<LoxClass>(callable) == nullptr;
+  }
+
+  void Collect(const std::any &value) {
+    if (!value.has_value() || value.type() == typeid(nullptr) || value.type() == typeid(bool) ||
+        value.type() == typeid(double) || value.type() == typeid(std::string)) {
+      return;
+    }
+    if (value.type() == typeid(std::shared_ptr<LoxInstance>)) {
+      CollectInstance(std::any_cast<const std::shared_ptr<LoxInstance> &>(value));
+      return;
+    }
+    if (value.type() == typeid(std::shared_ptr<LoxFunction>)) {
+      CollectFunction(std::any_cast<const std::shared_ptr<LoxFunction> &>(value));
+      return;
+    }
+    if (value.type() == typeid(std::shared_ptr<LoxCallable>)) {
+      const auto &callable {std::any_cast<const std::shared_ptr<LoxCallable> &>(value)};
+      if (auto function {std::dynamic_pointer_cast<LoxFunction>(callable)}) {
+        CollectFunction(function);
+        return;
+      }
+      if (auto klass {std::dynamic_pointer_cast<LoxClass>(callable)}) {
+        CollectClass(klass);
+        return;
+      }
+      throw SnapshotError("Native function '" + callable->ToString() + "' can only be snapshotted as a global.");
+    }
+    throw SnapshotError("Cannot snapshot a value of type " + std::string{value.type().name()} + ".");
+  }
+
+  void CollectCell(const UpvaluePtr &cell) {
+    if (cell_ids_.emplace(cell.get(), cells_.size()).second) {
+      cells_.push_back(cell);
+      Collect(cell->value_);
+    }
+  }
+
+  void CollectFunction(const std::shared_ptr<LoxFunction> &function) {
+    if (!function_ids_.emplace(function.get(), functions_.size()).second) {
+      return;
+    }
+    functions_.push_back(function);
+    const auto &declaration {function->GetDeclaration()};
+    if (declaration_ids_.emplace(declaration.get(), declarations_.size()).second) {
+      declarations_.push_back(declaration);
+    }
+    for (const auto &cell : function->GetUpvalues()) {
+      CollectCell(cell);
+    }
+    Collect(function->GetReceiver());
+  }
+
+  // 类的编号在 SortClasses 里分配，保证父类先于子类创建
+  void CollectClass(const std::shared_ptr<LoxClass> &klass) {
+    if (!class_ids_.emplace(klass.get(), 0).second) {
+      return;
+    }
+    classes_.push_back(klass);
+    if (klass->GetSuperClass() != nullptr) {
+      CollectClass(klass->GetSuperClass());
+    }
+    for (const auto &[name, method] : klass->GetMethods()) {
+      CollectFunction(method);
+    }
+  }
+
+  void CollectInstance(const std::shared_ptr<LoxInstance> &instance) {
+    if (!instance_ids_.emplace(instance.get(), instances_.size()).second) {
+      return;
+    }
+    instances_.push_back(instance);
+    CollectClass(instance->GetClass());
+    for (const auto &[name, value] : instance->GetFields()) {
+      Collect(value);
+    }
+  }
+
+  void SortClasses() {
+    auto depth = [](const std::shared_ptr<LoxClass> &klass) {
+      int result = 0;
+      for (auto current {klass->GetSuperClass()}; current != nullptr; current = current->GetSuperClass()) {
+        ++result;
+      }
+      return result;
+    };
+    std::stable_sort(classes_.begin(), classes_.end(),
+                     [&](const auto &lhs, const auto &rhs) { return depth(lhs) < depth(rhs); });
+    for (uint32_t i = 0; i < classes_.size(); ++i) {
+      class_ids_[classes_[i].get()] = i;
+    }
+  }
+
+  void WriteU8(uint8_t value) { out_.push_back(static_cast<char>(value)); }
+  void WriteU32(uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+      WriteU8(static_cast<uint8_t>(value >> shift));
+    }
+  }
+  void WriteF64(double value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    WriteU32(static_cast<uint32_t>(bits));
+    WriteU32(static_cast<uint32_t>(bits >> 32));
+  }
+  void WriteString(const std::string &value) {
+    WriteU32(value.size());
+    out_.append(value);
+  }
+  template <typename Tag>
+  void WriteTag(Tag tag) {
+    WriteU8(static_cast<uint8_t>(tag));
+  }
+  // token 的 literal 只有 Parser 用得到，不需要写
+  void WriteToken(const Token &token) {
+    WriteU8(static_cast<uint8_t>(token.GetTokenType()));
+    WriteString(token.GetTokenLexeme());
+    WriteU32(token.GetTokenLine());
+  }
+  void WriteRef(VariableRef ref) {
+    WriteU8(static_cast<uint8_t>(ref.kind_) + 1);
+    WriteU32(ref.index_);
+  }
+  void WriteRef(const std::optional<VariableRef> &ref) {
+    if (!ref.has_value() || ref->kind_ == VariableKind::GLOBAL) {
+      WriteU8(kNoRef);
+    } else {
+      WriteRef(*ref);
+    }
+  }
+  void WriteSlot(const SlotInfo *slot) {
+    WriteU8(slot == nullptr ? 0 : 1);
+    if (slot != nullptr) {
+      WriteU32(slot->index_);
+      WriteU8(slot->captured_ ? 1 : 0);
+    }
+  }
+  void WriteSlot(const std::shared_ptr<Stmt> &declaration) {
+    auto iter {interpreter_.declarations_.find(declaration)};
+    WriteSlot(iter == interpreter_.declarations_.end() ? nullptr : &iter->second);
+  }
+  void WriteExpr(const std::shared_ptr<ExprAST> &expr) {
+    if (expr == nullptr) {
+      WriteTag(ExprTag::NONE);
+    } else {
+      expr->Accept(*this);
+    }
+  }
+  void WriteStmt(const std::shared_ptr<Stmt> &stmt) {
+    if (stmt == nullptr) {
+      WriteTag(StmtTag::NONE);
+    } else {
+      stmt->Accept(*this);
+    }
+  }
+  void WriteStatements(const std::vector<std::shared_ptr<Stmt>> &statements) {
+    WriteU32(statements.size());
+    for (const auto &stmt : statements) {
+      WriteStmt(stmt);
+    }
+  }
+  void WriteFunction(const std::shared_ptr<FunctionStmt> &function) {
+    WriteToken(function->GetFunctionName());
+    auto params {function->GetFunctionParams()};
+    WriteU32(params.size());
+    for (const auto &param : params) {
+      WriteToken(param);
+    }
+    // 类型注解只用于运行时检查，TypeChecker 的推断结果不写进快照，读出来的函数体走通用路径
+    WriteU32(function->GetParamTypes().size());
+    for (auto type : function->GetParamTypes()) {
+      WriteU8(static_cast<uint8_t>(type));
+    }
+    WriteU8(static_cast<uint8_t>(function->GetReturnType()));
+    WriteStatements(function->GetFunctionBody());
+    const auto &info {interpreter_.functions_.at(function)};
+    WriteU32(info.slot_count_);
+    WriteU8(info.has_receiver_ ? 1 : 0);
+    WriteU32(info.captured_params_.size());
+    for (auto slot : info.captured_params_) {
+      WriteU32(slot);
+    }
+    WriteU32(info.upvalues_.size());
+    for (const auto &upvalue : info.upvalues_) {
+      WriteU32(upvalue.index_);
+      WriteU8(upvalue.is_local_ ? 1 : 0);
+    }
+    WriteSlot(function);
+  }
+  void WriteValue(const std::any &value) {
+    if (!value.has_value() || value.type() == typeid(nullptr)) {
+      WriteTag(ValueTag::NIL);
+    } else if (value.type() == typeid(bool)) {
+      WriteTag(ValueTag::BOOLEAN);
+      WriteU8(std::any_cast<bool>(value) ? 1 : 0);
+    } else if (value.type() == typeid(double)) {
+      WriteTag(ValueTag::NUMBER);
+      WriteF64(std::any_cast<double>(value));
+    } else if (value.type() == typeid(std::string)) {
+      WriteTag(ValueTag::STRING);
+      WriteString(std::any_cast<const std::string &>(value));
+    } else if (value.type() == typeid(std::shared_ptr<LoxInstance>)) {
+      WriteTag(ValueTag::INSTANCE);
+      WriteU32(instance_ids_.at(std::any_cast<const std::shared_ptr<LoxInstance> &>(value).get()));
+    } else if (value.type() == typeid(std::shared_ptr<LoxFunction>)) {
+      WriteTag(ValueTag::FUNCTION);
+      WriteU32(function_ids_.at(std::any_cast<const std::shared_ptr<LoxFunction> &>(value).get()));
+    } else {
+      const auto &callable {std::any_cast<const std::shared_ptr<LoxCallable> &>(value)};
+      if (auto *function = dynamic_cast<LoxFunction *>(callable.get())) {
+        WriteTag(ValueTag::FUNCTION);
+        WriteU32(function_ids_.at(function));
+      } else {
+        WriteTag(ValueTag::CLASS);
+        WriteU32(class_ids_.at(dynamic_cast<LoxClass *>(callable.get())));
+      }
+    }
+  }
+
+  Interpreter &interpreter_;
+  std::string out_;
+  std::vector<std::shared_ptr<FunctionStmt>> declarations_;
+  std::unordered_map<const FunctionStmt *, uint32_t> declaration_ids_;
+  std::vector<UpvaluePtr> cells_;
+  std::unordered_map<const Upvalue *, uint32_t> cell_ids_;
+  std::vector<std::shared_ptr<LoxFunction>> functions_;
+  std::unordered_map<const LoxFunction *, uint32_t> function_ids_;
+  std::vector<std::shared_ptr<LoxClass>> classes_;
+  std::unordered_map<const LoxClass *, uint32_t> class_ids_;
+  std::vector<std::shared_ptr<LoxInstance>> instances_;
+  std::unordered_map<const LoxInstance *, uint32_t> instance_ids_;
+};
+
+namespace {
+
+// 直接在 mmap 出来的文件内容上解码，按写入的顺序重建 AST、把 Resolver 的结果交给解释器，再重建对象图
+class SnapshotReader {
+public:
+  SnapshotReader(Interpreter &interpreter, std::string_view data) : interpreter_(interpreter), data_(data) {}
+
+  void Read() {
+    if (data_.substr(0, kMagic.size()) != kMagic) {
+      throw SnapshotError("Not a cpplox snapshot.");
+    }
+    position_ = kMagic.size();
+    if (ReadU8() != kVersion) {
+      throw SnapshotError("Unsupported snapshot version.");
+    }
+    declarations_.resize(ReadCount());
+    for (auto &declaration : declarations_) {
+      declaration = ReadFunction();
+    }
+    cells_.resize(ReadCount());
+    for (auto &cell : cells_) {
+      cell = std::make_shared<Upvalue>(Upvalue{std::any{nullptr}});
+    }
+    functions_.resize(ReadCount());
+    for (auto &function : functions_) {
+      const auto &declaration {Index(declarations_, ReadU32())};
+      bool is_initializer = ReadU8() != 0;
+      std::vector<UpvaluePtr> upvalues(ReadCount());
+      if (upvalues.size() != interpreter_.GetFunctionInfo(declaration)->upvalues_.size()) {
+        throw SnapshotError("Corrupt snapshot: wrong number of upvalues.");
+      }
+      for (auto &cell : upvalues) {
+        cell = Index(cells_, ReadU32());
+      }
+      function = std::make_shared<LoxFunction>(declaration, interpreter_.GetFunctionInfo(declaration),
+                                               std::move(upvalues), is_initializer);
+    }
+    classes_.resize(ReadCount());
+    for (size_t i = 0; i < classes_.size(); ++i) {
+      auto name {ReadString()};
+      uint32_t supper_id = ReadU32();
+      if (supper_id > i) {
+        throw SnapshotError("Corrupt snapshot: superclass defined after subclass.");
+      }
+      std::unordered_map<std::string, std::shared_ptr<LoxFunction>> methods;
+      for (uint32_t count = ReadCount(); count > 0; --count) {
+        auto method_name {ReadString()};
+        methods[method_name] = Index(functions_, ReadU32());
+      }
+      classes_[i] = std::make_shared<LoxClass>(std::move(name), supper_id == 0 ? nullptr : classes_[supper_id - 1],
+                                               methods);
+    }
+    instances_.resize(ReadCount());
+    for (auto &instance : instances_) {
+      instance = std::make_shared<LoxInstance>(Index(classes_, ReadU32()));
+    }
+
+    // 绑定过的方法先按未绑定创建，这里再换成绑定到实例上的副本
+    for (auto &function : functions_) {
+      auto receiver {ReadValue()};
+      if (receiver.type() == typeid(std::shared_ptr<LoxInstance>)) {
+        function = function->Bind(std::any_cast<const std::shared_ptr<LoxInstance> &>(receiver));
+      }
+    }
+    for (auto &cell : cells_) {
+      cell->value_ = ReadValue();
+    }
+    for (auto &instance : instances_) {
+      for (uint32_t count = ReadCount(); count > 0; --count) {
+        auto name {ReadString()};
+        instance->Set(Token(TokenType::IDENTIFIER, name, nullptr, 0), ReadValue());
+      }
+    }
+    auto globals {interpreter_.GetGlobalEnvironment()};
+    for (uint32_t count = ReadCount(); count > 0; --count) {
+      auto name {ReadString()};
+      globals->Define(name, ReadValue());
+    }
+  }
+
+private:
+  template <typename T>
+  static auto Index(const std::vector<T> &table, uint32_t index) -> const T & {
+    if (index >= table.size()) {
+      throw SnapshotError("Corrupt snapshot: object index out of range.");
+    }
+    return table[index];
+  }
+  void Need(size_t bytes) const {
+    if (data_.size() - position_ < bytes) {
+      throw SnapshotError("Corrupt snapshot: unexpected end of file.");
+    }
+  }
+  auto ReadU8() -> uint8_t {
+    Need(1);
+    return static_cast<uint8_t>(data_[position_++]);
+  }
+  auto ReadU32() -> uint32_t {
+    Need(4);
+    uint32_t value = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+      value |= static_cast<uint32_t>(static_cast<uint8_t>(data_[position_++])) << shift;
+    }
+    return value;
+  }
+  auto ReadType() -> StaticType {
+    auto type {ReadU8()};
+    if (type > static_cast<uint8_t>(StaticType::STRING)) {
+      throw SnapshotError("Corrupt snapshot: bad type annotation.");
+    }
+    return static_cast<StaticType>(type);
+  }
+  // 元素个数不会超过剩余字节数，提前挡住损坏文件里的超大长度
+  auto ReadCount() -> uint32_t {
+    auto count {ReadU32()};
+    Need(count);
+    return count;
+  }
+  auto ReadF64() -> double {
+    uint64_t bits = ReadU32();
+    bits |= static_cast<uint64_t>(ReadU32()) << 32;
+    double value = 0;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  auto ReadString() -> std::string {
+    auto size {ReadU32()};
+    Need(size);
+    std::string value{data_.substr(position_, size)};
+    position_ += size;
+    return value;
+  }
+  auto ReadToken() -> Token {
+    auto type {static_cast<TokenType>(ReadU8())};
+    if (type > TokenType::TOKEN_EOF) {
+      throw SnapshotError("Corrupt snapshot: bad token type.");
+    }
+    auto lexeme {ReadString()};
+    int line = static_cast<int>(ReadU32());
+    return Token(type, std::move(lexeme), nullptr, line);
+  }
+  // 槽位号和 upvalue 下标，不能是负数
+  auto ReadIndex() -> int {
+    auto index {ReadU32()};
+    if (index > static_cast<uint32_t>(std::numeric_limits<int>::max())) {
+      throw SnapshotError("Corrupt snapshot: index out of range.");
+    }
+    return static_cast<int>(index);
+  }
+  // 函数的槽位数和 upvalue 个数写在函数体后面，先记下函数体里用到的最大下标，读完函数再检查
+  void UseSlot(int index) {
+    if (!scopes_.empty()) {
+      scopes_.back().slots_ = std::max(scopes_.back().slots_, index + 1);
+    }
+  }
+  void UseUpvalue(int index) {
+    if (!scopes_.empty()) {
+      scopes_.back().upvalues_ = std::max(scopes_.back().upvalues_, index + 1);
+    }
+  }
+  auto ReadRef() -> std::optional<VariableRef> {
+    auto kind {ReadU8()};
+    if (kind == kNoRef) {
+      return std::nullopt;
+    }
+    if (kind > static_cast<uint8_t>(VariableKind::UPVALUE) + 1) {
+      throw SnapshotError("Corrupt snapshot: bad variable reference.");
+    }
+    VariableRef ref{static_cast<VariableKind>(kind - 1), ReadIndex()};
+    if (ref.kind_ == VariableKind::LOCAL) {
+      UseSlot(ref.index_);
+    } else {
+      UseUpvalue(ref.index_);
+    }
+    return ref;
+  }
+  // 全局变量的槽位号只在当前进程里有意义，快照里不保存，读入时按名字重新分配
+  auto ReadRef(const Token &name) -> VariableRef {
+    if (auto ref {ReadRef()}) {
+      return *ref;
+    }
+    return interpreter_.ResolveGlobal(name.GetTokenLexeme());
+  }
+  auto ReadSlot() -> std::optional<SlotInfo> {
+    if (ReadU8() == 0) {
+      return std::nullopt;
+    }
+    int index = ReadIndex();
+    UseSlot(index);
+    return SlotInfo{index, ReadU8() != 0};
+  }
+  void ReadSlot(const std::shared_ptr<Stmt> &declaration) {
+    if (auto slot {ReadSlot()}) {
+      interpreter_.DeclareSlot(declaration, *slot);
+    }
+  }
+
+  auto ReadExpr() -> std::shared_ptr<ExprAST> {
+    switch (static_cast<ExprTag>(ReadU8())) {
+      case ExprTag::NONE:
+        return nullptr;
+      case ExprTag::BINARY: {
+        auto left {ReadExpr()};
+        auto op {ReadToken()};
+        return std::make_shared<BinaryExprAST>(std::move(left), op, ReadExpr());
+      }
+      case ExprTag::GROUPING:
+        return std::make_shared<GroupingExprAST>(ReadExpr());
+      case ExprTag::LITERAL:
+        return std::make_shared<LiteralExprAST>(ReadValue());
+      case ExprTag::UNARY: {
+        auto right {ReadExpr()};
+        return std::make_shared<UnaryExprAST>(std::move(right), ReadToken());
+      }
+      case ExprTag::LOGICAL: {
+        auto left {ReadExpr()};
+        auto op {ReadToken()};
+        return std::make_shared<LogicalExprAST>(std::move(left), op, ReadExpr());
+      }
+      case ExprTag::VARIABLE: {
+        auto name {ReadToken()};
+        auto expr {std::make_shared<VarExprAST>(name)};
+        expr->SetVariable(ReadRef(name));
+        return expr;
+      }
+      case ExprTag::ASSIGN: {
+        auto name {ReadToken()};
+        auto expr {std::make_shared<AssignExprAST>(name, ReadExpr())};
+        expr->SetVariable(ReadRef(name));
+        return expr;
+      }
+      case ExprTag::CALL: {
+        auto callee {ReadExpr()};
+        auto paren {ReadToken()};
+        std::vector<ExprASTPtr> arguments(ReadCount());
+        for (auto &argument : arguments) {
+          argument = ReadExpr();
+        }
+        return std::make_shared<CallExprAST>(std::move(callee), paren, arguments);
+      }
+      case ExprTag::GET: {
+        auto object {ReadExpr()};
+        return std::make_shared<GetExprAST>(std::move(object), ReadToken());
+      }
+      case ExprTag::SET: {
+        auto object {ReadExpr()};
+        auto name {ReadToken()};
+        return std::make_shared<SetExprAST>(std::move(object), name, ReadExpr());
+      }
+      case ExprTag::THIS: {
+        auto keyword {ReadToken()};
+        auto expr {std::make_shared<ThisExprAST>(keyword)};
+        expr->SetVariable(ReadRef(keyword));
+        return expr;
+      }
+      case ExprTag::SUPER: {
+        auto keyword {ReadToken()};
+        auto expr {std::make_shared<SuperExprAST>(keyword, ReadToken())};
+        if (ReadU8() != 0) {
+          auto super_ref {ReadRef()};
+          auto this_ref {ReadRef()};
+          if (!super_ref || !this_ref) {
+            throw SnapshotError("Corrupt snapshot: unresolved super.");
+          }
+          interpreter_.ResolveSuper(expr, *super_ref, *this_ref);
+        }
+        return expr;
+      }
+    }
+    throw SnapshotError("Corrupt snapshot: bad expression tag.");
+  }
+
+  auto ReadStmt() -> std::shared_ptr<Stmt> {
+    switch (static_cast<StmtTag>(ReadU8())) {
+      case StmtTag::NONE:
+        return nullptr;
+      case StmtTag::EXPRESSION:
+        return std::make_shared<ExpressionStmt>(ReadExpr());
+      case StmtTag::IF: {
+        auto condition {ReadExpr()};
+        auto then_branch {ReadStmt()};
+        return std::make_shared<IfStmt>(std::move(condition), std::move(then_branch), ReadStmt());
+      }
+      case StmtTag::WHILE: {
+        auto keyword {ReadToken()};
+        auto condition {ReadExpr()};
+        return std::make_shared<WhileStmt>(keyword, std::move(condition), ReadStmt());
+      }
+      case StmtTag::PRINT:
+        return std::make_shared<PrintStmt>(ReadExpr());
+      case StmtTag::VAR: {
+        auto name {ReadToken()};
+        auto initializer {ReadExpr()};
+        std::shared_ptr<Stmt> stmt {std::make_shared<VarStmt>(name, std::move(initializer), ReadType())};
+        ReadSlot(stmt);
+        return stmt;
+      }
+      case StmtTag::BLOCK:
+        return std::make_shared<BlockStmt>(ReadStatements());
+      case StmtTag::FUNCTION:
+        return ReadFunction();
+      case StmtTag::RETURN: {
+        auto keyword {ReadToken()};
+        auto stmt {std::make_shared<ReturnStmt>(keyword, ReadExpr())};
+        if (ReadU8() != 0) {
+          interpreter_.MarkTailCall(stmt);
+        }
+        return stmt;
+      }
+      case StmtTag::CLASS: {
+        auto name {ReadToken()};
+        std::shared_ptr<VarExprAST> supper_class;
+        if (ReadU8() != 0) {
+          supper_class = std::make_shared<VarExprAST>(ReadToken());
+          supper_class->SetVariable(ReadRef(supper_class->GetToken()));
+        }
+        std::vector<std::shared_ptr<FunctionStmt>> methods(ReadCount());
+        for (auto &method : methods) {
+          method = ReadFunction();
+        }
+        auto stmt {std::make_shared<ClassStmt>(name, std::move(supper_class), methods)};
+        ReadSlot(stmt);
+        if (auto slot {ReadSlot()}) {
+          interpreter_.DeclareSuperSlot(stmt, *slot);
+        }
+        return stmt;
+      }
+    }
+    throw SnapshotError("Corrupt snapshot: bad statement tag.");
+  }
+
+  auto ReadStatements() -> std::vector<std::shared_ptr<Stmt>> {
+    std::vector<std::shared_ptr<Stmt>> statements(ReadCount());
+    for (auto &stmt : statements) {
+      stmt = ReadStmt();
+    }
+    return statements;
+  }
+
+  auto ReadFunction() -> std::shared_ptr<FunctionStmt> {
+    auto name {ReadToken()};
+    std::vector<Token> params;
+    for (uint32_t count = ReadCount(); count > 0; --count) {
+      params.push_back(ReadToken());
+    }
+    std::vector<StaticType> param_types(ReadCount());
+    for (auto &type : param_types) {
+      type = ReadType();
+    }
+    if (!param_types.empty() && param_types.size() != params.size()) {
+      throw SnapshotError("Corrupt snapshot: bad parameter types.");
+    }
+    auto return_type {ReadType()};
+    scopes_.emplace_back();
+    auto body {ReadStatements()};
+    auto used {scopes_.back()};
+    scopes_.pop_back();
+    auto function {std::make_shared<FunctionStmt>(name, params, body, std::move(param_types), return_type)};
+    FunctionInfo info;
+    info.slot_count_ = ReadIndex();
+    info.has_receiver_ = ReadU8() != 0;
+    // 参数 (和 this) 放在 frame 开头，函数体里的槽位也都要在 frame 里
+    if (static_cast<size_t>(info.slot_count_) < params.size() + (info.has_receiver_ ? 1 : 0) ||
+        info.slot_count_ < used.slots_) {
+      throw SnapshotError("Corrupt snapshot: slot index out of range.");
+    }
+    info.captured_params_.resize(ReadCount());
+    for (auto &slot : info.captured_params_) {
+      slot = ReadIndex();
+      if (slot >= info.slot_count_) {
+        throw SnapshotError("Corrupt snapshot: slot index out of range.");
+      }
+    }
+    // 捕获的是外层函数的槽位或者 upvalue，由外层函数读完后检查
+    info.upvalues_.resize(ReadCount());
+    for (auto &upvalue : info.upvalues_) {
+      upvalue.index_ = ReadIndex();
+      upvalue.is_local_ = ReadU8() != 0;
+      if (upvalue.is_local_) {
+        UseSlot(upvalue.index_);
+      } else {
+        UseUpvalue(upvalue.index_);
+      }
+    }
+    if (static_cast<size_t>(used.upvalues_) > info.upvalues_.size()) {
+      throw SnapshotError("Corrupt snapshot: upvalue index out of range.");
+    }
+    interpreter_.DeclareFunction(function, std::move(info));
+    ReadSlot(function);
+    return function;
+  }
+
+  auto ReadValue() -> std::any {
+    switch (static_cast<ValueTag>(ReadU8())) {
+      case ValueTag::NIL:
+        return nullptr;
+      case ValueTag::BOOLEAN:
+        return ReadU8() != 0;
+      case ValueTag::NUMBER:
+        return ReadF64();
+      case ValueTag::STRING:
+        return ReadString();
+      case ValueTag::FUNCTION:
+        return std::shared_ptr<LoxCallable>{Index(functions_, ReadU32())};
+      case ValueTag::CLASS:
+        return std::shared_ptr<LoxCallable>{Index(classes_, ReadU32())};
+      case ValueTag::INSTANCE:
+        return Index(instances_, ReadU32());
+    }
+    throw SnapshotError("Corrupt snapshot: bad value tag.");
+  }
+
+  Interpreter &interpreter_;
+  std::string_view data_;
+  size_t position_{0};
+  std::vector<std::shared_ptr<FunctionStmt>> declarations_;
+  std::vector<UpvaluePtr> cells_;
+  std::vector<std::shared_ptr<LoxFunction>> functions_;
+  std::vector<std::shared_ptr<LoxClass>> classes_;
+  std::vector<std::shared_ptr<LoxInstance>> instances_;
+  struct FunctionScope {
+    int slots_{0};
+    int upvalues_{0};
+  };
+  // 正在读的函数，最里层的在最后
+  std::vector<FunctionScope> scopes_;
+};
+
+}  // namespace
+
+void Snapshot::Save(Interpreter &interpreter, const std::string &path) {
+  auto data {SnapshotWriter(interpreter).Write()};
+  std::ofstream file{path, std::ios::binary | std::ios::trunc};
+  if (!file.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+    throw SnapshotError("Cannot write snapshot " + path + ".");
+  }
+}
+
+void Snapshot::Load(Interpreter &interpreter, const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw SnapshotError("Cannot open snapshot " + path + ": " + std::strerror(errno));
+  }
+  struct stat info {};
+  if (fstat(fd, &info) < 0 || info.st_size == 0) {
+    close(fd);
+    throw SnapshotError("Cannot read snapshot " + path + ".");
+  }
+  auto size {static_cast<size_t>(info.st_size)};
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw SnapshotError("Cannot map snapshot " + path + ": " + std::strerror(errno));
+  }
+  try {
+    SnapshotReader(interpreter, std::string_view{static_cast<const char *>(data), size}).Read();
+  } catch (...) {
+    munmap(data, size);
+    throw;
+  }
+  munmap(data, size);
+}
+
+}  // namespace cpplox
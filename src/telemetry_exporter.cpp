@@ -0,0 +1,89 @@
+#include "telemetry_exporter.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include "telemetry.h"
+
+namespace cpplox {
+
+TelemetryExporter::TelemetryExporter(const Telemetry &telemetry, std::string target, std::chrono::milliseconds interval)
+    : telemetry_(telemetry), target_(std::move(target)), interval_(interval) {
+  thread_ = std::jthread([this](std::stop_token stop) {
+    std::unique_lock lock{mutex_};
+    while (!wakeup_.wait_for(lock, stop, interval_, [] { return false; }) && !stop.stop_requested()) {
+      Export();
+    }
+  });
+}
+
+TelemetryExporter::~TelemetryExporter() {
+  thread_.request_stop();
+  thread_.join();
+  Export();
+}
+
+auto TelemetryExporter::Export() const -> bool {
+  constexpr std::string_view kUnix = "unix:";
+  constexpr std::string_view kFile = "file:";
+  // 主线程的统计加上已经结束的 isolate 的统计，存活字节数只算主线程的堆
+  Telemetry total;
+  total.Merge(telemetry_);
+  total.live_heap_bytes_.Add(telemetry_.live_heap_bytes_.Get());
+  {
+    std::lock_guard lock{finished_isolates.mutex_};
+    total.Merge(finished_isolates.telemetry_);
+  }
+  auto text {total.Format()};
+  std::string_view target {target_};
+  if (target.starts_with(kUnix)) {
+    return WriteSocket(std::string(target.substr(kUnix.size())), text);
+  }
+  if (target.starts_with(kFile)) {
+    target.remove_prefix(kFile.size());
+  }
+  return WriteFile(std::string(target), text);
+}
+
+auto TelemetryExporter::WriteFile(const std::string &path, const std::string &text) const -> bool {
+  auto temp {path + ".tmp"};
+  {
+    std::ofstream out{temp, std::ios::trunc};
+    if (!(out << text)) {
+      return false;
+    }
+  }
+  return std::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+auto TelemetryExporter::WriteSocket(const std::string &path, const std::string &text) const -> bool {
+  sockaddr_un address {};
+  if (path.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+  for (size_t offset = 0; ok && offset < text.size();) {
+    auto written = send(fd, text.data() + offset, text.size() - offset, MSG_NOSIGNAL);
+    ok = written > 0;
+    offset += ok ? static_cast<size_t>(written) : 0;
+  }
+  close(fd);
+  return ok;
+}
+
+}  // namespace cpplox
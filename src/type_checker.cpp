@@ -0,0 +1,304 @@
+#include "type_checker.h"
+#include <any>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "error.h"
+#include "stmt.h"
+#include "token.h"
+
+namespace cpplox {
+
+void TypeChecker::Check(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  variables_.clear();
+  do {
+    changed_ = false;
+    Walk(statements);
+  } while (changed_);
+  final_ = true;
+  Walk(statements);
+  final_ = false;
+}
+
+void TypeChecker::Walk(const std::vector<std::shared_ptr<Stmt>> &statements) {
+  for (const auto &statement : statements) {
+    Check(statement);
+  }
+}
+
+void TypeChecker::Check(const std::shared_ptr<Stmt> &statement) {
+  if (statement != nullptr) {
+    statement->Accept(*this);
+  }
+}
+
+auto TypeChecker::TypeOf(const std::shared_ptr<ExprAST> &expr) -> StaticType {
+  return std::any_cast<StaticType>(expr->Accept(*this));
+}
+
+auto TypeChecker::Mark(ExprAST &expr, StaticType type, Unboxed unboxed) -> std::any {
+  if (final_) {
+    bool unboxable = type == StaticType::NUMBER || type == StaticType::BOOL;
+    expr.SetStaticType(type, unboxable ? unboxed : Unboxed::NONE);
+  }
+  return type;
+}
+
+void TypeChecker::Error(const Token &token, const std::string &message) {
+  if (final_) {
+    Log::Error(token, message);
+  }
+}
+
+auto TypeChecker::TypeName(StaticType type) -> std::string {
+  switch (type) {
+    case StaticType::NIL:
+      return "nil";
+    case StaticType::BOOL:
+      return "bool";
+    case StaticType::NUMBER:
+      return "num";
+    case StaticType::STRING:
+      return "str";
+    default:
+      return "unknown";
+  }
+}
+
+void TypeChecker::Declare(const Token &name, const void *key, StaticType type, bool annotated) {
+  auto [iter, inserted] = variables_.try_emplace(key, Variable{type, annotated});
+  auto &variable {iter->second};
+  // 没有注解的变量在上一遍得到的类型和这次的初始值不一致，退回 UNKNOWN 再遍历一次
+  if (!inserted && !variable.annotated_ && variable.type_ != type && variable.type_ != StaticType::UNKNOWN) {
+    variable.type_ = StaticType::UNKNOWN;
+    changed_ = true;
+  }
+  if (scopes_.empty()) {
+    globals_.erase(name.GetTokenLexeme());
+    if (annotated) {
+      globals_[name.GetTokenLexeme()] = type;
+    }
+    return;
+  }
+  scopes_.back()[name.GetTokenLexeme()] = &variable;
+}
+
+auto TypeChecker::Lookup(const std::string &name) -> Variable * {
+  for (auto iter = scopes_.rbegin(); iter != scopes_.rend(); ++iter) {
+    if (auto found = iter->find(name); found != iter->end()) {
+      return found->second;
+    }
+  }
+  return nullptr;
+}
+
+void TypeChecker::VisitBlockStmt(std::shared_ptr<BlockStmt> stmt) {
+  scopes_.emplace_back();
+  Walk(stmt->GetBlockStatements());
+  scopes_.pop_back();
+}
+
+void TypeChecker::VisitVarStmt(std::shared_ptr<VarStmt> stmt) {
+  auto type {stmt->GetExpr() == nullptr ? StaticType::NIL : TypeOf(stmt->GetExpr())};
+  auto annotation {stmt->GetType()};
+  if (annotation == StaticType::UNKNOWN) {
+    Declare(stmt->GetName(), stmt.get(), type, false);
+    return;
+  }
+  // 初始值的类型证明符合注解时不需要运行时检查，不确定时由解释器在声明时检查
+  if (type == annotation) {
+    if (final_) {
+      stmt->SetChecked();
+    }
+  } else if (stmt->GetExpr() == nullptr) {
+    Error(stmt->GetName(), "Variable with type " + TypeName(annotation) + " needs an initializer.");
+  } else if (type != StaticType::UNKNOWN) {
+    Error(stmt->GetName(), "Cannot initialize " + TypeName(annotation) + " variable with " + TypeName(type) + ".");
+  }
+  Declare(stmt->GetName(), stmt.get(), annotation, true);
+}
+
+void TypeChecker::VisitFunctionStmt(std::shared_ptr<FunctionStmt> stmt) {
+  Declare(stmt->GetFunctionName(), stmt.get(), StaticType::UNKNOWN, false);
+  CheckFunction(stmt);
+}
+
+// 带注解的参数和返回值由 LoxFunction 在调用时检查，函数体里可以直接相信参数的注解
+void TypeChecker::CheckFunction(const std::shared_ptr<FunctionStmt> &function) {
+  scopes_.emplace_back();
+  const auto &params {function->GetFunctionParams()};
+  const auto &param_types {function->GetParamTypes()};
+  for (size_t i = 0; i < params.size(); ++i) {
+    auto type {param_types.empty() ? StaticType::UNKNOWN : param_types[i]};
+    Declare(params[i], &params[i], type, type != StaticType::UNKNOWN);
+  }
+  returns_.push_back(function->GetReturnType());
+  Walk(function->GetFunctionBody());
+  returns_.pop_back();
+  scopes_.pop_back();
+}
+
+void TypeChecker::VisitExpressionStmt(std::shared_ptr<ExpressionStmt> stmt) { TypeOf(stmt->GetExpr()); }
+
+void TypeChecker::VisitIfStmt(std::shared_ptr<IfStmt> stmt) {
+  TypeOf(stmt->GetConditionExpression());
+  Check(stmt->GetThenBranch());
+  Check(stmt->GetElseBranch());
+}
+
+void TypeChecker::VisitPrintStmt(std::shared_ptr<PrintStmt> stmt) { TypeOf(stmt->GetExpr()); }
+
+void TypeChecker::VisitReturnStmt(std::shared_ptr<ReturnStmt> stmt) {
+  auto type {stmt->GetReturnValue() == nullptr ? StaticType::NIL : TypeOf(stmt->GetReturnValue())};
+  if (returns_.empty() || returns_.back() == StaticType::UNKNOWN) {
+    return;
+  }
+  if (type != returns_.back() && type != StaticType::UNKNOWN) {
+    Error(stmt->GetReturnKeyWord(),
+          "Cannot return " + TypeName(type) + " from a function returning " + TypeName(returns_.back()) + ".");
+  }
+}
+
+void TypeChecker::VisitWhileStmt(std::shared_ptr<WhileStmt> stmt) {
+  TypeOf(stmt->GetConditionExpr());
+  Check(stmt->GetWhileBody());
+}
+
+void TypeChecker::VisitClassStmt(std::shared_ptr<ClassStmt> stmt) {
+  Declare(stmt->GetClassName(), stmt.get(), StaticType::UNKNOWN, false);
+  if (stmt->GetSupperClass() != nullptr) {
+    TypeOf(stmt->GetSupperClass());
+  }
+  // 方法里的 this 和字段都是 UNKNOWN
+  returns_.push_back(StaticType::UNKNOWN);
+  for (const auto &method : stmt->GetClassMethods()) {
+    CheckFunction(method);
+  }
+  returns_.pop_back();
+}
+
+void TypeChecker::VisitImportStmt(std::shared_ptr<ImportStmt> stmt) {
+  Declare(stmt->GetName(), stmt.get(), StaticType::UNKNOWN, false);
+}
+
+auto TypeChecker::VisitVariableExprAST(std::shared_ptr<VarExprAST> expr_ast) -> std::any {
+  const auto *variable {Lookup(expr_ast->GetToken().GetTokenLexeme())};
+  return Mark(*expr_ast, variable == nullptr ? StaticType::UNKNOWN : variable->type_, Unboxed::VALUE);
+}
+
+auto TypeChecker::VisitAssignmentExprAST(std::shared_ptr<AssignExprAST> expr_ast) -> std::any {
+  auto type {TypeOf(expr_ast->GetValue())};
+  const auto &name {expr_ast->GetName()};
+  auto *variable {Lookup(name.GetTokenLexeme())};
+  StaticType annotation {StaticType::UNKNOWN};
+  if (variable != nullptr && variable->annotated_) {
+    annotation = variable->type_;
+  } else if (variable == nullptr) {
+    if (auto global = globals_.find(name.GetTokenLexeme()); global != globals_.end()) {
+      annotation = global->second;
+    }
+  } else if (variable->type_ != type && variable->type_ != StaticType::UNKNOWN) {
+    variable->type_ = StaticType::UNKNOWN;
+    changed_ = true;
+  }
+  if (annotation == StaticType::UNKNOWN) {
+    return Mark(*expr_ast, type, Unboxed::VALUE);
+  }
+  if (type == StaticType::UNKNOWN) {
+    if (final_) {
+      expr_ast->SetGuard(annotation);
+    }
+  } else if (type != annotation) {
+    Error(name, "Cannot assign " + TypeName(type) + " to " + TypeName(annotation) + " variable.");
+  }
+  return Mark(*expr_ast, annotation, Unboxed::VALUE);
+}
+
+auto TypeChecker::VisitBinaryExprAST(std::shared_ptr<BinaryExprAST> expr_ast) -> std::any {
+  auto left {TypeOf(expr_ast->GetLeftExpr())};
+  auto right {TypeOf(expr_ast->GetRightExpr())};
+  bool numbers = left == StaticType::NUMBER && right == StaticType::NUMBER;
+  switch (expr_ast->GetOperation().GetTokenType()) {
+    case TokenType::PLUS:
+      if (left == StaticType::STRING && right == StaticType::STRING) {
+        return Mark(*expr_ast, StaticType::STRING, Unboxed::NONE);
+      }
+      return Mark(*expr_ast, numbers ? StaticType::NUMBER : StaticType::UNKNOWN, Unboxed::ARITHMETIC);
+    // 这些运算只要不抛出运行时错误，结果一定是数字或布尔值
+    case TokenType::MINUS:
+    case TokenType::STAR:
+    case TokenType::SLASH:
+      return Mark(*expr_ast, StaticType::NUMBER, numbers ? Unboxed::ARITHMETIC : Unboxed::VALUE);
+    case TokenType::GREATER:
+    case TokenType::GREATER_EQUAL:
+    case TokenType::LESS:
+    case TokenType::LESS_EQUAL:
+    case TokenType::EQUAL_EQUAL:
+    case TokenType::BANG_EQUAL:
+      return Mark(*expr_ast, StaticType::BOOL, numbers ? Unboxed::COMPARISON : Unboxed::VALUE);
+    default:
+      return Mark(*expr_ast, StaticType::UNKNOWN, Unboxed::NONE);
+  }
+}
+
+auto TypeChecker::VisitCallExprAST(std::shared_ptr<CallExprAST> expr_ast) -> std::any {
+  TypeOf(expr_ast->GetCallee());
+  for (const auto &argument : expr_ast->GetArguments()) {
+    TypeOf(argument);
+  }
+  return Mark(*expr_ast, StaticType::UNKNOWN, Unboxed::NONE);
+}
+
+auto TypeChecker::VisitGroupingExprAST(std::shared_ptr<GroupingExprAST> expr_ast) -> std::any {
+  return Mark(*expr_ast, TypeOf(expr_ast->GetExpression()), Unboxed::GROUPING);
+}
+
+auto TypeChecker::VisitLiteralExprAST(std::shared_ptr<LiteralExprAST> expr_ast) -> std::any {
+  const auto &type {expr_ast->GetValue().type()};
+  if (type == typeid(double)) {
+    return Mark(*expr_ast, StaticType::NUMBER, Unboxed::LITERAL);
+  }
+  if (type == typeid(bool)) {
+    return Mark(*expr_ast, StaticType::BOOL, Unboxed::LITERAL);
+  }
+  if (type == typeid(std::string)) {
+    return Mark(*expr_ast, StaticType::STRING, Unboxed::NONE);
+  }
+  return Mark(*expr_ast, type == typeid(std::nullptr_t) ? StaticType::NIL : StaticType::UNKNOWN, Unboxed::NONE);
+}
+
+auto TypeChecker::VisitLogicalExprAST(std::shared_ptr<LogicalExprAST> expr_ast) -> std::any {
+  auto left {TypeOf(expr_ast->GetLeftExpr())};
+  auto right {TypeOf(expr_ast->GetRightExpr())};
+  return Mark(*expr_ast, left == right ? left : StaticType::UNKNOWN, Unboxed::LOGICAL);
+}
+
+auto TypeChecker::VisitUnaryExprAST(std::shared_ptr<UnaryExprAST> expr_ast) -> std::any {
+  auto right {TypeOf(expr_ast->GetRightExpr())};
+  if (expr_ast->GetOperation().GetTokenType() == TokenType::BANG) {
+    return Mark(*expr_ast, StaticType::BOOL, Unboxed::NOT);
+  }
+  return Mark(*expr_ast, right == StaticType::NUMBER ? StaticType::NUMBER : StaticType::UNKNOWN, Unboxed::NEGATE);
+}
+
+auto TypeChecker::VisitGetExprAST(std::shared_ptr<GetExprAST> expr_ast) -> std::any {
+  TypeOf(expr_ast->GetObject());
+  return Mark(*expr_ast, StaticType::UNKNOWN, Unboxed::NONE);
+}
+
+auto TypeChecker::VisitSetExprAST(std::shared_ptr<SetExprAST> expr_ast) -> std::any {
+  TypeOf(expr_ast->GetSetObject());
+  TypeOf(expr_ast->GetSetValue());
+  return Mark(*expr_ast, StaticType::UNKNOWN, Unboxed::NONE);
+}
+
+auto TypeChecker::VisitThisExprAST(std::shared_ptr<ThisExprAST> expr_ast) -> std::any {
+  return Mark(*expr_ast, StaticType::UNKNOWN, Unboxed::NONE);
+}
+
+auto TypeChecker::VisitSuperExprAST(std::shared_ptr<SuperExprAST> expr_ast) -> std::any {
+  return Mark(*expr_ast, StaticType::UNKNOWN, Unboxed::NONE);
+}
+
+}  // namespace cpplox